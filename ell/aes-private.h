@@ -0,0 +1,83 @@
+/*
+ *
+ *  Embedded Linux library
+ *
+ *  Copyright (C) 2019  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define AES_BLOCK_SIZE		16
+#define AES_GCM_NONCE_SIZE	12
+
+/*
+ * In-process AES for the TLS record layer.  AES-NI and PCLMULQDQ are
+ * used when the CPU has them, otherwise a bitsliced constant-time
+ * implementation.  The choice is made in _aes_init.
+ */
+struct aes_ctx {
+	uint8_t rk[15][AES_BLOCK_SIZE] __attribute__ ((aligned(16)));
+	uint8_t dk[15][AES_BLOCK_SIZE] __attribute__ ((aligned(16)));
+	uint8_t htab[4][AES_BLOCK_SIZE] __attribute__ ((aligned(16)));
+	uint64_t bs_rk[15][8];
+	uint8_t h[AES_BLOCK_SIZE];
+	uint8_t iv[AES_BLOCK_SIZE];
+	unsigned int rounds;
+	bool aesni;
+};
+
+bool _aes_init(struct aes_ctx *ctx, const void *key, size_t key_len);
+const char *_aes_implementation(const struct aes_ctx *ctx);
+
+void _aes_set_iv(struct aes_ctx *ctx, const void *iv);
+void _aes_cbc_encrypt(struct aes_ctx *ctx, const void *in, void *out,
+								size_t len);
+void _aes_cbc_decrypt(struct aes_ctx *ctx, const void *in, void *out,
+								size_t len);
+
+void _aes_gcm_encrypt(const struct aes_ctx *ctx, const uint8_t *nonce,
+			const void *aad, size_t aad_len,
+			const void *in, void *out, size_t len,
+			void *tag, size_t tag_len);
+bool _aes_gcm_decrypt(const struct aes_ctx *ctx, const uint8_t *nonce,
+			const void *aad, size_t aad_len,
+			const void *in, void *out, size_t len,
+			const void *tag, size_t tag_len);
+
+/*
+ * Incremental GCM encryption for plaintext that is scattered across
+ * several buffers.  Each update may have any length.
+ */
+struct aes_gcm_state {
+	const struct aes_ctx *ctx;
+	uint8_t j0[AES_BLOCK_SIZE];
+	uint8_t ctr[AES_BLOCK_SIZE];
+	uint8_t y[AES_BLOCK_SIZE];
+	uint8_t ks[AES_BLOCK_SIZE];
+	uint8_t partial[AES_BLOCK_SIZE];
+	uint64_t aad_len;
+	uint64_t len;
+};
+
+void _aes_gcm_start(struct aes_gcm_state *gcm, const struct aes_ctx *ctx,
+			const uint8_t *nonce, const void *aad, size_t aad_len);
+void _aes_gcm_encrypt_update(struct aes_gcm_state *gcm, const void *in,
+						void *out, size_t len);
+void _aes_gcm_finish(struct aes_gcm_state *gcm, void *tag, size_t tag_len);
@@ -0,0 +1,1236 @@
+/*
+ *
+ *  Embedded Linux library
+ *
+ *  Copyright (C) 2019  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_AESNI
+#endif
+
+#include "util.h"
+#include "private.h"
+#include "aes-private.h"
+
+/*
+ * Portable implementation.  Four blocks are processed at once in a
+ * bitsliced representation: q[k] holds bit k of each of the 64 bytes,
+ * byte n of the four-block buffer at bit position n.  Within each
+ * 16-bit lane this puts state row r, column c at bit 4 * c + r.  All
+ * operations are fixed sequences of logic ops so no table lookups or
+ * branches depend on key or data.
+ */
+
+#define LANES(v) ((uint64_t) (v) * 0x0001000100010001ULL)
+
+/* Transpose an 8x8 bit matrix, bit 8 * i + j goes to bit 8 * j + i */
+static uint64_t bs_transpose8(uint64_t x)
+{
+	uint64_t t;
+
+	t = (x ^ (x >> 7)) & 0x00aa00aa00aa00aaULL;
+	x ^= t ^ (t << 7);
+	t = (x ^ (x >> 14)) & 0x0000cccc0000ccccULL;
+	x ^= t ^ (t << 14);
+	t = (x ^ (x >> 28)) & 0x00000000f0f0f0f0ULL;
+	x ^= t ^ (t << 28);
+
+	return x;
+}
+
+static void bs_load(uint64_t q[8], const uint8_t *in, size_t len)
+{
+	uint8_t buf[4 * AES_BLOCK_SIZE];
+	uint64_t w[8];
+	unsigned int k, m;
+
+	if (len < sizeof(buf)) {
+		memcpy(buf, in, len);
+		memset(buf + len, 0, sizeof(buf) - len);
+		in = buf;
+	}
+
+	for (m = 0; m < 8; m++)
+		w[m] = bs_transpose8(l_get_le64(in + m * 8));
+
+	for (k = 0; k < 8; k++) {
+		q[k] = 0;
+
+		for (m = 0; m < 8; m++)
+			q[k] |= ((w[m] >> (k * 8)) & 0xff) << (m * 8);
+	}
+}
+
+static void bs_store(const uint64_t q[8], uint8_t *out, size_t len)
+{
+	uint8_t buf[4 * AES_BLOCK_SIZE];
+	uint64_t w;
+	unsigned int k, m;
+
+	for (m = 0; m < 8; m++) {
+		w = 0;
+
+		for (k = 0; k < 8; k++)
+			w |= ((q[k] >> (m * 8)) & 0xff) << (k * 8);
+
+		l_put_le64(bs_transpose8(w), buf + m * 8);
+	}
+
+	memcpy(out, buf, len);
+	explicit_bzero(buf, sizeof(buf));
+}
+
+/*
+ * The S-box inversion is done in GF((2^4)^2): GF(2^4) modulo
+ * x^4 + x + 1 and the extension modulo y^2 + y + 10.  The basis change
+ * matrices to and from the AES field, with the affine transformation
+ * folded in, are the XOR networks in bs_sub_bytes and bs_inv_sub_bytes.
+ */
+static void bs_gf16_mul(uint64_t c[4], const uint64_t a[4],
+							const uint64_t b[4])
+{
+	uint64_t p4, p5, p6;
+
+	p4 = (a[1] & b[3]) ^ (a[2] & b[2]) ^ (a[3] & b[1]);
+	p5 = (a[2] & b[3]) ^ (a[3] & b[2]);
+	p6 = a[3] & b[3];
+
+	c[3] = (a[0] & b[3]) ^ (a[1] & b[2]) ^ (a[2] & b[1]) ^
+		(a[3] & b[0]) ^ p6;
+	c[2] = (a[0] & b[2]) ^ (a[1] & b[1]) ^ (a[2] & b[0]) ^ p5 ^ p6;
+	c[1] = (a[0] & b[1]) ^ (a[1] & b[0]) ^ p4 ^ p5;
+	c[0] = (a[0] & b[0]) ^ p4;
+}
+
+static void bs_gf16_sqr(uint64_t c[4], const uint64_t a[4])
+{
+	c[0] = a[0] ^ a[2];
+	c[1] = a[2];
+	c[2] = a[1] ^ a[3];
+	c[3] = a[3];
+}
+
+/* a^14, which is the multiplicative inverse and maps 0 to 0 */
+static void bs_gf16_inv(uint64_t c[4], const uint64_t a[4])
+{
+	uint64_t a2[4], a4[4], a8[4], a6[4];
+
+	bs_gf16_sqr(a2, a);
+	bs_gf16_sqr(a4, a2);
+	bs_gf16_sqr(a8, a4);
+	bs_gf16_mul(a6, a2, a4);
+	bs_gf16_mul(c, a6, a8);
+}
+
+/* t[0..3] is the low and t[4..7] the high GF(2^4) coefficient */
+static void bs_tower_inv(uint64_t t[8])
+{
+	const uint64_t *l = t;
+	const uint64_t *h = t + 4;
+	uint64_t hl[4], d[4], e[4], sum[4], inv_h[4], inv_l[4];
+
+	/* d = 10 * h^2 + h * l + l^2 */
+	bs_gf16_mul(hl, h, l);
+	d[0] = h[2] ^ h[3] ^ hl[0] ^ l[0] ^ l[2];
+	d[1] = h[0] ^ h[1] ^ hl[1] ^ l[2];
+	d[2] = h[1] ^ h[2] ^ hl[2] ^ l[1] ^ l[3];
+	d[3] = h[0] ^ h[1] ^ h[2] ^ hl[3] ^ l[3];
+
+	bs_gf16_inv(e, d);
+
+	sum[0] = h[0] ^ l[0];
+	sum[1] = h[1] ^ l[1];
+	sum[2] = h[2] ^ l[2];
+	sum[3] = h[3] ^ l[3];
+
+	bs_gf16_mul(inv_h, h, e);
+	bs_gf16_mul(inv_l, sum, e);
+
+	memcpy(t, inv_l, sizeof(inv_l));
+	memcpy(t + 4, inv_h, sizeof(inv_h));
+}
+
+static void bs_sub_bytes(uint64_t q[8])
+{
+	uint64_t t[8];
+
+	/* To the tower field */
+	t[0] = q[0] ^ q[5];
+	t[1] = q[2] ^ q[3] ^ q[5];
+	t[2] = q[1] ^ q[6] ^ q[7];
+	t[3] = q[1] ^ q[3] ^ q[6] ^ q[7];
+	t[4] = q[2] ^ q[3] ^ q[4] ^ q[6] ^ q[7];
+	t[5] = q[2] ^ q[3] ^ q[5] ^ q[7];
+	t[6] = q[1] ^ q[4] ^ q[5] ^ q[6];
+	t[7] = q[5] ^ q[7];
+
+	bs_tower_inv(t);
+
+	/* Back to the AES field and the affine transformation with 0x63 */
+	q[0] = ~(t[0] ^ t[4] ^ t[5] ^ t[7]);
+	q[1] = ~(t[0] ^ t[2]);
+	q[2] = t[0] ^ t[1] ^ t[3];
+	q[3] = t[0] ^ t[4] ^ t[6];
+	q[4] = t[0] ^ t[1] ^ t[2] ^ t[4] ^ t[5] ^ t[7];
+	q[5] = ~(t[1] ^ t[2] ^ t[4] ^ t[5] ^ t[7]);
+	q[6] = ~(t[4] ^ t[7]);
+	q[7] = t[1] ^ t[2] ^ t[3] ^ t[4];
+}
+
+static void bs_inv_sub_bytes(uint64_t q[8])
+{
+	uint64_t t[8];
+
+	/* Inverse affine transformation and on to the tower field */
+	t[0] = ~(q[4] ^ q[5]);
+	t[1] = ~(q[0] ^ q[1] ^ q[5]);
+	t[2] = q[1] ^ q[4] ^ q[5];
+	t[3] = q[0] ^ q[1] ^ q[2] ^ q[4];
+	t[4] = ~(q[1] ^ q[2] ^ q[7]);
+	t[5] = ~(q[0] ^ q[4] ^ q[5] ^ q[6]);
+	t[6] = q[1] ^ q[2] ^ q[3] ^ q[4] ^ q[5] ^ q[7];
+	t[7] = q[1] ^ q[2] ^ q[6] ^ q[7];
+
+	bs_tower_inv(t);
+
+	q[0] = t[0] ^ t[1] ^ t[5] ^ t[7];
+	q[1] = t[4] ^ t[5] ^ t[6];
+	q[2] = t[2] ^ t[3] ^ t[5] ^ t[7];
+	q[3] = t[2] ^ t[3];
+	q[4] = t[2] ^ t[6] ^ t[7];
+	q[5] = t[1] ^ t[5] ^ t[7];
+	q[6] = t[1] ^ t[2] ^ t[4] ^ t[6];
+	q[7] = t[1] ^ t[5];
+}
+
+static void bs_shift_rows(uint64_t q[8])
+{
+	unsigned int i;
+
+	for (i = 0; i < 8; i++) {
+		uint64_t x = q[i];
+
+		q[i] = (x & LANES(0x1111)) |
+			((x >> 4) & LANES(0x0222)) |
+			((x << 12) & LANES(0x2000)) |
+			((x >> 8) & LANES(0x0044)) |
+			((x << 8) & LANES(0x4400)) |
+			((x >> 12) & LANES(0x0008)) |
+			((x << 4) & LANES(0x8880));
+	}
+}
+
+static void bs_inv_shift_rows(uint64_t q[8])
+{
+	unsigned int i;
+
+	for (i = 0; i < 8; i++) {
+		uint64_t x = q[i];
+
+		q[i] = (x & LANES(0x1111)) |
+			((x << 4) & LANES(0x2220)) |
+			((x >> 12) & LANES(0x0002)) |
+			((x >> 8) & LANES(0x0044)) |
+			((x << 8) & LANES(0x4400)) |
+			((x >> 4) & LANES(0x0888)) |
+			((x << 12) & LANES(0x8000));
+	}
+}
+
+/* Rotate each column by 1, 2 or 3 rows so that row r gets row r + n */
+static inline uint64_t bs_rot1(uint64_t x)
+{
+	return ((x >> 1) & LANES(0x7777)) | ((x << 3) & LANES(0x8888));
+}
+
+static inline uint64_t bs_rot2(uint64_t x)
+{
+	return ((x >> 2) & LANES(0x3333)) | ((x << 2) & LANES(0xcccc));
+}
+
+static inline uint64_t bs_rot3(uint64_t x)
+{
+	return ((x >> 3) & LANES(0x1111)) | ((x << 1) & LANES(0xeeee));
+}
+
+static void bs_xtime(uint64_t out[8], const uint64_t a[8])
+{
+	uint64_t hi = a[7];
+
+	out[7] = a[6];
+	out[6] = a[5];
+	out[5] = a[4];
+	out[4] = a[3] ^ hi;
+	out[3] = a[2] ^ hi;
+	out[2] = a[1];
+	out[1] = a[0] ^ hi;
+	out[0] = hi;
+}
+
+static void bs_mix_columns(uint64_t q[8])
+{
+	uint64_t t[8], r[8];
+	unsigned int i;
+
+	for (i = 0; i < 8; i++) {
+		uint64_t a1 = bs_rot1(q[i]);
+
+		t[i] = q[i] ^ a1;
+		r[i] = a1 ^ bs_rot2(q[i]) ^ bs_rot3(q[i]);
+	}
+
+	bs_xtime(t, t);
+
+	for (i = 0; i < 8; i++)
+		q[i] = t[i] ^ r[i];
+}
+
+static void bs_inv_mix_columns(uint64_t q[8])
+{
+	uint64_t u[8];
+	unsigned int i;
+
+	for (i = 0; i < 8; i++)
+		u[i] = q[i] ^ bs_rot2(q[i]);
+
+	bs_xtime(u, u);
+	bs_xtime(u, u);
+
+	for (i = 0; i < 8; i++)
+		q[i] ^= u[i];
+
+	bs_mix_columns(q);
+}
+
+static void bs_add_round_key(uint64_t q[8], const uint64_t rk[8])
+{
+	unsigned int i;
+
+	for (i = 0; i < 8; i++)
+		q[i] ^= rk[i];
+}
+
+static void bs_encrypt(const struct aes_ctx *ctx, uint64_t q[8])
+{
+	unsigned int r;
+
+	bs_add_round_key(q, ctx->bs_rk[0]);
+
+	for (r = 1; r < ctx->rounds; r++) {
+		bs_sub_bytes(q);
+		bs_shift_rows(q);
+		bs_mix_columns(q);
+		bs_add_round_key(q, ctx->bs_rk[r]);
+	}
+
+	bs_sub_bytes(q);
+	bs_shift_rows(q);
+	bs_add_round_key(q, ctx->bs_rk[ctx->rounds]);
+}
+
+static void bs_decrypt(const struct aes_ctx *ctx, uint64_t q[8])
+{
+	unsigned int r;
+
+	bs_add_round_key(q, ctx->bs_rk[ctx->rounds]);
+
+	for (r = ctx->rounds - 1; r > 0; r--) {
+		bs_inv_shift_rows(q);
+		bs_inv_sub_bytes(q);
+		bs_add_round_key(q, ctx->bs_rk[r]);
+		bs_inv_mix_columns(q);
+	}
+
+	bs_inv_shift_rows(q);
+	bs_inv_sub_bytes(q);
+	bs_add_round_key(q, ctx->bs_rk[0]);
+}
+
+static uint32_t sub_word(uint32_t w)
+{
+	uint64_t q[8];
+	uint8_t b[4];
+
+	l_put_be32(w, b);
+	bs_load(q, b, 4);
+	bs_sub_bytes(q);
+	bs_store(q, b, 4);
+
+	return l_get_be32(b);
+}
+
+static void key_expand(struct aes_ctx *ctx, const uint8_t *key, size_t nk)
+{
+	uint32_t w[60];
+	unsigned int total = 4 * (ctx->rounds + 1);
+	unsigned int i;
+	uint8_t rcon = 1;
+
+	for (i = 0; i < nk; i++)
+		w[i] = l_get_be32(key + 4 * i);
+
+	for (; i < total; i++) {
+		uint32_t t = w[i - 1];
+
+		if (i % nk == 0) {
+			t = sub_word((t << 8) | (t >> 24)) ^
+				((uint32_t) rcon << 24);
+			rcon = (rcon << 1) ^ ((rcon >> 7) * 0x1b);
+		} else if (nk > 6 && i % nk == 4)
+			t = sub_word(t);
+
+		w[i] = w[i - nk] ^ t;
+	}
+
+	for (i = 0; i < total; i++)
+		l_put_be32(w[i], ctx->rk[i / 4] + (i % 4) * 4);
+
+	explicit_bzero(w, sizeof(w));
+
+	for (i = 0; i <= ctx->rounds; i++) {
+		uint8_t rk4[4 * AES_BLOCK_SIZE];
+		unsigned int j;
+
+		for (j = 0; j < 4; j++)
+			memcpy(rk4 + j * AES_BLOCK_SIZE, ctx->rk[i],
+							AES_BLOCK_SIZE);
+
+		bs_load(ctx->bs_rk[i], rk4, sizeof(rk4));
+		explicit_bzero(rk4, sizeof(rk4));
+	}
+}
+
+static inline void xor_block(uint8_t *out, const uint8_t *a,
+							const uint8_t *b)
+{
+	unsigned int i;
+
+	for (i = 0; i < AES_BLOCK_SIZE; i++)
+		out[i] = a[i] ^ b[i];
+}
+
+static void bs_encrypt_block(const struct aes_ctx *ctx, const uint8_t *in,
+								uint8_t *out)
+{
+	uint64_t q[8];
+
+	bs_load(q, in, AES_BLOCK_SIZE);
+	bs_encrypt(ctx, q);
+	bs_store(q, out, AES_BLOCK_SIZE);
+}
+
+static void bs_cbc_encrypt(struct aes_ctx *ctx, const uint8_t *in,
+						uint8_t *out, size_t len)
+{
+	uint8_t block[AES_BLOCK_SIZE];
+
+	for (; len >= AES_BLOCK_SIZE; len -= AES_BLOCK_SIZE) {
+		xor_block(block, in, ctx->iv);
+		bs_encrypt_block(ctx, block, ctx->iv);
+		memcpy(out, ctx->iv, AES_BLOCK_SIZE);
+
+		in += AES_BLOCK_SIZE;
+		out += AES_BLOCK_SIZE;
+	}
+}
+
+static void bs_cbc_decrypt(struct aes_ctx *ctx, const uint8_t *in,
+						uint8_t *out, size_t len)
+{
+	uint8_t chain[5 * AES_BLOCK_SIZE];
+	uint8_t plain[4 * AES_BLOCK_SIZE];
+	uint64_t q[8];
+
+	memcpy(chain, ctx->iv, AES_BLOCK_SIZE);
+
+	while (len >= AES_BLOCK_SIZE) {
+		size_t n = len < sizeof(plain) ? len & ~15 : sizeof(plain);
+		size_t i;
+
+		/* Keep the ciphertext around in case in == out */
+		memcpy(chain + AES_BLOCK_SIZE, in, n);
+
+		bs_load(q, in, n);
+		bs_decrypt(ctx, q);
+		bs_store(q, plain, n);
+
+		for (i = 0; i < n; i++)
+			out[i] = plain[i] ^ chain[i];
+
+		memcpy(chain, chain + n, AES_BLOCK_SIZE);
+		in += n;
+		out += n;
+		len -= n;
+	}
+
+	memcpy(ctx->iv, chain, AES_BLOCK_SIZE);
+}
+
+static void inc32(uint8_t *ctr)
+{
+	l_put_be32(l_get_be32(ctr + 12) + 1, ctr + 12);
+}
+
+static void bs_ctr(const struct aes_ctx *ctx, const uint8_t *j0,
+				const uint8_t *in, uint8_t *out, size_t len)
+{
+	uint8_t ctr[AES_BLOCK_SIZE];
+	uint8_t ks[4 * AES_BLOCK_SIZE];
+	uint64_t q[8];
+
+	memcpy(ctr, j0, AES_BLOCK_SIZE);
+
+	while (len) {
+		size_t n = len < sizeof(ks) ? len : sizeof(ks);
+		size_t i;
+
+		for (i = 0; i < n; i += AES_BLOCK_SIZE) {
+			inc32(ctr);
+			memcpy(ks + i, ctr, AES_BLOCK_SIZE);
+		}
+
+		bs_load(q, ks, sizeof(ks));
+		bs_encrypt(ctx, q);
+		bs_store(q, ks, sizeof(ks));
+
+		for (i = 0; i < n; i++)
+			out[i] = in[i] ^ ks[i];
+
+		in += n;
+		out += n;
+		len -= n;
+	}
+
+	explicit_bzero(ks, sizeof(ks));
+}
+
+/*
+ * Constant-time GHASH using integer multiplications with holes between
+ * the bits so that carries never reach a bit we keep.
+ */
+static uint64_t bmul64(uint64_t x, uint64_t y)
+{
+	uint64_t x0 = x & 0x1111111111111111ULL;
+	uint64_t x1 = x & 0x2222222222222222ULL;
+	uint64_t x2 = x & 0x4444444444444444ULL;
+	uint64_t x3 = x & 0x8888888888888888ULL;
+	uint64_t y0 = y & 0x1111111111111111ULL;
+	uint64_t y1 = y & 0x2222222222222222ULL;
+	uint64_t y2 = y & 0x4444444444444444ULL;
+	uint64_t y3 = y & 0x8888888888888888ULL;
+	uint64_t z0, z1, z2, z3;
+
+	z0 = (x0 * y0) ^ (x1 * y3) ^ (x2 * y2) ^ (x3 * y1);
+	z1 = (x0 * y1) ^ (x1 * y0) ^ (x2 * y3) ^ (x3 * y2);
+	z2 = (x0 * y2) ^ (x1 * y1) ^ (x2 * y0) ^ (x3 * y3);
+	z3 = (x0 * y3) ^ (x1 * y2) ^ (x2 * y1) ^ (x3 * y0);
+
+	return (z0 & 0x1111111111111111ULL) | (z1 & 0x2222222222222222ULL) |
+		(z2 & 0x4444444444444444ULL) | (z3 & 0x8888888888888888ULL);
+}
+
+static uint64_t rev64(uint64_t x)
+{
+	x = ((x & 0x5555555555555555ULL) << 1) |
+		((x >> 1) & 0x5555555555555555ULL);
+	x = ((x & 0x3333333333333333ULL) << 2) |
+		((x >> 2) & 0x3333333333333333ULL);
+	x = ((x & 0x0f0f0f0f0f0f0f0fULL) << 4) |
+		((x >> 4) & 0x0f0f0f0f0f0f0f0fULL);
+	x = ((x & 0x00ff00ff00ff00ffULL) << 8) |
+		((x >> 8) & 0x00ff00ff00ff00ffULL);
+	x = ((x & 0x0000ffff0000ffffULL) << 16) |
+		((x >> 16) & 0x0000ffff0000ffffULL);
+
+	return (x << 32) | (x >> 32);
+}
+
+static void ghash_ct(const struct aes_ctx *ctx, uint8_t *y,
+					const uint8_t *data, size_t len)
+{
+	uint64_t y0, y1, h0, h1, h2, h0r, h1r, h2r;
+
+	y1 = l_get_be64(y);
+	y0 = l_get_be64(y + 8);
+	h1 = l_get_be64(ctx->h);
+	h0 = l_get_be64(ctx->h + 8);
+	h0r = rev64(h0);
+	h1r = rev64(h1);
+	h2 = h0 ^ h1;
+	h2r = h0r ^ h1r;
+
+	while (len) {
+		uint8_t tmp[AES_BLOCK_SIZE];
+		const uint8_t *src = data;
+		uint64_t y0r, y1r, y2, y2r;
+		uint64_t z0, z1, z2, z0h, z1h, z2h;
+		uint64_t v0, v1, v2, v3;
+
+		if (len < AES_BLOCK_SIZE) {
+			memcpy(tmp, data, len);
+			memset(tmp + len, 0, AES_BLOCK_SIZE - len);
+			src = tmp;
+			len = AES_BLOCK_SIZE;
+		}
+
+		y1 ^= l_get_be64(src);
+		y0 ^= l_get_be64(src + 8);
+		data += AES_BLOCK_SIZE;
+		len -= AES_BLOCK_SIZE;
+
+		y0r = rev64(y0);
+		y1r = rev64(y1);
+		y2 = y0 ^ y1;
+		y2r = y0r ^ y1r;
+
+		z0 = bmul64(y0, h0);
+		z1 = bmul64(y1, h1);
+		z2 = bmul64(y2, h2);
+		z0h = bmul64(y0r, h0r);
+		z1h = bmul64(y1r, h1r);
+		z2h = bmul64(y2r, h2r);
+		z2 ^= z0 ^ z1;
+		z2h ^= z0h ^ z1h;
+		z0h = rev64(z0h) >> 1;
+		z1h = rev64(z1h) >> 1;
+		z2h = rev64(z2h) >> 1;
+
+		v0 = z0;
+		v1 = z0h ^ z2;
+		v2 = z1 ^ z2h;
+		v3 = z1h;
+
+		v3 = (v3 << 1) | (v2 >> 63);
+		v2 = (v2 << 1) | (v1 >> 63);
+		v1 = (v1 << 1) | (v0 >> 63);
+		v0 = (v0 << 1);
+
+		v2 ^= v0 ^ (v0 >> 1) ^ (v0 >> 2) ^ (v0 >> 7);
+		v1 ^= (v0 << 63) ^ (v0 << 62) ^ (v0 << 57);
+		v3 ^= v1 ^ (v1 >> 1) ^ (v1 >> 2) ^ (v1 >> 7);
+		v2 ^= (v1 << 63) ^ (v1 << 62) ^ (v1 << 57);
+
+		y0 = v2;
+		y1 = v3;
+	}
+
+	l_put_be64(y1, y);
+	l_put_be64(y0, y + 8);
+}
+
+#ifdef HAVE_AESNI
+
+#define AESNI_TARGET __attribute__ ((target("aes,pclmul,ssse3")))
+
+static bool aesni_supported(void)
+{
+	static int supported = -1;
+
+	if (supported < 0) {
+		__builtin_cpu_init();
+		supported = __builtin_cpu_supports("aes") &&
+				__builtin_cpu_supports("pclmul") &&
+				__builtin_cpu_supports("ssse3");
+	}
+
+	return supported;
+}
+
+#define AESNI_LOADU(p) _mm_loadu_si128((const __m128i *) (p))
+#define AESNI_STOREU(p, v) _mm_storeu_si128((__m128i *) (p), (v))
+#define AESNI_BSWAP(v) _mm_shuffle_epi8((v), _mm_set_epi8(0, 1, 2, 3, \
+				4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15))
+
+static AESNI_TARGET __m128i aesni_encrypt(const struct aes_ctx *ctx,
+								__m128i b)
+{
+	unsigned int r;
+
+	b = _mm_xor_si128(b, _mm_load_si128((const __m128i *) ctx->rk[0]));
+
+	for (r = 1; r < ctx->rounds; r++)
+		b = _mm_aesenc_si128(b,
+				_mm_load_si128((const __m128i *) ctx->rk[r]));
+
+	return _mm_aesenclast_si128(b,
+			_mm_load_si128((const __m128i *) ctx->rk[r]));
+}
+
+#define AESNI_ROUND4(op, b, k)			\
+	do {					\
+		b[0] = op(b[0], k);		\
+		b[1] = op(b[1], k);		\
+		b[2] = op(b[2], k);		\
+		b[3] = op(b[3], k);		\
+	} while (0)
+
+static AESNI_TARGET void aesni_encrypt4(const struct aes_ctx *ctx,
+								__m128i b[4])
+{
+	__m128i k = _mm_load_si128((const __m128i *) ctx->rk[0]);
+	unsigned int r;
+
+	AESNI_ROUND4(_mm_xor_si128, b, k);
+
+	for (r = 1; r < ctx->rounds; r++) {
+		k = _mm_load_si128((const __m128i *) ctx->rk[r]);
+		AESNI_ROUND4(_mm_aesenc_si128, b, k);
+	}
+
+	k = _mm_load_si128((const __m128i *) ctx->rk[r]);
+	AESNI_ROUND4(_mm_aesenclast_si128, b, k);
+}
+
+static AESNI_TARGET void aesni_decrypt4(const struct aes_ctx *ctx,
+								__m128i b[4])
+{
+	__m128i k = _mm_load_si128((const __m128i *) ctx->dk[0]);
+	unsigned int r;
+
+	AESNI_ROUND4(_mm_xor_si128, b, k);
+
+	for (r = 1; r < ctx->rounds; r++) {
+		k = _mm_load_si128((const __m128i *) ctx->dk[r]);
+		AESNI_ROUND4(_mm_aesdec_si128, b, k);
+	}
+
+	k = _mm_load_si128((const __m128i *) ctx->dk[r]);
+	AESNI_ROUND4(_mm_aesdeclast_si128, b, k);
+}
+
+static AESNI_TARGET __m128i aesni_decrypt(const struct aes_ctx *ctx,
+								__m128i b)
+{
+	unsigned int r;
+
+	b = _mm_xor_si128(b, _mm_load_si128((const __m128i *) ctx->dk[0]));
+
+	for (r = 1; r < ctx->rounds; r++)
+		b = _mm_aesdec_si128(b,
+				_mm_load_si128((const __m128i *) ctx->dk[r]));
+
+	return _mm_aesdeclast_si128(b,
+			_mm_load_si128((const __m128i *) ctx->dk[r]));
+}
+
+/*
+ * Carry-less multiplication in GF(2^128) on byte-reflected operands,
+ * split so that several products can share one reduction.
+ */
+static AESNI_TARGET void clmul_wide(__m128i a, __m128i b,
+						__m128i *lo, __m128i *hi)
+{
+	__m128i t0 = _mm_clmulepi64_si128(a, b, 0x00);
+	__m128i t1 = _mm_clmulepi64_si128(a, b, 0x10);
+	__m128i t2 = _mm_clmulepi64_si128(a, b, 0x01);
+	__m128i t3 = _mm_clmulepi64_si128(a, b, 0x11);
+
+	t1 = _mm_xor_si128(t1, t2);
+	*lo = _mm_xor_si128(*lo, _mm_xor_si128(t0, _mm_slli_si128(t1, 8)));
+	*hi = _mm_xor_si128(*hi, _mm_xor_si128(t3, _mm_srli_si128(t1, 8)));
+}
+
+static AESNI_TARGET __m128i clmul_reduce(__m128i lo, __m128i hi)
+{
+	__m128i t7, t8, t9, t2, t4, t5;
+
+	/* Shift the 256-bit product left by one to undo the reflection */
+	t7 = _mm_srli_epi32(lo, 31);
+	t8 = _mm_srli_epi32(hi, 31);
+	lo = _mm_slli_epi32(lo, 1);
+	hi = _mm_slli_epi32(hi, 1);
+	t9 = _mm_srli_si128(t7, 12);
+	t8 = _mm_slli_si128(t8, 4);
+	t7 = _mm_slli_si128(t7, 4);
+	lo = _mm_or_si128(lo, t7);
+	hi = _mm_or_si128(hi, t8);
+	hi = _mm_or_si128(hi, t9);
+
+	/* Reduce modulo x^128 + x^7 + x^2 + x + 1 */
+	t7 = _mm_slli_epi32(lo, 31);
+	t8 = _mm_slli_epi32(lo, 30);
+	t9 = _mm_slli_epi32(lo, 25);
+	t7 = _mm_xor_si128(t7, t8);
+	t7 = _mm_xor_si128(t7, t9);
+	t8 = _mm_srli_si128(t7, 4);
+	t7 = _mm_slli_si128(t7, 12);
+	lo = _mm_xor_si128(lo, t7);
+
+	t2 = _mm_srli_epi32(lo, 1);
+	t4 = _mm_srli_epi32(lo, 2);
+	t5 = _mm_srli_epi32(lo, 7);
+	t2 = _mm_xor_si128(t2, t4);
+	t2 = _mm_xor_si128(t2, t5);
+	t2 = _mm_xor_si128(t2, t8);
+	lo = _mm_xor_si128(lo, t2);
+
+	return _mm_xor_si128(hi, lo);
+}
+
+static AESNI_TARGET __m128i clmul(__m128i a, __m128i b)
+{
+	__m128i lo = _mm_setzero_si128();
+	__m128i hi = _mm_setzero_si128();
+
+	clmul_wide(a, b, &lo, &hi);
+
+	return clmul_reduce(lo, hi);
+}
+
+static AESNI_TARGET void aesni_init(struct aes_ctx *ctx)
+{
+	__m128i h, h2, h3, h4;
+	unsigned int r;
+
+	_mm_store_si128((__m128i *) ctx->dk[0],
+			_mm_load_si128((const __m128i *) ctx->rk[ctx->rounds]));
+
+	for (r = 1; r < ctx->rounds; r++)
+		_mm_store_si128((__m128i *) ctx->dk[r],
+			_mm_aesimc_si128(_mm_load_si128((const __m128i *)
+						ctx->rk[ctx->rounds - r])));
+
+	_mm_store_si128((__m128i *) ctx->dk[r],
+			_mm_load_si128((const __m128i *) ctx->rk[0]));
+
+	/* H, H^2, H^3 and H^4 for four-block aggregated GHASH */
+	h = AESNI_BSWAP(AESNI_LOADU(ctx->h));
+	h2 = clmul(h, h);
+	h3 = clmul(h2, h);
+	h4 = clmul(h3, h);
+
+	_mm_store_si128((__m128i *) ctx->htab[0], h);
+	_mm_store_si128((__m128i *) ctx->htab[1], h2);
+	_mm_store_si128((__m128i *) ctx->htab[2], h3);
+	_mm_store_si128((__m128i *) ctx->htab[3], h4);
+}
+
+static AESNI_TARGET void aesni_cbc_encrypt(struct aes_ctx *ctx,
+				const uint8_t *in, uint8_t *out, size_t len)
+{
+	__m128i iv = AESNI_LOADU(ctx->iv);
+
+	for (; len >= AES_BLOCK_SIZE; len -= AES_BLOCK_SIZE) {
+		iv = aesni_encrypt(ctx, _mm_xor_si128(iv, AESNI_LOADU(in)));
+		AESNI_STOREU(out, iv);
+
+		in += AES_BLOCK_SIZE;
+		out += AES_BLOCK_SIZE;
+	}
+
+	AESNI_STOREU(ctx->iv, iv);
+}
+
+static AESNI_TARGET void aesni_cbc_decrypt(struct aes_ctx *ctx,
+				const uint8_t *in, uint8_t *out, size_t len)
+{
+	__m128i iv = AESNI_LOADU(ctx->iv);
+
+	for (; len >= 4 * AES_BLOCK_SIZE; len -= 4 * AES_BLOCK_SIZE) {
+		__m128i c[4], b[4];
+
+		c[0] = b[0] = AESNI_LOADU(in + 0);
+		c[1] = b[1] = AESNI_LOADU(in + 16);
+		c[2] = b[2] = AESNI_LOADU(in + 32);
+		c[3] = b[3] = AESNI_LOADU(in + 48);
+
+		aesni_decrypt4(ctx, b);
+
+		AESNI_STOREU(out + 0, _mm_xor_si128(b[0], iv));
+		AESNI_STOREU(out + 16, _mm_xor_si128(b[1], c[0]));
+		AESNI_STOREU(out + 32, _mm_xor_si128(b[2], c[1]));
+		AESNI_STOREU(out + 48, _mm_xor_si128(b[3], c[2]));
+		iv = c[3];
+
+		in += 4 * AES_BLOCK_SIZE;
+		out += 4 * AES_BLOCK_SIZE;
+	}
+
+	for (; len >= AES_BLOCK_SIZE; len -= AES_BLOCK_SIZE) {
+		__m128i c = AESNI_LOADU(in);
+
+		AESNI_STOREU(out, _mm_xor_si128(aesni_decrypt(ctx, c), iv));
+		iv = c;
+
+		in += AES_BLOCK_SIZE;
+		out += AES_BLOCK_SIZE;
+	}
+
+	AESNI_STOREU(ctx->iv, iv);
+}
+
+static AESNI_TARGET void aesni_ctr(const struct aes_ctx *ctx,
+					const uint8_t *j0, const uint8_t *in,
+					uint8_t *out, size_t len)
+{
+	const __m128i one = _mm_set_epi32(0, 0, 0, 1);
+	__m128i ctr = AESNI_BSWAP(AESNI_LOADU(j0));
+
+	for (; len >= 4 * AES_BLOCK_SIZE; len -= 4 * AES_BLOCK_SIZE) {
+		__m128i b[4];
+
+		ctr = _mm_add_epi32(ctr, one);
+		b[0] = AESNI_BSWAP(ctr);
+		ctr = _mm_add_epi32(ctr, one);
+		b[1] = AESNI_BSWAP(ctr);
+		ctr = _mm_add_epi32(ctr, one);
+		b[2] = AESNI_BSWAP(ctr);
+		ctr = _mm_add_epi32(ctr, one);
+		b[3] = AESNI_BSWAP(ctr);
+
+		aesni_encrypt4(ctx, b);
+
+		AESNI_STOREU(out + 0, _mm_xor_si128(b[0], AESNI_LOADU(in)));
+		AESNI_STOREU(out + 16,
+				_mm_xor_si128(b[1], AESNI_LOADU(in + 16)));
+		AESNI_STOREU(out + 32,
+				_mm_xor_si128(b[2], AESNI_LOADU(in + 32)));
+		AESNI_STOREU(out + 48,
+				_mm_xor_si128(b[3], AESNI_LOADU(in + 48)));
+
+		in += 4 * AES_BLOCK_SIZE;
+		out += 4 * AES_BLOCK_SIZE;
+	}
+
+	while (len) {
+		uint8_t ks[AES_BLOCK_SIZE];
+		size_t n = len < AES_BLOCK_SIZE ? len : AES_BLOCK_SIZE;
+		size_t i;
+
+		ctr = _mm_add_epi32(ctr, one);
+		AESNI_STOREU(ks, aesni_encrypt(ctx, AESNI_BSWAP(ctr)));
+
+		for (i = 0; i < n; i++)
+			out[i] = in[i] ^ ks[i];
+
+		in += n;
+		out += n;
+		len -= n;
+	}
+}
+
+static AESNI_TARGET void aesni_ghash(const struct aes_ctx *ctx, uint8_t *y,
+					const uint8_t *data, size_t len)
+{
+	const __m128i *htab = (const __m128i *) ctx->htab;
+	__m128i acc = AESNI_BSWAP(AESNI_LOADU(y));
+
+	for (; len >= 4 * AES_BLOCK_SIZE; len -= 4 * AES_BLOCK_SIZE) {
+		__m128i lo = _mm_setzero_si128();
+		__m128i hi = _mm_setzero_si128();
+		__m128i x;
+
+		x = _mm_xor_si128(acc, AESNI_BSWAP(AESNI_LOADU(data)));
+		clmul_wide(x, _mm_load_si128(htab + 3), &lo, &hi);
+		x = AESNI_BSWAP(AESNI_LOADU(data + 16));
+		clmul_wide(x, _mm_load_si128(htab + 2), &lo, &hi);
+		x = AESNI_BSWAP(AESNI_LOADU(data + 32));
+		clmul_wide(x, _mm_load_si128(htab + 1), &lo, &hi);
+		x = AESNI_BSWAP(AESNI_LOADU(data + 48));
+		clmul_wide(x, _mm_load_si128(htab + 0), &lo, &hi);
+		acc = clmul_reduce(lo, hi);
+
+		data += 4 * AES_BLOCK_SIZE;
+	}
+
+	while (len) {
+		uint8_t tmp[AES_BLOCK_SIZE];
+		const uint8_t *src = data;
+		size_t n = AES_BLOCK_SIZE;
+
+		if (len < AES_BLOCK_SIZE) {
+			memcpy(tmp, data, len);
+			memset(tmp + len, 0, AES_BLOCK_SIZE - len);
+			src = tmp;
+			n = len;
+		}
+
+		acc = _mm_xor_si128(acc, AESNI_BSWAP(AESNI_LOADU(src)));
+		acc = clmul(acc, _mm_load_si128(htab));
+
+		data += n;
+		len -= n;
+	}
+
+	AESNI_STOREU(y, AESNI_BSWAP(acc));
+}
+
+static AESNI_TARGET void aesni_encrypt_block(const struct aes_ctx *ctx,
+					const uint8_t *in, uint8_t *out)
+{
+	AESNI_STOREU(out, aesni_encrypt(ctx, AESNI_LOADU(in)));
+}
+
+#endif
+
+static void encrypt_block(const struct aes_ctx *ctx, const uint8_t *in,
+								uint8_t *out)
+{
+#ifdef HAVE_AESNI
+	if (ctx->aesni) {
+		aesni_encrypt_block(ctx, in, out);
+		return;
+	}
+#endif
+
+	bs_encrypt_block(ctx, in, out);
+}
+
+bool _aes_init(struct aes_ctx *ctx, const void *key, size_t key_len)
+{
+	static const uint8_t zero[AES_BLOCK_SIZE];
+
+	switch (key_len) {
+	case 16:
+	case 24:
+	case 32:
+		break;
+	default:
+		return false;
+	}
+
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->rounds = key_len / 4 + 6;
+	key_expand(ctx, key, key_len / 4);
+
+	/* The GCM hash key, H = E(K, 0^128) */
+	bs_encrypt_block(ctx, zero, ctx->h);
+
+#ifdef HAVE_AESNI
+	ctx->aesni = aesni_supported();
+
+	if (ctx->aesni)
+		aesni_init(ctx);
+#endif
+
+	return true;
+}
+
+const char *_aes_implementation(const struct aes_ctx *ctx)
+{
+	return ctx->aesni ? "AES-NI" : "bitsliced";
+}
+
+void _aes_set_iv(struct aes_ctx *ctx, const void *iv)
+{
+	memcpy(ctx->iv, iv, AES_BLOCK_SIZE);
+}
+
+/*
+ * CBC mode, chaining from the IV last set or from the previous call's
+ * last ciphertext block.  len must be a multiple of the block size.
+ */
+void _aes_cbc_encrypt(struct aes_ctx *ctx, const void *in, void *out,
+								size_t len)
+{
+#ifdef HAVE_AESNI
+	if (ctx->aesni) {
+		aesni_cbc_encrypt(ctx, in, out, len);
+		return;
+	}
+#endif
+
+	bs_cbc_encrypt(ctx, in, out, len);
+}
+
+void _aes_cbc_decrypt(struct aes_ctx *ctx, const void *in, void *out,
+								size_t len)
+{
+#ifdef HAVE_AESNI
+	if (ctx->aesni) {
+		aesni_cbc_decrypt(ctx, in, out, len);
+		return;
+	}
+#endif
+
+	bs_cbc_decrypt(ctx, in, out, len);
+}
+
+static void gcm_ctr(const struct aes_ctx *ctx, const uint8_t *j0,
+				const uint8_t *in, uint8_t *out, size_t len)
+{
+#ifdef HAVE_AESNI
+	if (ctx->aesni) {
+		aesni_ctr(ctx, j0, in, out, len);
+		return;
+	}
+#endif
+
+	bs_ctr(ctx, j0, in, out, len);
+}
+
+static void gcm_ghash(const struct aes_ctx *ctx, uint8_t *y,
+					const uint8_t *data, size_t len)
+{
+#ifdef HAVE_AESNI
+	if (ctx->aesni) {
+		aesni_ghash(ctx, y, data, len);
+		return;
+	}
+#endif
+
+	ghash_ct(ctx, y, data, len);
+}
+
+static void gcm_tag(const struct aes_ctx *ctx, const uint8_t *j0,
+			const uint8_t *aad, size_t aad_len,
+			const uint8_t *ciphertext, size_t len, uint8_t *tag)
+{
+	uint8_t y[AES_BLOCK_SIZE] = { 0 };
+	uint8_t lens[AES_BLOCK_SIZE];
+	uint8_t ek0[AES_BLOCK_SIZE];
+
+	gcm_ghash(ctx, y, aad, aad_len);
+	gcm_ghash(ctx, y, ciphertext, len);
+
+	l_put_be64((uint64_t) aad_len * 8, lens);
+	l_put_be64((uint64_t) len * 8, lens + 8);
+	gcm_ghash(ctx, y, lens, sizeof(lens));
+
+	encrypt_block(ctx, j0, ek0);
+	xor_block(tag, y, ek0);
+
+	explicit_bzero(ek0, sizeof(ek0));
+}
+
+/* GCM with a 96-bit nonce, tag_len up to AES_BLOCK_SIZE */
+void _aes_gcm_encrypt(const struct aes_ctx *ctx, const uint8_t *nonce,
+			const void *aad, size_t aad_len,
+			const void *in, void *out, size_t len,
+			void *tag, size_t tag_len)
+{
+	struct aes_gcm_state gcm;
+
+	_aes_gcm_start(&gcm, ctx, nonce, aad, aad_len);
+	_aes_gcm_encrypt_update(&gcm, in, out, len);
+	_aes_gcm_finish(&gcm, tag, tag_len);
+}
+
+bool _aes_gcm_decrypt(const struct aes_ctx *ctx, const uint8_t *nonce,
+			const void *aad, size_t aad_len,
+			const void *in, void *out, size_t len,
+			const void *tag, size_t tag_len)
+{
+	uint8_t j0[AES_BLOCK_SIZE];
+	uint8_t full_tag[AES_BLOCK_SIZE];
+	const uint8_t *expected = tag;
+	uint8_t diff = 0;
+	size_t i;
+
+	memcpy(j0, nonce, AES_GCM_NONCE_SIZE);
+	l_put_be32(1, j0 + AES_GCM_NONCE_SIZE);
+
+	/* Authenticate first, in and out may be the same buffer */
+	gcm_tag(ctx, j0, aad, aad_len, in, len, full_tag);
+
+	for (i = 0; i < tag_len; i++)
+		diff |= full_tag[i] ^ expected[i];
+
+	if (diff)
+		return false;
+
+	gcm_ctr(ctx, j0, in, out, len);
+
+	return true;
+}
+
+void _aes_gcm_start(struct aes_gcm_state *gcm, const struct aes_ctx *ctx,
+			const uint8_t *nonce, const void *aad, size_t aad_len)
+{
+	gcm->ctx = ctx;
+	memcpy(gcm->j0, nonce, AES_GCM_NONCE_SIZE);
+	l_put_be32(1, gcm->j0 + AES_GCM_NONCE_SIZE);
+	memcpy(gcm->ctr, gcm->j0, AES_BLOCK_SIZE);
+	memset(gcm->y, 0, AES_BLOCK_SIZE);
+	gcm->aad_len = aad_len;
+	gcm->len = 0;
+
+	gcm_ghash(ctx, gcm->y, aad, aad_len);
+}
+
+void _aes_gcm_encrypt_update(struct aes_gcm_state *gcm, const void *in,
+						void *out, size_t len)
+{
+	const uint8_t *src = in;
+	uint8_t *dst = out;
+	unsigned int pos = gcm->len % AES_BLOCK_SIZE;
+	size_t n;
+
+	gcm->len += len;
+
+	/* Use up the keystream left over from the previous update */
+	if (pos) {
+		for (; len && pos < AES_BLOCK_SIZE; len--, pos++)
+			gcm->partial[pos] = *dst++ = *src++ ^ gcm->ks[pos];
+
+		if (pos < AES_BLOCK_SIZE)
+			return;
+
+		gcm_ghash(gcm->ctx, gcm->y, gcm->partial, AES_BLOCK_SIZE);
+	}
+
+	n = len & ~(AES_BLOCK_SIZE - 1);
+	if (n) {
+		gcm_ctr(gcm->ctx, gcm->ctr, src, dst, n);
+		gcm_ghash(gcm->ctx, gcm->y, dst, n);
+		l_put_be32(l_get_be32(gcm->ctr + 12) + n / AES_BLOCK_SIZE,
+				gcm->ctr + 12);
+		src += n;
+		dst += n;
+		len -= n;
+	}
+
+	if (!len)
+		return;
+
+	inc32(gcm->ctr);
+	encrypt_block(gcm->ctx, gcm->ctr, gcm->ks);
+
+	for (pos = 0; pos < len; pos++)
+		gcm->partial[pos] = dst[pos] = src[pos] ^ gcm->ks[pos];
+}
+
+void _aes_gcm_finish(struct aes_gcm_state *gcm, void *tag, size_t tag_len)
+{
+	uint8_t lens[AES_BLOCK_SIZE];
+	uint8_t full_tag[AES_BLOCK_SIZE];
+
+	/* The hash pads a short final block with zeros */
+	gcm_ghash(gcm->ctx, gcm->y, gcm->partial,
+				gcm->len % AES_BLOCK_SIZE);
+
+	l_put_be64(gcm->aad_len * 8, lens);
+	l_put_be64(gcm->len * 8, lens + 8);
+	gcm_ghash(gcm->ctx, gcm->y, lens, sizeof(lens));
+
+	encrypt_block(gcm->ctx, gcm->j0, full_tag);
+	xor_block(full_tag, full_tag, gcm->y);
+	memcpy(tag, full_tag, tag_len);
+
+	explicit_bzero(full_tag, sizeof(full_tag));
+	explicit_bzero(gcm->ks, sizeof(gcm->ks));
+}
@@ -0,0 +1,50 @@
+/*
+ *
+ *  Embedded Linux library
+ *
+ *  Copyright (C) 2019  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define ALG_POOL_DEFAULT_MAX	16
+
+/*
+ * Process-wide cache of bound AF_ALG transform sockets and of idle
+ * operation sockets accepted from them, kept by the main loop thread
+ * between l_main_init and l_main_exit.  Checking out an operation
+ * socket costs nothing when an idle one is cached and a single
+ * accept() when only the transform is, instead of the socket(),
+ * bind(), setsockopt() and accept() sequence.
+ *
+ * Keyed transforms are only cached after l_alg_pool_set_keyed(true),
+ * matched by a salted digest of the key rather than the key itself.
+ */
+struct alg_tfm;
+
+int _alg_pool_get(const char *alg_type, const char *alg_name,
+			const void *key, size_t key_len, size_t tag_len,
+			bool shared, struct alg_tfm **out_tfm);
+void _alg_pool_put(struct alg_tfm *tfm, int sk, bool reusable);
+struct alg_tfm *_alg_tfm_ref(struct alg_tfm *tfm);
+
+/* Set by l_main_init and cleared by l_main_exit on the calling thread */
+void _alg_pool_set_enabled(bool enabled);
@@ -0,0 +1,447 @@
+/*
+ *
+ *  Embedded Linux library
+ *
+ *  Copyright (C) 2019  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "util.h"
+#include "queue.h"
+#include "checksum.h"
+#include "random.h"
+#include "alg.h"
+#include "private.h"
+#include "digest-private.h"
+#include "alg-private.h"
+
+#ifndef HAVE_LINUX_IF_ALG_H
+#ifndef HAVE_LINUX_TYPES_H
+typedef uint8_t __u8;
+typedef uint16_t __u16;
+typedef uint32_t __u32;
+#else
+#include <linux/types.h>
+#endif
+
+#ifndef AF_ALG
+#define AF_ALG	38
+#define PF_ALG	AF_ALG
+#endif
+
+struct sockaddr_alg {
+	__u16	salg_family;
+	__u8	salg_type[14];
+	__u32	salg_feat;
+	__u32	salg_mask;
+	__u8	salg_name[64];
+};
+
+/* Socket options */
+#define ALG_SET_KEY	1
+
+#else
+#include <linux/if_alg.h>
+#endif
+
+#ifndef SOL_ALG
+#define SOL_ALG 279
+#endif
+
+#ifndef ALG_SET_AEAD_AUTHSIZE
+#define ALG_SET_AEAD_AUTHSIZE	5
+#endif
+
+#define ALG_KEY_ID_LEN	32
+
+struct alg_tfm {
+	char type[14];
+	char name[64];
+	size_t tag_len;
+	bool keyed;
+	size_t key_len;
+	uint8_t key_id[ALG_KEY_ID_LEN];
+	int sk;			/* -1 once the transform has left the pool */
+	int *idle;
+	unsigned int n_idle;
+	unsigned int idle_size;
+	unsigned int ref_count;
+};
+
+/* Most recently used first, each entry holds a reference */
+static struct l_queue *pool;
+
+static struct l_alg_pool_stats pool_stats = {
+	.max_sockets = ALG_POOL_DEFAULT_MAX,
+};
+
+static bool pool_keyed;
+static uint8_t key_id_secret[32];
+static bool key_id_secret_set;
+
+/* Only the main loop thread touches the pool */
+static __thread bool pool_enabled;
+
+static int create_tfm(const char *alg_type, const char *alg_name,
+			const void *key, size_t key_len, size_t tag_len)
+{
+	struct sockaddr_alg salg;
+	int sk;
+
+	sk = socket(PF_ALG, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (sk < 0)
+		return -errno;
+
+	memset(&salg, 0, sizeof(salg));
+	salg.salg_family = AF_ALG;
+	strcpy((char *) salg.salg_type, alg_type);
+	strcpy((char *) salg.salg_name, alg_name);
+
+	if (bind(sk, (struct sockaddr *) &salg, sizeof(salg)) < 0)
+		goto error;
+
+	if (key && setsockopt(sk, SOL_ALG, ALG_SET_KEY, key, key_len) < 0)
+		goto error;
+
+	if (tag_len && setsockopt(sk, SOL_ALG, ALG_SET_AEAD_AUTHSIZE, NULL,
+					tag_len) < 0)
+		goto error;
+
+	return sk;
+
+error:
+	close(sk);
+	return -1;
+}
+
+/*
+ * Keyed transforms are looked up by an HMAC of the key under a random
+ * per-process secret so that the pool never holds a copy of the key.
+ */
+static bool key_id(const void *key, size_t key_len, uint8_t *out)
+{
+	struct hmac_ctx hmac;
+
+	if (!key_id_secret_set) {
+		if (!l_getrandom(key_id_secret, sizeof(key_id_secret)))
+			return false;
+
+		key_id_secret_set = true;
+	}
+
+	if (!_hmac_init(&hmac, L_CHECKSUM_SHA256, key_id_secret,
+						sizeof(key_id_secret)))
+		return false;
+
+	_hmac_update(&hmac, key, key_len);
+	_hmac_final(&hmac, out);
+	explicit_bzero(&hmac, sizeof(hmac));
+
+	return true;
+}
+
+static void tfm_close_sockets(struct alg_tfm *tfm)
+{
+	while (tfm->n_idle) {
+		close(tfm->idle[--tfm->n_idle]);
+		pool_stats.cached_sockets--;
+	}
+
+	if (tfm->sk >= 0) {
+		close(tfm->sk);
+		tfm->sk = -1;
+		pool_stats.cached_sockets--;
+	}
+}
+
+/* Objects may be freed on another thread than the one that made them */
+static void tfm_unref(struct alg_tfm *tfm)
+{
+	if (__atomic_sub_fetch(&tfm->ref_count, 1, __ATOMIC_ACQ_REL))
+		return;
+
+	l_free(tfm->idle);
+	explicit_bzero(tfm, sizeof(*tfm));
+	l_free(tfm);
+}
+
+static bool tfm_match(const void *a, const void *b)
+{
+	const struct alg_tfm *tfm = a;
+	const struct alg_tfm *match = b;
+
+	if (tfm->tag_len != match->tag_len || tfm->keyed != match->keyed)
+		return false;
+
+	if (tfm->keyed && (tfm->key_len != match->key_len ||
+				memcmp(tfm->key_id, match->key_id,
+							ALG_KEY_ID_LEN)))
+		return false;
+
+	return !strcmp(tfm->name, match->name) &&
+		!strcmp(tfm->type, match->type);
+}
+
+static void tfm_evict(struct alg_tfm *tfm)
+{
+	tfm_close_sockets(tfm);
+	tfm_unref(tfm);
+	pool_stats.evicted++;
+}
+
+static bool tfm_evict_keyed(void *data, void *user_data)
+{
+	struct alg_tfm *tfm = data;
+
+	if (!tfm->keyed)
+		return false;
+
+	tfm_evict(tfm);
+	return true;
+}
+
+static void pool_trim(unsigned int max)
+{
+	struct alg_tfm *tfm;
+
+	while (pool_stats.cached_sockets > max) {
+		tfm = l_queue_peek_tail(pool);
+		l_queue_remove(pool, tfm);
+		tfm_evict(tfm);
+	}
+}
+
+static struct alg_tfm *tfm_new(const struct alg_tfm *match, int sk)
+{
+	struct alg_tfm *tfm = l_memdup(match, sizeof(*match));
+
+	tfm->sk = sk;
+	tfm->ref_count = 1;
+
+	return tfm;
+}
+
+/*
+ * Check out an operation socket for the given algorithm and key.  The
+ * transform reference returned in @out_tfm has to be handed back with
+ * the socket to _alg_pool_put.  Transforms that keep per-key state
+ * between operations, such as ARC4, must not be @shared.
+ */
+int _alg_pool_get(const char *alg_type, const char *alg_name,
+			const void *key, size_t key_len, size_t tag_len,
+			bool shared, struct alg_tfm **out_tfm)
+{
+	struct alg_tfm match;
+	struct alg_tfm *tfm = NULL;
+	bool cache = shared && pool_enabled && pool_stats.max_sockets;
+	int tfm_sk;
+	int sk;
+
+	memset(&match, 0, sizeof(match));
+	l_strlcpy(match.type, alg_type, sizeof(match.type));
+	l_strlcpy(match.name, alg_name, sizeof(match.name));
+	match.tag_len = tag_len;
+	match.keyed = key != NULL;
+	match.sk = -1;
+
+	if (cache && key) {
+		match.key_len = key_len;
+		cache = pool_keyed && key_id(key, key_len, match.key_id);
+	}
+
+	if (cache)
+		tfm = l_queue_find(pool, tfm_match, &match);
+
+	if (tfm) {
+		/* Keep the pool in least recently used order */
+		l_queue_remove(pool, tfm);
+		l_queue_push_head(pool, tfm);
+
+		if (tfm->n_idle) {
+			sk = tfm->idle[--tfm->n_idle];
+			pool_stats.cached_sockets--;
+			pool_stats.reused++;
+		} else {
+			sk = accept4(tfm->sk, NULL, 0, SOCK_CLOEXEC);
+			if (sk < 0)
+				return -errno;
+
+			pool_stats.accepted++;
+		}
+
+		*out_tfm = _alg_tfm_ref(tfm);
+		return sk;
+	}
+
+	tfm_sk = create_tfm(alg_type, alg_name, key, key_len, tag_len);
+	if (tfm_sk < 0)
+		return tfm_sk;
+
+	sk = accept4(tfm_sk, NULL, 0, SOCK_CLOEXEC);
+	if (sk < 0) {
+		sk = -errno;
+		close(tfm_sk);
+		return sk;
+	}
+
+	if (pool_enabled)
+		pool_stats.created++;
+
+	if (!cache) {
+		close(tfm_sk);
+		*out_tfm = tfm_new(&match, -1);
+		return sk;
+	}
+
+	pool_trim(pool_stats.max_sockets - 1);
+
+	if (!pool)
+		pool = l_queue_new();
+
+	tfm = tfm_new(&match, tfm_sk);
+	l_queue_push_head(pool, tfm);
+	pool_stats.cached_sockets++;
+
+	*out_tfm = _alg_tfm_ref(tfm);
+	return sk;
+}
+
+/*
+ * Return an operation socket.  It is kept for the next user only if
+ * the caller says it carries no state from the previous one, e.g. no
+ * unread digest or chained IV.
+ */
+void _alg_pool_put(struct alg_tfm *tfm, int sk, bool reusable)
+{
+	if (unlikely(!tfm))
+		return;
+
+	if (reusable && pool_enabled && tfm->sk >= 0 &&
+			pool_stats.cached_sockets < pool_stats.max_sockets) {
+		if (tfm->n_idle == tfm->idle_size) {
+			tfm->idle_size = tfm->idle_size ? tfm->idle_size * 2 : 2;
+			tfm->idle = l_realloc(tfm->idle,
+					tfm->idle_size * sizeof(int));
+		}
+
+		tfm->idle[tfm->n_idle++] = sk;
+		pool_stats.cached_sockets++;
+	} else
+		close(sk);
+
+	tfm_unref(tfm);
+}
+
+/* For operation sockets accept()ed from another, e.g. hash clones */
+struct alg_tfm *_alg_tfm_ref(struct alg_tfm *tfm)
+{
+	if (unlikely(!tfm))
+		return NULL;
+
+	__atomic_add_fetch(&tfm->ref_count, 1, __ATOMIC_RELAXED);
+	return tfm;
+}
+
+void _alg_pool_set_enabled(bool enabled)
+{
+	if (!enabled)
+		l_alg_pool_flush();
+
+	pool_enabled = enabled;
+}
+
+/**
+ * l_alg_pool_set_max:
+ * @max: maximum number of idle sockets
+ *
+ * Sets how many AF_ALG sockets, transforms included, the main loop
+ * thread keeps open while no #l_checksum or #l_cipher uses them.  A
+ * @max of 0 turns the pool off.  The default is 16.
+ **/
+LIB_EXPORT void l_alg_pool_set_max(unsigned int max)
+{
+	pool_stats.max_sockets = max;
+
+	if (pool_enabled)
+		pool_trim(max);
+}
+
+/**
+ * l_alg_pool_set_keyed:
+ * @enabled: whether to pool keyed transforms
+ *
+ * Keyed transforms, such as HMACs and ciphers, are not pooled by
+ * default since the kernel then keeps the key for as long as the pool
+ * holds the transform.  Enabling this lets objects created with the
+ * same algorithm and key share one transform.  Disabling it closes the
+ * keyed transforms already pooled.
+ **/
+LIB_EXPORT void l_alg_pool_set_keyed(bool enabled)
+{
+	pool_keyed = enabled;
+
+	if (!enabled && pool_enabled)
+		l_queue_foreach_remove(pool, tfm_evict_keyed, NULL);
+}
+
+/**
+ * l_alg_pool_get_stats:
+ * @stats: statistics to fill in
+ *
+ * Obtain AF_ALG pool statistics gathered since the process started.
+ * @created counts new transforms, @accepted operation sockets opened
+ * on a pooled transform and @reused idle operation sockets handed out
+ * again.
+ *
+ * Returns: #true on success or #false if not called on the main loop
+ * thread
+ **/
+LIB_EXPORT bool l_alg_pool_get_stats(struct l_alg_pool_stats *stats)
+{
+	if (unlikely(!stats) || !pool_enabled)
+		return false;
+
+	*stats = pool_stats;
+	return true;
+}
+
+/**
+ * l_alg_pool_flush:
+ *
+ * Closes every pooled socket.  Transforms still in use are closed once
+ * their user frees them.  l_main_exit does this implicitly.
+ **/
+LIB_EXPORT void l_alg_pool_flush(void)
+{
+	if (!pool_enabled)
+		return;
+
+	pool_trim(0);
+
+	l_queue_destroy(pool, NULL);
+	pool = NULL;
+}
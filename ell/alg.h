@@ -0,0 +1,52 @@
+/*
+ *
+ *  Embedded Linux library
+ *
+ *  Copyright (C) 2019  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+
+#ifndef __ELL_ALG_H
+#define __ELL_ALG_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+struct l_alg_pool_stats {
+	unsigned int max_sockets;
+	unsigned int cached_sockets;
+	uint64_t reused;
+	uint64_t accepted;
+	uint64_t created;
+	uint64_t evicted;
+};
+
+void l_alg_pool_set_max(unsigned int max);
+void l_alg_pool_set_keyed(bool enabled);
+bool l_alg_pool_get_stats(struct l_alg_pool_stats *stats);
+void l_alg_pool_flush(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __ELL_ALG_H */
@@ -34,6 +34,9 @@
 #include "util.h"
 #include "checksum.h"
 #include "private.h"
+#include "digest-private.h"
+#include "alg-private.h"
+#include "checksum-private.h"
 
 #ifndef HAVE_LINUX_IF_ALG_H
 #ifndef HAVE_LINUX_TYPES_H
@@ -57,17 +60,10 @@ struct sockaddr_alg {
 	__u8	salg_name[64];
 };
 
-/* Socket options */
-#define ALG_SET_KEY	1
-
 #else
 #include <linux/if_alg.h>
 #endif
 
-#ifndef SOL_ALG
-#define SOL_ALG 279
-#endif
-
 struct checksum_info {
 	const char *name;
 	uint8_t digest_len;
@@ -78,6 +74,7 @@ static struct checksum_info checksum_algs[] = {
 	[L_CHECKSUM_MD4] = { .name = "md4", .digest_len = 16 },
 	[L_CHECKSUM_MD5] = { .name = "md5", .digest_len = 16 },
 	[L_CHECKSUM_SHA1] = { .name = "sha1", .digest_len = 20 },
+	[L_CHECKSUM_SHA224] = { .name = "sha224", .digest_len = 28 },
 	[L_CHECKSUM_SHA256] = { .name = "sha256", .digest_len = 32 },
 	[L_CHECKSUM_SHA384] = { .name = "sha384", .digest_len = 48 },
 	[L_CHECKSUM_SHA512] = { .name = "sha512", .digest_len = 64 },
@@ -90,6 +87,7 @@ static struct checksum_info checksum_hmac_algs[] = {
 	[L_CHECKSUM_MD4] = { .name = "hmac(md4)", .digest_len = 16 },
 	[L_CHECKSUM_MD5] = { .name = "hmac(md5)", .digest_len = 16 },
 	[L_CHECKSUM_SHA1] = { .name = "hmac(sha1)", .digest_len = 20 },
+	[L_CHECKSUM_SHA224] = { .name = "hmac(sha224)", .digest_len = 28 },
 	[L_CHECKSUM_SHA256] = { .name = "hmac(sha256)", .digest_len = 32 },
 	[L_CHECKSUM_SHA384] = { .name = "hmac(sha384)", .digest_len = 48 },
 	[L_CHECKSUM_SHA512] = { .name = "hmac(sha512)", .digest_len = 64 },
@@ -121,31 +119,22 @@ static const struct {
  */
 struct l_checksum {
 	int sk;
+	struct alg_tfm *tfm;
+	bool dirty;		/* The socket holds state, don't pool it */
 	const struct checksum_info *alg_info;
+	/*
+	 * Hashes and HMACs that digest.c implements are computed
+	 * in-process, sk is -1 then.  This saves the socket setup and a
+	 * syscall per update, and makes clones a plain copy.
+	 */
+	enum l_checksum_type type;
+	bool hmac;
+	union {
+		struct digest_ctx digest;
+		struct hmac_ctx hmac_ctx;
+	};
 };
 
-static int create_alg(const char *alg)
-{
-	struct sockaddr_alg salg;
-	int sk;
-
-	sk = socket(PF_ALG, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
-	if (sk < 0)
-		return -1;
-
-	memset(&salg, 0, sizeof(salg));
-	salg.salg_family = AF_ALG;
-	strcpy((char *) salg.salg_type, "hash");
-	strcpy((char *) salg.salg_name, alg);
-
-	if (bind(sk, (struct sockaddr *) &salg, sizeof(salg)) < 0) {
-		close(sk);
-		return -1;
-	}
-
-	return sk;
-}
-
 /**
  * l_checksum_new:
  * @type: checksum type
@@ -157,50 +146,37 @@ static int create_alg(const char *alg)
 LIB_EXPORT struct l_checksum *l_checksum_new(enum l_checksum_type type)
 {
 	struct l_checksum *checksum;
-	int fd;
 
 	if (!is_valid_index(checksum_algs, type) || !checksum_algs[type].name)
 		return NULL;
 
 	checksum = l_new(struct l_checksum, 1);
 	checksum->alg_info = &checksum_algs[type];
+	checksum->type = type;
 
-	fd = create_alg(checksum->alg_info->name);
-	if (fd < 0)
-		goto error;
-
-	checksum->sk = accept4(fd, NULL, 0, SOCK_CLOEXEC);
-	close(fd);
+	if (_digest_init(&checksum->digest, type)) {
+		checksum->sk = -1;
+		return checksum;
+	}
 
-	if (checksum->sk < 0)
-		goto error;
+	checksum->sk = _alg_pool_get("hash", checksum->alg_info->name,
+					NULL, 0, 0, true, &checksum->tfm);
+	if (checksum->sk < 0) {
+		l_free(checksum);
+		return NULL;
+	}
 
 	return checksum;
-
-error:
-	l_free(checksum);
-	return NULL;
 }
 
 LIB_EXPORT struct l_checksum *l_checksum_new_cmac_aes(const void *key,
 							size_t key_len)
 {
 	struct l_checksum *checksum;
-	int fd;
-
-	fd = create_alg("cmac(aes)");
-	if (fd < 0)
-		return NULL;
-
-	if (setsockopt(fd, SOL_ALG, ALG_SET_KEY, key, key_len) < 0) {
-		close(fd);
-		return NULL;
-	}
 
 	checksum = l_new(struct l_checksum, 1);
-	checksum->sk = accept4(fd, NULL, 0, SOCK_CLOEXEC);
-	close(fd);
-
+	checksum->sk = _alg_pool_get("hash", "cmac(aes)", key, key_len, 0,
+					true, &checksum->tfm);
 	if (checksum->sk < 0) {
 		l_free(checksum);
 		return NULL;
@@ -210,29 +186,29 @@ LIB_EXPORT struct l_checksum *l_checksum_new_cmac_aes(const void *key,
 	return checksum;
 }
 
-LIB_EXPORT struct l_checksum *l_checksum_new_hmac(enum l_checksum_type type,
-					  const void *key, size_t key_len)
+static struct l_checksum *checksum_new_hmac(enum l_checksum_type type,
+					const void *key, size_t key_len,
+					bool in_process)
 {
 	struct l_checksum *checksum;
-	int fd;
 
 	if (!is_valid_index(checksum_hmac_algs, type) ||
 			!checksum_hmac_algs[type].name)
 		return NULL;
 
-	fd = create_alg(checksum_hmac_algs[type].name);
-	if (fd < 0)
-		return NULL;
-
-	if (setsockopt(fd, SOL_ALG, ALG_SET_KEY, key, key_len) < 0) {
-		close(fd);
-		return NULL;
+	if (in_process && _digest_supported(type)) {
+		checksum = l_new(struct l_checksum, 1);
+		checksum->sk = -1;
+		checksum->alg_info = &checksum_hmac_algs[type];
+		checksum->type = type;
+		checksum->hmac = true;
+		_hmac_init(&checksum->hmac_ctx, type, key, key_len);
+		return checksum;
 	}
 
 	checksum = l_new(struct l_checksum, 1);
-	checksum->sk = accept4(fd, NULL, 0, SOCK_CLOEXEC);
-	close(fd);
-
+	checksum->sk = _alg_pool_get("hash", checksum_hmac_algs[type].name,
+					key, key_len, 0, true, &checksum->tfm);
 	if (checksum->sk < 0) {
 		l_free(checksum);
 		return NULL;
@@ -242,6 +218,18 @@ LIB_EXPORT struct l_checksum *l_checksum_new_hmac(enum l_checksum_type type,
 	return checksum;
 }
 
+LIB_EXPORT struct l_checksum *l_checksum_new_hmac(enum l_checksum_type type,
+					  const void *key, size_t key_len)
+{
+	return checksum_new_hmac(type, key, key_len, true);
+}
+
+struct l_checksum *_checksum_new_hmac_kernel(enum l_checksum_type type,
+					const void *key, size_t key_len)
+{
+	return checksum_new_hmac(type, key, key_len, false);
+}
+
 /**
  * l_checksum_clone:
  * @checksum: parent checksum object
@@ -257,6 +245,9 @@ LIB_EXPORT struct l_checksum *l_checksum_clone(struct l_checksum *checksum)
 	if (unlikely(!checksum))
 		return NULL;
 
+	if (checksum->sk < 0)
+		return l_memdup(checksum, sizeof(*checksum));
+
 	clone = l_new(struct l_checksum, 1);
 	clone->sk = accept4(checksum->sk, NULL, 0, SOCK_CLOEXEC);
 
@@ -265,6 +256,8 @@ LIB_EXPORT struct l_checksum *l_checksum_clone(struct l_checksum *checksum)
 		return NULL;
 	}
 
+	clone->tfm = _alg_tfm_ref(checksum->tfm);
+	clone->dirty = checksum->dirty;
 	clone->alg_info = checksum->alg_info;
 	return clone;
 }
@@ -280,7 +273,10 @@ LIB_EXPORT void l_checksum_free(struct l_checksum *checksum)
 	if (unlikely(!checksum))
 		return;
 
-	close(checksum->sk);
+	if (checksum->sk >= 0)
+		_alg_pool_put(checksum->tfm, checksum->sk, !checksum->dirty);
+
+	explicit_bzero(checksum, sizeof(*checksum));
 	l_free(checksum);
 }
 
@@ -295,7 +291,22 @@ LIB_EXPORT void l_checksum_reset(struct l_checksum *checksum)
 	if (unlikely(!checksum))
 		return;
 
-	send(checksum->sk, NULL, 0, 0);
+	if (checksum->sk >= 0) {
+		send(checksum->sk, NULL, 0, 0);
+		checksum->dirty = true;
+	} else if (checksum->hmac)
+		_hmac_reset(&checksum->hmac_ctx);
+	else
+		_digest_init(&checksum->digest, checksum->type);
+}
+
+static void checksum_update(struct l_checksum *checksum,
+				const void *data, size_t len)
+{
+	if (checksum->hmac)
+		_hmac_update(&checksum->hmac_ctx, data, len);
+	else
+		_digest_update(&checksum->digest, data, len);
 }
 
 /**
@@ -316,6 +327,13 @@ LIB_EXPORT bool l_checksum_update(struct l_checksum *checksum,
 	if (unlikely(!checksum))
 		return false;
 
+	if (checksum->sk < 0) {
+		checksum_update(checksum, data, len);
+		return true;
+	}
+
+	checksum->dirty = true;
+
 	written = send(checksum->sk, data, len, MSG_MORE);
 	if (written < 0)
 		return false;
@@ -346,10 +364,22 @@ LIB_EXPORT bool l_checksum_updatev(struct l_checksum *checksum,
 	if (unlikely(!iov) || unlikely(!iov_len))
 		return false;
 
+	if (checksum->sk < 0) {
+		size_t i;
+
+		for (i = 0; i < iov_len; i++)
+			checksum_update(checksum, iov[i].iov_base,
+							iov[i].iov_len);
+
+		return true;
+	}
+
 	memset(&msg, 0, sizeof(msg));
 	msg.msg_iov = (struct iovec *) iov;
 	msg.msg_iovlen = iov_len;
 
+	checksum->dirty = true;
+
 	written = sendmsg(checksum->sk, &msg, MSG_MORE);
 	if (written < 0)
 		return false;
@@ -383,10 +413,32 @@ LIB_EXPORT ssize_t l_checksum_get_digest(struct l_checksum *checksum,
 	if (unlikely(!len))
 		return -EINVAL;
 
+	if (checksum->sk < 0) {
+		uint8_t buf[DIGEST_MAX_LEN];
+
+		/* Like the kernel, start over with a fresh state */
+		if (checksum->hmac)
+			_hmac_final(&checksum->hmac_ctx, buf);
+		else {
+			_digest_final(&checksum->digest, buf);
+			_digest_init(&checksum->digest, checksum->type);
+		}
+
+		if (len > checksum->alg_info->digest_len)
+			len = checksum->alg_info->digest_len;
+
+		memcpy(digest, buf, len);
+		explicit_bzero(buf, sizeof(buf));
+
+		return len;
+	}
+
 	result = recv(checksum->sk, digest, len, 0);
 	if (result < 0)
 		return -errno;
 
+	checksum->dirty = false;
+
 	if ((size_t) result < len && result < checksum->alg_info->digest_len)
 		return -EIO;
 
@@ -413,6 +465,58 @@ LIB_EXPORT char *l_checksum_get_string(struct l_checksum *checksum)
 	return l_util_hexstring(digest, checksum->alg_info->digest_len);
 }
 
+/**
+ * l_checksum_digest_many:
+ * @type: checksum type
+ * @msgs: messages to hash
+ * @count: number of messages
+ * @digests: output buffer for @count digests
+ *
+ * Hashes @count independent messages with the algorithm @type, writing
+ * their digests one after another into @digests, each one
+ * l_checksum_digest_length bytes long.  SHA-1, SHA-224 and SHA-256
+ * process several messages at once, which is considerably faster than
+ * one #l_checksum per message when the messages are short.
+ *
+ * Returns: true on success, false if @type isn't supported.
+ **/
+LIB_EXPORT bool l_checksum_digest_many(enum l_checksum_type type,
+					const struct iovec *msgs, size_t count,
+					void *digests)
+{
+	struct l_checksum *checksum;
+	ssize_t digest_len;
+	uint8_t *out = digests;
+	size_t i;
+
+	if (unlikely(!msgs && count) || unlikely(!digests && count))
+		return false;
+
+	if (_digest_many(type, msgs, count, digests))
+		return true;
+
+	checksum = l_checksum_new(type);
+	if (!checksum)
+		return false;
+
+	digest_len = checksum->alg_info->digest_len;
+
+	for (i = 0; i < count; i++) {
+		if (!l_checksum_update(checksum, msgs[i].iov_base,
+						msgs[i].iov_len) ||
+				l_checksum_get_digest(checksum, out,
+						digest_len) != digest_len) {
+			l_checksum_free(checksum);
+			return false;
+		}
+
+		out += digest_len;
+	}
+
+	l_checksum_free(checksum);
+	return true;
+}
+
 static void init_supported()
 {
 	static bool initialized = false;
@@ -453,8 +557,8 @@ static void init_supported()
 	close(sk);
 }
 
-LIB_EXPORT bool l_checksum_is_supported(enum l_checksum_type type,
-							bool check_hmac)
+
+bool _checksum_kernel_supported(enum l_checksum_type type, bool check_hmac)
 {
 	const struct checksum_info *list;
 
@@ -475,6 +579,15 @@ LIB_EXPORT bool l_checksum_is_supported(enum l_checksum_type type,
 	return list[type].supported;
 }
 
+LIB_EXPORT bool l_checksum_is_supported(enum l_checksum_type type,
+							bool check_hmac)
+{
+	if (_digest_supported(type))
+		return true;
+
+	return _checksum_kernel_supported(type, check_hmac);
+}
+
 LIB_EXPORT bool l_checksum_cmac_aes_supported()
 {
 	init_supported();
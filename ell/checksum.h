@@ -63,6 +63,10 @@ ssize_t l_checksum_get_digest(struct l_checksum *checksum,
 					void *digest, size_t len);
 char *l_checksum_get_string(struct l_checksum *checksum);
 
+bool l_checksum_digest_many(enum l_checksum_type type,
+				const struct iovec *msgs, size_t count,
+				void *digests);
+
 bool l_checksum_is_supported(enum l_checksum_type type, bool check_hmac);
 bool l_checksum_cmac_aes_supported();
 
@@ -34,6 +34,7 @@
 #include "cipher.h"
 #include "private.h"
 #include "random.h"
+#include "alg-private.h"
 
 #ifndef HAVE_LINUX_IF_ALG_H
 #ifndef HAVE_LINUX_TYPES_H
@@ -82,10 +83,6 @@ struct af_alg_iv {
 #define ALG_SET_AEAD_ASSOCLEN	4
 #endif
 
-#ifndef ALG_SET_AEAD_AUTHSIZE
-#define ALG_SET_AEAD_AUTHSIZE	5
-#endif
-
 #define is_valid_type(type)  ((type) <= L_CIPHER_DES3_EDE_CBC)
 
 static uint32_t supported_ciphers;
@@ -95,52 +92,20 @@ struct l_cipher {
 	int type;
 	int encrypt_sk;
 	int decrypt_sk;
+	struct alg_tfm *encrypt_tfm;
+	struct alg_tfm *decrypt_tfm;
+	bool reusable;		/* No IV or queued data left in the sockets */
 };
 
 struct l_aead_cipher {
 	int type;
 	int encrypt_sk;
 	int decrypt_sk;
+	struct alg_tfm *encrypt_tfm;
+	struct alg_tfm *decrypt_tfm;
+	bool reusable;
 };
 
-static int create_alg(const char *alg_type, const char *alg_name,
-			const void *key, size_t key_length, size_t tag_length)
-{
-	struct sockaddr_alg salg;
-	int sk;
-	int ret;
-
-	sk = socket(PF_ALG, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
-	if (sk < 0)
-		return -errno;
-
-	memset(&salg, 0, sizeof(salg));
-	salg.salg_family = AF_ALG;
-	strcpy((char *) salg.salg_type, alg_type);
-	strcpy((char *) salg.salg_name, alg_name);
-
-	if (bind(sk, (struct sockaddr *) &salg, sizeof(salg)) < 0) {
-		close(sk);
-		return -1;
-	}
-
-	if (setsockopt(sk, SOL_ALG, ALG_SET_KEY, key, key_length) < 0) {
-		close(sk);
-		return -1;
-	}
-
-	if (tag_length && setsockopt(sk, SOL_ALG, ALG_SET_AEAD_AUTHSIZE, NULL,
-					tag_length)) {
-		close(sk);
-		return -1;
-	}
-
-	ret = accept4(sk, NULL, 0, SOCK_CLOEXEC);
-	close(sk);
-
-	return ret;
-}
-
 static const char *cipher_type_to_name(enum l_cipher_type type)
 {
 	switch (type) {
@@ -167,6 +132,7 @@ LIB_EXPORT struct l_cipher *l_cipher_new(enum l_cipher_type type,
 {
 	struct l_cipher *cipher;
 	const char *uninitialized_var(alg_name);
+	bool shared;
 
 	if (unlikely(!key))
 		return NULL;
@@ -178,20 +144,28 @@ LIB_EXPORT struct l_cipher *l_cipher_new(enum l_cipher_type type,
 	cipher->type = type;
 	alg_name = cipher_type_to_name(type);
 
-	cipher->encrypt_sk = create_alg("skcipher", alg_name, key, key_length,
-					0);
+	/* ARC4 keeps its keystream in the transform, it can't be shared */
+	shared = type != L_CIPHER_ARC4;
+
+	/* Only ECB sockets come out of an operation without IV state */
+	cipher->reusable = type == L_CIPHER_AES || type == L_CIPHER_DES;
+
+	cipher->encrypt_sk = _alg_pool_get("skcipher", alg_name,
+						key, key_length, 0, shared,
+						&cipher->encrypt_tfm);
 	if (cipher->encrypt_sk < 0)
 		goto error_free;
 
-	cipher->decrypt_sk = create_alg("skcipher", alg_name, key, key_length,
-					0);
+	cipher->decrypt_sk = _alg_pool_get("skcipher", alg_name,
+						key, key_length, 0, shared,
+						&cipher->decrypt_tfm);
 	if (cipher->decrypt_sk < 0)
 		goto error_close;
 
 	return cipher;
 
 error_close:
-	close(cipher->encrypt_sk);
+	_alg_pool_put(cipher->encrypt_tfm, cipher->encrypt_sk, false);
 error_free:
 	l_free(cipher);
 	return NULL;
@@ -225,22 +199,25 @@ LIB_EXPORT struct l_aead_cipher *l_aead_cipher_new(enum l_aead_cipher_type type,
 
 	cipher = l_new(struct l_aead_cipher, 1);
 	cipher->type = type;
+	cipher->reusable = true;
 	alg_name = aead_cipher_type_to_name(type);
 
-	cipher->encrypt_sk = create_alg("aead", alg_name, key, key_length,
-					tag_length);
+	cipher->encrypt_sk = _alg_pool_get("aead", alg_name, key, key_length,
+						tag_length, true,
+						&cipher->encrypt_tfm);
 	if (cipher->encrypt_sk < 0)
 		goto error_free;
 
-	cipher->decrypt_sk = create_alg("aead", alg_name, key, key_length,
-					tag_length);
+	cipher->decrypt_sk = _alg_pool_get("aead", alg_name, key, key_length,
+						tag_length, true,
+						&cipher->decrypt_tfm);
 	if (cipher->decrypt_sk < 0)
 		goto error_close;
 
 	return cipher;
 
 error_close:
-	close(cipher->encrypt_sk);
+	_alg_pool_put(cipher->encrypt_tfm, cipher->encrypt_sk, false);
 error_free:
 	l_free(cipher);
 	return NULL;
@@ -251,8 +228,10 @@ LIB_EXPORT void l_cipher_free(struct l_cipher *cipher)
 	if (unlikely(!cipher))
 		return;
 
-	close(cipher->encrypt_sk);
-	close(cipher->decrypt_sk);
+	_alg_pool_put(cipher->encrypt_tfm, cipher->encrypt_sk,
+							cipher->reusable);
+	_alg_pool_put(cipher->decrypt_tfm, cipher->decrypt_sk,
+							cipher->reusable);
 
 	l_free(cipher);
 }
@@ -262,8 +241,10 @@ LIB_EXPORT void l_aead_cipher_free(struct l_aead_cipher *cipher)
 	if (unlikely(!cipher))
 		return;
 
-	close(cipher->encrypt_sk);
-	close(cipher->decrypt_sk);
+	_alg_pool_put(cipher->encrypt_tfm, cipher->encrypt_sk,
+							cipher->reusable);
+	_alg_pool_put(cipher->decrypt_tfm, cipher->decrypt_sk,
+							cipher->reusable);
 
 	l_free(cipher);
 }
@@ -426,8 +407,13 @@ LIB_EXPORT bool l_cipher_encrypt(struct l_cipher *cipher,
 	if (unlikely(!in) || unlikely(!out))
 		return false;
 
-	return operate_cipher(cipher->encrypt_sk, ALG_OP_ENCRYPT, in, len,
-				NULL, 0, NULL, 0, out, len) >= 0;
+	if (operate_cipher(cipher->encrypt_sk, ALG_OP_ENCRYPT, in, len,
+				NULL, 0, NULL, 0, out, len) < 0) {
+		cipher->reusable = false;
+		return false;
+	}
+
+	return true;
 }
 
 LIB_EXPORT bool l_cipher_encryptv(struct l_cipher *cipher,
@@ -440,8 +426,13 @@ LIB_EXPORT bool l_cipher_encryptv(struct l_cipher *cipher,
 	if (unlikely(!in) || unlikely(!out))
 		return false;
 
-	return operate_cipherv(cipher->encrypt_sk, ALG_OP_ENCRYPT, in, in_cnt,
-				out, out_cnt) >= 0;
+	if (operate_cipherv(cipher->encrypt_sk, ALG_OP_ENCRYPT, in, in_cnt,
+				out, out_cnt) < 0) {
+		cipher->reusable = false;
+		return false;
+	}
+
+	return true;
 }
 
 LIB_EXPORT bool l_cipher_decrypt(struct l_cipher *cipher,
@@ -453,8 +444,13 @@ LIB_EXPORT bool l_cipher_decrypt(struct l_cipher *cipher,
 	if (unlikely(!in) || unlikely(!out))
 		return false;
 
-	return operate_cipher(cipher->decrypt_sk, ALG_OP_DECRYPT, in, len,
-				NULL, 0, NULL, 0, out, len) >= 0;
+	if (operate_cipher(cipher->decrypt_sk, ALG_OP_DECRYPT, in, len,
+				NULL, 0, NULL, 0, out, len) < 0) {
+		cipher->reusable = false;
+		return false;
+	}
+
+	return true;
 }
 
 LIB_EXPORT bool l_cipher_decryptv(struct l_cipher *cipher,
@@ -467,8 +463,13 @@ LIB_EXPORT bool l_cipher_decryptv(struct l_cipher *cipher,
 	if (unlikely(!in) || unlikely(!out))
 		return false;
 
-	return operate_cipherv(cipher->decrypt_sk, ALG_OP_DECRYPT, in, in_cnt,
-				out, out_cnt) >= 0;
+	if (operate_cipherv(cipher->decrypt_sk, ALG_OP_DECRYPT, in, in_cnt,
+				out, out_cnt) < 0) {
+		cipher->reusable = false;
+		return false;
+	}
+
+	return true;
 }
 
 LIB_EXPORT bool l_cipher_set_iv(struct l_cipher *cipher, const uint8_t *iv,
@@ -568,9 +569,14 @@ LIB_EXPORT bool l_aead_cipher_encrypt(struct l_aead_cipher *cipher,
 		iv_len = nonce_len;
 	}
 
-	return operate_cipher(cipher->encrypt_sk, ALG_OP_ENCRYPT, in, in_len,
-				ad, ad_len, iv, iv_len, out, out_len) ==
-			(ssize_t)out_len;
+	if (operate_cipher(cipher->encrypt_sk, ALG_OP_ENCRYPT, in, in_len,
+				ad, ad_len, iv, iv_len, out, out_len) !=
+			(ssize_t)out_len) {
+		cipher->reusable = false;
+		return false;
+	}
+
+	return true;
 }
 
 LIB_EXPORT bool l_aead_cipher_decrypt(struct l_aead_cipher *cipher,
@@ -603,9 +609,14 @@ LIB_EXPORT bool l_aead_cipher_decrypt(struct l_aead_cipher *cipher,
 		iv_len = nonce_len;
 	}
 
-	return operate_cipher(cipher->decrypt_sk, ALG_OP_DECRYPT, in, in_len,
-				ad, ad_len, iv, iv_len, out, out_len) ==
-			(ssize_t)out_len;
+	if (operate_cipher(cipher->decrypt_sk, ALG_OP_DECRYPT, in, in_len,
+				ad, ad_len, iv, iv_len, out, out_len) !=
+			(ssize_t)out_len) {
+		cipher->reusable = false;
+		return false;
+	}
+
+	return true;
 }
 
 static void init_supported()
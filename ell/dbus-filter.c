@@ -39,12 +39,17 @@
 
 #define NODE_TYPE_CALLBACK	L_DBUS_MATCH_NONE
 
+#define FILTER_MAX_ARGS		64
+
+struct filter_level;
+
 struct filter_node {
 	enum l_dbus_match_type type;
 	union {
 		struct {
 			char *value;
-			struct filter_node *children;
+			struct filter_node *callbacks;
+			struct filter_level *levels;
 			bool remote_rule;
 		} match;
 		struct {
@@ -53,63 +58,101 @@ struct filter_node {
 		} callback;
 	};
 	unsigned int id;
+	struct filter_node *parent;
 	struct filter_node *next;
 };
 
+/*
+ * The children of a match node that test the same header field or
+ * argument, indexed by the value they match.  Senders given as
+ * well-known names are also listed separately as their unique name
+ * has to be looked up for every message.
+ */
+struct filter_level {
+	enum l_dbus_match_type type;
+	struct l_hashmap *values;
+	struct l_queue *names;
+	struct filter_level *next;
+};
+
 struct _dbus_filter {
 	struct l_dbus *dbus;
 	struct filter_node *root;
+	struct l_hashmap *callbacks;
 	unsigned int signal_id;
 	unsigned int last_id;
+	unsigned int max_arg;
 	const struct _dbus_filter_ops *driver;
 	struct _dbus_name_cache *name_cache;
 };
 
-static void filter_subtree_free(struct filter_node *node)
+/* Values of the message being dispatched, each looked up at most once */
+struct filter_dispatch {
+	struct _dbus_filter *filter;
+	struct l_dbus_message *message;
+	const char *header[L_DBUS_MATCH_ARG0];
+	bool header_done[L_DBUS_MATCH_ARG0];
+	bool args_done;
+	const char *args[FILTER_MAX_ARGS];
+};
+
+static void filter_subtree_free(void *data)
 {
-	struct filter_node *child, *next;
+	struct filter_node *node = data;
+	struct filter_node *callback;
+	struct filter_level *level;
 
-	if (node->type == NODE_TYPE_CALLBACK) {
-		l_free(node);
-		return;
+	while ((callback = node->match.callbacks)) {
+		node->match.callbacks = callback->next;
+		l_free(callback);
 	}
 
-	next = node->match.children;
+	while ((level = node->match.levels)) {
+		node->match.levels = level->next;
+
+		l_queue_destroy(level->names, NULL);
+		l_hashmap_destroy(level->values, filter_subtree_free);
+		l_free(level);
+	}
 
 	l_free(node->match.value);
 	l_free(node);
-
-	while (next) {
-		child = next;
-		next = child->next;
-
-		filter_subtree_free(child);
-	}
 }
 
 static void dbus_filter_destroy(void *data)
 {
 	struct _dbus_filter *filter = data;
 
-	if (filter->root)
-		filter_subtree_free(filter->root);
+	filter_subtree_free(filter->root);
+	l_hashmap_destroy(filter->callbacks, NULL);
 
 	l_free(filter);
 }
 
-static void filter_dispatch_match_recurse(struct _dbus_filter *filter,
-						struct filter_node *node,
-						struct l_dbus_message *message)
+static const char *filter_dispatch_value(struct filter_dispatch *dispatch,
+						enum l_dbus_match_type type)
 {
+	struct l_dbus_message *message = dispatch->message;
 	const char *value = NULL;
-	const char *alt_value = NULL;
-	struct filter_node *child;
 
-	switch ((int) node->type) {
-	case NODE_TYPE_CALLBACK:
-		node->callback.func(message, node->callback.user_data);
-		return;
+	if (type >= L_DBUS_MATCH_ARG0) {
+		if (!dispatch->args_done) {
+			if (!_dbus_message_get_string_arguments(message,
+						dispatch->args,
+						dispatch->filter->max_arg + 1))
+				memset(dispatch->args, 0,
+						sizeof(dispatch->args));
+
+			dispatch->args_done = true;
+		}
 
+		return dispatch->args[type - L_DBUS_MATCH_ARG0];
+	}
+
+	if (dispatch->header_done[type])
+		return dispatch->header[type];
+
+	switch ((int) type) {
 	case L_DBUS_MATCH_SENDER:
 		value = l_dbus_message_get_sender(message);
 		break;
@@ -129,33 +172,60 @@ static void filter_dispatch_match_recurse(struct _dbus_filter *filter,
 	case L_DBUS_MATCH_MEMBER:
 		value = l_dbus_message_get_member(message);
 		break;
-
-	case L_DBUS_MATCH_ARG0...(L_DBUS_MATCH_ARG0 + 63):
-		value = _dbus_message_get_nth_string_argument(message,
-						node->type - L_DBUS_MATCH_ARG0);
-		break;
 	}
 
-	if (!value)
-		return;
+	dispatch->header[type] = value;
+	dispatch->header_done[type] = true;
 
-	if (node->type == L_DBUS_MATCH_SENDER && filter->name_cache)
-		alt_value = _dbus_name_cache_lookup(filter->name_cache,
-							node->match.value);
-
-	if (strcmp(value, node->match.value) &&
-			(!alt_value || strcmp(value, alt_value)))
-		return;
+	return value;
+}
 
-	for (child = node->match.children; child; child = child->next)
-		filter_dispatch_match_recurse(filter, child, message);
+static void filter_dispatch_node(struct filter_dispatch *dispatch,
+					struct filter_node *node)
+{
+	struct _dbus_filter *filter = dispatch->filter;
+	struct filter_node *child;
+	struct filter_level *level;
+	const struct l_queue_entry *entry;
+	const char *value, *alt_value;
+
+	for (child = node->match.callbacks; child; child = child->next)
+		child->callback.func(dispatch->message,
+					child->callback.user_data);
+
+	for (level = node->match.levels; level; level = level->next) {
+		value = filter_dispatch_value(dispatch, level->type);
+		if (!value)
+			continue;
+
+		child = l_hashmap_lookup(level->values, value);
+		if (child)
+			filter_dispatch_node(dispatch, child);
+
+		for (entry = l_queue_get_entries(level->names); entry;
+							entry = entry->next) {
+			struct filter_node *named = entry->data;
+
+			if (named == child)
+				continue;
+
+			alt_value = _dbus_name_cache_lookup(filter->name_cache,
+							named->match.value);
+			if (alt_value && !strcmp(value, alt_value))
+				filter_dispatch_node(dispatch, named);
+		}
+	}
 }
 
 void _dbus_filter_dispatch(struct l_dbus_message *message, void *user_data)
 {
-	struct _dbus_filter *filter = user_data;
+	struct filter_dispatch dispatch;
+
+	memset(&dispatch, 0, offsetof(struct filter_dispatch, args));
+	dispatch.filter = user_data;
+	dispatch.message = message;
 
-	filter_dispatch_match_recurse(filter, filter->root, message);
+	filter_dispatch_node(&dispatch, dispatch.filter->root);
 }
 
 struct _dbus_filter *_dbus_filter_new(struct l_dbus *dbus,
@@ -169,6 +239,8 @@ struct _dbus_filter *_dbus_filter_new(struct l_dbus *dbus,
 	filter->dbus = dbus;
 	filter->driver = driver;
 	filter->name_cache = name_cache;
+	filter->root = l_new(struct filter_node, 1);
+	filter->callbacks = l_hashmap_new();
 
 	if (!filter->driver->skip_register)
 		filter->signal_id = l_dbus_register(dbus, _dbus_filter_dispatch,
@@ -196,41 +268,117 @@ static int condition_compare(const void *a, const void *b)
 	return condition_a->type - condition_b->type;
 }
 
-static bool remove_recurse(struct _dbus_filter *filter,
-				struct filter_node **node, unsigned int id)
+static bool is_well_known_sender(struct _dbus_filter *filter,
+					struct filter_node *node)
 {
-	struct filter_node *tmp;
+	return node->type == L_DBUS_MATCH_SENDER && filter->name_cache &&
+			!_dbus_parse_unique_name(node->match.value, NULL);
+}
 
-	for (; *node; node = &(*node)->next) {
-		if ((*node)->type == NODE_TYPE_CALLBACK && (*node)->id == id)
-			break;
+static struct filter_node *filter_child_lookup(struct filter_node *parent,
+						enum l_dbus_match_type type,
+						const char *value)
+{
+	struct filter_level *level;
 
-		if ((*node)->type != NODE_TYPE_CALLBACK &&
-				remove_recurse(filter, &(*node)->match.children,
-						id))
-			break;
+	for (level = parent->match.levels; level; level = level->next)
+		if (level->type == type)
+			return l_hashmap_lookup(level->values, value);
+
+	return NULL;
+}
+
+static void filter_child_add(struct _dbus_filter *filter,
+				struct filter_node *parent,
+				struct filter_node *node)
+{
+	struct filter_level **level_ptr = &parent->match.levels;
+	struct filter_level *level;
+
+	/* Levels are kept sorted by type for a predictable dispatch order */
+	while (*level_ptr && (*level_ptr)->type < node->type)
+		level_ptr = &(*level_ptr)->next;
+
+	level = *level_ptr;
+
+	if (!level || level->type != node->type) {
+		level = l_new(struct filter_level, 1);
+		level->type = node->type;
+		level->values = l_hashmap_string_new();
+		level->next = *level_ptr;
+		*level_ptr = level;
 	}
 
-	if (!*node)
-		return false;
+	l_hashmap_insert(level->values, node->match.value, node);
+	node->parent = parent;
+
+	if (is_well_known_sender(filter, node)) {
+		if (!level->names)
+			level->names = l_queue_new();
+
+		l_queue_push_tail(level->names, node);
+		_dbus_name_cache_add(filter->name_cache, node->match.value);
+	}
+}
+
+static void filter_child_remove(struct _dbus_filter *filter,
+				struct filter_node *node)
+{
+	struct filter_level **level_ptr = &node->parent->match.levels;
+	struct filter_level *level;
 
-	if ((*node)->type == NODE_TYPE_CALLBACK || !(*node)->match.children) {
-		tmp = *node;
-		*node = tmp->next;
+	while ((*level_ptr)->type != node->type)
+		level_ptr = &(*level_ptr)->next;
 
-		if (tmp->match.remote_rule)
-			filter->driver->remove_match(filter->dbus, tmp->id);
+	level = *level_ptr;
 
-		if (tmp->type == L_DBUS_MATCH_SENDER && filter->name_cache &&
-				!_dbus_parse_unique_name(tmp->match.value,
-								NULL))
-			_dbus_name_cache_remove(filter->name_cache,
-						tmp->match.value);
+	l_hashmap_remove(level->values, node->match.value);
 
-		filter_subtree_free(tmp);
+	if (is_well_known_sender(filter, node)) {
+		l_queue_remove(level->names, node);
+		_dbus_name_cache_remove(filter->name_cache, node->match.value);
 	}
 
-	return true;
+	if (!l_hashmap_isempty(level->values))
+		return;
+
+	*level_ptr = level->next;
+
+	l_queue_destroy(level->names, NULL);
+	l_hashmap_destroy(level->values, NULL);
+	l_free(level);
+}
+
+/*
+ * Unlink a callback node and then any match nodes above it that are
+ * left without children, dropping the bus side rules they stood for.
+ */
+static void filter_callback_remove(struct _dbus_filter *filter,
+					struct filter_node *callback)
+{
+	struct filter_node *node = callback->parent;
+	struct filter_node **ptr = &node->match.callbacks;
+
+	while (*ptr != callback)
+		ptr = &(*ptr)->next;
+
+	*ptr = callback->next;
+	l_free(callback);
+
+	while (node != filter->root && !node->match.callbacks &&
+			!node->match.levels) {
+		struct filter_node *parent = node->parent;
+
+		filter_child_remove(filter, node);
+
+		if (node->match.remote_rule)
+			filter->driver->remove_match(filter->dbus, node->id);
+
+		l_free(node->match.value);
+		l_free(node);
+
+		node = parent;
+	}
 }
 
 unsigned int _dbus_filter_add_rule(struct _dbus_filter *filter,
@@ -239,7 +387,6 @@ unsigned int _dbus_filter_add_rule(struct _dbus_filter *filter,
 				l_dbus_message_func_t signal_func,
 				void *user_data)
 {
-	struct filter_node **node_ptr = &filter->root;
 	struct filter_node *node;
 	struct filter_node *parent = filter->root;
 	bool remote_rule = false;
@@ -262,49 +409,33 @@ unsigned int _dbus_filter_add_rule(struct _dbus_filter *filter,
 		 * condition.  Note there could be multiple matches, we're
 		 * happy with the first we can find.
 		 */
-		while (*node_ptr) {
-			node = *node_ptr;
-
-			for (condition = unused; condition < end; condition++) {
-				if (condition->type > node->type) {
-					condition = end;
-					break;
-				}
-
-				if (condition->type < node->type ||
-						condition->type ==
-						L_DBUS_MATCH_NONE)
-					continue;
-
-				if (!strcmp(node->match.value,
-						condition->value))
-					break;
-			}
-
-			if (condition < end)
-				break;
+		node = NULL;
+
+		for (condition = unused; condition < end; condition++) {
+			if (condition->type == L_DBUS_MATCH_NONE)
+				continue;
 
-			node_ptr = &node->next;
+			node = filter_child_lookup(parent, condition->type,
+							condition->value);
+			if (node)
+				break;
 		}
 
 		/* Add a node */
-		if (!*node_ptr) {
+		if (!node) {
 			condition = unused;
 
 			node = l_new(struct filter_node, 1);
 			node->type = condition->type;
 			node->match.value = l_strdup(condition->value);
 
-			*node_ptr = node;
-
-			if (node->type == L_DBUS_MATCH_SENDER &&
-					filter->name_cache &&
-					!_dbus_parse_unique_name(
-							node->match.value,
-							NULL))
-				_dbus_name_cache_add(filter->name_cache,
-							node->match.value);
+			filter_child_add(filter, parent, node);
 
+			if (node->type >= L_DBUS_MATCH_ARG0 &&
+					node->type - L_DBUS_MATCH_ARG0 >
+							filter->max_arg)
+				filter->max_arg = node->type -
+							L_DBUS_MATCH_ARG0;
 		}
 
 		/*
@@ -319,8 +450,6 @@ unsigned int _dbus_filter_add_rule(struct _dbus_filter *filter,
 		while (unused < end && unused[0].type == L_DBUS_MATCH_NONE)
 			unused++;
 
-		node_ptr = &node->match.children;
-
 		parent = node;
 
 		/*
@@ -335,9 +464,10 @@ unsigned int _dbus_filter_add_rule(struct _dbus_filter *filter,
 	node->callback.func = signal_func;
 	node->callback.user_data = user_data;
 	node->id = ++filter->last_id;
-	node->next = *node_ptr;
+	node->parent = parent;
+	node->next = parent->match.callbacks;
 
-	*node_ptr = node;
+	parent->match.callbacks = node;
 
 	if (!remote_rule) {
 		if (!filter->driver->add_match(filter->dbus, node->id,
@@ -348,19 +478,28 @@ unsigned int _dbus_filter_add_rule(struct _dbus_filter *filter,
 		parent->match.remote_rule = true;
 	}
 
+	l_hashmap_insert(filter->callbacks, L_UINT_TO_PTR(node->id), node);
+
 	return node->id;
 
 err:
 	/* Remove all the nodes we may have added */
-	node->id = (unsigned int) -1;
-	remove_recurse(filter, &filter->root, node->id);
+	filter_callback_remove(filter, node);
 
 	return 0;
 }
 
 bool _dbus_filter_remove_rule(struct _dbus_filter *filter, unsigned int id)
 {
-	return remove_recurse(filter, &filter->root, id);
+	struct filter_node *node;
+
+	node = l_hashmap_remove(filter->callbacks, L_UINT_TO_PTR(id));
+	if (!node)
+		return false;
+
+	filter_callback_remove(filter, node);
+
+	return true;
 }
 
 char *_dbus_filter_rule_to_str(const struct _dbus_filter_condition *rule,
@@ -29,6 +29,9 @@
 #include <stdarg.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 
 #include "util.h"
 #include "private.h"
@@ -56,6 +59,35 @@
 
 #define DBUS_MAX_NESTING	32
 
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC		0x0001U
+#define MFD_ALLOW_SEALING	0x0002U
+#endif
+
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS	1033
+#define F_GET_SEALS	1034
+#define F_SEAL_SEAL	0x0001
+#define F_SEAL_SHRINK	0x0002
+#define F_SEAL_GROW	0x0004
+#define F_SEAL_WRITE	0x0008
+#endif
+
+#define MEMFD_BODY_SEALS	(F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE)
+#define MEMFD_BODY_MAGIC	"ELLBODY"
+
+/*
+ * A body moved into a memfd is sent as a single 'h' argument.  The
+ * memfd starts with this header, followed by the original signature
+ * and, at an 8-byte aligned offset, the original body.
+ */
+struct memfd_body {
+	char magic[8];
+	uint64_t body_offset;
+	uint64_t body_size;
+	char signature[];
+} __attribute__ ((packed));
+
 struct l_dbus_message {
 	int refcount;
 	void *header;
@@ -73,9 +105,19 @@ struct l_dbus_message {
 	char *sender;
 	int fds[16];
 	uint32_t num_fds;
+	void *mapping;
+	size_t mapping_size;
+
+	/*
+	 * Sealed messages have their header parsed once, string fields are
+	 * recorded as offsets into the header and 0 marks an absent one.
+	 */
+	uint32_t fields[DBUS_MESSAGE_FIELD_SIGNATURE + 1];
+	uint32_t unix_fds;
 
 	bool sealed : 1;
 	bool signature_free : 1;
+	bool contiguous : 1;
 };
 
 struct l_dbus_message_builder {
@@ -428,18 +470,29 @@ LIB_EXPORT void l_dbus_message_unref(struct l_dbus_message *message)
 		l_free(message->signature);
 
 	l_free(message->header);
-	l_free(message->body);
+
+	if (message->mapping)
+		munmap(message->mapping, message->mapping_size);
+	else if (!message->contiguous)
+		l_free(message->body);
+
 	l_free(message);
 }
 
-const char *_dbus_message_get_nth_string_argument(
-					struct l_dbus_message *message, int n)
+/*
+ * Walk the first @n arguments once, storing each that is a string,
+ * object path or signature in @out and NULL for any other or missing
+ * argument.
+ */
+bool _dbus_message_get_string_arguments(struct l_dbus_message *message,
+					const char **out, unsigned int n)
 {
 	struct l_dbus_message_iter iter;
-	const char *signature, *value;
+	const char *signature;
 	void *body;
 	size_t size;
 	char type;
+	unsigned int i;
 	bool (*skip_entry)(struct l_dbus_message_iter *);
 	bool (*get_basic)(struct l_dbus_message_iter *, char, void *);
 
@@ -447,12 +500,12 @@ const char *_dbus_message_get_nth_string_argument(
 	body = _dbus_message_get_body(message, &size);
 
 	if (!signature)
-		return NULL;
+		return false;
 
 	if (_dbus_message_is_gvariant(message)) {
 		if (!_gvariant_iter_init(&iter, message, signature, NULL,
 						body, size))
-			return NULL;
+			return false;
 
 		skip_entry = _gvariant_iter_skip_entry;
 		get_basic = _gvariant_iter_next_entry_basic;
@@ -463,21 +516,36 @@ const char *_dbus_message_get_nth_string_argument(
 		get_basic = _dbus1_iter_next_entry_basic;
 	}
 
-	while (n--)
-		if (!skip_entry(&iter))
-			return NULL;
+	for (i = 0; i < n; i++) {
+		out[i] = NULL;
 
-	if (!iter.sig_start)
-		return NULL;
+		if (!iter.sig_start || iter.sig_pos >= iter.sig_len)
+			break;
 
-	type = iter.sig_start[iter.sig_pos];
-	if (!strchr("sog", type))
-		return NULL;
+		type = iter.sig_start[iter.sig_pos];
+
+		if (strchr("sog", type)) {
+			if (!get_basic(&iter, type, &out[i]))
+				break;
+		} else if (!skip_entry(&iter))
+			break;
+	}
 
-	if (!get_basic(&iter, type, &value))
+	while (++i < n)
+		out[i] = NULL;
+
+	return true;
+}
+
+const char *_dbus_message_get_nth_string_argument(
+					struct l_dbus_message *message, int n)
+{
+	const char *args[n + 1];
+
+	if (!_dbus_message_get_string_arguments(message, args, n + 1))
 		return NULL;
 
-	return value;
+	return args[n];
 }
 
 static bool message_iter_next_entry_valist(struct l_dbus_message_iter *orig,
@@ -606,18 +674,84 @@ static inline bool message_iter_next_entry(struct l_dbus_message_iter *iter,
 	return result;
 }
 
-static bool get_header_field_from_iter_valist(struct l_dbus_message *message,
-						uint8_t type, char data_type,
-						va_list args)
+static const char header_field_types[] = {
+	[DBUS_MESSAGE_FIELD_PATH] = 'o',
+	[DBUS_MESSAGE_FIELD_INTERFACE] = 's',
+	[DBUS_MESSAGE_FIELD_MEMBER] = 's',
+	[DBUS_MESSAGE_FIELD_ERROR_NAME] = 's',
+	[DBUS_MESSAGE_FIELD_DESTINATION] = 's',
+	[DBUS_MESSAGE_FIELD_SENDER] = 's',
+	[DBUS_MESSAGE_FIELD_SIGNATURE] = 'g',
+};
+
+static bool parse_header_field(struct l_dbus_message *message,
+				uint64_t field_type,
+				struct l_dbus_message_iter *iter,
+				uint32_t *seen)
+{
+	char type = iter->sig_start[iter->sig_pos];
+	const char *str;
+
+	/* Unknown fields must be accepted and ignored */
+	if (field_type > DBUS_MESSAGE_FIELD_UNIX_FDS)
+		return true;
+
+	/* A known field may appear only once */
+	if (*seen & (1U << field_type))
+		return false;
+
+	*seen |= 1U << field_type;
+
+	switch (field_type) {
+	case DBUS_MESSAGE_FIELD_REPLY_SERIAL:
+		if (_dbus_message_is_gvariant(message)) {
+			uint64_t reply_serial;
+
+			if (type != 't' ||
+					!message_iter_next_entry(iter,
+							&reply_serial))
+				return false;
+
+			message->reply_serial = reply_serial;
+			return true;
+		}
+
+		return type == 'u' &&
+			message_iter_next_entry(iter, &message->reply_serial);
+	case DBUS_MESSAGE_FIELD_UNIX_FDS:
+		return type == 'u' &&
+			message_iter_next_entry(iter, &message->unix_fds);
+	default:
+		if (field_type >= L_ARRAY_SIZE(header_field_types) ||
+				!header_field_types[field_type])
+			return true;
+
+		if (type != header_field_types[field_type] ||
+				!message_iter_next_entry(iter, &str))
+			return false;
+
+		message->fields[field_type] = (const uint8_t *) str -
+						(const uint8_t *) message->header;
+		return true;
+	}
+}
+
+/*
+ * Walk the header field array once and remember where every field we
+ * know about is.  A known field that appears twice or has the wrong
+ * type makes the whole header invalid.
+ */
+static bool parse_header_fields(struct l_dbus_message *message)
 {
 	struct l_dbus_message_iter header;
 	struct l_dbus_message_iter array, iter;
 	uint8_t endian, message_type, flags, version;
 	uint32_t body_length, serial;
-	bool found;
+	uint32_t seen = 0;
 
-	if (!message->sealed)
-		return false;
+	memset(message->fields, 0, sizeof(message->fields));
+	message->reply_serial = 0;
+	message->unix_fds = 0;
 
 	if (_dbus_message_is_gvariant(message)) {
 		uint64_t field_type;
@@ -630,10 +764,10 @@ static bool get_header_field_from_iter_valist(struct l_dbus_message *message,
 		if (!_gvariant_iter_enter_array(&header, &array))
 			return false;
 
-		while ((found = message_iter_next_entry(&array,
-							&field_type, &iter)))
-			if (field_type == type)
-				break;
+		while (message_iter_next_entry(&array, &field_type, &iter))
+			if (!parse_header_field(message, field_type, &iter,
+							&seen))
+				return false;
 	} else {
 		uint8_t field_type;
 
@@ -645,33 +779,21 @@ static bool get_header_field_from_iter_valist(struct l_dbus_message *message,
 						&body_length, &serial, &array))
 			return false;
 
-		while ((found = message_iter_next_entry(&array,
-							&field_type, &iter)))
-			if (field_type == type)
-				break;
+		while (message_iter_next_entry(&array, &field_type, &iter))
+			if (!parse_header_field(message, field_type, &iter,
+							&seen))
+				return false;
 	}
 
-	if (!found)
-		return false;
-
-	if (iter.sig_start[iter.sig_pos] != data_type)
-		return false;
-
-	return message_iter_next_entry_valist(&iter, args);
+	return true;
 }
 
-static inline bool get_header_field(struct l_dbus_message *message,
-					uint8_t type, int data_type, ...)
+static inline const char *get_header_string(struct l_dbus_message *message,
+						uint8_t field)
 {
-	va_list args;
-	bool result;
+	uint32_t offset = message->fields[field];
 
-	va_start(args, data_type);
-	result = get_header_field_from_iter_valist(message, type, data_type,
-							args);
-	va_end(args);
-
-	return result;
+	return offset ? (const char *) message->header + offset : NULL;
 }
 
 static bool valid_header(const struct dbus_header *hdr)
@@ -698,18 +820,16 @@ static bool valid_header(const struct dbus_header *hdr)
 unsigned int _dbus_message_unix_fds_from_header(const void *data, size_t size)
 {
 	struct l_dbus_message message;
-	uint32_t unix_fds;
 
+	memset(&message, 0, sizeof(message));
 	message.header = (uint8_t *) data;
 	message.header_size = size;
-	message.body_size = 0;
 	message.sealed = true;
 
-	if (!get_header_field(&message, DBUS_MESSAGE_FIELD_UNIX_FDS,
-				'u', &unix_fds))
+	if (!parse_header_fields(&message))
 		return 0;
 
-	return unix_fds;
+	return message.unix_fds;
 }
 
 struct l_dbus_message *dbus_message_from_blob(const void *data, size_t size,
@@ -777,20 +897,22 @@ struct l_dbus_message *dbus_message_from_blob(const void *data, size_t size,
 
 	message->sealed = true;
 
+	if (!parse_header_fields(message))
+		goto free;
+
 	/* If the field is absent message->signature will remain NULL */
 	if (hdr->version == 1)
-		get_header_field(message, DBUS_MESSAGE_FIELD_SIGNATURE,
-					'g', &message->signature);
+		message->signature = (char *) get_header_string(message,
+						DBUS_MESSAGE_FIELD_SIGNATURE);
 
 	if (num_fds) {
-		uint32_t unix_fds, orig_fds = num_fds;
+		uint32_t orig_fds = num_fds;
 
-		if (!get_header_field(message, DBUS_MESSAGE_FIELD_UNIX_FDS,
-					'u', &unix_fds))
+		if (!message->unix_fds)
 			goto free;
 
-		if (num_fds > unix_fds)
-			num_fds = unix_fds;
+		if (num_fds > message->unix_fds)
+			num_fds = message->unix_fds;
 
 		if (num_fds > L_ARRAY_SIZE(message->fds))
 			num_fds = L_ARRAY_SIZE(message->fds);
@@ -810,18 +932,28 @@ free:
 	return NULL;
 }
 
-struct l_dbus_message *dbus_message_build(void *header, size_t header_size,
-						void *body, size_t body_size,
-						int fds[], uint32_t num_fds)
+/*
+ * Takes ownership of @data, a single allocation holding the header
+ * immediately followed by the body, so that a received message costs
+ * one allocation regardless of how it was read off the wire.
+ *
+ * On entry @num_fds is the number of descriptors available in @fds, on
+ * return it is the number the header claims, which the caller no longer
+ * owns if a message is returned.  Claimed descriptors that do not fit
+ * in the message are closed.
+ */
+struct l_dbus_message *dbus_message_build(void *data, size_t header_size,
+						size_t body_size,
+						int fds[], uint32_t *num_fds)
 {
-	const struct dbus_header *hdr = header;
+	const struct dbus_header *hdr = data;
 	struct l_dbus_message *message;
+	uint32_t available = *num_fds;
 	unsigned int i;
 
-	if (unlikely(header_size < DBUS_HEADER_SIZE))
-		return NULL;
+	*num_fds = 0;
 
-	if (unlikely(!valid_header(hdr)))
+	if (unlikely(header_size < DBUS_HEADER_SIZE))
 		return NULL;
 
 	/*
@@ -835,36 +967,35 @@ struct l_dbus_message *dbus_message_build(void *header, size_t header_size,
 
 	message->refcount = 1;
 	message->header_size = header_size;
-	message->header = header;
+	message->header = data;
 	message->body_size = body_size;
-	message->body = body;
+	message->body = data + header_size;
 	message->sealed = true;
+	message->contiguous = true;
 
-	if (num_fds) {
-		uint32_t unix_fds, orig_fds = num_fds;
-
-		if (!get_header_field(message, DBUS_MESSAGE_FIELD_UNIX_FDS,
-					'u', &unix_fds)) {
-			l_free(message);
-			return NULL;
-		}
+	if (!parse_header_fields(message)) {
+		l_free(message);
+		return NULL;
+	}
 
-		if (num_fds > unix_fds)
-			num_fds = unix_fds;
+	/* Report the claim even for a bad message so its FDs get dropped */
+	*num_fds = message->unix_fds;
 
-		if (num_fds > L_ARRAY_SIZE(message->fds))
-			num_fds = L_ARRAY_SIZE(message->fds);
+	if (unlikely(!valid_header(hdr)) || message->unix_fds > available) {
+		l_free(message);
+		return NULL;
+	}
 
-		for (i = num_fds; i < orig_fds; i++)
-			close(fds[i]);
+	message->num_fds = minsize(message->unix_fds,
+					L_ARRAY_SIZE(message->fds));
+	memcpy(message->fds, fds, message->num_fds * sizeof(int));
 
-		message->num_fds = num_fds;
-		memcpy(message->fds, fds, num_fds * sizeof(int));
-	}
+	for (i = message->num_fds; i < message->unix_fds; i++)
+		close(fds[i]);
 
 	/* If the field is absent message->signature will remain NULL */
-	get_header_field(message, DBUS_MESSAGE_FIELD_SIGNATURE, 'g',
-						&message->signature);
+	message->signature = (char *) get_header_string(message,
+						DBUS_MESSAGE_FIELD_SIGNATURE);
 
 	return message;
 }
@@ -912,6 +1043,8 @@ struct builder_driver {
 	bool (*leave_array)(struct dbus_builder *);
 	bool (*enter_variant)(struct dbus_builder *, const char *);
 	bool (*leave_variant)(struct dbus_builder *);
+	bool (*append_fixed_array)(struct dbus_builder *, char, const void *,
+								uint32_t);
 	char *(*finish)(struct dbus_builder *, void **, size_t *);
 	bool (*mark)(struct dbus_builder *);
 	bool (*rewind)(struct dbus_builder *);
@@ -929,6 +1062,7 @@ static struct builder_driver dbus1_driver = {
 	.leave_variant = _dbus1_builder_leave_variant,
 	.enter_array = _dbus1_builder_enter_array,
 	.leave_array = _dbus1_builder_leave_array,
+	.append_fixed_array = _dbus1_builder_append_fixed_array,
 	.finish = _dbus1_builder_finish,
 	.mark = _dbus1_builder_mark,
 	.rewind = _dbus1_builder_rewind,
@@ -946,6 +1080,7 @@ static struct builder_driver gvariant_driver = {
 	.leave_variant = _gvariant_builder_leave_variant,
 	.enter_array = _gvariant_builder_enter_array,
 	.leave_array = _gvariant_builder_leave_array,
+	.append_fixed_array = _gvariant_builder_append_fixed_array,
 	.finish = _gvariant_builder_finish,
 	.mark = _gvariant_builder_mark,
 	.rewind = _gvariant_builder_rewind,
@@ -1079,6 +1214,191 @@ static void build_header(struct l_dbus_message *message, const char *signature)
 	message->header_end = header_size;
 }
 
+/*
+ * Build a copy of @message, which has to be sealed, that carries its
+ * body in a sealed memfd instead.  Returns NULL if the body cannot be
+ * moved, in which case @message should be sent as is.
+ */
+struct l_dbus_message *_dbus_message_to_memfd(struct l_dbus_message *message)
+{
+	struct dbus_header *hdr = message->header;
+	struct l_dbus_message *wrapper;
+	struct memfd_body *head;
+	size_t sig_len, head_size;
+	const uint8_t *body;
+	size_t left;
+	int fd;
+
+	if (_dbus_message_is_gvariant(message) || message->num_fds ||
+			!message->sealed || !message->signature)
+		return NULL;
+
+	sig_len = strlen(message->signature) + 1;
+	head_size = align_len(sizeof(*head) + sig_len, 8);
+
+	fd = syscall(__NR_memfd_create, "dbus-body",
+					MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd < 0)
+		return NULL;
+
+	head = l_malloc(head_size);
+	memset(head, 0, head_size);
+	memcpy(head->magic, MEMFD_BODY_MAGIC, sizeof(head->magic));
+	head->body_offset = head_size;
+	head->body_size = message->body_size;
+	memcpy(head->signature, message->signature, sig_len);
+
+	if (TEMP_FAILURE_RETRY(write(fd, head, head_size)) !=
+						(ssize_t) head_size) {
+		l_free(head);
+		goto error;
+	}
+
+	l_free(head);
+
+	for (body = message->body, left = message->body_size; left; ) {
+		ssize_t written = TEMP_FAILURE_RETRY(write(fd, body, left));
+
+		if (written <= 0)
+			goto error;
+
+		body += written;
+		left -= written;
+	}
+
+	if (fcntl(fd, F_ADD_SEALS, MEMFD_BODY_SEALS | F_SEAL_SEAL) < 0)
+		goto error;
+
+	wrapper = message_new_common(hdr->message_type, hdr->flags, 1);
+
+	wrapper->path = l_strdup(l_dbus_message_get_path(message));
+	wrapper->interface = l_strdup(l_dbus_message_get_interface(message));
+	wrapper->member = l_strdup(l_dbus_message_get_member(message));
+	wrapper->destination =
+			l_strdup(l_dbus_message_get_destination(message));
+	wrapper->sender = l_strdup(l_dbus_message_get_sender(message));
+	wrapper->error_name = l_strdup(get_header_string(message,
+						DBUS_MESSAGE_FIELD_ERROR_NAME));
+	wrapper->reply_serial = message->reply_serial;
+
+	wrapper->fds[0] = fd;
+	wrapper->num_fds = 1;
+	wrapper->body = l_new(uint32_t, 1);
+	wrapper->body_size = sizeof(uint32_t);
+
+	build_header(wrapper, "h");
+	wrapper->sealed = true;
+	parse_header_fields(wrapper);
+	wrapper->signature = l_strdup("h");
+	wrapper->signature_free = true;
+
+	_dbus_message_set_serial(wrapper, hdr->dbus1.serial);
+
+	return wrapper;
+
+error:
+	close(fd);
+	return NULL;
+}
+
+/*
+ * If @message carries its body in a memfd, as built by
+ * _dbus_message_to_memfd, map the body read-only in its place and
+ * rebuild the header to describe it.  Only memfds sealed against any
+ * further modification are accepted, so the sender cannot change the
+ * body under us.
+ */
+bool _dbus_message_from_memfd(struct l_dbus_message *message)
+{
+	struct dbus_header *hdr = message->header;
+	const struct memfd_body *head;
+	struct stat st;
+	void *mapping;
+	const char *signature;
+	size_t sig_max;
+	int seals;
+	int fd;
+
+	if (_dbus_message_is_gvariant(message) || message->num_fds != 1 ||
+			hdr->endian != DBUS_NATIVE_ENDIAN ||
+			!message->signature ||
+			strcmp(message->signature, "h") ||
+			message->body_size != sizeof(uint32_t) ||
+			l_get_u32(message->body) != 0)
+		return false;
+
+	fd = message->fds[0];
+
+	seals = fcntl(fd, F_GET_SEALS);
+	if (seals < 0 || (seals & MEMFD_BODY_SEALS) != MEMFD_BODY_SEALS)
+		return false;
+
+	if (fstat(fd, &st) < 0 || (size_t) st.st_size <= sizeof(*head))
+		return false;
+
+	mapping = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (mapping == MAP_FAILED)
+		return false;
+
+	head = mapping;
+
+	if (memcmp(head->magic, MEMFD_BODY_MAGIC, sizeof(head->magic)) ||
+			head->body_offset & 7 ||
+			head->body_offset <= sizeof(*head) ||
+			head->body_offset > (size_t) st.st_size ||
+			head->body_size > st.st_size - head->body_offset)
+		goto unmap;
+
+	signature = head->signature;
+	sig_max = head->body_offset - sizeof(*head);
+
+	if (!memchr(signature, '\0', sig_max) ||
+			!_dbus_valid_signature(signature))
+		goto unmap;
+
+	close(fd);
+	message->num_fds = 0;
+
+	if (message->signature_free)
+		l_free(message->signature);
+
+	message->signature = l_strdup(signature);
+	message->signature_free = true;
+
+	if (!message->contiguous)
+		l_free(message->body);
+
+	message->body = mapping + head->body_offset;
+	message->body_size = head->body_size;
+	message->mapping = mapping;
+	message->mapping_size = st.st_size;
+
+	/*
+	 * The received header still has the wrapper's signature, fd count
+	 * and body length.  Keep the fixed part, including the serial, and
+	 * rebuild the fields around the real body.
+	 */
+	message->path = l_strdup(l_dbus_message_get_path(message));
+	message->interface = l_strdup(l_dbus_message_get_interface(message));
+	message->member = l_strdup(l_dbus_message_get_member(message));
+	message->destination =
+			l_strdup(l_dbus_message_get_destination(message));
+	message->sender = l_strdup(l_dbus_message_get_sender(message));
+	message->error_name = l_strdup(get_header_string(message,
+						DBUS_MESSAGE_FIELD_ERROR_NAME));
+
+	message->header_size = 12;
+	message->header_end = message->header_size;
+	build_header(message, signature);
+	parse_header_fields(message);
+
+	return true;
+
+unmap:
+	munmap(mapping, st.st_size);
+	return false;
+}
+
 struct container {
 	char type;
 	const char *sig_start;
@@ -1135,12 +1455,10 @@ LIB_EXPORT bool l_dbus_message_get_error(struct l_dbus_message *message,
 	if (!str)
 		return false;
 
-	if (!message->error_name)
-		get_header_field(message, DBUS_MESSAGE_FIELD_ERROR_NAME, 's',
-					&message->error_name);
-
 	if (name)
-		*name = message->error_name;
+		*name = message->sealed ? get_header_string(message,
+						DBUS_MESSAGE_FIELD_ERROR_NAME) :
+					message->error_name;
 
 	if (text)
 		*text = str;
@@ -1249,8 +1567,7 @@ LIB_EXPORT const char *l_dbus_message_get_path(struct l_dbus_message *message)
 		return NULL;
 
 	if (!message->path && message->sealed)
-		get_header_field(message, DBUS_MESSAGE_FIELD_PATH, 'o',
-					&message->path);
+		return get_header_string(message, DBUS_MESSAGE_FIELD_PATH);
 
 	return message->path;
 }
@@ -1261,8 +1578,7 @@ LIB_EXPORT const char *l_dbus_message_get_interface(struct l_dbus_message *messa
 		return NULL;
 
 	if (!message->interface && message->sealed)
-		get_header_field(message, DBUS_MESSAGE_FIELD_INTERFACE, 's',
-					&message->interface);
+		return get_header_string(message, DBUS_MESSAGE_FIELD_INTERFACE);
 
 	return message->interface;
 }
@@ -1273,8 +1589,7 @@ LIB_EXPORT const char *l_dbus_message_get_member(struct l_dbus_message *message)
 		return NULL;
 
 	if (!message->member && message->sealed)
-		get_header_field(message, DBUS_MESSAGE_FIELD_MEMBER, 's',
-					&message->member);
+		return get_header_string(message, DBUS_MESSAGE_FIELD_MEMBER);
 
 	return message->member;
 }
@@ -1285,8 +1600,7 @@ LIB_EXPORT const char *l_dbus_message_get_destination(struct l_dbus_message *mes
 		return NULL;
 
 	if (!message->destination && message->sealed)
-		get_header_field(message, DBUS_MESSAGE_FIELD_DESTINATION, 's',
-							&message->destination);
+		return get_header_string(message, DBUS_MESSAGE_FIELD_DESTINATION);
 
 	return message->destination;
 }
@@ -1297,8 +1611,7 @@ LIB_EXPORT const char *l_dbus_message_get_sender(struct l_dbus_message *message)
 		return NULL;
 
 	if (!message->sender && message->sealed)
-		get_header_field(message, DBUS_MESSAGE_FIELD_SENDER, 's',
-					&message->sender);
+		return get_header_string(message, DBUS_MESSAGE_FIELD_SENDER);
 
 	return message->sender;
 }
@@ -1317,21 +1630,6 @@ uint32_t _dbus_message_get_reply_serial(struct l_dbus_message *message)
 	if (unlikely(!message))
 		return 0;
 
-	if (message->reply_serial == 0 && message->sealed) {
-		if (_dbus_message_is_gvariant(message)) {
-			uint64_t reply_serial = 0;
-
-			get_header_field(message,
-					DBUS_MESSAGE_FIELD_REPLY_SERIAL, 't',
-					&reply_serial);
-
-			message->reply_serial = reply_serial;
-		} else
-			get_header_field(message,
-					DBUS_MESSAGE_FIELD_REPLY_SERIAL, 'u',
-					&message->reply_serial);
-	}
-
 	return message->reply_serial;
 }
 
@@ -1422,7 +1720,7 @@ LIB_EXPORT bool l_dbus_message_iter_get_fixed_array(
 		return false;
 
 	if (_dbus_message_is_gvariant(iter->message))
-		return false;
+		return _gvariant_iter_get_fixed_array(iter, out, n_elem);
 
 	return _dbus1_iter_get_fixed_array(iter, out, n_elem);
 }
@@ -1495,6 +1793,25 @@ LIB_EXPORT bool l_dbus_message_builder_append_basic(
 	return builder->driver->append_basic(builder->builder, type, value);
 }
 
+/*
+ * Appends "a@type" holding @n_elem elements copied from @data in one go.
+ * @type has to be a fixed size numeric type, so not 'b' or 'h'.
+ */
+LIB_EXPORT bool l_dbus_message_builder_append_fixed_array(
+					struct l_dbus_message_builder *builder,
+					char type, const void *data,
+					uint32_t n_elem)
+{
+	if (unlikely(!builder))
+		return false;
+
+	if (unlikely(!data && n_elem))
+		return false;
+
+	return builder->driver->append_fixed_array(builder->builder, type,
+							data, n_elem);
+}
+
 LIB_EXPORT bool l_dbus_message_builder_enter_container(
 					struct l_dbus_message_builder *builder,
 					char container_type,
@@ -1966,6 +2283,7 @@ LIB_EXPORT struct l_dbus_message *l_dbus_message_builder_finalize(
 
 	build_header(builder->message, generated_signature);
 	builder->message->sealed = true;
+	parse_header_fields(builder->message);
 	builder->message->signature = generated_signature;
 	builder->message->signature_free = true;
 
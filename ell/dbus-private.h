@@ -105,6 +105,9 @@ bool _dbus1_builder_leave_variant(struct dbus_builder *builder);
 bool _dbus1_builder_enter_array(struct dbus_builder *builder,
 					const char *signature);
 bool _dbus1_builder_leave_array(struct dbus_builder *builder);
+bool _dbus1_builder_append_fixed_array(struct dbus_builder *builder,
+					char type, const void *data,
+					uint32_t n_elem);
 char *_dbus1_builder_finish(struct dbus_builder *builder,
 				void **body, size_t *body_size);
 bool _dbus1_builder_mark(struct dbus_builder *builder);
@@ -129,6 +132,8 @@ uint8_t _dbus_message_get_version(struct l_dbus_message *message);
 uint8_t _dbus_message_get_endian(struct l_dbus_message *message);
 const char *_dbus_message_get_nth_string_argument(
 					struct l_dbus_message *message, int n);
+bool _dbus_message_get_string_arguments(struct l_dbus_message *message,
+					const char **out, unsigned int n);
 
 struct l_dbus_message *_dbus_message_new_method_call(uint8_t version,
 							const char *destination,
@@ -147,12 +152,15 @@ struct l_dbus_message *_dbus_message_new_error(uint8_t version,
 
 struct l_dbus_message *dbus_message_from_blob(const void *data, size_t size,
 						int fds[], uint32_t num_fds);
-struct l_dbus_message *dbus_message_build(void *header, size_t header_size,
-						void *body, size_t body_size,
-						int fds[], uint32_t num_fds);
+struct l_dbus_message *dbus_message_build(void *data, size_t header_size,
+						size_t body_size,
+						int fds[], uint32_t *num_fds);
 bool dbus_message_compare(struct l_dbus_message *message,
 					const void *data, size_t size);
 
+struct l_dbus_message *_dbus_message_to_memfd(struct l_dbus_message *message);
+bool _dbus_message_from_memfd(struct l_dbus_message *message);
+
 bool _dbus_message_builder_mark(struct l_dbus_message_builder *builder);
 bool _dbus_message_builder_rewind(struct l_dbus_message_builder *builder);
 
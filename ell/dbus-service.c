@@ -75,6 +75,8 @@ struct l_dbus_interface {
 	struct l_queue *methods;
 	struct l_queue *signals;
 	struct l_queue *properties;
+	struct l_hashmap *method_index;
+	struct l_hashmap *property_index;
 	bool handle_old_style_properties;
 	void (*instance_destroy)(void *);
 	char name[];
@@ -82,6 +84,7 @@ struct l_dbus_interface {
 
 struct child_node {
 	struct object_node *node;
+	struct child_node *prev;
 	struct child_node *next;
 	char subpath[];
 };
@@ -93,8 +96,10 @@ struct interface_instance {
 
 struct object_node {
 	struct object_node *parent;
+	struct child_node *entry;
 	struct l_queue *instances;
 	struct child_node *children;
+	struct l_hashmap *child_index;
 	void *user_data;
 	void (*destroy) (void *);
 };
@@ -347,6 +352,9 @@ LIB_EXPORT bool l_dbus_interface_method(struct l_dbus_interface *interface,
 
 	l_queue_push_tail(interface->methods, info);
 
+	if (!l_hashmap_lookup(interface->method_index, info->metainfo))
+		l_hashmap_insert(interface->method_index, info->metainfo, info);
+
 	return true;
 }
 
@@ -427,9 +435,25 @@ LIB_EXPORT bool l_dbus_interface_property(struct l_dbus_interface *interface,
 
 	l_queue_push_tail(interface->properties, info);
 
+	if (!l_hashmap_lookup(interface->property_index, info->metainfo))
+		l_hashmap_insert(interface->property_index, info->metainfo,
+									info);
+
 	return true;
 }
 
+/* Keys are names owned by the stored values and are not copied */
+static struct l_hashmap *name_index_new(l_hashmap_hash_func_t hash)
+{
+	struct l_hashmap *index = l_hashmap_new();
+
+	l_hashmap_set_hash_function(index, hash);
+	l_hashmap_set_compare_function(index,
+					(l_hashmap_compare_func_t) strcmp);
+
+	return index;
+}
+
 struct l_dbus_interface *_dbus_interface_new(const char *name)
 {
 	struct l_dbus_interface *interface;
@@ -442,11 +466,18 @@ struct l_dbus_interface *_dbus_interface_new(const char *name)
 
 	strcpy(interface->name, name);
 
+	/* Only the service adds members, peers can't flood these */
+	interface->method_index = name_index_new(l_str_hash);
+	interface->property_index = name_index_new(l_str_hash);
+
 	return interface;
 }
 
 void _dbus_interface_free(struct l_dbus_interface *interface)
 {
+	l_hashmap_destroy(interface->method_index, NULL);
+	l_hashmap_destroy(interface->property_index, NULL);
+
 	l_queue_destroy(interface->methods, l_free);
 	l_queue_destroy(interface->signals, l_free);
 	l_queue_destroy(interface->properties, l_free);
@@ -454,21 +485,10 @@ void _dbus_interface_free(struct l_dbus_interface *interface)
 	l_free(interface);
 }
 
-static bool match_method(const void *a, const void *b)
-{
-	const struct _dbus_method *method = a;
-	const char *name = b;
-
-	if (!strcmp(method->metainfo, name))
-		return true;
-
-	return false;
-}
-
 struct _dbus_method *_dbus_interface_find_method(struct l_dbus_interface *i,
 							const char *method)
 {
-	return l_queue_find(i->methods, match_method, (char *) method);
+	return l_hashmap_lookup(i->method_index, method);
 }
 
 static bool match_signal(const void *a, const void *b)
@@ -488,21 +508,10 @@ struct _dbus_signal *_dbus_interface_find_signal(struct l_dbus_interface *i,
 	return l_queue_find(i->signals, match_signal, (char *) signal);
 }
 
-static bool match_property(const void *a, const void *b)
-{
-	const struct _dbus_property *property = a;
-	const char *name = b;
-
-	if (!strcmp(property->metainfo, name))
-		return true;
-
-	return false;
-}
-
 struct _dbus_property *_dbus_interface_find_property(struct l_dbus_interface *i,
 							const char *property)
 {
-	return l_queue_find(i->properties, match_property, (char *) property);
+	return l_hashmap_lookup(i->property_index, property);
 }
 
 static void interface_instance_free(struct interface_instance *instance)
@@ -560,10 +569,7 @@ struct _dbus_object_tree *_dbus_object_tree_new()
 
 	tree = l_new(struct _dbus_object_tree, 1);
 
-	tree->interfaces = l_hashmap_new();
-	l_hashmap_set_hash_function(tree->interfaces, l_str_hash);
-	l_hashmap_set_compare_function(tree->interfaces,
-					(l_hashmap_compare_func_t)strcmp);
+	tree->interfaces = name_index_new(l_str_hash_keyed);
 
 	tree->objects = l_hashmap_string_new();
 
@@ -597,6 +603,8 @@ static void subtree_free(struct object_node *node)
 		l_free(child);
 	}
 
+	l_hashmap_destroy(node->child_index, NULL);
+
 	l_queue_destroy(node->instances,
 			(l_queue_destroy_func_t) interface_instance_free);
 
@@ -635,6 +643,32 @@ void _dbus_object_tree_free(struct _dbus_object_tree *tree)
 	l_free(tree);
 }
 
+static struct child_node *child_lookup(const struct object_node *node,
+					const char *subpath, size_t len)
+{
+	char buf[64];
+	char *name;
+	struct child_node *child;
+
+	if (!node->child_index)
+		return NULL;
+
+	/* The path may come from a peer, only short names go on the stack */
+	if (len < sizeof(buf)) {
+		memcpy(buf, subpath, len);
+		buf[len] = '\0';
+		name = buf;
+	} else
+		name = l_strndup(subpath, len);
+
+	child = l_hashmap_lookup(node->child_index, name);
+
+	if (name != buf)
+		l_free(name);
+
+	return child;
+}
+
 static struct object_node *makepath_recurse(struct object_node *node,
 						const char *path)
 {
@@ -646,24 +680,30 @@ static struct object_node *makepath_recurse(struct object_node *node,
 
 	path += 1;
 	end = strchrnul(path, '/');
-	child = node->children;
-
-	while (child) {
-		if (!strncmp(child->subpath, path, end - path) &&
-				child->subpath[end - path] == '\0')
-			goto done;
 
-		child = child->next;
-	}
+	child = child_lookup(node, path, end - path);
+	if (child)
+		goto done;
 
 	child = l_malloc(sizeof(*child) + end - path + 1);
 	child->node = l_new(struct object_node, 1);
 	child->node->parent = node;
+	child->node->entry = child;
 	memcpy(child->subpath, path, end - path);
 	child->subpath[end-path] = '\0';
+	child->prev = NULL;
 	child->next = node->children;
+
+	if (node->children)
+		node->children->prev = child;
+
 	node->children = child;
 
+	if (!node->child_index)
+		node->child_index = name_index_new(l_str_hash_keyed);
+
+	l_hashmap_insert(node->child_index, child->subpath, child);
+
 done:
 	return makepath_recurse(child->node, end);
 }
@@ -688,17 +728,12 @@ static struct object_node *lookup_recurse(struct object_node *node,
 
 	path += 1;
 	end = strchrnul(path, '/');
-	child = node->children;
-
-	while (child) {
-		if (!strncmp(child->subpath, path, end - path) &&
-				child->subpath[end - path] == '\0')
-			return lookup_recurse(child->node, end);
 
-		child = child->next;
-	}
+	child = child_lookup(node, path, end - path);
+	if (!child)
+		return NULL;
 
-	return NULL;
+	return lookup_recurse(child->node, end);
 }
 
 struct object_node *_dbus_object_tree_lookup(struct _dbus_object_tree *tree,
@@ -713,27 +748,30 @@ struct object_node *_dbus_object_tree_lookup(struct _dbus_object_tree *tree,
 void _dbus_object_tree_prune_node(struct object_node *node)
 {
 	struct object_node *parent = node->parent;
-	struct child_node *p = NULL, *c;
+	struct child_node *c;
 
 	while (parent) {
-		for (c = parent->children, p = NULL; c; p = c, c = c->next) {
-			if (c->node != node)
-				continue;
+		c = node->entry;
 
-			if (p)
-				p->next = c->next;
-			else
-				parent->children = c->next;
+		if (c->prev)
+			c->prev->next = c->next;
+		else
+			parent->children = c->next;
 
-			subtree_free(c->node);
-			l_free(c);
+		if (c->next)
+			c->next->prev = c->prev;
 
-			break;
-		}
+		l_hashmap_remove(parent->child_index, c->subpath);
+
+		subtree_free(c->node);
+		l_free(c);
 
 		if (parent->children != NULL)
 			return;
 
+		l_hashmap_destroy(parent->child_index, NULL);
+		parent->child_index = NULL;
+
 		if (parent->instances)
 			return;
 
@@ -1244,6 +1244,35 @@ bool _dbus1_builder_leave_array(struct dbus_builder *builder)
 	return true;
 }
 
+/*
+ * Append a whole array of a fixed size type with a single grow_body
+ * and copy, instead of an append_basic per element.  Booleans and file
+ * descriptors have a different representation in memory and on the
+ * wire and are not accepted.
+ */
+bool _dbus1_builder_append_fixed_array(struct dbus_builder *builder,
+					char type, const void *data,
+					uint32_t n_elem)
+{
+	char signature[2] = { type, '\0' };
+	size_t size = get_basic_size(type);
+	size_t start;
+
+	if (unlikely(!builder))
+		return false;
+
+	if (!size || type == 'b' || type == 'h')
+		return false;
+
+	if (!_dbus1_builder_enter_array(builder, signature))
+		return false;
+
+	start = grow_body(builder, size * n_elem, 1);
+	memcpy(builder->body + start, data, size * n_elem);
+
+	return _dbus1_builder_leave_array(builder);
+}
+
 bool _dbus1_builder_mark(struct dbus_builder *builder)
 {
 	struct container *container = l_queue_peek_head(builder->containers);
@@ -31,6 +31,7 @@
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <errno.h>
@@ -52,16 +53,26 @@
 
 #define DBUS_MAXIMUM_MATCH_RULE_LENGTH	1024
 
+#define DBUS_RECV_BUFFER_SIZE	(64 * 1024)
+
+#define DBUS_MAXIMUM_MESSAGE_LENGTH	(128 * 1024 * 1024)
+
+/* Header and body of each message take an iovec entry apiece */
+#define DBUS_MAX_SEND_BATCH	(IOV_MAX / 2)
+
 enum auth_state {
 	WAITING_FOR_OK,
 	WAITING_FOR_AGREE_UNIX_FD,
+	WAITING_FOR_AGREE_MEMFD_BODY,
 	SETUP_DONE
 };
 
 struct l_dbus_ops {
 	char version;
-	bool (*send_message)(struct l_dbus *bus,
-				struct l_dbus_message *message);
+	int (*send_messages)(struct l_dbus *bus,
+				struct l_dbus_message **messages,
+				unsigned int count, bool *partial);
+	bool (*recv_data)(struct l_dbus *bus);
 	struct l_dbus_message *(*recv_message)(struct l_dbus *bus);
 	void (*free)(struct l_dbus *bus);
 	struct _dbus_name_ops name_ops;
@@ -77,11 +88,14 @@ struct l_dbus {
 	char *guid;
 	bool negotiate_unix_fd;
 	bool support_unix_fd;
+	bool support_memfd_body;
 	bool is_ready;
 	char *unique_name;
 	unsigned int next_id;
 	uint32_t next_serial;
 	struct l_queue *message_queue;
+	/* Partially written, kept off the queue until it's out in full */
+	struct message_callback *tx_callback;
 	struct l_hashmap *message_list;
 	struct l_hashmap *signal_list;
 	l_dbus_ready_func_t ready_handler;
@@ -97,6 +111,8 @@ struct l_dbus {
 	struct _dbus_name_cache *name_cache;
 	struct _dbus_filter *filter;
 	bool name_notify_enabled;
+	bool *destroyed;
+	size_t memfd_threshold;
 
 	const struct l_dbus_ops *driver;
 };
@@ -108,6 +124,13 @@ struct l_dbus_classic {
 	struct l_hashmap *match_strings;
 	int *fd_buf;
 	unsigned int num_fds;
+	size_t tx_offset;
+	uint8_t *rx_buf;
+	size_t rx_start;
+	size_t rx_end;
+	uint8_t *rx_msg;
+	size_t rx_msg_pos;
+	size_t rx_msg_size;
 };
 
 struct message_callback {
@@ -152,49 +175,98 @@ static void signal_list_destroy(void *value)
 	l_free(callback);
 }
 
+/* The partially written message, if any, goes before the queue */
+static struct message_callback *message_queue_next(struct l_dbus *dbus)
+{
+	struct message_callback *callback = dbus->tx_callback;
+
+	if (!callback)
+		return l_queue_pop_head(dbus->message_queue);
+
+	dbus->tx_callback = NULL;
+
+	return callback;
+}
+
 static bool message_write_handler(struct l_io *io, void *user_data)
 {
 	struct l_dbus *dbus = user_data;
-	struct l_dbus_message *message;
+	struct l_dbus_message *messages[DBUS_MAX_SEND_BATCH];
+	const struct l_queue_entry *entry;
 	struct message_callback *callback;
 	const void *header, *body;
 	size_t header_size, body_size;
+	unsigned int count = 0;
+	bool partial;
+	int sent, i;
 
-	callback = l_queue_pop_head(dbus->message_queue);
-	if (!callback)
-		return false;
+	if (dbus->tx_callback)
+		messages[count++] = dbus->tx_callback->message;
 
-	message = callback->message;
-	if (_dbus_message_get_type(message) == DBUS_MESSAGE_TYPE_METHOD_CALL &&
-			callback->callback == NULL)
-		l_dbus_message_set_no_reply(message, true);
+	for (entry = l_queue_get_entries(dbus->message_queue);
+			entry && count < L_ARRAY_SIZE(messages);
+			entry = entry->next) {
+		struct l_dbus_message *message;
 
-	_dbus_message_set_serial(message, callback->serial);
+		/* Only the Hello call goes out before the connection is ready */
+		if (!dbus->is_ready && count)
+			break;
 
-	if (!dbus->driver->send_message(dbus, message)) {
-		message_queue_destroy(callback);
+		callback = entry->data;
+		message = callback->message;
+
+		if (_dbus_message_get_type(message) ==
+					DBUS_MESSAGE_TYPE_METHOD_CALL &&
+				callback->callback == NULL)
+			l_dbus_message_set_no_reply(message, true);
+
+		_dbus_message_set_serial(message, callback->serial);
+
+		messages[count++] = message;
+	}
+
+	if (!count)
+		return false;
+
+	sent = dbus->driver->send_messages(dbus, messages, count, &partial);
+	if (sent < 0) {
+		message_queue_destroy(message_queue_next(dbus));
 		return false;
 	}
 
-	header = _dbus_message_get_header(message, &header_size);
-	body = _dbus_message_get_body(message, &body_size);
-	l_util_hexdump_two(false, header, header_size, body, body_size,
-				dbus->debug_handler, dbus->debug_data);
+	for (i = 0; i < sent; i++) {
+		callback = message_queue_next(dbus);
 
-	if (callback->callback == NULL) {
-		message_queue_destroy(callback);
-		goto done;
+		header = _dbus_message_get_header(callback->message,
+							&header_size);
+		body = _dbus_message_get_body(callback->message, &body_size);
+		l_util_hexdump_two(false, header, header_size, body, body_size,
+					dbus->debug_handler, dbus->debug_data);
+
+		if (callback->callback == NULL) {
+			message_queue_destroy(callback);
+			continue;
+		}
+
+		l_hashmap_insert(dbus->message_list,
+					L_UINT_TO_PTR(callback->serial), callback);
 	}
 
-	l_hashmap_insert(dbus->message_list,
-				L_UINT_TO_PTR(callback->serial), callback);
+	/*
+	 * Neither l_dbus_cancel nor a priority send may touch a message
+	 * once part of it is on the wire.
+	 */
+	if (partial && !dbus->tx_callback)
+		dbus->tx_callback = l_queue_pop_head(dbus->message_queue);
+
+	if (dbus->tx_callback)
+		return true;
 
-done:
 	if (l_queue_isempty(dbus->message_queue))
 		return false;
 
-	/* Only continue sending messges if the connection is ready */
-	return dbus->is_ready;
+	/* Retry a write that would block, otherwise only continue if ready */
+	return !sent || dbus->is_ready;
 }
 
 static void handle_method_return(struct l_dbus *dbus,
@@ -252,18 +324,13 @@ static void handle_signal(struct l_dbus *dbus, struct l_dbus_message *message)
 	l_hashmap_foreach(dbus->signal_list, process_signal, message);
 }
 
-static bool message_read_handler(struct l_io *io, void *user_data)
+static void dispatch_message(struct l_dbus *dbus,
+					struct l_dbus_message *message)
 {
-	struct l_dbus *dbus = user_data;
-	struct l_dbus_message *message;
 	const void *header, *body;
 	size_t header_size, body_size;
 	enum dbus_message_type msgtype;
 
-	message = dbus->driver->recv_message(dbus);
-	if (!message)
-		return true;
-
 	header = _dbus_message_get_header(message, &header_size);
 	body = _dbus_message_get_body(message, &body_size);
 	l_util_hexdump_two(true, header, header_size, body, body_size,
@@ -293,12 +360,61 @@ static bool message_read_handler(struct l_io *io, void *user_data)
 
 		break;
 	}
+}
+
+static bool message_read_handler(struct l_io *io, void *user_data)
+{
+	struct l_dbus *dbus = user_data;
+	struct l_dbus_message *message;
+	bool destroyed = false;
+
+	if (!dbus->driver->recv_data(dbus))
+		return true;
+
+	/*
+	 * Dispatch everything that arrived with this wakeup, any of the
+	 * callbacks may destroy the bus along the way.
+	 */
+	dbus->destroyed = &destroyed;
+
+	while ((message = dbus->driver->recv_message(dbus))) {
+		dispatch_message(dbus, message);
+		l_dbus_message_unref(message);
+
+		if (destroyed)
+			return true;
+	}
 
-	l_dbus_message_unref(message);
+	dbus->destroyed = NULL;
 
 	return true;
 }
 
+/*
+ * Move a large body into a memfd while the message is queued, before
+ * any of it can have been written out.
+ */
+static void message_to_memfd(struct l_dbus *dbus,
+					struct message_callback *callback)
+{
+	struct l_dbus_message *wrapper;
+	size_t body_size;
+
+	if (!dbus->memfd_threshold || !dbus->support_memfd_body)
+		return;
+
+	_dbus_message_get_body(callback->message, &body_size);
+	if (body_size < dbus->memfd_threshold)
+		return;
+
+	wrapper = _dbus_message_to_memfd(callback->message);
+	if (!wrapper)
+		return;
+
+	l_dbus_message_unref(callback->message);
+	callback->message = wrapper;
+}
+
 static uint32_t send_message(struct l_dbus *dbus, bool priority,
 				struct l_dbus_message *message,
 				l_dbus_message_func_t function,
@@ -330,6 +446,16 @@ static uint32_t send_message(struct l_dbus *dbus, bool priority,
 	callback->destroy = destroy;
 	callback->user_data = user_data;
 
+	if (!priority) {
+		path = l_dbus_message_get_path(message);
+		if (path)
+			_dbus_object_tree_signals_flush(dbus, path);
+	}
+
+	/* May replace callback->message, don't use message past this */
+	if (dbus->is_ready)
+		message_to_memfd(dbus, callback);
+
 	if (priority) {
 		l_queue_push_head(dbus->message_queue, callback);
 
@@ -339,10 +465,6 @@ static uint32_t send_message(struct l_dbus *dbus, bool priority,
 		return callback->serial;
 	}
 
-	path = l_dbus_message_get_path(message);
-	if (path)
-		_dbus_object_tree_signals_flush(dbus, path);
-
 	l_queue_push_tail(dbus->message_queue, callback);
 
 	if (dbus->is_ready)
@@ -354,6 +476,8 @@ static uint32_t send_message(struct l_dbus *dbus, bool priority,
 
 static void bus_ready(struct l_dbus *dbus)
 {
+	const struct l_queue_entry *entry;
+
 	dbus->is_ready = true;
 
 	if (dbus->ready_handler)
@@ -365,6 +489,10 @@ static void bus_ready(struct l_dbus *dbus)
 	if (l_queue_isempty(dbus->message_queue))
 		return;
 
+	for (entry = l_queue_get_entries(dbus->message_queue); entry;
+							entry = entry->next)
+		message_to_memfd(dbus, entry->data);
+
 	l_io_set_write_handler(dbus->io, message_write_handler, dbus, NULL);
 }
 
@@ -519,23 +647,38 @@ static bool auth_read_handler(struct l_io *io, void *user_data)
 		break;
 
 	case WAITING_FOR_AGREE_UNIX_FD:
-		if (!strncmp(ptr, "AGREE_UNIX_FD", 13)) {
-			static const char *command = "BEGIN\r\n";
-
+		if (!strncmp(ptr, "AGREE_UNIX_FD", 13))
 			dbus->support_unix_fd = true;
+		else if (!strncmp(ptr, "ERROR", 5))
+			dbus->support_unix_fd = false;
+		else
+			break;
 
-			classic->auth_command = l_strdup(command);
-			classic->auth_state = SETUP_DONE;
+		/*
+		 * Memfd bodies are an ell extension, a bus daemon rejects
+		 * the command so only peers that agree ever get them.
+		 */
+		if (dbus->support_unix_fd && dbus->memfd_threshold) {
+			classic->auth_command =
+					l_strdup("NEGOTIATE_MEMFD_BODY\r\n");
+			classic->auth_state = WAITING_FOR_AGREE_MEMFD_BODY;
 			break;
-		} else if (!strncmp(ptr, "ERROR", 5)) {
-			static const char *command = "BEGIN\r\n";
+		}
 
-			dbus->support_unix_fd = false;
+		classic->auth_command = l_strdup("BEGIN\r\n");
+		classic->auth_state = SETUP_DONE;
+		break;
 
-			classic->auth_command = l_strdup(command);
-			classic->auth_state = SETUP_DONE;
+	case WAITING_FOR_AGREE_MEMFD_BODY:
+		if (!strncmp(ptr, "AGREE_MEMFD_BODY", 16))
+			dbus->support_memfd_body = true;
+		else if (!strncmp(ptr, "ERROR", 5))
+			dbus->support_memfd_body = false;
+		else
 			break;
-		}
+
+		classic->auth_command = l_strdup("BEGIN\r\n");
+		classic->auth_state = SETUP_DONE;
 		break;
 
 	case SETUP_DONE:
@@ -586,220 +729,419 @@ static void classic_free(struct l_dbus *dbus)
 		close(classic->fd_buf[i]);
 	l_free(classic->fd_buf);
 
+	l_free(classic->rx_buf);
+	l_free(classic->rx_msg);
+
 	l_free(classic->auth_command);
 	l_hashmap_destroy(classic->match_strings, l_free);
 	l_free(classic);
 }
 
-static bool classic_send_message(struct l_dbus *dbus,
-					struct l_dbus_message *message)
+/*
+ * Coalesce as many queued messages as possible into a single sendmsg.
+ * File descriptors are attached to the start of the write, so only the
+ * first message of a batch may carry any.  Returns the number of
+ * messages written out completely, what was written of the next one is
+ * remembered and skipped the next time around.  @partial tells whether
+ * there is such a message, which then has to come first next time.
+ */
+static int classic_send_messages(struct l_dbus *dbus,
+					struct l_dbus_message **messages,
+					unsigned int count, bool *partial)
 {
+	struct l_dbus_classic *classic =
+		container_of(dbus, struct l_dbus_classic, super);
 	int fd = l_io_get_fd(dbus->io);
+	struct iovec iov[DBUS_MAX_SEND_BATCH * 2];
+	size_t sizes[DBUS_MAX_SEND_BATCH];
+	size_t skip = classic->tx_offset;
 	struct msghdr msg;
-	struct iovec iov[2], *iovpos;
-	ssize_t r;
+	struct cmsghdr *cmsg;
 	int *fds = NULL;
 	uint32_t num_fds = 0;
-	struct cmsghdr *cmsg;
-	int iovlen;
-
-	iov[0].iov_base = _dbus_message_get_header(message, &iov[0].iov_len);
-	iov[1].iov_base = _dbus_message_get_body(message, &iov[1].iov_len);
+	unsigned int i, iovlen = 0;
+	size_t done;
+	ssize_t r;
+	int sent;
 
-	if (dbus->support_unix_fd)
-		fds = _dbus_message_get_fds(message, &num_fds);
+	for (i = 0; i < count; i++) {
+		struct iovec part[2];
+		unsigned int j;
 
-	iovpos = iov;
-	iovlen = 2;
+		if (dbus->support_unix_fd) {
+			uint32_t n = 0;
 
-	while (1) {
-		memset(&msg, 0, sizeof(msg));
-		msg.msg_iov = iovpos;
-		msg.msg_iovlen = iovlen;
-
-		if (num_fds) {
-			msg.msg_control =
-				alloca(CMSG_SPACE(num_fds * sizeof(int)));
-			msg.msg_controllen = CMSG_LEN(num_fds * sizeof(int));
-
-			cmsg = CMSG_FIRSTHDR(&msg);
-			cmsg->cmsg_len = msg.msg_controllen;
-			cmsg->cmsg_level = SOL_SOCKET;
-			cmsg->cmsg_type = SCM_RIGHTS;
-			memcpy(CMSG_DATA(cmsg), fds, num_fds * sizeof(int));
+			_dbus_message_get_fds(messages[i], &n);
+			if (n && i)
+				break;
 		}
 
-		r = TEMP_FAILURE_RETRY(sendmsg(fd, &msg, 0));
-		if (r < 0)
-			return false;
+		part[0].iov_base = _dbus_message_get_header(messages[i],
+							&part[0].iov_len);
+		part[1].iov_base = _dbus_message_get_body(messages[i],
+							&part[1].iov_len);
+		sizes[i] = part[0].iov_len + part[1].iov_len;
 
-		while ((size_t) r >= iovpos->iov_len) {
-			r -= iovpos->iov_len;
-			iovpos++;
-			iovlen--;
+		for (j = 0; j < 2; j++) {
+			if (skip >= part[j].iov_len) {
+				skip -= part[j].iov_len;
+				continue;
+			}
 
-			if (!iovlen)
-				break;
+			iov[iovlen].iov_base = part[j].iov_base + skip;
+			iov[iovlen].iov_len = part[j].iov_len - skip;
+			iovlen++;
+			skip = 0;
 		}
+	}
+
+	count = i;
+
+	/* The FDs go out with the first byte of their message only */
+	if (dbus->support_unix_fd && !classic->tx_offset)
+		fds = _dbus_message_get_fds(messages[0], &num_fds);
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = iovlen;
+
+	if (num_fds) {
+		msg.msg_control = alloca(CMSG_SPACE(num_fds * sizeof(int)));
+		msg.msg_controllen = CMSG_LEN(num_fds * sizeof(int));
+
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_len = msg.msg_controllen;
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		memcpy(CMSG_DATA(cmsg), fds, num_fds * sizeof(int));
+	}
+
+	r = TEMP_FAILURE_RETRY(sendmsg(fd, &msg, MSG_DONTWAIT));
+	if (r < 0) {
+		*partial = classic->tx_offset != 0;
+
+		if (errno == EAGAIN)
+			return 0;
+
+		classic->tx_offset = 0;
+		return -errno;
+	}
 
-		if (!iovlen)
+	done = classic->tx_offset + r;
+
+	for (sent = 0; (unsigned int) sent < count; sent++) {
+		if (done < sizes[sent])
 			break;
 
-		iovpos->iov_base += r;
-		iovpos->iov_len -= r;
+		done -= sizes[sent];
+	}
+
+	classic->tx_offset = done;
+	*partial = done != 0;
+
+	return sent;
+}
+
+static void classic_recv_fds(struct l_dbus_classic *classic,
+						struct msghdr *msg)
+{
+	struct cmsghdr *cmsg;
+	unsigned int i;
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		uint32_t num_fds;
+		int *fds;
+
+		if (cmsg->cmsg_level != SOL_SOCKET ||
+				cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+
+		num_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		fds = (void *) CMSG_DATA(cmsg);
+
+		/* Set FD_CLOEXEC on all file descriptors */
+		for (i = 0; i < num_fds; i++) {
+			long flags;
+
+			flags = fcntl(fds[i], F_GETFD, NULL);
+			if (flags < 0)
+				continue;
+
+			if (!(flags & FD_CLOEXEC))
+				fcntl(fds[i], F_SETFD, flags | FD_CLOEXEC);
+		}
 
-		/* The FDs have been transmitted, don't retransmit */
-		num_fds = 0;
+		classic->fd_buf = l_realloc(classic->fd_buf,
+					(classic->num_fds + num_fds) *
+					sizeof(int));
+		memcpy(classic->fd_buf + classic->num_fds, fds,
+			num_fds * sizeof(int));
+		classic->num_fds += num_fds;
 	}
+}
 
-	return true;
+/* Remove the first @count buffered fds, which belong to one message */
+static void classic_take_fds(struct l_dbus_classic *classic,
+				uint32_t count)
+{
+	if (classic->num_fds > count) {
+		memmove(classic->fd_buf, classic->fd_buf + count,
+			(classic->num_fds - count) * sizeof(int));
+		classic->num_fds -= count;
+		return;
+	}
+
+	l_free(classic->fd_buf);
+
+	classic->fd_buf = NULL;
+	classic->num_fds = 0;
 }
 
-static struct l_dbus_message *classic_recv_message(struct l_dbus *dbus)
+static void classic_drop_fds(struct l_dbus_classic *classic, uint32_t count)
+{
+	unsigned int i;
+
+	if (count > classic->num_fds)
+		count = classic->num_fds;
+
+	for (i = 0; i < count; i++)
+		close(classic->fd_buf[i]);
+
+	classic_take_fds(classic, count);
+}
+
+/*
+ * Read as much as the socket has for us with a single recvmsg.  Data
+ * lands in a per-connection buffer from which classic_recv_message
+ * then parses every complete message.  A message too large for the
+ * buffer gets its own allocation and the remainder of it is received
+ * straight into that, with anything following it buffered as usual.
+ */
+static bool classic_recv_data(struct l_dbus *dbus)
 {
 	struct l_dbus_classic *classic =
 		container_of(dbus, struct l_dbus_classic, super);
 	int fd = l_io_get_fd(dbus->io);
-	struct dbus_header hdr;
 	struct msghdr msg;
-	struct iovec iov[2], *iovpos;
-	struct cmsghdr *cmsg;
-	ssize_t len, r;
-	void *header, *body;
-	size_t header_size, body_size;
+	struct iovec iov[2];
 	union {
 		uint8_t bytes[CMSG_SPACE(16 * sizeof(int))];
 		struct cmsghdr align;
 	} fd_buf;
-	int *fds = NULL;
-	uint32_t num_fds = 0;
-	int iovlen;
-	struct l_dbus_message *message;
-	unsigned int i;
+	int iovlen = 0;
+	ssize_t r;
 
-	len = recv(fd, &hdr, DBUS_HEADER_SIZE, MSG_PEEK | MSG_DONTWAIT);
-	if (len != DBUS_HEADER_SIZE)
-		return NULL;
+	if (!classic->rx_buf)
+		classic->rx_buf = l_malloc(DBUS_RECV_BUFFER_SIZE);
 
-	header_size = align_len(DBUS_HEADER_SIZE + hdr.dbus1.field_length, 8);
-	header = l_malloc(header_size);
+	if (classic->rx_msg) {
+		iov[iovlen].iov_base = classic->rx_msg + classic->rx_msg_pos;
+		iov[iovlen].iov_len = classic->rx_msg_size -
+							classic->rx_msg_pos;
+		iovlen++;
+	}
 
-	body_size = hdr.dbus1.body_length;
-	body = l_malloc(body_size);
+	iov[iovlen].iov_base = classic->rx_buf + classic->rx_end;
+	iov[iovlen].iov_len = DBUS_RECV_BUFFER_SIZE - classic->rx_end;
+	iovlen++;
 
-	iov[0].iov_base = header;
-	iov[0].iov_len  = header_size;
-	iov[1].iov_base = body;
-	iov[1].iov_len  = body_size;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = iovlen;
+	msg.msg_control = &fd_buf;
+	msg.msg_controllen = sizeof(fd_buf);
 
-	iovpos = iov;
-	iovlen = 2;
+	r = TEMP_FAILURE_RETRY(recvmsg(fd, &msg,
+					MSG_CMSG_CLOEXEC | MSG_DONTWAIT));
+	if (r <= 0)
+		return false;
 
-	while (1) {
-		memset(&msg, 0, sizeof(msg));
-		msg.msg_iov = iovpos;
-		msg.msg_iovlen = iovlen;
-		msg.msg_control = &fd_buf;
-		msg.msg_controllen = sizeof(fd_buf);
-
-		r = TEMP_FAILURE_RETRY(recvmsg(fd, &msg,
-					MSG_CMSG_CLOEXEC | MSG_WAITALL));
-		if (r < 0)
-			goto cmsg_fail;
-
-		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg;
-				cmsg = CMSG_NXTHDR(&msg, cmsg)) {
-			if (cmsg->cmsg_level != SOL_SOCKET ||
-					cmsg->cmsg_type != SCM_RIGHTS)
-				continue;
+	classic_recv_fds(classic, &msg);
 
-			num_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
-			fds = (void *) CMSG_DATA(cmsg);
+	if (classic->rx_msg) {
+		size_t len = classic->rx_msg_size - classic->rx_msg_pos;
 
-			/* Set FD_CLOEXEC on all file descriptors */
-			for (i = 0; i < num_fds; i++) {
-				long flags;
+		if ((size_t) r < len)
+			len = r;
 
-				flags = fcntl(fds[i], F_GETFD, NULL);
-				if (flags < 0)
-					continue;
+		classic->rx_msg_pos += len;
+		r -= len;
+	}
 
-				if (!(flags & FD_CLOEXEC))
-					fcntl(fds[i], F_SETFD,
-						flags | FD_CLOEXEC);
-			}
+	classic->rx_end += r;
 
-			classic->fd_buf = l_realloc(classic->fd_buf,
-						(classic->num_fds + num_fds) *
-						sizeof(int));
-			memcpy(classic->fd_buf + classic->num_fds, fds,
-				num_fds * sizeof(int));
-			classic->num_fds += num_fds;
-		}
+	return true;
+}
 
-		while ((size_t) r >= iovpos->iov_len) {
-			r -= iovpos->iov_len;
-			iovpos++;
-			iovlen--;
+static struct l_dbus_message *classic_build_message(struct l_dbus *dbus,
+							void *data)
+{
+	struct l_dbus_classic *classic =
+		container_of(dbus, struct l_dbus_classic, super);
+	const struct dbus_header *hdr = data;
+	struct l_dbus_message *message;
+	size_t header_size;
+	uint32_t num_fds;
 
-			if (!iovlen)
-				break;
-		}
+	/* classic_next_blob has checked the endianness and version */
+	header_size = align_len(DBUS_HEADER_SIZE + hdr->dbus1.field_length, 8);
 
-		if (!iovlen)
-			break;
+	num_fds = classic->num_fds;
+	message = dbus_message_build(data, header_size, hdr->dbus1.body_length,
+					classic->fd_buf, &num_fds);
+	if (!message)
+		goto bad_msg;
 
-		iovpos->iov_base += r;
-		iovpos->iov_len -= r;
-	}
+	if (dbus->support_memfd_body && num_fds == 1)
+		_dbus_message_from_memfd(message);
+
+	if (num_fds)
+		classic_take_fds(classic, num_fds);
+
+	return message;
+
+bad_msg:
+	/* Later messages in the batch may own the fds following these */
+	classic_drop_fds(classic, num_fds);
+	l_free(data);
 
-	if (hdr.endian != DBUS_NATIVE_ENDIAN) {
+	return NULL;
+}
+
+static bool classic_header_valid(struct l_dbus_classic *classic,
+					const struct dbus_header *hdr)
+{
+	struct l_dbus *dbus = &classic->super;
+
+	if (hdr->endian != DBUS_NATIVE_ENDIAN) {
 		l_util_debug(dbus->debug_handler,
 				dbus->debug_data, "Endianness incorrect");
-		goto bad_msg;
+		return false;
 	}
 
-	if (hdr.version != 1) {
+	if (hdr->version != 1) {
 		l_util_debug(dbus->debug_handler,
 				dbus->debug_data, "Protocol version incorrect");
-		goto bad_msg;
+		return false;
 	}
 
-	num_fds = _dbus_message_unix_fds_from_header(header, header_size);
-	if (num_fds > classic->num_fds)
-		goto bad_msg;
+	return true;
+}
+
+static void *classic_next_blob(struct l_dbus_classic *classic)
+{
+	struct dbus_header hdr;
+	size_t avail = classic->rx_end - classic->rx_start;
+	size_t size;
+	void *data;
 
-	message = dbus_message_build(header, header_size, body, body_size,
-					classic->fd_buf, num_fds);
+	if (classic->rx_msg) {
+		if (classic->rx_msg_pos < classic->rx_msg_size)
+			return NULL;
 
-	if (message && num_fds) {
-		if (classic->num_fds > num_fds) {
-			memmove(classic->fd_buf, classic->fd_buf + num_fds,
-				(classic->num_fds - num_fds) * sizeof(int));
-			classic->num_fds -= num_fds;
-		} else {
-			l_free(classic->fd_buf);
+		data = classic->rx_msg;
+		classic->rx_msg = NULL;
 
-			classic->fd_buf = NULL;
-			classic->num_fds = 0;
-		}
+		return data;
 	}
 
-	if (message)
-		return message;
+	if (avail < DBUS_HEADER_SIZE)
+		goto incomplete;
 
-bad_msg:
-cmsg_fail:
-	for (i = 0; i < classic->num_fds; i++)
-		close(classic->fd_buf[i]);
+	memcpy(&hdr, classic->rx_buf + classic->rx_start, DBUS_HEADER_SIZE);
 
-	l_free(classic->fd_buf);
+	if (!classic_header_valid(classic, &hdr))
+		goto invalid;
 
-	classic->fd_buf = NULL;
-	classic->num_fds = 0;
+	size = align_len(DBUS_HEADER_SIZE + hdr.dbus1.field_length, 8) +
+							hdr.dbus1.body_length;
 
-	l_free(header);
-	l_free(body);
+	if (size > DBUS_MAXIMUM_MESSAGE_LENGTH) {
+		l_util_debug(classic->super.debug_handler,
+				classic->super.debug_data,
+				"Message length %zu exceeds maximum", size);
+		goto invalid;
+	}
+
+	if (size > avail) {
+		if (size <= DBUS_RECV_BUFFER_SIZE)
+			goto incomplete;
+
+		/* Too large for the buffer, receive the rest in place */
+		classic->rx_msg = l_malloc(size);
+		classic->rx_msg_pos = avail;
+		classic->rx_msg_size = size;
+		memcpy(classic->rx_msg, classic->rx_buf + classic->rx_start,
+									avail);
+
+		classic->rx_start = 0;
+		classic->rx_end = 0;
+
+		return NULL;
+	}
+
+	/*
+	 * A message that starts at the beginning of the buffer and is
+	 * all it holds is suitably aligned to be used as is.  Unless it
+	 * is small enough that copying is cheaper than allocating a new
+	 * buffer, hand the buffer over instead.
+	 */
+	if (classic->rx_start == 0 && size == classic->rx_end &&
+			size >= DBUS_RECV_BUFFER_SIZE / 16) {
+		data = l_realloc(classic->rx_buf, size);
+
+		classic->rx_buf = NULL;
+		classic->rx_end = 0;
+
+		return data;
+	}
+
+	data = l_memdup(classic->rx_buf + classic->rx_start, size);
+	classic->rx_start += size;
+
+	if (classic->rx_start == classic->rx_end) {
+		classic->rx_start = 0;
+		classic->rx_end = 0;
+	}
+
+	return data;
+
+incomplete:
+	/* Keep the partial message at the front for the next read */
+	if (classic->rx_start) {
+		memmove(classic->rx_buf, classic->rx_buf + classic->rx_start,
+									avail);
+		classic->rx_start = 0;
+		classic->rx_end = avail;
+	}
+
+	return NULL;
+
+invalid:
+	/*
+	 * There is no way to find the next message boundary, drop what
+	 * is buffered and hang up so that the disconnect handler runs.
+	 */
+	classic_drop_fds(classic, classic->num_fds);
+	classic->rx_start = 0;
+	classic->rx_end = 0;
+	shutdown(l_io_get_fd(classic->super.io), SHUT_RDWR);
+
+	return NULL;
+}
+
+static struct l_dbus_message *classic_recv_message(struct l_dbus *dbus)
+{
+	struct l_dbus_classic *classic =
+		container_of(dbus, struct l_dbus_classic, super);
+	struct l_dbus_message *message;
+	void *data;
+
+	while ((data = classic_next_blob(classic))) {
+		message = classic_build_message(dbus, data);
+		if (message)
+			return message;
+	}
 
 	return NULL;
 }
@@ -1020,7 +1362,8 @@ static uint32_t classic_name_acquire(struct l_dbus *dbus, const char *name,
 
 static const struct l_dbus_ops classic_ops = {
 	.version = 1,
-	.send_message = classic_send_message,
+	.send_messages = classic_send_messages,
+	.recv_data = classic_recv_data,
 	.recv_message = classic_recv_message,
 	.free = classic_free,
 	.name_ops = {
@@ -1211,6 +1554,9 @@ LIB_EXPORT void l_dbus_destroy(struct l_dbus *dbus)
 	if (unlikely(!dbus))
 		return;
 
+	if (dbus->destroyed)
+		*dbus->destroyed = true;
+
 	if (dbus->ready_destroy)
 		dbus->ready_destroy(dbus->ready_data);
 
@@ -1222,6 +1568,9 @@ LIB_EXPORT void l_dbus_destroy(struct l_dbus *dbus)
 	l_hashmap_destroy(dbus->message_list, message_list_destroy);
 	l_queue_destroy(dbus->message_queue, message_queue_destroy);
 
+	if (dbus->tx_callback)
+		message_queue_destroy(dbus->tx_callback);
+
 	l_io_destroy(dbus->io);
 
 	if (dbus->disconnect_destroy)
@@ -1291,6 +1640,26 @@ LIB_EXPORT bool l_dbus_set_debug(struct l_dbus *dbus,
 	return true;
 }
 
+/*
+ * Send message bodies of at least @threshold bytes in a sealed memfd,
+ * passed as a Unix fd, and map such bodies when received instead of
+ * reading them off the socket.  The other end has to agree to this
+ * during authentication, so it must be set before that completes,
+ * e.g. right after l_dbus_new().  A message bus daemon never agrees,
+ * leaving this to peer-to-peer connections.  A threshold of 0, the
+ * default, disables sending memfd bodies.
+ */
+LIB_EXPORT bool l_dbus_set_memfd_threshold(struct l_dbus *dbus,
+							size_t threshold)
+{
+	if (unlikely(!dbus))
+		return false;
+
+	dbus->memfd_threshold = threshold;
+
+	return true;
+}
+
 LIB_EXPORT uint32_t l_dbus_send_with_reply(struct l_dbus *dbus,
 						struct l_dbus_message *message,
 						l_dbus_message_func_t function,
@@ -1339,6 +1708,18 @@ LIB_EXPORT bool l_dbus_cancel(struct l_dbus *dbus, uint32_t serial)
 		return true;
 	}
 
+	/* Let a partially written message finish, but drop its callback */
+	callback = dbus->tx_callback;
+	if (callback && callback->serial == serial) {
+		if (callback->destroy)
+			callback->destroy(callback->user_data);
+
+		callback->callback = NULL;
+		callback->destroy = NULL;
+		callback->user_data = NULL;
+		return true;
+	}
+
 	count = l_queue_foreach_remove(dbus->message_queue, remove_entry,
 							L_UINT_TO_PTR(serial));
 	if (!count)
@@ -83,6 +83,8 @@ bool l_dbus_set_disconnect_handler(struct l_dbus *dbus,
 bool l_dbus_set_debug(struct l_dbus *dbus, l_dbus_debug_func_t function,
 				void *user_data, l_dbus_destroy_func_t destroy);
 
+bool l_dbus_set_memfd_threshold(struct l_dbus *dbus, size_t threshold);
+
 struct l_dbus_message;
 
 struct l_dbus_message_iter {
@@ -185,6 +187,10 @@ void l_dbus_message_builder_destroy(struct l_dbus_message_builder *builder);
 
 bool l_dbus_message_builder_append_basic(struct l_dbus_message_builder *builder,
 					char type, const void *value);
+bool l_dbus_message_builder_append_fixed_array(
+					struct l_dbus_message_builder *builder,
+					char type, const void *data,
+					uint32_t n_elem);
 
 bool l_dbus_message_builder_enter_container(
 					struct l_dbus_message_builder *builder,
@@ -0,0 +1,622 @@
+/*
+ *
+ *  Embedded Linux library
+ *
+ *  Copyright (C) 2019  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "util.h"
+#include "deque.h"
+#include "private.h"
+
+/**
+ * SECTION:deque
+ * @short_description: Double-ended queue support
+ *
+ * Array backed double-ended queue support.  Unlike #l_queue, pushing and
+ * popping at either end and indexed access are O(1) and entries are
+ * contiguous in memory.  Pointers to entries are not stable, so there is
+ * no equivalent of l_queue_get_entries().
+ */
+
+#define MIN_DEQUE_SIZE 8
+
+/**
+ * l_deque:
+ *
+ * Opague object representing the double-ended queue.
+ */
+struct l_deque {
+	void **items;
+	unsigned int size;
+	unsigned int head;
+	unsigned int entries;
+};
+
+static inline void **item(const struct l_deque *deque, unsigned int index)
+{
+	return &deque->items[(deque->head + index) & (deque->size - 1)];
+}
+
+/* Length of the first contiguous run of entries, starting at head */
+static inline unsigned int first_run(const struct l_deque *deque)
+{
+	unsigned int run = deque->size - deque->head;
+
+	return run < deque->entries ? run : deque->entries;
+}
+
+/* Moves all entries to the start of a new array of @size entries */
+static void deque_resize(struct l_deque *deque, unsigned int size)
+{
+	void **items = l_new(void *, size);
+	unsigned int first = first_run(deque);
+
+	if (deque->entries) {
+		memcpy(items, deque->items + deque->head,
+						first * sizeof(void *));
+		memcpy(items + first, deque->items,
+				(deque->entries - first) * sizeof(void *));
+	}
+
+	l_free(deque->items);
+
+	deque->items = items;
+	deque->size = size;
+	deque->head = 0;
+}
+
+static void deque_grow(struct l_deque *deque)
+{
+	if (deque->entries < deque->size)
+		return;
+
+	deque_resize(deque, deque->size ? deque->size * 2 : MIN_DEQUE_SIZE);
+}
+
+/**
+ * l_deque_new:
+ *
+ * Create a new double-ended queue.
+ *
+ * No error handling is needed since. In case of real memory allocation
+ * problems abort() will be called.
+ *
+ * Returns: a newly allocated #l_deque object
+ **/
+LIB_EXPORT struct l_deque *l_deque_new(void)
+{
+	return l_new(struct l_deque, 1);
+}
+
+/**
+ * l_deque_destroy:
+ * @deque: deque object
+ * @destroy: destroy function
+ *
+ * Free deque and call @destroy on all remaining entries.
+ **/
+LIB_EXPORT void l_deque_destroy(struct l_deque *deque,
+				l_deque_destroy_func_t destroy)
+{
+	if (unlikely(!deque))
+		return;
+
+	l_deque_clear(deque, destroy);
+	l_free(deque->items);
+	l_free(deque);
+}
+
+/**
+ * l_deque_clear:
+ * @deque: deque object
+ * @destroy: destroy function
+ *
+ * Clear deque and call @destroy on all remaining entries.
+ **/
+LIB_EXPORT void l_deque_clear(struct l_deque *deque,
+				l_deque_destroy_func_t destroy)
+{
+	unsigned int i;
+
+	if (unlikely(!deque))
+		return;
+
+	if (destroy)
+		for (i = 0; i < deque->entries; i++)
+			destroy(*item(deque, i));
+
+	deque->head = 0;
+	deque->entries = 0;
+}
+
+/**
+ * l_deque_push_tail:
+ * @deque: deque object
+ * @data: pointer to data
+ *
+ * Adds @data pointer at the end of the deque.
+ *
+ * Returns: #true when data has been added and #false in case an invalid
+ *          @deque object has been provided
+ **/
+LIB_EXPORT bool l_deque_push_tail(struct l_deque *deque, void *data)
+{
+	if (unlikely(!deque))
+		return false;
+
+	deque_grow(deque);
+
+	*item(deque, deque->entries) = data;
+	deque->entries++;
+
+	return true;
+}
+
+/**
+ * l_deque_push_head:
+ * @deque: deque object
+ * @data: pointer to data
+ *
+ * Adds @data pointer at the start of the deque.
+ *
+ * Returns: #true when data has been added and #false in case an invalid
+ *          @deque object has been provided
+ **/
+LIB_EXPORT bool l_deque_push_head(struct l_deque *deque, void *data)
+{
+	if (unlikely(!deque))
+		return false;
+
+	deque_grow(deque);
+
+	deque->head = (deque->head - 1) & (deque->size - 1);
+	deque->items[deque->head] = data;
+	deque->entries++;
+
+	return true;
+}
+
+/**
+ * l_deque_pop_head:
+ * @deque: deque object
+ *
+ * Removes the first element of the deque and returns it.
+ *
+ * Returns: data pointer to first element or #NULL in case of an empty deque
+ **/
+LIB_EXPORT void *l_deque_pop_head(struct l_deque *deque)
+{
+	void *data;
+
+	if (unlikely(!deque))
+		return NULL;
+
+	if (!deque->entries)
+		return NULL;
+
+	data = deque->items[deque->head];
+
+	deque->head = (deque->head + 1) & (deque->size - 1);
+	deque->entries--;
+
+	return data;
+}
+
+/**
+ * l_deque_pop_tail:
+ * @deque: deque object
+ *
+ * Removes the last element of the deque and returns it.
+ *
+ * Returns: data pointer to last element or #NULL in case of an empty deque
+ **/
+LIB_EXPORT void *l_deque_pop_tail(struct l_deque *deque)
+{
+	if (unlikely(!deque))
+		return NULL;
+
+	if (!deque->entries)
+		return NULL;
+
+	deque->entries--;
+
+	return *item(deque, deque->entries);
+}
+
+/**
+ * l_deque_peek_head:
+ * @deque: deque object
+ *
+ * Returns: data pointer to first element or #NULL in case of an empty deque
+ **/
+LIB_EXPORT void *l_deque_peek_head(struct l_deque *deque)
+{
+	return l_deque_at(deque, 0);
+}
+
+/**
+ * l_deque_peek_tail:
+ * @deque: deque object
+ *
+ * Returns: data pointer to last element or #NULL in case of an empty deque
+ **/
+LIB_EXPORT void *l_deque_peek_tail(struct l_deque *deque)
+{
+	if (unlikely(!deque))
+		return NULL;
+
+	if (!deque->entries)
+		return NULL;
+
+	return *item(deque, deque->entries - 1);
+}
+
+/**
+ * l_deque_at:
+ * @deque: deque object
+ * @index: position of the element, starting with 0 at the head
+ *
+ * Returns: data pointer to the element at @index or #NULL if @index is
+ *          out of range
+ **/
+LIB_EXPORT void *l_deque_at(struct l_deque *deque, unsigned int index)
+{
+	if (unlikely(!deque))
+		return NULL;
+
+	if (index >= deque->entries)
+		return NULL;
+
+	return *item(deque, index);
+}
+
+/**
+ * l_deque_remove_at:
+ * @deque: deque object
+ * @index: position of the element, starting with 0 at the head
+ *
+ * Removes the element at @index.  The elements on the shorter side of
+ * @index are moved to close the gap.
+ *
+ * Returns: data pointer to the removed element or #NULL if @index is
+ *          out of range
+ **/
+LIB_EXPORT void *l_deque_remove_at(struct l_deque *deque, unsigned int index)
+{
+	void *data;
+	unsigned int i;
+
+	if (unlikely(!deque))
+		return NULL;
+
+	if (index >= deque->entries)
+		return NULL;
+
+	data = *item(deque, index);
+
+	if (index < deque->entries / 2) {
+		for (i = index; i > 0; i--)
+			*item(deque, i) = *item(deque, i - 1);
+
+		deque->head = (deque->head + 1) & (deque->size - 1);
+	} else {
+		for (i = index; i + 1 < deque->entries; i++)
+			*item(deque, i) = *item(deque, i + 1);
+	}
+
+	deque->entries--;
+
+	return data;
+}
+
+/**
+ * l_deque_find:
+ * @deque: deque object
+ * @function: match function
+ * @user_data: user data given to compare function
+ *
+ * Finds an entry in the deque by running the match @function
+ *
+ * Returns: Matching entry or NULL if no entry can be found
+ **/
+LIB_EXPORT void *l_deque_find(struct l_deque *deque,
+				l_deque_match_func_t function,
+				const void *user_data)
+{
+	void **items;
+	unsigned int i, run;
+
+	if (unlikely(!deque || !function))
+		return NULL;
+
+	items = deque->items + deque->head;
+	run = first_run(deque);
+
+	for (i = 0; i < run; i++)
+		if (function(items[i], user_data))
+			return items[i];
+
+	items = deque->items;
+	run = deque->entries - run;
+
+	for (i = 0; i < run; i++)
+		if (function(items[i], user_data))
+			return items[i];
+
+	return NULL;
+}
+
+/**
+ * l_deque_remove:
+ * @deque: deque object
+ * @data: pointer to data
+ *
+ * Remove the first occurrence of @data from the deque.
+ *
+ * Returns: #true when data has been removed and #false when data could not
+ *          be found or an invalid @deque object has been provided
+ **/
+LIB_EXPORT bool l_deque_remove(struct l_deque *deque, void *data)
+{
+	unsigned int i;
+
+	if (unlikely(!deque))
+		return false;
+
+	for (i = 0; i < deque->entries; i++) {
+		if (*item(deque, i) != data)
+			continue;
+
+		l_deque_remove_at(deque, i);
+
+		return true;
+	}
+
+	return false;
+}
+
+/**
+ * l_deque_remove_if
+ * @deque: deque object
+ * @function: callback function
+ * @user_data: user data given to callback function
+ *
+ * Remove the first entry in the @deque where the function returns #true.
+ *
+ * Returns: NULL if no entry was found, or the entry data if removal was
+ * successful.
+ **/
+LIB_EXPORT void *l_deque_remove_if(struct l_deque *deque,
+					l_deque_match_func_t function,
+					const void *user_data)
+{
+	unsigned int i;
+
+	if (unlikely(!deque || !function))
+		return NULL;
+
+	for (i = 0; i < deque->entries; i++) {
+		if (function(*item(deque, i), user_data))
+			return l_deque_remove_at(deque, i);
+	}
+
+	return NULL;
+}
+
+/**
+ * l_deque_sort:
+ * @deque: deque object
+ * @function: compare function
+ * @user_data: user data given to compare function
+ *
+ * Sorts the deque in ascending order as determined by @function, which
+ * should return < 0, 0 or > 0 like strcmp().  The sort is stable.
+ **/
+LIB_EXPORT void l_deque_sort(struct l_deque *deque,
+				l_deque_compare_func_t function, void *user_data)
+{
+	void **src, **dst, **tmp;
+	unsigned int n, width, i;
+
+	if (unlikely(!deque || !function))
+		return;
+
+	n = deque->entries;
+	if (n < 2)
+		return;
+
+	/* Make the entries contiguous, then do a bottom-up merge sort */
+	if (deque->head + n > deque->size)
+		deque_resize(deque, deque->size);
+
+	src = deque->items + deque->head;
+	dst = l_new(void *, n);
+
+	for (width = 1; width < n; width *= 2) {
+		for (i = 0; i < n; i += 2 * width) {
+			unsigned int left = i;
+			unsigned int mid = minsize(i + width, n);
+			unsigned int right = minsize(i + 2 * width, n);
+			unsigned int a = left, b = mid, out = left;
+
+			while (a < mid && b < right) {
+				if (function(src[b], src[a], user_data) < 0)
+					dst[out++] = src[b++];
+				else
+					dst[out++] = src[a++];
+			}
+
+			while (a < mid)
+				dst[out++] = src[a++];
+
+			while (b < right)
+				dst[out++] = src[b++];
+		}
+
+		tmp = src;
+		src = dst;
+		dst = tmp;
+	}
+
+	if (src != deque->items + deque->head) {
+		memcpy(deque->items + deque->head, src, n * sizeof(void *));
+		l_free(src);
+	} else
+		l_free(dst);
+}
+
+/**
+ * l_deque_bsearch:
+ * @deque: deque object
+ * @key: key to search for
+ * @function: compare function, called with @key as the first argument
+ * @user_data: user data given to compare function
+ *
+ * Searches a deque that is sorted according to @function for an entry
+ * matching @key.
+ *
+ * Returns: Matching entry or NULL if no entry can be found
+ **/
+LIB_EXPORT void *l_deque_bsearch(struct l_deque *deque, const void *key,
+				l_deque_compare_func_t function, void *user_data)
+{
+	unsigned int low, high;
+
+	if (unlikely(!deque || !function))
+		return NULL;
+
+	low = 0;
+	high = deque->entries;
+
+	while (low < high) {
+		unsigned int mid = low + (high - low) / 2;
+		void *data = *item(deque, mid);
+		int cmp = function(key, data, user_data);
+
+		if (cmp == 0)
+			return data;
+
+		if (cmp < 0)
+			high = mid;
+		else
+			low = mid + 1;
+	}
+
+	return NULL;
+}
+
+/**
+ * l_deque_foreach:
+ * @deque: deque object
+ * @function: callback function
+ * @user_data: user data given to callback function
+ *
+ * Call @function for every given data in @deque.
+ *
+ * NOTE: While the foreach is in progress, the deque is assumed to be
+ * invariant.  The behavior of adding or removing entries while a foreach
+ * operation is in progress is undefined.
+ **/
+LIB_EXPORT void l_deque_foreach(struct l_deque *deque,
+			l_deque_foreach_func_t function, void *user_data)
+{
+	void **items;
+	unsigned int i, run;
+
+	if (unlikely(!deque || !function))
+		return;
+
+	items = deque->items + deque->head;
+	run = first_run(deque);
+
+	for (i = 0; i < run; i++)
+		function(items[i], user_data);
+
+	items = deque->items;
+	run = deque->entries - run;
+
+	for (i = 0; i < run; i++)
+		function(items[i], user_data);
+}
+
+/**
+ * l_deque_foreach_remove:
+ * @deque: deque object
+ * @function: callback function
+ * @user_data: user data given to callback function
+ *
+ * Remove all entries in the @deque where @function returns #true.
+ *
+ * Returns: number of removed entries
+ **/
+LIB_EXPORT unsigned int l_deque_foreach_remove(struct l_deque *deque,
+				l_deque_remove_func_t function, void *user_data)
+{
+	unsigned int i, kept = 0;
+	unsigned int count;
+
+	if (unlikely(!deque || !function))
+		return 0;
+
+	for (i = 0; i < deque->entries; i++) {
+		void *data = *item(deque, i);
+
+		if (function(data, user_data))
+			continue;
+
+		*item(deque, kept++) = data;
+	}
+
+	count = deque->entries - kept;
+	deque->entries = kept;
+
+	return count;
+}
+
+/**
+ * l_deque_length:
+ * @deque: deque object
+ *
+ * Returns: entries of the deque
+ **/
+LIB_EXPORT unsigned int l_deque_length(struct l_deque *deque)
+{
+	if (unlikely(!deque))
+		return 0;
+
+	return deque->entries;
+}
+
+/**
+ * l_deque_isempty:
+ * @deque: deque object
+ *
+ * Returns: #true if @deque is empty and #false if not
+ **/
+LIB_EXPORT bool l_deque_isempty(struct l_deque *deque)
+{
+	if (unlikely(!deque))
+		return true;
+
+	return deque->entries == 0;
+}
@@ -0,0 +1,80 @@
+/*
+ *
+ *  Embedded Linux library
+ *
+ *  Copyright (C) 2019  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifndef __ELL_DEQUE_H
+#define __ELL_DEQUE_H
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void (*l_deque_foreach_func_t) (void *data, void *user_data);
+typedef void (*l_deque_destroy_func_t) (void *data);
+typedef int (*l_deque_compare_func_t) (const void *a, const void *b,
+							void *user_data);
+typedef bool (*l_deque_match_func_t) (const void *a, const void *b);
+typedef bool (*l_deque_remove_func_t) (void *data, void *user_data);
+
+struct l_deque;
+
+struct l_deque *l_deque_new(void);
+void l_deque_destroy(struct l_deque *deque,
+			l_deque_destroy_func_t destroy);
+void l_deque_clear(struct l_deque *deque,
+			l_deque_destroy_func_t destroy);
+
+bool l_deque_push_tail(struct l_deque *deque, void *data);
+bool l_deque_push_head(struct l_deque *deque, void *data);
+void *l_deque_pop_head(struct l_deque *deque);
+void *l_deque_pop_tail(struct l_deque *deque);
+void *l_deque_peek_head(struct l_deque *deque);
+void *l_deque_peek_tail(struct l_deque *deque);
+
+void *l_deque_at(struct l_deque *deque, unsigned int index);
+void *l_deque_remove_at(struct l_deque *deque, unsigned int index);
+
+void *l_deque_find(struct l_deque *deque,
+			l_deque_match_func_t function, const void *user_data);
+bool l_deque_remove(struct l_deque *deque, void *data);
+void *l_deque_remove_if(struct l_deque *deque,
+			l_deque_match_func_t function, const void *user_data);
+
+void l_deque_sort(struct l_deque *deque,
+			l_deque_compare_func_t function, void *user_data);
+void *l_deque_bsearch(struct l_deque *deque, const void *key,
+			l_deque_compare_func_t function, void *user_data);
+
+void l_deque_foreach(struct l_deque *deque,
+			l_deque_foreach_func_t function, void *user_data);
+unsigned int l_deque_foreach_remove(struct l_deque *deque,
+			l_deque_remove_func_t function, void *user_data);
+
+unsigned int l_deque_length(struct l_deque *deque);
+bool l_deque_isempty(struct l_deque *deque);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __ELL_DEQUE_H */
@@ -0,0 +1,75 @@
+/*
+ *
+ *  Embedded Linux library
+ *
+ *  Copyright (C) 2019  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "checksum.h"
+
+#define DIGEST_MAX_BLOCK_LEN	128
+#define DIGEST_MAX_LEN		64
+
+struct digest_alg;
+
+/*
+ * In-process message digests, for callers that would otherwise spend
+ * most of their time in AF_ALG round trips on small inputs.  Contexts
+ * hold no references and can be copied with a plain assignment.
+ */
+struct digest_ctx {
+	const struct digest_alg *alg;
+	uint64_t len;
+	union {
+		uint32_t h32[8];
+		uint64_t h64[8];
+	} state;
+	uint8_t buf[DIGEST_MAX_BLOCK_LEN];
+	unsigned int buf_len;
+};
+
+struct hmac_ctx {
+	struct digest_ctx inner;
+	struct digest_ctx outer;
+	struct digest_ctx ctx;
+};
+
+bool _digest_supported(enum l_checksum_type type);
+size_t _digest_length(enum l_checksum_type type);
+
+bool _digest_init(struct digest_ctx *ctx, enum l_checksum_type type);
+void _digest_update(struct digest_ctx *ctx, const void *data, size_t len);
+void _digest_final(struct digest_ctx *ctx, uint8_t *out);
+
+bool _hmac_init(struct hmac_ctx *hmac, enum l_checksum_type type,
+					const void *key, size_t key_len);
+void _hmac_reset(struct hmac_ctx *hmac);
+void _hmac_update(struct hmac_ctx *hmac, const void *data, size_t len);
+void _hmac_final(struct hmac_ctx *hmac, uint8_t *out);
+void _hmac_iterate(struct hmac_ctx *hmac, uint8_t *u, uint8_t *t,
+							unsigned int count);
+
+struct iovec;
+
+bool _digest_many(enum l_checksum_type type, const struct iovec *msgs,
+					size_t count, uint8_t *out);
+bool _digest_many_set_avx2(bool enable);
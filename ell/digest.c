@@ -0,0 +1,966 @@
+/*
+ *
+ *  Embedded Linux library
+ *
+ *  Copyright (C) 2019  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+#include <string.h>
+#include <sys/uio.h>
+
+#include "util.h"
+#include "checksum.h"
+#include "private.h"
+#include "digest-private.h"
+
+/* RFC 1321 MD5 and FIPS 180-4 SHA-1, SHA-224, SHA-256, SHA-384, SHA-512 */
+
+/*
+ * Eight independent 32-bit lanes.  GCC lowers the vector operations to
+ * whatever the target has: two SSE2 registers by default, one AVX2
+ * register in functions built for it, scalar code elsewhere.
+ */
+#define MB_LANES 8
+
+typedef uint32_t mb_vec __attribute__ ((vector_size(MB_LANES * 4)));
+
+struct digest_alg {
+	unsigned int block_len;
+	unsigned int digest_len;
+	unsigned int state_len;
+	bool little_endian;
+	const void *iv;
+	void (*compress)(void *state, const uint8_t *data, size_t blocks);
+	void (*compress_many)(mb_vec *state, const uint8_t **blocks);
+};
+
+#define ROL32(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define ROR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+#define ROR64(x, n) (((x) >> (n)) | ((x) << (64 - (n))))
+
+static const uint32_t md5_iv[4] = {
+	0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476,
+};
+
+static const uint32_t md5_k[64] = {
+	0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee,
+	0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+	0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+	0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+	0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa,
+	0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+	0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed,
+	0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+	0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+	0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+	0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05,
+	0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+	0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039,
+	0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+	0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+	0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+};
+
+static const uint8_t md5_r[4][4] = {
+	{ 7, 12, 17, 22 },
+	{ 5, 9, 14, 20 },
+	{ 4, 11, 16, 23 },
+	{ 6, 10, 15, 21 },
+};
+
+static void md5_compress(void *state, const uint8_t *data, size_t blocks)
+{
+	uint32_t *h = state;
+	uint32_t w[16];
+	uint32_t a, b, c, d, f, t;
+	unsigned int i, g;
+
+	while (blocks--) {
+		a = h[0];
+		b = h[1];
+		c = h[2];
+		d = h[3];
+
+		for (i = 0; i < 16; i++)
+			w[i] = l_get_le32(data + i * 4);
+
+		for (i = 0; i < 64; i++) {
+			switch (i / 16) {
+			case 0:
+				f = (b & c) | (~b & d);
+				g = i;
+				break;
+			case 1:
+				f = (d & b) | (~d & c);
+				g = (5 * i + 1) & 15;
+				break;
+			case 2:
+				f = b ^ c ^ d;
+				g = (3 * i + 5) & 15;
+				break;
+			default:
+				f = c ^ (b | ~d);
+				g = (7 * i) & 15;
+				break;
+			}
+
+			t = d;
+			d = c;
+			c = b;
+			b += ROL32(a + f + md5_k[i] + w[g], md5_r[i / 16][i & 3]);
+			a = t;
+		}
+
+		h[0] += a;
+		h[1] += b;
+		h[2] += c;
+		h[3] += d;
+
+		data += 64;
+	}
+}
+
+static const uint32_t sha1_iv[5] = {
+	0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0,
+};
+
+#define SHA1_W(i) (w[(i) & 15] = ROL32(w[((i) + 13) & 15] ^	\
+				w[((i) + 8) & 15] ^ w[((i) + 2) & 15] ^	\
+				w[(i) & 15], 1))
+
+#define SHA1_ROUND(f, k, wi)					\
+	do {							\
+		t = ROL32(a, 5) + (f) + e + (k) + (wi);		\
+		e = d;						\
+		d = c;						\
+		c = ROL32(b, 30);				\
+		b = a;						\
+		a = t;						\
+	} while (0)
+
+static void sha1_compress(void *state, const uint8_t *data, size_t blocks)
+{
+	uint32_t *h = state;
+	uint32_t w[16];
+	uint32_t a, b, c, d, e, t;
+	unsigned int i;
+
+	while (blocks--) {
+		a = h[0];
+		b = h[1];
+		c = h[2];
+		d = h[3];
+		e = h[4];
+
+		for (i = 0; i < 16; i++) {
+			w[i] = l_get_be32(data + i * 4);
+			SHA1_ROUND((b & c) | (~b & d), 0x5a827999, w[i]);
+		}
+
+		for (; i < 20; i++)
+			SHA1_ROUND((b & c) | (~b & d), 0x5a827999, SHA1_W(i));
+
+		for (; i < 40; i++)
+			SHA1_ROUND(b ^ c ^ d, 0x6ed9eba1, SHA1_W(i));
+
+		for (; i < 60; i++)
+			SHA1_ROUND((b & c) | (b & d) | (c & d), 0x8f1bbcdc,
+								SHA1_W(i));
+
+		for (; i < 80; i++)
+			SHA1_ROUND(b ^ c ^ d, 0xca62c1d6, SHA1_W(i));
+
+		h[0] += a;
+		h[1] += b;
+		h[2] += c;
+		h[3] += d;
+		h[4] += e;
+
+		data += 64;
+	}
+}
+
+static const uint32_t sha224_iv[8] = {
+	0xc1059ed8, 0x367cd507, 0x3070dd17, 0xf70e5939,
+	0xffc00b31, 0x68581511, 0x64f98fa7, 0xbefa4fa4,
+};
+
+static const uint32_t sha256_iv[8] = {
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+	0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+static const uint32_t sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static void sha256_compress(void *state, const uint8_t *data, size_t blocks)
+{
+	uint32_t *h = state;
+	uint32_t w[16];
+	uint32_t a, b, c, d, e, f, g, hh, t1, t2, s0, s1;
+	unsigned int i;
+
+	while (blocks--) {
+		a = h[0];
+		b = h[1];
+		c = h[2];
+		d = h[3];
+		e = h[4];
+		f = h[5];
+		g = h[6];
+		hh = h[7];
+
+		for (i = 0; i < 64; i++) {
+			if (i < 16)
+				w[i] = l_get_be32(data + i * 4);
+			else {
+				s0 = w[(i + 1) & 15];
+				s0 = ROR32(s0, 7) ^ ROR32(s0, 18) ^ (s0 >> 3);
+				s1 = w[(i + 14) & 15];
+				s1 = ROR32(s1, 17) ^ ROR32(s1, 19) ^ (s1 >> 10);
+				w[i & 15] += s0 + s1 + w[(i + 9) & 15];
+			}
+
+			t1 = hh + (ROR32(e, 6) ^ ROR32(e, 11) ^ ROR32(e, 25)) +
+				((e & f) ^ (~e & g)) + sha256_k[i] + w[i & 15];
+			t2 = (ROR32(a, 2) ^ ROR32(a, 13) ^ ROR32(a, 22)) +
+				((a & b) ^ (a & c) ^ (b & c));
+
+			hh = g;
+			g = f;
+			f = e;
+			e = d + t1;
+			d = c;
+			c = b;
+			b = a;
+			a = t1 + t2;
+		}
+
+		h[0] += a;
+		h[1] += b;
+		h[2] += c;
+		h[3] += d;
+		h[4] += e;
+		h[5] += f;
+		h[6] += g;
+		h[7] += hh;
+
+		data += 64;
+	}
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_MB_AVX2
+#define MB_AVX2_TARGET __attribute__ ((target("avx2")))
+
+static int mb_avx2 = -1;
+
+static bool mb_use_avx2(void)
+{
+	if (mb_avx2 < 0) {
+		__builtin_cpu_init();
+		mb_avx2 = __builtin_cpu_supports("avx2");
+	}
+
+	return mb_avx2;
+}
+#endif
+
+/* Vectors are passed by reference, returning them would change the ABI */
+static inline __attribute__ ((always_inline))
+void mb_load_be32(mb_vec *v, const uint8_t **blocks, unsigned int offset)
+{
+	unsigned int i;
+
+	for (i = 0; i < MB_LANES; i++)
+		(*v)[i] = l_get_be32(blocks[i] + offset);
+}
+
+/* One block from each lane, same rounds as sha1_compress */
+static inline __attribute__ ((always_inline))
+void sha1_compress_lanes(mb_vec *h, const uint8_t **blocks)
+{
+	mb_vec w[16];
+	mb_vec a, b, c, d, e, t;
+	unsigned int i;
+
+	a = h[0];
+	b = h[1];
+	c = h[2];
+	d = h[3];
+	e = h[4];
+
+	for (i = 0; i < 16; i++) {
+		mb_load_be32(&w[i], blocks, i * 4);
+		SHA1_ROUND((b & c) | (~b & d), 0x5a827999, w[i]);
+	}
+
+	for (; i < 20; i++)
+		SHA1_ROUND((b & c) | (~b & d), 0x5a827999, SHA1_W(i));
+
+	for (; i < 40; i++)
+		SHA1_ROUND(b ^ c ^ d, 0x6ed9eba1, SHA1_W(i));
+
+	for (; i < 60; i++)
+		SHA1_ROUND((b & c) | (b & d) | (c & d), 0x8f1bbcdc, SHA1_W(i));
+
+	for (; i < 80; i++)
+		SHA1_ROUND(b ^ c ^ d, 0xca62c1d6, SHA1_W(i));
+
+	h[0] += a;
+	h[1] += b;
+	h[2] += c;
+	h[3] += d;
+	h[4] += e;
+}
+
+static inline __attribute__ ((always_inline))
+void sha256_compress_lanes(mb_vec *h, const uint8_t **blocks)
+{
+	mb_vec w[16];
+	mb_vec a, b, c, d, e, f, g, hh, t1, t2, s0, s1;
+	unsigned int i;
+
+	a = h[0];
+	b = h[1];
+	c = h[2];
+	d = h[3];
+	e = h[4];
+	f = h[5];
+	g = h[6];
+	hh = h[7];
+
+	for (i = 0; i < 64; i++) {
+		if (i < 16)
+			mb_load_be32(&w[i], blocks, i * 4);
+		else {
+			s0 = w[(i + 1) & 15];
+			s0 = ROR32(s0, 7) ^ ROR32(s0, 18) ^ (s0 >> 3);
+			s1 = w[(i + 14) & 15];
+			s1 = ROR32(s1, 17) ^ ROR32(s1, 19) ^ (s1 >> 10);
+			w[i & 15] += s0 + s1 + w[(i + 9) & 15];
+		}
+
+		t1 = hh + (ROR32(e, 6) ^ ROR32(e, 11) ^ ROR32(e, 25)) +
+			((e & f) ^ (~e & g)) + sha256_k[i] + w[i & 15];
+		t2 = (ROR32(a, 2) ^ ROR32(a, 13) ^ ROR32(a, 22)) +
+			((a & b) ^ (a & c) ^ (b & c));
+
+		hh = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+
+	h[0] += a;
+	h[1] += b;
+	h[2] += c;
+	h[3] += d;
+	h[4] += e;
+	h[5] += f;
+	h[6] += g;
+	h[7] += hh;
+}
+
+#ifdef HAVE_MB_AVX2
+static MB_AVX2_TARGET void sha1_compress_avx2(mb_vec *h,
+						const uint8_t **blocks)
+{
+	sha1_compress_lanes(h, blocks);
+}
+
+static MB_AVX2_TARGET void sha256_compress_avx2(mb_vec *h,
+						const uint8_t **blocks)
+{
+	sha256_compress_lanes(h, blocks);
+}
+#endif
+
+static void sha1_compress_many(mb_vec *h, const uint8_t **blocks)
+{
+#ifdef HAVE_MB_AVX2
+	if (mb_use_avx2()) {
+		sha1_compress_avx2(h, blocks);
+		return;
+	}
+#endif
+
+	sha1_compress_lanes(h, blocks);
+}
+
+static void sha256_compress_many(mb_vec *h, const uint8_t **blocks)
+{
+#ifdef HAVE_MB_AVX2
+	if (mb_use_avx2()) {
+		sha256_compress_avx2(h, blocks);
+		return;
+	}
+#endif
+
+	sha256_compress_lanes(h, blocks);
+}
+
+static const uint64_t sha384_iv[8] = {
+	0xcbbb9d5dc1059ed8ULL, 0x629a292a367cd507ULL,
+	0x9159015a3070dd17ULL, 0x152fecd8f70e5939ULL,
+	0x67332667ffc00b31ULL, 0x8eb44a8768581511ULL,
+	0xdb0c2e0d64f98fa7ULL, 0x47b5481dbefa4fa4ULL,
+};
+
+static const uint64_t sha512_iv[8] = {
+	0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL,
+	0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+	0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL,
+	0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL,
+};
+
+static const uint64_t sha512_k[80] = {
+	0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL,
+	0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
+	0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL,
+	0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+	0xd807aa98a3030242ULL, 0x12835b0145706fbeULL,
+	0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+	0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL,
+	0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+	0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL,
+	0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+	0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL,
+	0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+	0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL,
+	0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
+	0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL,
+	0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+	0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL,
+	0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+	0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL,
+	0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+	0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL,
+	0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
+	0xd192e819d6ef5218ULL, 0xd69906245565a910ULL,
+	0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+	0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL,
+	0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
+	0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL,
+	0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+	0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL,
+	0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+	0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL,
+	0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+	0xca273eceea26619cULL, 0xd186b8c721c0c207ULL,
+	0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
+	0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL,
+	0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+	0x28db77f523047d84ULL, 0x32caab7b40c72493ULL,
+	0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
+	0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL,
+	0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL,
+};
+
+static void sha512_compress(void *state, const uint8_t *data, size_t blocks)
+{
+	uint64_t *h = state;
+	uint64_t w[16];
+	uint64_t a, b, c, d, e, f, g, hh, t1, t2, s0, s1;
+	unsigned int i;
+
+	while (blocks--) {
+		a = h[0];
+		b = h[1];
+		c = h[2];
+		d = h[3];
+		e = h[4];
+		f = h[5];
+		g = h[6];
+		hh = h[7];
+
+		for (i = 0; i < 80; i++) {
+			if (i < 16)
+				w[i] = l_get_be64(data + i * 8);
+			else {
+				s0 = w[(i + 1) & 15];
+				s0 = ROR64(s0, 1) ^ ROR64(s0, 8) ^ (s0 >> 7);
+				s1 = w[(i + 14) & 15];
+				s1 = ROR64(s1, 19) ^ ROR64(s1, 61) ^ (s1 >> 6);
+				w[i & 15] += s0 + s1 + w[(i + 9) & 15];
+			}
+
+			t1 = hh + (ROR64(e, 14) ^ ROR64(e, 18) ^ ROR64(e, 41)) +
+				((e & f) ^ (~e & g)) + sha512_k[i] + w[i & 15];
+			t2 = (ROR64(a, 28) ^ ROR64(a, 34) ^ ROR64(a, 39)) +
+				((a & b) ^ (a & c) ^ (b & c));
+
+			hh = g;
+			g = f;
+			f = e;
+			e = d + t1;
+			d = c;
+			c = b;
+			b = a;
+			a = t1 + t2;
+		}
+
+		h[0] += a;
+		h[1] += b;
+		h[2] += c;
+		h[3] += d;
+		h[4] += e;
+		h[5] += f;
+		h[6] += g;
+		h[7] += hh;
+
+		data += 128;
+	}
+}
+
+static const struct digest_alg digest_algs[] = {
+	[L_CHECKSUM_MD5] = {
+		.block_len = 64, .digest_len = 16, .state_len = 16,
+		.little_endian = true, .iv = md5_iv, .compress = md5_compress,
+	},
+	[L_CHECKSUM_SHA1] = {
+		.block_len = 64, .digest_len = 20, .state_len = 20,
+		.iv = sha1_iv, .compress = sha1_compress,
+		.compress_many = sha1_compress_many,
+	},
+	[L_CHECKSUM_SHA224] = {
+		.block_len = 64, .digest_len = 28, .state_len = 32,
+		.iv = sha224_iv, .compress = sha256_compress,
+		.compress_many = sha256_compress_many,
+	},
+	[L_CHECKSUM_SHA256] = {
+		.block_len = 64, .digest_len = 32, .state_len = 32,
+		.iv = sha256_iv, .compress = sha256_compress,
+		.compress_many = sha256_compress_many,
+	},
+	[L_CHECKSUM_SHA384] = {
+		.block_len = 128, .digest_len = 48, .state_len = 64,
+		.iv = sha384_iv, .compress = sha512_compress,
+	},
+	[L_CHECKSUM_SHA512] = {
+		.block_len = 128, .digest_len = 64, .state_len = 64,
+		.iv = sha512_iv, .compress = sha512_compress,
+	},
+};
+
+static const struct digest_alg *digest_alg_get(enum l_checksum_type type)
+{
+	if ((unsigned int) type >= L_ARRAY_SIZE(digest_algs))
+		return NULL;
+
+	if (!digest_algs[type].compress)
+		return NULL;
+
+	return &digest_algs[type];
+}
+
+bool _digest_supported(enum l_checksum_type type)
+{
+	return digest_alg_get(type) != NULL;
+}
+
+size_t _digest_length(enum l_checksum_type type)
+{
+	const struct digest_alg *alg = digest_alg_get(type);
+
+	return alg ? alg->digest_len : 0;
+}
+
+static void state_to_bytes(const struct digest_alg *alg, const void *state,
+								uint8_t *out)
+{
+	unsigned int i;
+
+	if (alg->block_len == 128) {
+		const uint64_t *h = state;
+
+		for (i = 0; i < alg->digest_len / 8; i++)
+			l_put_be64(h[i], out + i * 8);
+	} else if (alg->little_endian) {
+		const uint32_t *h = state;
+
+		for (i = 0; i < alg->digest_len / 4; i++)
+			l_put_le32(h[i], out + i * 4);
+	} else {
+		const uint32_t *h = state;
+
+		for (i = 0; i < alg->digest_len / 4; i++)
+			l_put_be32(h[i], out + i * 4);
+	}
+}
+
+bool _digest_init(struct digest_ctx *ctx, enum l_checksum_type type)
+{
+	const struct digest_alg *alg = digest_alg_get(type);
+
+	if (!alg)
+		return false;
+
+	ctx->alg = alg;
+	ctx->len = 0;
+	ctx->buf_len = 0;
+	memcpy(&ctx->state, alg->iv, alg->state_len);
+
+	return true;
+}
+
+void _digest_update(struct digest_ctx *ctx, const void *data, size_t len)
+{
+	const struct digest_alg *alg = ctx->alg;
+	const uint8_t *ptr = data;
+	size_t blocks;
+
+	ctx->len += len;
+
+	if (ctx->buf_len) {
+		size_t n = alg->block_len - ctx->buf_len;
+
+		if (n > len)
+			n = len;
+
+		memcpy(ctx->buf + ctx->buf_len, ptr, n);
+		ctx->buf_len += n;
+		ptr += n;
+		len -= n;
+
+		if (ctx->buf_len < alg->block_len)
+			return;
+
+		alg->compress(&ctx->state, ctx->buf, 1);
+		ctx->buf_len = 0;
+	}
+
+	/* Whole blocks are compressed straight from the caller's buffer */
+	blocks = len / alg->block_len;
+	if (blocks) {
+		alg->compress(&ctx->state, ptr, blocks);
+		ptr += blocks * alg->block_len;
+		len -= blocks * alg->block_len;
+	}
+
+	memcpy(ctx->buf, ptr, len);
+	ctx->buf_len = len;
+}
+
+void _digest_final(struct digest_ctx *ctx, uint8_t *out)
+{
+	const struct digest_alg *alg = ctx->alg;
+	unsigned int len_size = alg->block_len / 8;
+	uint64_t bits = ctx->len * 8;
+
+	ctx->buf[ctx->buf_len++] = 0x80;
+
+	if (ctx->buf_len > alg->block_len - len_size) {
+		memset(ctx->buf + ctx->buf_len, 0,
+				alg->block_len - ctx->buf_len);
+		alg->compress(&ctx->state, ctx->buf, 1);
+		ctx->buf_len = 0;
+	}
+
+	/* The upper half of SHA-384/512's 128-bit length stays zero */
+	memset(ctx->buf + ctx->buf_len, 0, alg->block_len - ctx->buf_len - 8);
+
+	if (alg->little_endian)
+		l_put_le64(bits, ctx->buf + alg->block_len - 8);
+	else
+		l_put_be64(bits, ctx->buf + alg->block_len - 8);
+
+	alg->compress(&ctx->state, ctx->buf, 1);
+
+	state_to_bytes(alg, &ctx->state, out);
+}
+
+/* RFC 2104 */
+bool _hmac_init(struct hmac_ctx *hmac, enum l_checksum_type type,
+					const void *key, size_t key_len)
+{
+	const struct digest_alg *alg = digest_alg_get(type);
+	uint8_t pad[DIGEST_MAX_BLOCK_LEN];
+	unsigned int i;
+
+	if (!alg)
+		return false;
+
+	memset(pad, 0, sizeof(pad));
+
+	if (key_len > alg->block_len) {
+		_digest_init(&hmac->inner, type);
+		_digest_update(&hmac->inner, key, key_len);
+		_digest_final(&hmac->inner, pad);
+	} else
+		memcpy(pad, key, key_len);
+
+	for (i = 0; i < alg->block_len; i++)
+		pad[i] ^= 0x36;
+
+	_digest_init(&hmac->inner, type);
+	_digest_update(&hmac->inner, pad, alg->block_len);
+
+	for (i = 0; i < alg->block_len; i++)
+		pad[i] ^= 0x36 ^ 0x5c;
+
+	_digest_init(&hmac->outer, type);
+	_digest_update(&hmac->outer, pad, alg->block_len);
+
+	explicit_bzero(pad, sizeof(pad));
+
+	hmac->ctx = hmac->inner;
+
+	return true;
+}
+
+void _hmac_reset(struct hmac_ctx *hmac)
+{
+	hmac->ctx = hmac->inner;
+}
+
+void _hmac_update(struct hmac_ctx *hmac, const void *data, size_t len)
+{
+	_digest_update(&hmac->ctx, data, len);
+}
+
+void _hmac_final(struct hmac_ctx *hmac, uint8_t *out)
+{
+	uint8_t digest[DIGEST_MAX_LEN];
+	unsigned int digest_len = hmac->ctx.alg->digest_len;
+
+	_digest_final(&hmac->ctx, digest);
+
+	hmac->ctx = hmac->outer;
+	_digest_update(&hmac->ctx, digest, digest_len);
+	_digest_final(&hmac->ctx, out);
+
+	hmac->ctx = hmac->inner;
+
+	explicit_bzero(digest, sizeof(digest));
+}
+
+/*
+ * Iterate U = HMAC(key, U) @count times over a digest sized @u, XORing
+ * every result into @t, as PBKDF2 does.  Both the inner and the outer
+ * message fit in a single block with the same padding, so each round
+ * is just two compression function calls on a prepared block.
+ */
+void _hmac_iterate(struct hmac_ctx *hmac, uint8_t *u, uint8_t *t,
+							unsigned int count)
+{
+	const struct digest_alg *alg = hmac->inner.alg;
+	unsigned int digest_len = alg->digest_len;
+	uint8_t block[DIGEST_MAX_BLOCK_LEN];
+	uint64_t state[8];
+	uint64_t bits;
+	unsigned int i;
+
+	memset(block, 0, alg->block_len);
+	memcpy(block, u, digest_len);
+	block[digest_len] = 0x80;
+	bits = (uint64_t) (alg->block_len + digest_len) * 8;
+
+	if (alg->little_endian)
+		l_put_le64(bits, block + alg->block_len - 8);
+	else
+		l_put_be64(bits, block + alg->block_len - 8);
+
+	while (count--) {
+		memcpy(state, &hmac->inner.state, alg->state_len);
+		alg->compress(state, block, 1);
+		state_to_bytes(alg, state, block);
+
+		memcpy(state, &hmac->outer.state, alg->state_len);
+		alg->compress(state, block, 1);
+		state_to_bytes(alg, state, block);
+
+		for (i = 0; i < digest_len; i++)
+			t[i] ^= block[i];
+	}
+
+	memcpy(u, block, digest_len);
+
+	explicit_bzero(block, sizeof(block));
+	explicit_bzero(state, sizeof(state));
+}
+
+struct mb_lane {
+	const uint8_t *data;
+	size_t blocks;
+	uint8_t tail[128];
+	unsigned int tail_blocks;
+	unsigned int tail_pos;
+	size_t index;
+};
+
+/* Only the padded tail of each message is ever copied */
+static void mb_lane_load(struct mb_lane *lane, const struct iovec *msg,
+								size_t index)
+{
+	size_t rem = msg->iov_len % 64;
+
+	lane->data = msg->iov_base;
+	lane->blocks = msg->iov_len / 64;
+	lane->tail_blocks = rem + 9 > 64 ? 2 : 1;
+	lane->tail_pos = 0;
+	lane->index = index;
+
+	memcpy(lane->tail, lane->data + lane->blocks * 64, rem);
+	lane->tail[rem] = 0x80;
+	memset(lane->tail + rem + 1, 0, lane->tail_blocks * 64 - rem - 9);
+	l_put_be64((uint64_t) msg->iov_len * 8,
+				lane->tail + lane->tail_blocks * 64 - 8);
+}
+
+static const uint8_t *mb_lane_next(struct mb_lane *lane)
+{
+	const uint8_t *block;
+
+	if (lane->blocks) {
+		block = lane->data;
+		lane->data += 64;
+		lane->blocks--;
+		return block;
+	}
+
+	return lane->tail + 64 * lane->tail_pos++;
+}
+
+static void digest_many_lanes(const struct digest_alg *alg,
+				const struct iovec *msgs, size_t count,
+				uint8_t *out)
+{
+	static const uint8_t idle_block[64];
+	const uint32_t *iv = alg->iv;
+	struct mb_lane lanes[MB_LANES];
+	const uint8_t *blocks[MB_LANES];
+	mb_vec state[8];
+	unsigned int words = alg->state_len / 4;
+	unsigned int active = 0;
+	size_t next = 0;
+	unsigned int i, j;
+
+	for (i = 0; i < MB_LANES; i++) {
+		for (j = 0; j < words; j++)
+			state[j][i] = iv[j];
+
+		if (next < count) {
+			mb_lane_load(&lanes[i], &msgs[next], next);
+			next++;
+			active |= 1 << i;
+		}
+	}
+
+	while (active) {
+		for (i = 0; i < MB_LANES; i++)
+			blocks[i] = active & (1 << i) ?
+					mb_lane_next(&lanes[i]) : idle_block;
+
+		alg->compress_many(state, blocks);
+
+		for (i = 0; i < MB_LANES; i++) {
+			struct mb_lane *lane = &lanes[i];
+			uint8_t *digest;
+
+			if (!(active & (1 << i)) || lane->blocks ||
+					lane->tail_pos < lane->tail_blocks)
+				continue;
+
+			/* Emit the finished digest and refill the lane */
+			digest = out + lane->index * alg->digest_len;
+
+			for (j = 0; j < alg->digest_len / 4; j++) {
+				l_put_be32(state[j][i], digest + j * 4);
+				state[j][i] = iv[j];
+			}
+
+			for (; j < words; j++)
+				state[j][i] = iv[j];
+
+			if (next < count) {
+				mb_lane_load(lane, &msgs[next], next);
+				next++;
+			} else
+				active &= ~(1 << i);
+		}
+	}
+}
+
+/*
+ * Hash @count independent messages into consecutive digests at @out.
+ * SHA-1 and SHA-224/256 run eight messages at a time, one per vector
+ * lane, which pays off when the messages are short and many.
+ */
+bool _digest_many(enum l_checksum_type type, const struct iovec *msgs,
+					size_t count, uint8_t *out)
+{
+	const struct digest_alg *alg = digest_alg_get(type);
+	struct digest_ctx ctx;
+	size_t i;
+
+	if (!alg)
+		return false;
+
+	if (alg->compress_many && count > 1) {
+		digest_many_lanes(alg, msgs, count, out);
+		return true;
+	}
+
+	for (i = 0; i < count; i++) {
+		_digest_init(&ctx, type);
+		_digest_update(&ctx, msgs[i].iov_base, msgs[i].iov_len);
+		_digest_final(&ctx, out + i * alg->digest_len);
+	}
+
+	return true;
+}
+
+/* Lets the tests compare the portable lanes against AVX2 */
+bool _digest_many_set_avx2(bool enable)
+{
+#ifdef HAVE_MB_AVX2
+	mb_avx2 = -1;
+
+	if (enable)
+		return mb_use_avx2();
+
+	mb_avx2 = 0;
+#endif
+	return false;
+}
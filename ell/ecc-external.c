@@ -127,21 +127,25 @@ void _vli_rshift1(uint64_t *vli, unsigned int ndigits)
 	}
 }
 
-/* Computes result = left + right, returning carry. Can modify in place. */
-static uint64_t vli_add(uint64_t *result, const uint64_t *left,
-							const uint64_t *right,
-							unsigned int ndigits)
+/*
+ * Computes result = left + right, returning carry. Can modify in place.
+ * The carries are computed without branches so that the field kernels
+ * run in constant time once unrolled.
+ */
+static inline __attribute__ ((always_inline))
+uint64_t vli_add(uint64_t *result, const uint64_t *left,
+					const uint64_t *right,
+					unsigned int ndigits)
 {
 	uint64_t carry = 0;
 	unsigned int i;
 
 	for (i = 0; i < ndigits; i++) {
-		uint64_t sum;
-
-		sum = left[i] + right[i] + carry;
-		if (sum != left[i])
-			carry = (sum < left[i]);
+		uint64_t sum = left[i] + right[i];
+		uint64_t c = sum < left[i];
 
+		sum += carry;
+		carry = c | (sum < carry);
 		result[i] = sum;
 	}
 
@@ -149,26 +153,46 @@ static uint64_t vli_add(uint64_t *result, const uint64_t *left,
 }
 
 /* Computes result = left - right, returning borrow. Can modify in place. */
-uint64_t _vli_sub(uint64_t *result, const uint64_t *left,
-							const uint64_t *right,
-							unsigned int ndigits)
+static inline __attribute__ ((always_inline))
+uint64_t vli_sub(uint64_t *result, const uint64_t *left,
+					const uint64_t *right,
+					unsigned int ndigits)
 {
 	uint64_t borrow = 0;
 	unsigned int i;
 
 	for (i = 0; i < ndigits; i++) {
-		uint64_t diff;
-
-		diff = left[i] - right[i] - borrow;
-		if (diff != left[i])
-			borrow = (diff > left[i]);
+		uint64_t diff = left[i] - right[i];
+		uint64_t b = diff > left[i];
 
+		b |= diff < borrow;
+		diff -= borrow;
+		borrow = b;
 		result[i] = diff;
 	}
 
 	return borrow;
 }
 
+uint64_t _vli_sub(uint64_t *result, const uint64_t *left,
+							const uint64_t *right,
+							unsigned int ndigits)
+{
+	return vli_sub(result, left, right, ndigits);
+}
+
+#ifdef __SIZEOF_INT128__
+static uint128_t mul_64_64(uint64_t left, uint64_t right)
+{
+	unsigned __int128 m = (unsigned __int128) left * right;
+	uint128_t result;
+
+	result.m_low = m;
+	result.m_high = m >> 64;
+
+	return result;
+}
+#else
 static uint128_t mul_64_64(uint64_t left, uint64_t right)
 {
 	uint64_t a0 = left & 0xffffffffull;
@@ -193,6 +217,7 @@ static uint128_t mul_64_64(uint64_t left, uint64_t right)
 
 	return result;
 }
+#endif
 
 static uint128_t add_128_128(uint128_t a, uint128_t b)
 {
@@ -204,9 +229,14 @@ static uint128_t add_128_128(uint128_t a, uint128_t b)
 	return result;
 }
 
-static void vli_mult(uint64_t *result, const uint64_t *left,
-							const uint64_t *right,
-							unsigned int ndigits)
+/*
+ * The product loops are inlined into each field kernel below with a
+ * constant digit count so that they can be fully unrolled.
+ */
+static inline __attribute__ ((always_inline))
+void vli_mult(uint64_t *result, const uint64_t *left,
+					const uint64_t *right,
+					unsigned int ndigits)
 {
 	uint128_t r01 = { 0, 0 };
 	uint64_t r2 = 0;
@@ -241,8 +271,8 @@ static void vli_mult(uint64_t *result, const uint64_t *left,
 	result[ndigits * 2 - 1] = r01.m_low;
 }
 
-static void vli_square(uint64_t *result, const uint64_t *left,
-			unsigned int ndigits)
+static inline __attribute__ ((always_inline))
+void vli_square(uint64_t *result, const uint64_t *left, unsigned int ndigits)
 {
 	uint128_t r01 = { 0, 0 };
 	uint64_t r2 = 0;
@@ -296,7 +326,7 @@ void _vli_mod_add(uint64_t *result, const uint64_t *left,
 	 * get remainder.
 	 */
 	if (carry || _vli_cmp(result, mod, ndigits) >= 0)
-		_vli_sub(result, result, mod, ndigits);
+		vli_sub(result, result, mod, ndigits);
 }
 
 /* Computes result = (left - right) % mod.
@@ -306,7 +336,7 @@ void _vli_mod_sub(uint64_t *result, const uint64_t *left,
 				const uint64_t *right, const uint64_t *mod,
 				unsigned int ndigits)
 {
-	uint64_t borrow = _vli_sub(result, left, right, ndigits);
+	uint64_t borrow = vli_sub(result, left, right, ndigits);
 
 	/* In this case, p_result == -diff == (max int) - diff.
 	 * Since -x % d == d - x, we can get the correct result from
@@ -341,86 +371,81 @@ static void vli_mmod_fast_192(uint64_t *result, const uint64_t *product,
 	carry += vli_add(result, result, tmp, ndigits);
 
 	while (carry || _vli_cmp(curve_prime, result, ndigits) != 1)
-		carry -= _vli_sub(result, result, curve_prime, ndigits);
+		carry -= vli_sub(result, result, curve_prime, ndigits);
 }
 
 /* Computes result = product % curve_prime
  * from http://www.nsa.gov/ia/_files/nist-routines.pdf
  */
+/*
+ * The NIST terms are summed per 32-bit word of the result so that the
+ * carries are propagated once instead of once per term, and the final
+ * correction does not branch on the value.
+ */
 static void vli_mmod_fast_256(uint64_t *result, const uint64_t *product,
 				const uint64_t *curve_prime, uint64_t *tmp)
 {
-	int carry;
 	const unsigned int ndigits = 4;
+	int64_t c[16];
+	int64_t w[8];
+	int64_t acc;
+	uint64_t borrow, mask;
+	unsigned int i, j;
+
+	for (i = 0; i < 8; i++) {
+		c[2 * i] = product[i] & 0xffffffff;
+		c[2 * i + 1] = product[i] >> 32;
+	}
 
-	/* t */
-	vli_set(result, product, ndigits);
+	/* t + 2 * s1 + 2 * s2 + s3 + s4 - d1 - d2 - d3 - d4 */
+	w[0] = c[0] + c[8] + c[9] - c[11] - c[12] - c[13] - c[14];
+	w[1] = c[1] + c[9] + c[10] - c[12] - c[13] - c[14] - c[15];
+	w[2] = c[2] + c[10] + c[11] - c[13] - c[14] - c[15];
+	w[3] = c[3] + 2 * (c[11] + c[12]) + c[13] - c[15] - c[8] - c[9];
+	w[4] = c[4] + 2 * (c[12] + c[13]) + c[14] - c[9] - c[10];
+	w[5] = c[5] + 2 * (c[13] + c[14]) + c[15] - c[10] - c[11];
+	w[6] = c[6] + 3 * c[14] + 2 * c[15] + c[13] - c[8] - c[9];
+	w[7] = c[7] + 3 * c[15] + c[8] - c[10] - c[11] - c[12] - c[13];
+
+	/*
+	 * Fold the carry back in with 2^256 = 2^224 - 2^192 - 2^96 + 1
+	 * mod p.  After the second pass there is no carry left and the
+	 * result is below 2^256 < 2p.
+	 */
+	for (j = 0; j < 2; j++) {
+		acc = 0;
 
-	/* s1 */
-	tmp[0] = 0;
-	tmp[1] = product[5] & 0xffffffff00000000ull;
-	tmp[2] = product[6];
-	tmp[3] = product[7];
-	carry = vli_lshift(tmp, tmp, 1, ndigits);
-	carry += vli_add(result, result, tmp, ndigits);
+		for (i = 0; i < 8; i++) {
+			acc += w[i];
+			w[i] = (uint32_t) acc;
+			acc >>= 32;
+		}
 
-	/* s2 */
-	tmp[1] = product[6] << 32;
-	tmp[2] = (product[6] >> 32) | (product[7] << 32);
-	tmp[3] = product[7] >> 32;
-	carry += vli_lshift(tmp, tmp, 1, ndigits);
-	carry += vli_add(result, result, tmp, ndigits);
+		w[0] += acc;
+		w[3] -= acc;
+		w[6] -= acc;
+		w[7] += acc;
+	}
 
-	/* s3 */
-	tmp[0] = product[4];
-	tmp[1] = product[5] & 0xffffffff;
-	tmp[2] = 0;
-	tmp[3] = product[7];
-	carry += vli_add(result, result, tmp, ndigits);
+	acc = 0;
 
-	/* s4 */
-	tmp[0] = (product[4] >> 32) | (product[5] << 32);
-	tmp[1] = (product[5] >> 32) | (product[6] & 0xffffffff00000000ull);
-	tmp[2] = product[7];
-	tmp[3] = (product[6] >> 32) | (product[4] << 32);
-	carry += vli_add(result, result, tmp, ndigits);
+	for (i = 0; i < 4; i++) {
+		uint64_t lo;
 
-	/* d1 */
-	tmp[0] = (product[5] >> 32) | (product[6] << 32);
-	tmp[1] = (product[6] >> 32);
-	tmp[2] = 0;
-	tmp[3] = (product[4] & 0xffffffff) | (product[5] << 32);
-	carry -= _vli_sub(result, result, tmp, ndigits);
+		acc += w[2 * i];
+		lo = (uint32_t) acc;
+		acc >>= 32;
+		acc += w[2 * i + 1];
+		result[i] = lo | ((uint64_t) (uint32_t) acc << 32);
+		acc >>= 32;
+	}
 
-	/* d2 */
-	tmp[0] = product[6];
-	tmp[1] = product[7];
-	tmp[2] = 0;
-	tmp[3] = (product[4] >> 32) | (product[5] & 0xffffffff00000000ull);
-	carry -= _vli_sub(result, result, tmp, ndigits);
-
-	/* d3 */
-	tmp[0] = (product[6] >> 32) | (product[7] << 32);
-	tmp[1] = (product[7] >> 32) | (product[4] << 32);
-	tmp[2] = (product[4] >> 32) | (product[5] << 32);
-	tmp[3] = (product[6] << 32);
-	carry -= _vli_sub(result, result, tmp, ndigits);
-
-	/* d4 */
-	tmp[0] = product[7];
-	tmp[1] = product[4] & 0xffffffff00000000ull;
-	tmp[2] = product[5];
-	tmp[3] = product[6] & 0xffffffff00000000ull;
-	carry -= _vli_sub(result, result, tmp, ndigits);
+	/* result < 2^256 < 2p */
+	borrow = vli_sub(tmp, result, curve_prime, ndigits);
+	mask = borrow - 1;
 
-	if (carry < 0) {
-		do {
-			carry += vli_add(result, result, curve_prime, ndigits);
-		} while (carry < 0);
-	} else {
-		while (carry || _vli_cmp(curve_prime, result, ndigits) != 1)
-			carry -= _vli_sub(result, result, curve_prime, ndigits);
-	}
+	for (i = 0; i < ndigits; i++)
+		result[i] = (tmp[i] & mask) | (result[i] & ~mask);
 }
 
 /*
@@ -519,7 +544,7 @@ static void vli_mmod_fast_384(uint64_t *result, const uint64_t *product,
 	tmp[3] = ECC_SET_S(product, 18, 17);
 	tmp[4] = ECC_SET_S(product, 20, 19);
 	tmp[5] = ECC_SET_S(product, 22, 21);
-	carry -= _vli_sub(result, result, tmp, ndigits);
+	carry -= vli_sub(result, result, tmp, ndigits);
 
 	/* s8 */
 	tmp[0] = ECC_SET_S(product, 20, -1);
@@ -528,7 +553,7 @@ static void vli_mmod_fast_384(uint64_t *result, const uint64_t *product,
 	tmp[3] = 0;
 	tmp[4] = 0;
 	tmp[5] = 0;
-	carry -= _vli_sub(result, result, tmp, ndigits);
+	carry -= vli_sub(result, result, tmp, ndigits);
 
 	/* s9 */
 	tmp[0] = 0;
@@ -537,7 +562,7 @@ static void vli_mmod_fast_384(uint64_t *result, const uint64_t *product,
 	tmp[3] = 0;
 	tmp[4] = 0;
 	tmp[5] = 0;
-	carry -= _vli_sub(result, result, tmp, ndigits);
+	carry -= vli_sub(result, result, tmp, ndigits);
 
 	if (carry < 0) {
 		do {
@@ -545,7 +570,7 @@ static void vli_mmod_fast_384(uint64_t *result, const uint64_t *product,
 		} while (carry < 0);
 	} else {
 		while (carry || _vli_cmp(curve_prime, result, ndigits) != 1)
-			carry -= _vli_sub(result, result, curve_prime, ndigits);
+			carry -= vli_sub(result, result, curve_prime, ndigits);
 	}
 }
 
@@ -581,9 +606,22 @@ void _vli_mod_mult_fast(uint64_t *result, const uint64_t *left,
 			unsigned int ndigits)
 {
 	uint64_t product[2 * L_ECC_MAX_DIGITS];
+	uint64_t tmp[2 * L_ECC_MAX_DIGITS];
 
-	vli_mult(product, left, right, ndigits);
-	vli_mmod_fast(result, product, curve_prime, ndigits);
+	switch (ndigits) {
+	case 4:
+		vli_mult(product, left, right, 4);
+		vli_mmod_fast_256(result, product, curve_prime, tmp);
+		break;
+	case 6:
+		vli_mult(product, left, right, 6);
+		vli_mmod_fast_384(result, product, curve_prime, tmp);
+		break;
+	default:
+		vli_mult(product, left, right, ndigits);
+		vli_mmod_fast(result, product, curve_prime, ndigits);
+		break;
+	}
 }
 
 /* Computes result = left^2 % curve_p. */
@@ -592,9 +630,69 @@ void _vli_mod_square_fast(uint64_t *result, const uint64_t *left,
 					unsigned int ndigits)
 {
 	uint64_t product[2 * L_ECC_MAX_DIGITS];
+	uint64_t tmp[2 * L_ECC_MAX_DIGITS];
 
-	vli_square(product, left, ndigits);
-	vli_mmod_fast(result, product, curve_prime, ndigits);
+	switch (ndigits) {
+	case 4:
+		vli_square(product, left, 4);
+		vli_mmod_fast_256(result, product, curve_prime, tmp);
+		break;
+	case 6:
+		vli_square(product, left, 6);
+		vli_mmod_fast_384(result, product, curve_prime, tmp);
+		break;
+	default:
+		vli_square(product, left, ndigits);
+		vli_mmod_fast(result, product, curve_prime, ndigits);
+		break;
+	}
+}
+
+/*
+ * Computes result = (1 / input) % curve_p as input^(p - 2), so that the
+ * sequence of operations only depends on the prime and not on the
+ * input, unlike _vli_mod_inv.  The exponent is processed in 4-bit
+ * windows.
+ */
+void _vli_mod_inv_fast(uint64_t *result, const uint64_t *input,
+					const uint64_t *curve_prime,
+					unsigned int ndigits)
+{
+	static const uint64_t two[L_ECC_MAX_DIGITS] = { 2 };
+	uint64_t powers[16][L_ECC_MAX_DIGITS];
+	uint64_t exp[L_ECC_MAX_DIGITS];
+	uint64_t r[L_ECC_MAX_DIGITS];
+	bool started = false;
+	unsigned int i, w;
+	int bit;
+
+	_vli_sub(exp, curve_prime, two, ndigits);
+
+	vli_set(powers[1], input, ndigits);
+
+	for (i = 2; i < 16; i++)
+		_vli_mod_mult_fast(powers[i], powers[i - 1], input,
+						curve_prime, ndigits);
+
+	for (bit = ndigits * 64 - 4; bit >= 0; bit -= 4) {
+		w = (exp[bit / 64] >> (bit % 64)) & 0xf;
+
+		if (started) {
+			for (i = 0; i < 4; i++)
+				_vli_mod_square_fast(r, r, curve_prime,
+								ndigits);
+
+			if (w)
+				_vli_mod_mult_fast(r, r, powers[w],
+							curve_prime, ndigits);
+		} else if (w) {
+			vli_set(r, powers[w], ndigits);
+			started = true;
+		}
+	}
+
+	vli_set(result, r, ndigits);
+	explicit_bzero(powers, sizeof(powers));
 }
 
 #define EVEN(vli) (!(vli[0] & 1))
@@ -927,7 +1025,7 @@ void _ecc_point_mult(struct l_ecc_point *result,
 	_vli_mod_mult_fast(z, z, point->x, curve_prime, ndigits);
 
 	/* 1 / (xP * Yb * (X1 - X0)) */
-	_vli_mod_inv(z, z, curve_prime, ndigits);
+	_vli_mod_inv_fast(z, z, curve_prime, ndigits);
 
 	/* yP / (xP * Yb * (X1 - X0)) */
 	_vli_mod_mult_fast(z, z, point->y, curve_prime, ndigits);
@@ -943,6 +1041,520 @@ void _ecc_point_mult(struct l_ecc_point *result,
 	vli_set(result->y, ry[0], ndigits);
 }
 
+/* ------ Windowed multiplication ------ */
+
+/*
+ * (x1, y1, z1) += (x2, y2), with z1 == 0 as the point at infinity.
+ * Doubling and infinity need branches.  They come up for related input
+ * points, and in the windowed sums for scalars such as 2^bits - n that
+ * are easy to construct, so they have to be handled correctly.
+ */
+static void ecc_point_add_mixed(uint64_t *x1, uint64_t *y1, uint64_t *z1,
+				const uint64_t *x2, const uint64_t *y2,
+				const uint64_t *curve_prime,
+				unsigned int ndigits)
+{
+	uint64_t t1[L_ECC_MAX_DIGITS];
+	uint64_t t2[L_ECC_MAX_DIGITS];
+	uint64_t h[L_ECC_MAX_DIGITS];
+	uint64_t r[L_ECC_MAX_DIGITS];
+
+	if (vli_is_zero(z1, ndigits)) {
+		vli_set(x1, x2, ndigits);
+		vli_set(y1, y2, ndigits);
+		vli_clear(z1, ndigits);
+		z1[0] = 1;
+		return;
+	}
+
+	/* t1 = z1^2 */
+	_vli_mod_square_fast(t1, z1, curve_prime, ndigits);
+	/* t2 = x2 * z1^2 = U2 */
+	_vli_mod_mult_fast(t2, x2, t1, curve_prime, ndigits);
+	/* t1 = z1^3 */
+	_vli_mod_mult_fast(t1, t1, z1, curve_prime, ndigits);
+	/* t1 = y2 * z1^3 = S2 */
+	_vli_mod_mult_fast(t1, y2, t1, curve_prime, ndigits);
+	/* h = U2 - x1 */
+	_vli_mod_sub(h, t2, x1, curve_prime, ndigits);
+	/* r = S2 - y1 */
+	_vli_mod_sub(r, t1, y1, curve_prime, ndigits);
+
+	if (vli_is_zero(h, ndigits)) {
+		/* Same point, or the sum is the point at infinity */
+		if (vli_is_zero(r, ndigits))
+			ecc_point_double_jacobian(x1, y1, z1, curve_prime,
+							ndigits);
+		else
+			vli_clear(z1, ndigits);
+
+		return;
+	}
+
+	/* z3 = z1 * h */
+	_vli_mod_mult_fast(z1, z1, h, curve_prime, ndigits);
+	/* t1 = h^2 */
+	_vli_mod_square_fast(t1, h, curve_prime, ndigits);
+	/* h = h^3 */
+	_vli_mod_mult_fast(h, h, t1, curve_prime, ndigits);
+	/* t1 = x1 * h^2 = V */
+	_vli_mod_mult_fast(t1, x1, t1, curve_prime, ndigits);
+	/* x3 = r^2 - h^3 - 2V */
+	_vli_mod_square_fast(x1, r, curve_prime, ndigits);
+	_vli_mod_sub(x1, x1, h, curve_prime, ndigits);
+	_vli_mod_sub(x1, x1, t1, curve_prime, ndigits);
+	_vli_mod_sub(x1, x1, t1, curve_prime, ndigits);
+	/* y3 = r * (V - x3) - y1 * h^3 */
+	_vli_mod_sub(t1, t1, x1, curve_prime, ndigits);
+	_vli_mod_mult_fast(t1, t1, r, curve_prime, ndigits);
+	_vli_mod_mult_fast(t2, y1, h, curve_prime, ndigits);
+	_vli_mod_sub(y1, t1, t2, curve_prime, ndigits);
+}
+
+/* (x, y, z) => (x / z^2, y / z^3) */
+static void ecc_point_to_affine(uint64_t *x, uint64_t *y, const uint64_t *z,
+				const uint64_t *curve_prime,
+				unsigned int ndigits)
+{
+	uint64_t z_inv[L_ECC_MAX_DIGITS];
+
+	_vli_mod_inv_fast(z_inv, z, curve_prime, ndigits);
+	apply_z(x, y, z_inv, curve_prime, ndigits);
+}
+
+/*
+ * Converts count points to affine coordinates with one inversion,
+ * using Montgomery's trick: invert the product of all z values and
+ * peel the individual inverses off it.  Points at infinity (z == 0)
+ * end up as (0, 0) and keep z == 0, all others get z == 1.
+ */
+void _ecc_points_to_affine(struct ecc_jacobian_point *points,
+				unsigned int count,
+				const uint64_t *curve_prime,
+				unsigned int ndigits)
+{
+	static const uint64_t one[L_ECC_MAX_DIGITS] = { 1 };
+	uint64_t *prefix;
+	uint64_t acc[L_ECC_MAX_DIGITS];
+	uint64_t z_inv[L_ECC_MAX_DIGITS];
+	unsigned int i;
+
+	if (!count)
+		return;
+
+	prefix = l_new(uint64_t, count * ndigits);
+	vli_set(acc, one, ndigits);
+
+	/* prefix[i] = z[0] * ... * z[i - 1] */
+	for (i = 0; i < count; i++) {
+		vli_set(prefix + i * ndigits, acc, ndigits);
+
+		if (!vli_is_zero(points[i].z, ndigits))
+			_vli_mod_mult_fast(acc, acc, points[i].z, curve_prime,
+						ndigits);
+	}
+
+	_vli_mod_inv_fast(acc, acc, curve_prime, ndigits);
+
+	/* acc = 1 / (z[0] * ... * z[i]) on each iteration */
+	for (i = count; i--;) {
+		struct ecc_jacobian_point *point = &points[i];
+
+		if (vli_is_zero(point->z, ndigits)) {
+			vli_clear(point->x, ndigits);
+			vli_clear(point->y, ndigits);
+			continue;
+		}
+
+		_vli_mod_mult_fast(z_inv, acc, prefix + i * ndigits,
+					curve_prime, ndigits);
+		_vli_mod_mult_fast(acc, acc, point->z, curve_prime, ndigits);
+		apply_z(point->x, point->y, z_inv, curve_prime, ndigits);
+		vli_set(point->z, one, ndigits);
+	}
+
+	l_free(prefix);
+}
+
+/*
+ * The windowed methods below use 4-bit windows with the scalar recoded
+ * into odd signed digits d_i in [-15, 15], so that every window needs
+ * one of the eight odd multiples of a point and never the point at
+ * infinity.  The digits are read from tables that are scanned in full
+ * for every window, so neither the memory access pattern nor the
+ * number of additions depends on the scalar.
+ */
+#define WINDOW_BITS		4
+#define WINDOW_ENTRIES		(1 << (WINDOW_BITS - 1))
+#define MAX_WINDOWS		(L_ECC_MAX_DIGITS * 64 / WINDOW_BITS + 1)
+
+static void vli_select(uint64_t *result, const uint64_t *a,
+			const uint64_t *b, uint64_t mask,
+			unsigned int ndigits)
+{
+	unsigned int i;
+
+	/* result = mask ? a : b */
+	for (i = 0; i < ndigits; i++)
+		result[i] = (a[i] & mask) | (b[i] & ~mask);
+}
+
+/*
+ * k = scalar mod n, made odd by using n - k for even values.  Returns
+ * an all-ones mask if n - k was used, in which case the caller has to
+ * negate the point, or the result.  Returns false if k is 0 mod n.
+ */
+static bool scalar_make_odd(uint64_t *k, const uint64_t *scalar,
+				const struct l_ecc_curve *curve,
+				uint64_t *out_negate)
+{
+	unsigned int ndigits = curve->ndigits;
+	/* Only ndigits get written, which the compiler can't tell */
+	uint64_t t[L_ECC_MAX_DIGITS] = { 0 };
+	uint64_t mask;
+
+	/* scalar < 2^bits < 2n */
+	mask = -vli_sub(t, scalar, curve->n, ndigits);
+	vli_select(k, scalar, t, mask, ndigits);
+
+	*out_negate = 0;
+
+	if (vli_is_zero(k, ndigits))
+		return false;
+
+	mask = -(k[0] & 1);
+	vli_sub(t, curve->n, k, ndigits);
+	vli_select(k, k, t, mask, ndigits);
+	*out_negate = ~mask;
+
+	explicit_bzero(t, sizeof(t));
+
+	return true;
+}
+
+/*
+ * Recodes an odd k into one more window than k has, each digit odd.
+ * The top digit ends up as 1.  k is destroyed.
+ */
+static void scalar_recode(int8_t *digits, uint64_t *k, unsigned int windows,
+				unsigned int ndigits)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < windows - 1; i++) {
+		digits[i] = (int) (k[0] & 31) - 16;
+
+		/* k = (k - d) / 16, which is odd again */
+		k[0] = (k[0] & ~31ull) | 16;
+
+		for (j = 0; j < ndigits - 1; j++)
+			k[j] = (k[j] >> 4) | (k[j + 1] << 60);
+
+		k[ndigits - 1] >>= 4;
+	}
+
+	digits[windows - 1] = k[0];
+}
+
+/*
+ * Sets (x, y) to d times the base of a table of odd multiples without
+ * revealing d.  Entry i, (2i + 1) times the base, is at table + i *
+ * stride with y at y_offset.
+ */
+static void window_select(uint64_t *x, uint64_t *y, int d,
+				const uint64_t *table, size_t stride,
+				size_t y_offset, const uint64_t *curve_prime,
+				unsigned int ndigits)
+{
+	uint64_t t[L_ECC_MAX_DIGITS];
+	uint64_t neg = -(uint64_t) ((unsigned int) d >> 31);
+	unsigned int j, i, k;
+
+	d = (d ^ (int) neg) - (int) neg;
+	j = (d - 1) / 2;
+
+	vli_clear(x, ndigits);
+	vli_clear(y, ndigits);
+
+	for (i = 0; i < WINDOW_ENTRIES; i++, table += stride) {
+		uint64_t mask = -(uint64_t) (((i ^ j) - 1) >> 31 & 1);
+
+		for (k = 0; k < ndigits; k++) {
+			x[k] |= table[k] & mask;
+			y[k] |= table[y_offset + k] & mask;
+		}
+	}
+
+	/* -(x, y) = (x, p - y) */
+	vli_sub(t, curve_prime, y, ndigits);
+	vli_select(y, t, y, neg, ndigits);
+}
+
+/* ------ Fixed-base multiplication ------ */
+
+/*
+ * k * G is computed as the sum of one precomputed point per window of
+ * k, without any doublings, from a per-curve table of odd multiples
+ * of 16^i * G.
+ */
+struct ecc_fixed_base {
+	unsigned int windows;
+	unsigned int ndigits;
+	/* Affine x and y for each window and odd multiple */
+	uint64_t points[];
+};
+
+static uint64_t *fixed_base_entry(struct ecc_fixed_base *table,
+					unsigned int window, unsigned int j)
+{
+	return table->points + (window * WINDOW_ENTRIES + j) *
+						2 * table->ndigits;
+}
+
+static struct ecc_fixed_base *ecc_fixed_base_new(
+					const struct l_ecc_curve *curve)
+{
+	unsigned int ndigits = curve->ndigits;
+	const uint64_t *p = curve->p;
+	/* One more window than the scalar has for the recoding carry */
+	unsigned int windows = ndigits * 64 / WINDOW_BITS + 1;
+	struct ecc_fixed_base *table;
+	/* The odd multiples of B followed by 16B */
+	struct ecc_jacobian_point points[WINDOW_ENTRIES + 1];
+	struct ecc_jacobian_point d;
+	uint64_t bx[L_ECC_MAX_DIGITS], by[L_ECC_MAX_DIGITS];
+	unsigned int i, j;
+
+	table = l_malloc(sizeof(*table) + windows * WINDOW_ENTRIES *
+				2 * ndigits * sizeof(uint64_t));
+	table->windows = windows;
+	table->ndigits = ndigits;
+
+	/* B = 16^i * G */
+	vli_set(bx, curve->g.x, ndigits);
+	vli_set(by, curve->g.y, ndigits);
+
+	for (i = 0; i < windows; i++) {
+		/* D = 2B */
+		vli_set(d.x, bx, ndigits);
+		vli_set(d.y, by, ndigits);
+		vli_clear(d.z, ndigits);
+		d.z[0] = 1;
+		ecc_point_double_jacobian(d.x, d.y, d.z, p, ndigits);
+		_ecc_points_to_affine(&d, 1, p, ndigits);
+
+		vli_set(points[0].x, bx, ndigits);
+		vli_set(points[0].y, by, ndigits);
+		vli_clear(points[0].z, ndigits);
+		points[0].z[0] = 1;
+
+		for (j = 1; j <= WINDOW_ENTRIES; j++) {
+			points[j] = points[j - 1];
+
+			/* 15B + B = 16B for the next window */
+			if (j == WINDOW_ENTRIES)
+				ecc_point_add_mixed(points[j].x, points[j].y,
+							points[j].z, bx, by,
+							p, ndigits);
+			else
+				ecc_point_add_mixed(points[j].x, points[j].y,
+							points[j].z, d.x, d.y,
+							p, ndigits);
+		}
+
+		_ecc_points_to_affine(points, L_ARRAY_SIZE(points), p,
+								ndigits);
+
+		for (j = 0; j < WINDOW_ENTRIES; j++) {
+			uint64_t *entry = fixed_base_entry(table, i, j);
+
+			vli_set(entry, points[j].x, ndigits);
+			vli_set(entry + ndigits, points[j].y, ndigits);
+		}
+
+		vli_set(bx, points[WINDOW_ENTRIES].x, ndigits);
+		vli_set(by, points[WINDOW_ENTRIES].y, ndigits);
+	}
+
+	return table;
+}
+
+/*
+ * The table is built the first time a curve is used.  Threads racing
+ * on that each build one and the first to publish it wins.
+ */
+static struct ecc_fixed_base *ecc_fixed_base_get(
+					const struct l_ecc_curve *curve)
+{
+	struct ecc_fixed_base *table;
+	struct ecc_fixed_base *expected = NULL;
+
+	table = __atomic_load_n(curve->fixed_base, __ATOMIC_ACQUIRE);
+	if (likely(table))
+		return table;
+
+	table = ecc_fixed_base_new(curve);
+
+	if (!__atomic_compare_exchange_n(curve->fixed_base, &expected, table,
+						false, __ATOMIC_ACQ_REL,
+						__ATOMIC_ACQUIRE)) {
+		l_free(table);
+		table = expected;
+	}
+
+	return table;
+}
+
+/* result = scalar * curve->g */
+void _ecc_point_mult_g(struct l_ecc_point *result,
+			const struct l_ecc_curve *curve, const uint64_t *scalar)
+{
+	unsigned int ndigits = curve->ndigits;
+	const uint64_t *p = curve->p;
+	struct ecc_fixed_base *table = ecc_fixed_base_get(curve);
+	int8_t digits[MAX_WINDOWS];
+	uint64_t k[L_ECC_MAX_DIGITS];
+	uint64_t t[L_ECC_MAX_DIGITS];
+	uint64_t x[L_ECC_MAX_DIGITS], y[L_ECC_MAX_DIGITS];
+	uint64_t z[L_ECC_MAX_DIGITS];
+	uint64_t qx[L_ECC_MAX_DIGITS], qy[L_ECC_MAX_DIGITS];
+	uint64_t negate;
+	unsigned int i;
+
+	/* k * G is never infinity past this point */
+	if (!scalar_make_odd(k, scalar, curve, &negate)) {
+		_ecc_point_mult(result, &curve->g, scalar, NULL, p);
+		return;
+	}
+
+	scalar_recode(digits, k, table->windows, ndigits);
+
+	vli_clear(z, ndigits);
+
+	/*
+	 * The sum of the earlier windows is smaller in magnitude than the
+	 * digit of the current one, so the additions only hit the
+	 * exceptional cases when the partial sums wrap around n.  Scalars
+	 * that do, e.g. 2^bits - n, are easy to construct and are handled
+	 * by ecc_point_add_mixed.
+	 */
+	for (i = 0; i < table->windows; i++) {
+		window_select(x, y, digits[i], fixed_base_entry(table, i, 0),
+				2 * ndigits, ndigits, p, ndigits);
+		ecc_point_add_mixed(qx, qy, z, x, y, p, ndigits);
+	}
+
+	ecc_point_to_affine(qx, qy, z, p, ndigits);
+
+	/* Undo the n - k */
+	vli_sub(t, p, qy, ndigits);
+	vli_select(qy, t, qy, negate, ndigits);
+
+	vli_set(result->x, qx, ndigits);
+	vli_set(result->y, qy, ndigits);
+
+	explicit_bzero(k, sizeof(k));
+	explicit_bzero(digits, sizeof(digits));
+}
+
+/* ------ Multi-scalar multiplication ------ */
+
+/*
+ * result = a * p + b * q with the two scalars processed in the same
+ * pass (Straus), so the doublings are shared.  Each point gets a table
+ * of its odd multiples, and both tables are normalized with a single
+ * inversion.  Returns false if the result is the point at infinity.
+ */
+bool _ecc_point_mult_add(struct l_ecc_point *result,
+				const uint64_t *a, const struct l_ecc_point *p,
+				const uint64_t *b, const struct l_ecc_point *q)
+{
+	const struct l_ecc_curve *curve = p->curve;
+	unsigned int ndigits = curve->ndigits;
+	const uint64_t *prime = curve->p;
+	unsigned int windows = ndigits * 64 / WINDOW_BITS + 1;
+	const struct l_ecc_point *points[2] = { p, q };
+	const uint64_t *scalars[2] = { a, b };
+	struct ecc_jacobian_point tables[2][WINDOW_ENTRIES];
+	struct ecc_jacobian_point doubles[2];
+	int8_t digits[2][MAX_WINDOWS];
+	uint64_t k[L_ECC_MAX_DIGITS];
+	uint64_t t[L_ECC_MAX_DIGITS];
+	uint64_t x[L_ECC_MAX_DIGITS], y[L_ECC_MAX_DIGITS];
+	uint64_t z[L_ECC_MAX_DIGITS];
+	uint64_t rx[L_ECC_MAX_DIGITS], ry[L_ECC_MAX_DIGITS];
+	uint64_t negate;
+	unsigned int i, j, w;
+	bool nonzero[2];
+
+	for (i = 0; i < 2; i++) {
+		nonzero[i] = scalar_make_odd(k, scalars[i], curve, &negate);
+
+		if (nonzero[i])
+			scalar_recode(digits[i], k, windows, ndigits);
+
+		/* a * P = (n - a) * -P */
+		vli_set(tables[i][0].x, points[i]->x, ndigits);
+		vli_sub(t, prime, points[i]->y, ndigits);
+		vli_select(tables[i][0].y, t, points[i]->y, negate, ndigits);
+		vli_clear(tables[i][0].z, ndigits);
+		tables[i][0].z[0] = 1;
+
+		doubles[i] = tables[i][0];
+		ecc_point_double_jacobian(doubles[i].x, doubles[i].y,
+						doubles[i].z, prime, ndigits);
+	}
+
+	if (!nonzero[0] || !nonzero[1]) {
+		explicit_bzero(digits, sizeof(digits));
+
+		if (!nonzero[0] && !nonzero[1])
+			return false;
+
+		i = nonzero[1];
+		_ecc_point_mult(result, points[i], scalars[i], NULL, prime);
+		return true;
+	}
+
+	_ecc_points_to_affine(doubles, 2, prime, ndigits);
+
+	for (i = 0; i < 2; i++)
+		for (j = 1; j < WINDOW_ENTRIES; j++) {
+			tables[i][j] = tables[i][j - 1];
+			ecc_point_add_mixed(tables[i][j].x, tables[i][j].y,
+						tables[i][j].z, doubles[i].x,
+						doubles[i].y, prime, ndigits);
+		}
+
+	_ecc_points_to_affine(tables[0], 2 * WINDOW_ENTRIES, prime, ndigits);
+
+	vli_clear(z, ndigits);
+
+	for (w = windows; w--;) {
+		for (j = 0; j < WINDOW_BITS; j++)
+			ecc_point_double_jacobian(rx, ry, z, prime, ndigits);
+
+		for (i = 0; i < 2; i++) {
+			window_select(x, y, digits[i][w], tables[i][0].x,
+					3 * L_ECC_MAX_DIGITS, L_ECC_MAX_DIGITS,
+					prime, ndigits);
+			ecc_point_add_mixed(rx, ry, z, x, y, prime, ndigits);
+		}
+	}
+
+	explicit_bzero(k, sizeof(k));
+	explicit_bzero(digits, sizeof(digits));
+
+	if (vli_is_zero(z, ndigits))
+		return false;
+
+	ecc_point_to_affine(rx, ry, z, prime, ndigits);
+	vli_set(result->x, rx, ndigits);
+	vli_set(result->y, ry, ndigits);
+
+	return true;
+}
+
 /* Returns true if p_point is the point at infinity, false otherwise. */
 bool _ecc_point_is_zero(const struct l_ecc_point *point)
 {
@@ -26,6 +26,7 @@
 #include "ecc.h"
 
 struct l_ecc_curve;
+struct ecc_fixed_base;
 
 struct l_ecc_point {
 	uint64_t x[L_ECC_MAX_DIGITS];
@@ -42,6 +43,15 @@ struct l_ecc_curve {
 	uint64_t p[L_ECC_MAX_DIGITS];
 	uint64_t n[L_ECC_MAX_DIGITS];
 	uint64_t b[L_ECC_MAX_DIGITS];
+	/* Multiples of g for _ecc_point_mult_g, built on first use */
+	struct ecc_fixed_base **fixed_base;
+};
+
+/* Jacobian coordinates, (x / z^2, y / z^3) in affine */
+struct ecc_jacobian_point {
+	uint64_t x[L_ECC_MAX_DIGITS];
+	uint64_t y[L_ECC_MAX_DIGITS];
+	uint64_t z[L_ECC_MAX_DIGITS];
 };
 
 struct l_ecc_scalar {
@@ -72,6 +82,9 @@ void _vli_mod_mult_fast(uint64_t *result, const uint64_t *left,
 void _vli_mod_square_fast(uint64_t *result, const uint64_t *left,
 					const uint64_t *curve_prime,
 					unsigned int ndigits);
+void _vli_mod_inv_fast(uint64_t *result, const uint64_t *input,
+				const uint64_t *curve_prime,
+				unsigned int ndigits);
 void _vli_mod_exp(uint64_t *result, uint64_t *base, uint64_t *exp,
 		const uint64_t *mod, unsigned int ndigits);
 
@@ -92,6 +105,16 @@ bool _ecc_compute_y(const struct l_ecc_curve *curve, uint64_t *y, uint64_t *x);
 void _ecc_point_mult(struct l_ecc_point *result,
 			const struct l_ecc_point *point, const uint64_t *scalar,
 			uint64_t *initial_z, const uint64_t *curve_prime);
+void _ecc_point_mult_g(struct l_ecc_point *result,
+			const struct l_ecc_curve *curve,
+			const uint64_t *scalar);
+bool _ecc_point_mult_add(struct l_ecc_point *result,
+				const uint64_t *a, const struct l_ecc_point *p,
+				const uint64_t *b, const struct l_ecc_point *q);
+void _ecc_points_to_affine(struct ecc_jacobian_point *points,
+				unsigned int count,
+				const uint64_t *curve_prime,
+				unsigned int ndigits);
 void _ecc_point_add(struct l_ecc_point *ret, const struct l_ecc_point *p,
 			const struct l_ecc_point *q,
 			const uint64_t *curve_prime);
@@ -46,6 +46,8 @@
 #define P256_CURVE_B { 0x3BCE3C3E27D2604Bull, 0x651D06B0CC53B0F6ull,   \
 			0xB3EBBD55769886BCull, 0x5AC635D8AA3A93E7ull }
 
+static struct ecc_fixed_base *p256_fixed_base;
+
 static const struct l_ecc_curve p256 = {
 	.name = "secp256r1",
 	.ike_group = 19,
@@ -59,6 +61,7 @@ static const struct l_ecc_curve p256 = {
 	.p = P256_CURVE_P,
 	.n = P256_CURVE_N,
 	.b = P256_CURVE_B,
+	.fixed_base = &p256_fixed_base,
 };
 
 /*
@@ -80,6 +83,8 @@ static const struct l_ecc_curve p256 = {
 			0x0314088F5013875Aull, 0x181D9C6EFE814112ull, \
 			0x988E056BE3F82D19ull, 0xB3312FA7E23EE7E4ull }
 
+static struct ecc_fixed_base *p384_fixed_base;
+
 static const struct l_ecc_curve p384 = {
 	.name = "secp384r1",
 	.ike_group = 20,
@@ -92,7 +97,8 @@ static const struct l_ecc_curve p384 = {
 	},
 	.p = P384_CURVE_P,
 	.n = P384_CURVE_N,
-	.b = P384_CURVE_B
+	.b = P384_CURVE_B,
+	.fixed_base = &p384_fixed_base,
 };
 
 static const struct l_ecc_curve *curves[] = {
@@ -380,7 +386,7 @@ void _ecc_point_add(struct l_ecc_point *ret, const struct l_ecc_point *p,
 	/* kp2 = px - qx */
 	_vli_mod_sub(kp2, q->x, p->x, curve_prime, ndigits);
 	/* s = kp1/kp2 */
-	_vli_mod_inv(kp2, kp2, curve_prime, ndigits);
+	_vli_mod_inv_fast(kp2, kp2, curve_prime, ndigits);
 	_vli_mod_mult_fast(s, kp1, kp2, curve_prime, ndigits);
 	/* rx = s^2 - px - qx */
 	_vli_mod_mult_fast(kp1, s, s, curve_prime, ndigits);
@@ -644,14 +650,40 @@ LIB_EXPORT bool l_ecc_point_multiply(struct l_ecc_point *ret,
 					const struct l_ecc_scalar *scalar,
 					const struct l_ecc_point *point)
 {
+	const struct l_ecc_curve *curve;
+	size_t len;
+
 	if (unlikely(!ret || !scalar || !point))
 		return false;
 
-	_ecc_point_mult(ret, point, scalar->c, NULL, scalar->curve->p);
+	curve = scalar->curve;
+	len = curve->ndigits * 8;
+
+	if (!memcmp(point->x, curve->g.x, len) &&
+			!memcmp(point->y, curve->g.y, len))
+		_ecc_point_mult_g(ret, curve, scalar->c);
+	else
+		_ecc_point_mult(ret, point, scalar->c, NULL, curve->p);
 
 	return true;
 }
 
+LIB_EXPORT bool l_ecc_point_multiply_add(struct l_ecc_point *ret,
+					const struct l_ecc_scalar *a,
+					const struct l_ecc_point *p,
+					const struct l_ecc_scalar *b,
+					const struct l_ecc_point *q)
+{
+	if (unlikely(!ret || !a || !p || !b || !q))
+		return false;
+
+	if (unlikely(a->curve != p->curve || b->curve != p->curve ||
+			q->curve != p->curve))
+		return false;
+
+	return _ecc_point_mult_add(ret, a->c, p, b->c, q);
+}
+
 LIB_EXPORT bool l_ecc_point_add(struct l_ecc_point *ret,
 					const struct l_ecc_point *a,
 					const struct l_ecc_point *b)
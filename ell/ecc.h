@@ -77,6 +77,11 @@ bool l_ecc_scalar_add(struct l_ecc_scalar *ret, const struct l_ecc_scalar *a,
 bool l_ecc_point_multiply(struct l_ecc_point *ret,
 				const struct l_ecc_scalar *scalar,
 				const struct l_ecc_point *point);
+bool l_ecc_point_multiply_add(struct l_ecc_point *ret,
+				const struct l_ecc_scalar *a,
+				const struct l_ecc_point *p,
+				const struct l_ecc_scalar *b,
+				const struct l_ecc_point *q);
 bool l_ecc_point_add(struct l_ecc_point *ret, const struct l_ecc_point *a,
 				const struct l_ecc_point *b);
 bool l_ecc_point_inverse(struct l_ecc_point *p);
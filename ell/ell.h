@@ -25,6 +25,7 @@
 #include <ell/strv.h>
 #include <ell/utf8.h>
 #include <ell/queue.h>
+#include <ell/deque.h>
 #include <ell/hashmap.h>
 #include <ell/string.h>
 #include <ell/main.h>
@@ -40,6 +41,7 @@
 #include <ell/hwdb.h>
 #include <ell/cipher.h>
 #include <ell/random.h>
+#include <ell/alg.h>
 #include <ell/uintset.h>
 #include <ell/base64.h>
 #include <ell/pem.h>
@@ -36,6 +36,8 @@ bool _gvariant_iter_enter_variant(struct l_dbus_message_iter *iter,
 bool _gvariant_iter_enter_array(struct l_dbus_message_iter *iter,
 					struct l_dbus_message_iter *array);
 bool _gvariant_iter_skip_entry(struct l_dbus_message_iter *iter);
+bool _gvariant_iter_get_fixed_array(struct l_dbus_message_iter *iter,
+					void *out, uint32_t *n_elem);
 
 bool _gvariant_valid_signature(const char *sig);
 int _gvariant_get_alignment(const char *signature);
@@ -63,6 +65,9 @@ bool _gvariant_builder_leave_variant(struct dbus_builder *builder);
 bool _gvariant_builder_enter_array(struct dbus_builder *builder,
 					const char *signature);
 bool _gvariant_builder_leave_array(struct dbus_builder *builder);
+bool _gvariant_builder_append_fixed_array(struct dbus_builder *builder,
+						char type, const void *data,
+						uint32_t n_elem);
 
 size_t _gvariant_message_finalize(size_t header_end,
 					void *body, size_t body_size,
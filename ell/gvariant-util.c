@@ -748,6 +748,29 @@ bool _gvariant_iter_enter_array(struct l_dbus_message_iter *iter,
 						start, item_size);
 }
 
+bool _gvariant_iter_get_fixed_array(struct l_dbus_message_iter *iter,
+					void *out, uint32_t *n_elem)
+{
+	char type;
+	size_t size;
+
+	if (iter->container_type != DBUS_CONTAINER_TYPE_ARRAY)
+		return false;
+
+	type = iter->sig_start[iter->sig_pos];
+	size = get_basic_fixed_size(type);
+
+	/* Fail if the array is not a fixed size or contains file descriptors */
+	if (!size || type == 'h')
+		return false;
+
+	/* The elements follow each other with no padding or offsets */
+	*(const void **) out = iter->data + iter->pos;
+	*n_elem = (iter->len - iter->pos) / size;
+
+	return true;
+}
+
 bool _gvariant_iter_skip_entry(struct l_dbus_message_iter *iter)
 {
 	size_t size;
@@ -1263,6 +1286,30 @@ bool _gvariant_builder_append_basic(struct dbus_builder *builder,
 	return true;
 }
 
+/* Arrays of fixed size types are a plain run of elements, no offsets */
+bool _gvariant_builder_append_fixed_array(struct dbus_builder *builder,
+						char type, const void *data,
+						uint32_t n_elem)
+{
+	char signature[2] = { type, '\0' };
+	size_t size = get_basic_fixed_size(type);
+	size_t start;
+
+	if (unlikely(!builder))
+		return false;
+
+	if (!size || type == 'b' || type == 'h')
+		return false;
+
+	if (!_gvariant_builder_enter_array(builder, signature))
+		return false;
+
+	start = grow_body(builder, size * n_elem, 1);
+	memcpy(builder->body + start, data, size * n_elem);
+
+	return _gvariant_builder_leave_array(builder);
+}
+
 bool _gvariant_builder_mark(struct dbus_builder *builder)
 {
 	struct container *container = l_queue_peek_head(builder->containers);
@@ -24,8 +24,13 @@
 #include <config.h>
 #endif
 
+#include <unistd.h>
+
 #include "util.h"
 #include "hashmap.h"
+#include "random.h"
+#include "time.h"
+#include "siphash-private.h"
 #include "private.h"
 
 /**
@@ -35,13 +40,33 @@
  * Hash table support
  */
 
-#define NBUCKETS 127
+/*
+ * The table uses open addressing with linear probing and Robin Hood
+ * ordering: every cluster of occupied slots is kept sorted by home slot,
+ * and entries with the same home slot stay in insertion order.  Insertion
+ * shifts the rest of the cluster up by one slot, removal shifts it back
+ * down, so no tombstones are needed.
+ *
+ * When the table grows or shrinks, the previous table is kept around and
+ * migrated into the new one a few slots at a time on every insert and
+ * remove.  Whole clusters are moved at once, which keeps duplicate keys in
+ * insertion order across both tables.
+ */
+#define MIN_TABLE_BITS	4
+#define REHASH_STEP	16
 
 struct entry {
 	void *key;
 	void *value;
-	struct entry *next;
 	unsigned int hash;
+	unsigned int dist;	/* Probe distance + 1, 0 for an empty slot */
+};
+
+struct table {
+	struct entry *slots;
+	unsigned int bits;
+	unsigned int mask;
+	unsigned int count;
 };
 
 /**
@@ -55,7 +80,9 @@ struct l_hashmap {
 	l_hashmap_key_new_func_t key_new_func;
 	l_hashmap_key_free_func_t key_free_func;
 	unsigned int entries;
-	struct entry buckets[NBUCKETS];
+	struct table table;
+	struct table old;
+	unsigned int rehash_pos;
 };
 
 static inline void *get_key_new(const struct l_hashmap *hashmap,
@@ -126,6 +153,218 @@ static inline unsigned int hash_superfast(const uint8_t *key, unsigned int len)
 	return hash;
 }
 
+static inline unsigned int table_home(const struct table *table,
+							unsigned int hash)
+{
+	/* Fibonacci hashing spreads clustered hash values, e.g. pointers */
+	return (hash * 2654435769U) >> (32 - table->bits);
+}
+
+static inline unsigned int table_next(const struct table *table,
+							unsigned int index)
+{
+	return (index + 1) & table->mask;
+}
+
+static void table_init(struct table *table, unsigned int bits)
+{
+	table->bits = bits;
+	table->mask = (1U << bits) - 1;
+	table->count = 0;
+	table->slots = l_new(struct entry, 1U << bits);
+}
+
+static void table_free(struct table *table)
+{
+	l_free(table->slots);
+	memset(table, 0, sizeof(*table));
+}
+
+static void table_insert(struct table *table, void *key, void *value,
+							unsigned int hash)
+{
+	struct entry *slots = table->slots;
+	unsigned int index = table_home(table, hash);
+	unsigned int dist = 1;
+	unsigned int end;
+
+	/* Skip over entries from earlier or from the same home slot */
+	while (slots[index].dist >= dist) {
+		index = table_next(table, index);
+		dist += 1;
+	}
+
+	/* Make room by shifting the rest of the cluster up by one */
+	for (end = index; slots[end].dist; end = table_next(table, end))
+		;
+
+	while (end != index) {
+		unsigned int prev = (end - 1) & table->mask;
+
+		slots[end] = slots[prev];
+		slots[end].dist += 1;
+		end = prev;
+	}
+
+	slots[index].key = key;
+	slots[index].value = value;
+	slots[index].hash = hash;
+	slots[index].dist = dist;
+
+	table->count += 1;
+}
+
+static int table_find(const struct table *table,
+				l_hashmap_compare_func_t compare_func,
+				const void *key, unsigned int hash)
+{
+	const struct entry *slots = table->slots;
+	unsigned int index;
+	unsigned int dist;
+
+	if (!table->count)
+		return -1;
+
+	index = table_home(table, hash);
+
+	for (dist = 1; slots[index].dist >= dist; dist++) {
+		if (slots[index].hash == hash &&
+				!compare_func(key, slots[index].key))
+			return index;
+
+		index = table_next(table, index);
+	}
+
+	return -1;
+}
+
+static void table_remove_at(struct table *table, unsigned int index)
+{
+	struct entry *slots = table->slots;
+	unsigned int next = table_next(table, index);
+
+	/* Shift the rest of the cluster down, unless already at home */
+	while (slots[next].dist > 1) {
+		slots[index] = slots[next];
+		slots[index].dist -= 1;
+		index = next;
+		next = table_next(table, next);
+	}
+
+	memset(&slots[index], 0, sizeof(struct entry));
+
+	table->count -= 1;
+}
+
+static void rehash_cluster(struct l_hashmap *hashmap, unsigned int index)
+{
+	struct table *old = &hashmap->old;
+	struct entry *slots = old->slots;
+
+	while (slots[(index - 1) & old->mask].dist)
+		index = (index - 1) & old->mask;
+
+	while (slots[index].dist) {
+		table_insert(&hashmap->table, slots[index].key,
+				slots[index].value, slots[index].hash);
+		slots[index].dist = 0;
+		old->count -= 1;
+		index = table_next(old, index);
+	}
+
+	if (!old->count)
+		table_free(old);
+}
+
+static void rehash_step(struct l_hashmap *hashmap)
+{
+	unsigned int i;
+
+	for (i = 0; i < REHASH_STEP && hashmap->old.slots; i++) {
+		unsigned int pos = hashmap->rehash_pos;
+
+		hashmap->rehash_pos = table_next(&hashmap->old, pos);
+
+		if (hashmap->old.slots[pos].dist)
+			rehash_cluster(hashmap, pos);
+	}
+}
+
+static void rehash_finish(struct l_hashmap *hashmap)
+{
+	while (hashmap->old.slots)
+		rehash_step(hashmap);
+}
+
+/*
+ * Moves all entries sharing the home slot of @hash into the current
+ * table, so that insert and remove only ever have to touch one table.
+ */
+static void rehash_touch(struct l_hashmap *hashmap, unsigned int hash)
+{
+	unsigned int index;
+
+	if (!hashmap->old.slots)
+		return;
+
+	index = table_home(&hashmap->old, hash);
+
+	if (hashmap->old.slots[index].dist)
+		rehash_cluster(hashmap, index);
+}
+
+static void resize(struct l_hashmap *hashmap, unsigned int bits)
+{
+	rehash_finish(hashmap);
+
+	if (hashmap->table.count) {
+		hashmap->old = hashmap->table;
+		hashmap->rehash_pos = 0;
+	} else
+		table_free(&hashmap->table);
+
+	table_init(&hashmap->table, bits);
+}
+
+static void table_destroy(struct l_hashmap *hashmap, struct table *table,
+				l_hashmap_destroy_func_t destroy)
+{
+	unsigned int i;
+
+	if (!table->slots)
+		return;
+
+	for (i = 0; i <= table->mask; i++) {
+		struct entry *entry = &table->slots[i];
+
+		if (!entry->dist)
+			continue;
+
+		if (destroy)
+			destroy(entry->value);
+
+		free_key(hashmap, entry->key);
+	}
+
+	table_free(table);
+}
+
+static void table_foreach(const struct table *table,
+			l_hashmap_foreach_func_t function, void *user_data)
+{
+	unsigned int i;
+
+	if (!table->slots)
+		return;
+
+	for (i = 0; i <= table->mask; i++) {
+		struct entry *entry = &table->slots[i];
+
+		if (entry->dist)
+			function(entry->key, entry->value, user_data);
+	}
+}
+
 static unsigned int direct_hash_func(const void *p)
 {
 	return L_PTR_TO_UINT(p);
@@ -170,11 +409,56 @@ LIB_EXPORT unsigned int l_str_hash(const void *p)
 	return hash_superfast((const uint8_t *)s, len);
 }
 
+static const uint8_t *hash_key(void)
+{
+	static uint8_t key[16];
+	static bool initialized = false;
+
+	if (likely(initialized))
+		return key;
+
+	/*
+	 * Without getrandom() fall back to something that at least differs
+	 * between processes and is not known ahead of time.
+	 */
+	if (!l_getrandom(key, sizeof(key))) {
+		uint64_t now = l_time_now();
+		uint64_t pid = getpid();
+
+		memcpy(key, &now, sizeof(now));
+		memcpy(key + 8, &pid, sizeof(pid));
+	}
+
+	initialized = true;
+
+	return key;
+}
+
+/**
+ * l_str_hash_keyed:
+ * @p: NUL terminated string
+ *
+ * Hash a string with SipHash-2-4, keyed with a random per-process secret.
+ * Unlike l_str_hash(), the result cannot be predicted by a peer, so it
+ * should be used for keys that can be chosen by an untrusted party.
+ *
+ * Returns: the hash value of @p
+ **/
+LIB_EXPORT unsigned int l_str_hash_keyed(const void *p)
+{
+	const char *s = p;
+	uint8_t out[8];
+
+	_siphash24(out, (const uint8_t *) s, strlen(s), hash_key());
+
+	return l_get_le32(out);
+}
+
 /**
  * l_hashmap_string_new:
  *
  * Create a new hash table. The keys are considered strings and are
- * copied.
+ * copied.  They are hashed with l_str_hash_keyed().
  *
  * No error handling is needed since. In case of real memory allocation
  * problems abort() will be called.
@@ -189,7 +473,7 @@ LIB_EXPORT struct l_hashmap *l_hashmap_string_new(void)
 
 	hashmap = l_new(struct l_hashmap, 1);
 
-	hashmap->hash_func = l_str_hash;
+	hashmap->hash_func = l_str_hash_keyed;
 	hashmap->compare_func = (l_hashmap_compare_func_t) strcmp;
 	hashmap->key_new_func = (l_hashmap_key_new_func_t) l_strdup;
 	hashmap->key_free_func = l_free;
@@ -320,32 +604,11 @@ LIB_EXPORT bool l_hashmap_set_key_free_function(struct l_hashmap *hashmap,
 LIB_EXPORT void l_hashmap_destroy(struct l_hashmap *hashmap,
 				l_hashmap_destroy_func_t destroy)
 {
-	unsigned int i;
-
 	if (unlikely(!hashmap))
 		return;
 
-	for (i = 0; i < NBUCKETS; i++) {
-		struct entry *entry, *next, *head = &hashmap->buckets[i];
-
-		if (!head->next)
-			continue;
-
-		for (entry = head;; entry = next) {
-			if (destroy)
-				destroy(entry->value);
-
-			free_key(hashmap, entry->key);
-
-			next = entry->next;
-
-			if (entry != head)
-				l_free(entry);
-
-			if (next == head)
-				break;
-		}
-	}
+	table_destroy(hashmap, &hashmap->old, destroy);
+	table_destroy(hashmap, &hashmap->table, destroy);
 
 	l_free(hashmap);
 }
@@ -363,7 +626,6 @@ LIB_EXPORT void l_hashmap_destroy(struct l_hashmap *hashmap,
 LIB_EXPORT bool l_hashmap_insert(struct l_hashmap *hashmap,
 				const void *key, void *value)
 {
-	struct entry *entry, *head;
 	unsigned int hash;
 	void *key_new;
 
@@ -372,30 +634,19 @@ LIB_EXPORT bool l_hashmap_insert(struct l_hashmap *hashmap,
 
 	key_new = get_key_new(hashmap, key);
 	hash = hashmap->hash_func(key_new);
-	head = &hashmap->buckets[hash % NBUCKETS];
-
-	if (!head->next) {
-		head->key = key_new;
-		head->value = value;
-		head->hash = hash;
-		head->next = head;
-		goto done;
-	}
 
-	entry = l_new(struct entry, 1);
-	entry->key = key_new;
-	entry->value = value;
-	entry->hash = hash;
-	entry->next = head;
+	if (!hashmap->table.slots)
+		table_init(&hashmap->table, MIN_TABLE_BITS);
+	else if (hashmap->entries + 1 > hashmap->table.mask -
+					hashmap->table.mask / 4)
+		resize(hashmap, hashmap->table.bits + 1);
 
-	while (head->next != entry->next)
-		head = head->next;
-
-	head->next = entry;
-
-done:
+	rehash_touch(hashmap, hash);
+	table_insert(&hashmap->table, key_new, value, hash);
 	hashmap->entries++;
 
+	rehash_step(hashmap);
+
 	return true;
 }
 
@@ -410,61 +661,35 @@ done:
  **/
 LIB_EXPORT void *l_hashmap_remove(struct l_hashmap *hashmap, const void *key)
 {
-	struct entry *entry, *head, *prev;
+	struct table *table;
 	unsigned int hash;
+	void *value;
+	int index;
 
 	if (unlikely(!hashmap))
 		return NULL;
 
+	table = &hashmap->table;
 	hash = hashmap->hash_func(key);
-	head = &hashmap->buckets[hash % NBUCKETS];
 
-	if (!head->next)
-		return NULL;
+	rehash_touch(hashmap, hash);
 
-	for (entry = head, prev = NULL;; prev = entry, entry = entry->next) {
-		void *value;
-
-		if (entry->hash != hash)
-			goto next;
-
-		if (hashmap->compare_func(key, entry->key))
-			goto next;
-
-		value = entry->value;
-
-		if (entry == head) {
-			if (entry->next == head) {
-				free_key(hashmap, entry->key);
-				head->key = NULL;
-				head->value = NULL;
-				head->hash = 0;
-				head->next = NULL;
-			} else {
-				entry = entry->next;
-				free_key(hashmap, head->key);
-				head->key = entry->key;
-				head->value = entry->value;
-				head->hash = entry->hash;
-				head->next = entry->next;
-				l_free(entry);
-			}
-		} else {
-			prev->next = entry->next;
-			free_key(hashmap, entry->key);
-			l_free(entry);
-		}
-
-		hashmap->entries--;
+	index = table_find(table, hashmap->compare_func, key, hash);
+	if (index < 0)
+		return NULL;
 
-		return value;
+	value = table->slots[index].value;
+	free_key(hashmap, table->slots[index].key);
+	table_remove_at(table, index);
+	hashmap->entries--;
 
-next:
-		if (entry->next == head)
-			break;
-	}
+	if (hashmap->old.slots)
+		rehash_step(hashmap);
+	else if (table->bits > MIN_TABLE_BITS &&
+				hashmap->entries < (table->mask + 1) / 8)
+		resize(hashmap, table->bits - 1);
 
-	return NULL;
+	return value;
 }
 
 /**
@@ -478,28 +703,27 @@ next:
  **/
 LIB_EXPORT void *l_hashmap_lookup(struct l_hashmap *hashmap, const void *key)
 {
-	struct entry *entry, *head;
 	unsigned int hash;
+	int index;
 
 	if (unlikely(!hashmap))
 		return NULL;
 
 	hash = hashmap->hash_func(key);
-	head = &hashmap->buckets[hash % NBUCKETS];
 
-	if (!head->next)
-		return NULL;
-
-	for (entry = head;; entry = entry->next) {
-		if (entry->hash == hash &&
-				!hashmap->compare_func(key, entry->key))
-			return entry->value;
-
-		if (entry->next == head)
-			break;
+	/* Entries still in the old table predate those in the new one */
+	if (hashmap->old.slots) {
+		index = table_find(&hashmap->old, hashmap->compare_func,
+								key, hash);
+		if (index >= 0)
+			return hashmap->old.slots[index].value;
 	}
 
-	return NULL;
+	index = table_find(&hashmap->table, hashmap->compare_func, key, hash);
+	if (index < 0)
+		return NULL;
+
+	return hashmap->table.slots[index].value;
 }
 
 /**
@@ -517,24 +741,11 @@ LIB_EXPORT void *l_hashmap_lookup(struct l_hashmap *hashmap, const void *key)
 LIB_EXPORT void l_hashmap_foreach(struct l_hashmap *hashmap,
 			l_hashmap_foreach_func_t function, void *user_data)
 {
-	unsigned int i;
-
 	if (unlikely(!hashmap || !function))
 		return;
 
-	for (i = 0; i < NBUCKETS; i++) {
-		struct entry *entry, *head = &hashmap->buckets[i];
-
-		if (!head->next)
-			continue;
-
-		for (entry = head;; entry = entry->next) {
-			function(entry->key, entry->value, user_data);
-
-			if (entry->next == head)
-				break;
-		}
-	}
+	table_foreach(&hashmap->old, function, user_data);
+	table_foreach(&hashmap->table, function, user_data);
 }
 
 /**
@@ -556,69 +767,42 @@ LIB_EXPORT unsigned int l_hashmap_foreach_remove(struct l_hashmap *hashmap,
 					l_hashmap_remove_func_t function,
 					void *user_data)
 {
-	unsigned int i;
+	struct table *table;
+	unsigned int start, index, n;
 	unsigned int nremoved = 0;
 
 	if (unlikely(!hashmap || !function))
 		return 0;
 
-	for (i = 0; i < NBUCKETS; i++) {
-		struct entry *head = &hashmap->buckets[i];
+	if (!hashmap->entries)
+		return 0;
+
+	rehash_finish(hashmap);
+	table = &hashmap->table;
+
+	/*
+	 * Start right after an empty slot, so that removals only ever shift
+	 * entries which have not been visited yet into the current slot.
+	 */
+	for (start = 0; table->slots[start].dist; start++)
+		;
+
+	for (n = 1; n <= table->mask;) {
 		struct entry *entry;
-		struct entry *prev;
-		bool remove;
 
-		if (head->next == NULL)
-			continue;
+		index = (start + n) & table->mask;
+		entry = &table->slots[index];
 
-		entry = head;
-		prev = NULL;
-
-		while (true) {
-			remove = function(entry->key, entry->value, user_data);
-
-			if (!remove)
-				goto next;
-
-			nremoved += 1;
-			hashmap->entries -= 1;
-
-			if (entry == head) {
-				if (entry->next == head) {
-					free_key(hashmap, entry->key);
-					head->key = NULL;
-					head->value = NULL;
-					head->hash = 0;
-					head->next = NULL;
-					break;
-				} else {
-					entry = entry->next;
-					free_key(hashmap, head->key);
-					head->key = entry->key;
-					head->value = entry->value;
-					head->hash = entry->hash;
-					head->next = entry->next;
-					l_free(entry);
-					entry = head;
-					continue;
-				}
-			} else {
-				prev->next = entry->next;
-				free_key(hashmap, entry->key);
-				l_free(entry);
-				entry = prev->next;
-				if (entry == head)
-					break;
-				continue;
-			}
-
-next:
-			if (entry->next == head)
-				break;
-
-			prev = entry;
-			entry = entry->next;
+		if (!entry->dist || !function(entry->key, entry->value,
+								user_data)) {
+			n++;
+			continue;
 		}
+
+		free_key(hashmap, entry->key);
+		table_remove_at(table, index);
+		hashmap->entries--;
+		nremoved++;
 	}
 
 	return nremoved;
@@ -42,6 +42,7 @@ typedef bool (*l_hashmap_remove_func_t)(const void *key, void *value,
 struct l_hashmap;
 
 unsigned int l_str_hash(const void *p);
+unsigned int l_str_hash_keyed(const void *p);
 
 struct l_hashmap *l_hashmap_new(void);
 struct l_hashmap *l_hashmap_string_new(void);
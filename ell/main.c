@@ -40,8 +40,11 @@
 #include "log.h"
 #include "util.h"
 #include "main.h"
+#include "pool-private.h"
+#include "alg-private.h"
 #include "private.h"
 #include "timeout.h"
+#include "time.h"
 
 /**
  * SECTION:main
@@ -50,7 +53,8 @@
  * Main loop handling
  */
 
-#define MAX_EPOLL_EVENTS 10
+#define MIN_EPOLL_EVENTS 10
+#define MAX_EPOLL_EVENTS 256
 
 #define IDLE_FLAG_DISPATCHING	1
 #define IDLE_FLAG_DESTROYED	2
@@ -69,6 +73,11 @@ static int notify_fd;
 
 static struct l_timeout *watchdog;
 
+static unsigned int event_batch;
+static unsigned int event_batch_min = MIN_EPOLL_EVENTS;
+static unsigned int event_batch_max = MAX_EPOLL_EVENTS;
+static struct l_main_stats main_stats;
+
 static struct l_queue *idle_list;
 
 struct watch_data {
@@ -85,6 +94,27 @@ struct watch_data {
 static unsigned int watch_entries;
 static struct watch_data **watch_list;
 
+static bool watch_list_grow(unsigned int fd)
+{
+	struct watch_data **list;
+	unsigned int entries = watch_entries;
+
+	while (entries <= fd)
+		entries *= 2;
+
+	list = realloc(watch_list, entries * sizeof(void *));
+	if (!list)
+		return false;
+
+	memset(list + watch_entries, 0,
+			(entries - watch_entries) * sizeof(void *));
+
+	watch_list = list;
+	watch_entries = entries;
+
+	return true;
+}
+
 struct idle_data {
 	idle_event_cb_t callback;
 	idle_destroy_cb_t destroy;
@@ -93,6 +123,9 @@ struct idle_data {
 	int id;
 };
 
+static struct pool watch_pool = POOL_INIT(struct watch_data, 64);
+static struct pool idle_pool = POOL_INIT(struct idle_data, 64);
+
 static inline bool __attribute__ ((always_inline)) create_epoll(void)
 {
 	unsigned int i;
@@ -138,10 +171,10 @@ int watch_add(int fd, uint32_t events, watch_event_cb_t callback,
 	if (!epoll_fd)
 		return -EIO;
 
-	if ((unsigned int) fd > watch_entries - 1)
-		return -ERANGE;
+	if ((unsigned int) fd >= watch_entries && !watch_list_grow(fd))
+		return -ENOMEM;
 
-	data = l_new(struct watch_data, 1);
+	data = _pool_alloc(&watch_pool);
 
 	data->fd = fd;
 	data->events = events;
@@ -156,7 +189,7 @@ int watch_add(int fd, uint32_t events, watch_event_cb_t callback,
 
 	err = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, data->fd, &ev);
 	if (err < 0) {
-		l_free(data);
+		_pool_free(&watch_pool, data);
 		return -errno;
 	}
 
@@ -174,8 +207,8 @@ int watch_modify(int fd, uint32_t events, bool force)
 	if (unlikely(fd < 0))
 		return -EINVAL;
 
-	if ((unsigned int) fd > watch_entries - 1)
-		return -ERANGE;
+	if ((unsigned int) fd >= watch_entries)
+		return -ENXIO;
 
 	data = watch_list[fd];
 	if (!data)
@@ -204,8 +237,8 @@ int watch_clear(int fd)
 	if (unlikely(fd < 0))
 		return -EINVAL;
 
-	if ((unsigned int) fd > watch_entries - 1)
-		return -ERANGE;
+	if ((unsigned int) fd >= watch_entries)
+		return -ENXIO;
 
 	data = watch_list[fd];
 	if (!data)
@@ -219,7 +252,7 @@ int watch_clear(int fd)
 	if (data->flags & WATCH_FLAG_DISPATCHING)
 		data->flags |= WATCH_FLAG_DESTROYED;
 	else
-		l_free(data);
+		_pool_free(&watch_pool, data);
 
 	return 0;
 }
@@ -254,7 +287,7 @@ static bool idle_remove_by_id(void *data, void *user_data)
 		return false;
 	}
 
-	l_free(idle);
+	_pool_free(&idle_pool, idle);
 
 	return true;
 }
@@ -266,7 +299,7 @@ static bool idle_prune(void *data, void *user_data)
 	if ((idle->flags & IDLE_FLAG_DESTROYED) == 0)
 		return false;
 
-	l_free(idle);
+	_pool_free(&idle_pool, idle);
 
 	return true;
 }
@@ -282,7 +315,7 @@ int idle_add(idle_event_cb_t callback, void *user_data, uint32_t flags,
 	if (!epoll_fd)
 		return -EIO;
 
-	data = l_new(struct idle_data, 1);
+	data = _pool_alloc(&idle_pool);
 
 	data->callback = callback;
 	data->destroy = destroy;
@@ -290,7 +323,7 @@ int idle_add(idle_event_cb_t callback, void *user_data, uint32_t flags,
 	data->flags = flags;
 
 	if (!l_queue_push_tail(idle_list, data)) {
-		l_free(data);
+		_pool_free(&idle_pool, data);
 		return -ENOMEM;
 	}
 
@@ -319,7 +352,7 @@ static void idle_destroy(void *data)
 	if (idle->destroy)
 		idle->destroy(idle->user_data);
 
-	l_free(idle);
+	_pool_free(&idle_pool, idle);
 }
 
 static void idle_dispatch(void *data, void *user_data)
@@ -428,6 +461,14 @@ LIB_EXPORT bool l_main_init(void)
 
 	epoll_terminate = false;
 
+	event_batch = event_batch_min;
+	memset(&main_stats, 0, sizeof(main_stats));
+	main_stats.start_time = l_time_now();
+	main_stats.event_batch = event_batch;
+
+	_pool_set_caching(true);
+	_alg_pool_set_enabled(true);
+
 	return true;
 }
 
@@ -445,6 +486,34 @@ LIB_EXPORT int l_main_prepare(void)
 	return l_queue_isempty(idle_list) ? -1 : 0;
 }
 
+static void update_stats(unsigned int nfds, uint64_t start)
+{
+	main_stats.wakeups += 1;
+	main_stats.events += nfds;
+	main_stats.dispatch_time += l_time_diff(start, l_time_now());
+
+	if (nfds > main_stats.max_events)
+		main_stats.max_events = nfds;
+
+	/*
+	 * A full batch means more events are likely pending, so ask for
+	 * more on the next wakeup.  Fall back slowly once the load drops.
+	 */
+	if (nfds == event_batch && event_batch < event_batch_max) {
+		event_batch *= 2;
+
+		if (event_batch > event_batch_max)
+			event_batch = event_batch_max;
+	} else if (nfds < event_batch / 4 && event_batch > event_batch_min) {
+		event_batch /= 2;
+
+		if (event_batch < event_batch_min)
+			event_batch = event_batch_min;
+	}
+
+	main_stats.event_batch = event_batch;
+}
+
 /**
  * l_main_iterate:
  *
@@ -454,9 +523,14 @@ LIB_EXPORT void l_main_iterate(int timeout)
 {
 	struct epoll_event events[MAX_EPOLL_EVENTS];
 	struct watch_data *data;
+	uint64_t start;
 	int n, nfds;
 
-	nfds = epoll_wait(epoll_fd, events, MAX_EPOLL_EVENTS, timeout);
+	nfds = epoll_wait(epoll_fd, events, event_batch, timeout);
+	start = l_time_now();
+
+	if (nfds < 0)
+		nfds = 0;
 
 	for (n = 0; n < nfds; n++) {
 		data = events[n].data.ptr;
@@ -478,13 +552,15 @@ LIB_EXPORT void l_main_iterate(int timeout)
 		data = events[n].data.ptr;
 
 		if (data->flags & WATCH_FLAG_DESTROYED)
-			l_free(data);
+			_pool_free(&watch_pool, data);
 		else
 			data->flags = 0;
 	}
 
 	l_queue_foreach(idle_list, idle_dispatch, NULL);
 	l_queue_foreach_remove(idle_list, idle_prune, NULL);
+
+	update_stats(nfds, start);
 }
 
 /**
@@ -560,7 +636,7 @@ LIB_EXPORT bool l_main_exit(void)
 		else
 			l_error("Dangling file descriptor %d found", data->fd);
 
-		l_free(data);
+		_pool_free(&watch_pool, data);
 	}
 
 	watch_entries = 0;
@@ -571,6 +647,12 @@ LIB_EXPORT bool l_main_exit(void)
 	l_queue_destroy(idle_list, idle_destroy);
 	idle_list = NULL;
 
+	_pool_set_caching(false);
+	_pool_flush(&watch_pool);
+	_pool_flush(&idle_pool);
+	_alg_pool_set_enabled(false);
+	_queue_pool_flush();
+
 	close(epoll_fd);
 	epoll_fd = 0;
 
@@ -649,6 +731,60 @@ LIB_EXPORT int l_main_run_with_signal(l_main_signal_cb_t callback,
 	return result;
 }
 
+/**
+ * l_main_set_event_batch:
+ * @min: fewest events to fetch per wakeup
+ * @max: most events to fetch per wakeup, up to 256
+ *
+ * Set the range within which l_main_iterate() adapts the number of events
+ * it asks epoll_wait() for.  The batch doubles after every wakeup that
+ * fills it and halves once wakeups use less than a quarter of it.  Pass
+ * the same value twice for a fixed batch size.  The default range is 10
+ * to 256.
+ *
+ * Returns: #true on success or #false if the range is invalid
+ **/
+LIB_EXPORT bool l_main_set_event_batch(unsigned int min, unsigned int max)
+{
+	if (unlikely(!min || min > max || max > MAX_EPOLL_EVENTS))
+		return false;
+
+	event_batch_min = min;
+	event_batch_max = max;
+
+	if (event_batch < min)
+		event_batch = min;
+	else if (event_batch > max)
+		event_batch = max;
+
+	main_stats.event_batch = event_batch;
+
+	return true;
+}
+
+/**
+ * l_main_get_stats:
+ * @stats: statistics to fill in
+ *
+ * Obtain event loop statistics gathered since l_main_init().  The average
+ * number of events per wakeup is @events / @wakeups, and the wakeup rate
+ * is @wakeups over the time elapsed since @start_time (see l_time_now()).
+ *
+ * Returns: #true on success or #false if the main loop is not initialized
+ **/
+LIB_EXPORT bool l_main_get_stats(struct l_main_stats *stats)
+{
+	if (unlikely(!stats))
+		return false;
+
+	if (unlikely(!epoll_fd))
+		return false;
+
+	memcpy(stats, &main_stats, sizeof(main_stats));
+
+	return true;
+}
+
 /**
  * l_main_get_epoll_fd:
  *
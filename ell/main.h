@@ -44,6 +44,18 @@ int l_main_run_with_signal(l_main_signal_cb_t callback, void *user_data);
 
 int l_main_get_epoll_fd();
 
+struct l_main_stats {
+	uint64_t start_time;
+	uint64_t wakeups;
+	uint64_t events;
+	uint64_t dispatch_time;
+	unsigned int max_events;
+	unsigned int event_batch;
+};
+
+bool l_main_set_event_batch(unsigned int min, unsigned int max);
+bool l_main_get_stats(struct l_main_stats *stats);
+
 #ifdef __cplusplus
 }
 #endif
@@ -31,6 +31,8 @@
 #include "checksum.h"
 #include "cipher.h"
 #include "asn1-private.h"
+#include "checksum-private.h"
+#include "digest-private.h"
 #include "private.h"
 #include "pkcs5.h"
 #include "pkcs5-private.h"
@@ -97,85 +99,172 @@ LIB_EXPORT bool l_pkcs5_pbkdf1(enum l_checksum_type type, const char *password,
 	return !iter_count;
 }
 
-/* RFC8018 section 5.2 */
-LIB_EXPORT bool l_pkcs5_pbkdf2(enum l_checksum_type type, const char *password,
-				const uint8_t *salt, size_t salt_len,
-				unsigned int iter_count,
-				uint8_t *out_dk, size_t dk_len)
+static size_t pbkdf2_hash_len(enum l_checksum_type type)
 {
-	size_t h_len;
-	struct l_checksum *checksum;
-	unsigned int i;
-
 	switch (type) {
 	case L_CHECKSUM_SHA1:
-		h_len = 20;
-		break;
+		return 20;
 	case L_CHECKSUM_SHA224:
-		h_len = 28;
-		break;
+		return 28;
 	case L_CHECKSUM_SHA256:
-		h_len = 32;
-		break;
+		return 32;
 	case L_CHECKSUM_SHA384:
-		h_len = 48;
-		break;
+		return 48;
 	case L_CHECKSUM_SHA512:
-		h_len = 64;
-		break;
+		return 64;
 	case L_CHECKSUM_NONE:
 	case L_CHECKSUM_MD4:
 	case L_CHECKSUM_MD5:
-		return false;
-	default:
-		return false;
+		return 0;
 	}
 
-	checksum = l_checksum_new_hmac(type, password, strlen(password));
-	if (!checksum)
-		return false;
+	return 0;
+}
+
+/*
+ * Applies the PRF @count times starting from the @u_len bytes in @u,
+ * XORing each @h_len byte output into @t and leaving the last one in @u.
+ */
+typedef bool (*pbkdf2_prf_func_t)(void *prf, size_t h_len,
+					uint8_t *u, size_t u_len,
+					uint8_t *t, unsigned int count);
+
+static bool pbkdf2_prf_hmac(void *prf, size_t h_len,
+					uint8_t *u, size_t u_len,
+					uint8_t *t, unsigned int count)
+{
+	struct hmac_ctx *hmac = prf;
+
+	if (!count)
+		return true;
+
+	_hmac_reset(hmac);
+	_hmac_update(hmac, u, u_len);
+	_hmac_final(hmac, u);
+	memcpy(t, u, h_len);
+
+	/*
+	 * Each iteration is two compression function calls, doing them
+	 * in-process instead of over an AF_ALG socket saves three
+	 * syscalls per iteration.
+	 */
+	_hmac_iterate(hmac, u, t, count - 1);
+
+	return true;
+}
+
+static bool pbkdf2_prf_checksum(void *prf, size_t h_len,
+					uint8_t *u, size_t u_len,
+					uint8_t *t, unsigned int count)
+{
+	struct l_checksum *checksum = prf;
+	unsigned int k;
+
+	while (count--) {
+		l_checksum_reset(checksum);
+
+		if (!l_checksum_update(checksum, u, u_len))
+			return false;
+
+		if (l_checksum_get_digest(checksum, u, h_len) !=
+				(ssize_t) h_len)
+			return false;
+
+		u_len = h_len;
+
+		for (k = 0; k < h_len; k++)
+			t[k] ^= u[k];
+	}
+
+	return true;
+}
+
+/* The F() loop of RFC8018 section 5.2 over every output block */
+static bool pbkdf2(size_t h_len, pbkdf2_prf_func_t prf_func, void *prf,
+				const uint8_t *salt, size_t salt_len,
+				unsigned int iter_count,
+				uint8_t *out_dk, size_t dk_len)
+{
+	uint8_t u[salt_len + DIGEST_MAX_LEN];
+	uint8_t t[DIGEST_MAX_LEN];
+	unsigned int i;
 
 	for (i = 1; dk_len; i++) {
-		unsigned int j, k;
-		uint8_t u[salt_len + 64];
-		size_t u_len;
 		size_t block_len = h_len;
 
 		if (block_len > dk_len)
 			block_len = dk_len;
 
-		memset(out_dk, 0, block_len);
-
 		memcpy(u, salt, salt_len);
 		l_put_be32(i, u + salt_len);
-		u_len = salt_len + 4;
+		memset(t, 0, h_len);
 
-		for (j = 0; j < iter_count; j++) {
-			l_checksum_reset(checksum);
+		if (!prf_func(prf, h_len, u, salt_len + 4, t, iter_count))
+			break;
 
-			if (!l_checksum_update(checksum, u, u_len))
-				break;
+		memcpy(out_dk, t, block_len);
 
-			if (l_checksum_get_digest(checksum, u, h_len) !=
-					(ssize_t) h_len)
-				break;
+		out_dk += block_len;
+		dk_len -= block_len;
+	}
 
-			u_len = h_len;
+	explicit_bzero(u, sizeof(u));
+	explicit_bzero(t, sizeof(t));
 
-			for (k = 0; k < block_len; k++)
-				out_dk[k] ^= u[k];
-		}
+	return !dk_len;
+}
 
-		if (j < iter_count)
-			break;
+/* RFC8018 section 5.2 */
+LIB_EXPORT bool l_pkcs5_pbkdf2(enum l_checksum_type type, const char *password,
+				const uint8_t *salt, size_t salt_len,
+				unsigned int iter_count,
+				uint8_t *out_dk, size_t dk_len)
+{
+	size_t h_len = pbkdf2_hash_len(type);
+	struct hmac_ctx hmac;
+	bool r;
 
-		out_dk += block_len;
-		dk_len -= block_len;
-	}
+	if (!h_len)
+		return false;
 
+	if (!_hmac_init(&hmac, type, password, strlen(password)))
+		return false;
+
+	r = pbkdf2(h_len, pbkdf2_prf_hmac, &hmac, salt, salt_len, iter_count,
+							out_dk, dk_len);
+	explicit_bzero(&hmac, sizeof(hmac));
+
+	return r;
+}
+
+/*
+ * Same as l_pkcs5_pbkdf2 but with the HMAC computed by the kernel
+ * through AF_ALG, for callers that must not use the in-process
+ * implementation.
+ */
+LIB_EXPORT bool l_pkcs5_pbkdf2_kernel(enum l_checksum_type type,
+					const char *password,
+					const uint8_t *salt, size_t salt_len,
+					unsigned int iter_count,
+					uint8_t *out_dk, size_t dk_len)
+{
+	size_t h_len = pbkdf2_hash_len(type);
+	struct l_checksum *checksum;
+	bool r;
+
+	if (!h_len)
+		return false;
+
+	checksum = _checksum_new_hmac_kernel(type, password,
+							strlen(password));
+	if (!checksum)
+		return false;
+
+	r = pbkdf2(h_len, pbkdf2_prf_checksum, checksum, salt, salt_len,
+					iter_count, out_dk, dk_len);
 	l_checksum_free(checksum);
 
-	return !dk_len;
+	return r;
 }
 
 static struct asn1_oid pkcs5_pbkdf2_oid = {
@@ -40,6 +40,11 @@ bool l_pkcs5_pbkdf2(enum l_checksum_type type, const char *password,
 			unsigned int iter_count,
 			uint8_t *out_dk, size_t dk_len);
 
+bool l_pkcs5_pbkdf2_kernel(enum l_checksum_type type, const char *password,
+				const uint8_t *salt, size_t salt_len,
+				unsigned int iter_count,
+				uint8_t *out_dk, size_t dk_len);
+
 #ifdef __cplusplus
 }
 #endif
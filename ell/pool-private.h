@@ -0,0 +1,58 @@
+/*
+ *
+ *  Embedded Linux library
+ *
+ *  Copyright (C) 2019  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <stddef.h>
+#include <stdbool.h>
+
+struct pool_stats {
+	unsigned long allocs;
+	unsigned long frees;
+	unsigned long mallocs;
+};
+
+/*
+ * Free-list cache for small fixed-size objects.  Each pool keeps up to
+ * @max_cached freed objects around for reuse instead of handing them back
+ * to malloc.  A pool is not thread-safe, declare it __thread if it can be
+ * used from several threads.
+ */
+struct pool {
+	size_t size;
+	unsigned int max_cached;
+	unsigned int cached;
+	void *free_list;
+};
+
+#define POOL_INIT(type, max) { .size = sizeof(type), .max_cached = (max) }
+
+void *_pool_alloc(struct pool *pool);
+void _pool_free(struct pool *pool, void *ptr);
+void _pool_flush(struct pool *pool);
+
+/* Set by l_main_init and cleared by l_main_exit on the calling thread */
+void _pool_set_caching(bool enabled);
+bool _pool_caching_enabled(void);
+void _pool_set_stats_enabled(bool enabled);
+void _pool_get_stats(struct pool_stats *out);
+
+/* The main loop thread's l_queue entry cache, flushed by l_main_exit */
+void _queue_pool_flush(void);
@@ -0,0 +1,128 @@
+/*
+ *
+ *  Embedded Linux library
+ *
+ *  Copyright (C) 2019  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+
+#include "util.h"
+#include "pool-private.h"
+#include "private.h"
+
+/*
+ * When built with AddressSanitizer, objects are always returned to malloc
+ * so that use-after-free and leaks are still caught.
+ */
+#ifdef __SANITIZE_ADDRESS__
+#define POOL_CACHING	false
+#else
+#define POOL_CACHING	true
+#endif
+
+/*
+ * Freed objects are only cached on the thread running the main loop, so
+ * that l_main_exit can hand them back.  Other threads use plain malloc.
+ */
+static __thread bool thread_caching;
+
+static __thread bool stats_enabled;
+static __thread struct pool_stats stats;
+
+void *_pool_alloc(struct pool *pool)
+{
+	void *ptr = pool->free_list;
+
+	if (unlikely(stats_enabled)) {
+		stats.allocs += 1;
+
+		if (!ptr)
+			stats.mallocs += 1;
+	}
+
+	if (ptr) {
+		pool->free_list = *(void **) ptr;
+		pool->cached -= 1;
+	} else
+		ptr = l_malloc(pool->size);
+
+	memset(ptr, 0, pool->size);
+
+	return ptr;
+}
+
+void _pool_free(struct pool *pool, void *ptr)
+{
+	if (unlikely(!ptr))
+		return;
+
+	if (unlikely(stats_enabled))
+		stats.frees += 1;
+
+	if (!POOL_CACHING || !thread_caching ||
+			pool->cached >= pool->max_cached ||
+						pool->size < sizeof(void *)) {
+		l_free(ptr);
+		return;
+	}
+
+	*(void **) ptr = pool->free_list;
+	pool->free_list = ptr;
+	pool->cached += 1;
+}
+
+void _pool_flush(struct pool *pool)
+{
+	while (pool->free_list) {
+		void *ptr = pool->free_list;
+
+		pool->free_list = *(void **) ptr;
+		l_free(ptr);
+	}
+
+	pool->cached = 0;
+}
+
+void _pool_set_caching(bool enabled)
+{
+	thread_caching = enabled;
+}
+
+bool _pool_caching_enabled(void)
+{
+	return POOL_CACHING && thread_caching;
+}
+
+/*
+ * Statistics are off by default and kept per thread.  Once enabled, they
+ * are gathered for all pools used by the calling thread.
+ */
+void _pool_set_stats_enabled(bool enabled)
+{
+	stats_enabled = enabled;
+}
+
+void _pool_get_stats(struct pool_stats *out)
+{
+	memcpy(out, &stats, sizeof(stats));
+}
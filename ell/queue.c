@@ -26,6 +26,7 @@
 
 #include "util.h"
 #include "queue.h"
+#include "pool-private.h"
 #include "private.h"
 
 /**
@@ -46,6 +47,14 @@ struct l_queue {
 	unsigned int entries;
 };
 
+static __thread struct pool entry_pool =
+				POOL_INIT(struct l_queue_entry, 1024);
+
+void _queue_pool_flush(void)
+{
+	_pool_flush(&entry_pool);
+}
+
 /**
  * l_queue_new:
  *
@@ -108,7 +117,7 @@ LIB_EXPORT void l_queue_clear(struct l_queue *queue,
 
 		entry = entry->next;
 
-		l_free(tmp);
+		_pool_free(&entry_pool, tmp);
 	}
 
 	queue->head = NULL;
@@ -133,7 +142,7 @@ LIB_EXPORT bool l_queue_push_tail(struct l_queue *queue, void *data)
 	if (unlikely(!queue))
 		return false;
 
-	entry = l_new(struct l_queue_entry, 1);
+	entry = _pool_alloc(&entry_pool);
 
 	entry->data = data;
 	entry->next = NULL;
@@ -168,7 +177,7 @@ LIB_EXPORT bool l_queue_push_head(struct l_queue *queue, void *data)
 	if (unlikely(!queue))
 		return false;
 
-	entry = l_new(struct l_queue_entry, 1);
+	entry = _pool_alloc(&entry_pool);
 
 	entry->data = data;
 	entry->next = queue->head;
@@ -212,7 +221,7 @@ LIB_EXPORT void *l_queue_pop_head(struct l_queue *queue)
 
 	data = entry->data;
 
-	l_free(entry);
+	_pool_free(&entry_pool, entry);
 
 	queue->entries--;
 
@@ -285,7 +294,7 @@ LIB_EXPORT bool l_queue_insert(struct l_queue *queue, void *data,
 	if (unlikely(!queue || !function))
 		return false;
 
-	entry = l_new(struct l_queue_entry, 1);
+	entry = _pool_alloc(&entry_pool);
 
 	entry->data = data;
 	entry->next = NULL;
@@ -379,7 +388,7 @@ LIB_EXPORT bool l_queue_remove(struct l_queue *queue, void *data)
 		if (!entry->next)
 			queue->tail = prev;
 
-		l_free(entry);
+		_pool_free(&entry_pool, entry);
 
 		queue->entries--;
 
@@ -476,7 +485,7 @@ LIB_EXPORT unsigned int l_queue_foreach_remove(struct l_queue *queue,
 
 			entry = entry->next;
 
-			l_free(tmp);
+			_pool_free(&entry_pool, tmp);
 
 			count++;
 		} else {
@@ -529,7 +538,7 @@ LIB_EXPORT void *l_queue_remove_if(struct l_queue *queue,
 
 			data = tmp->data;
 
-			l_free(tmp);
+			_pool_free(&entry_pool, tmp);
 			queue->entries--;
 
 			return data;
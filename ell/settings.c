@@ -42,7 +42,7 @@
 #include "strv.h"
 #include "utf8.h"
 #include "string.h"
-#include "queue.h"
+#include "deque.h"
 #include "settings.h"
 #include "private.h"
 
@@ -53,14 +53,14 @@ struct setting_data {
 
 struct group_data {
 	char *name;
-	struct l_queue *settings;
+	struct l_deque *settings;
 };
 
 struct l_settings {
 	l_settings_debug_cb_t debug_handler;
 	l_settings_destroy_cb_t debug_destroy;
 	void *debug_data;
-	struct l_queue *groups;
+	struct l_deque *groups;
 };
 
 static void setting_destroy(void *data)
@@ -78,7 +78,7 @@ static void group_destroy(void *data)
 	struct group_data *group = data;
 
 	l_free(group->name);
-	l_queue_destroy(group->settings, setting_destroy);
+	l_deque_destroy(group->settings, setting_destroy);
 
 	l_free(group);
 }
@@ -88,7 +88,7 @@ LIB_EXPORT struct l_settings *l_settings_new(void)
 	struct l_settings *settings;
 
 	settings = l_new(struct l_settings, 1);
-	settings->groups = l_queue_new();
+	settings->groups = l_deque_new();
 
 	return settings;
 }
@@ -101,7 +101,7 @@ LIB_EXPORT void l_settings_free(struct l_settings *settings)
 	if (settings->debug_destroy)
 		settings->debug_destroy(settings->debug_data);
 
-	l_queue_destroy(settings->groups, group_destroy);
+	l_deque_destroy(settings->groups, group_destroy);
 
 	l_free(settings);
 }
@@ -257,9 +257,9 @@ static bool parse_group(struct l_settings *settings, const char *data,
 
 	group = l_new(struct group_data, 1);
 	group->name = l_strndup(data + 1, end - 1);
-	group->settings = l_queue_new();
+	group->settings = l_deque_new();
 
-	l_queue_push_tail(settings->groups, group);
+	l_deque_push_tail(settings->groups, group);
 
 	return true;
 }
@@ -301,10 +301,10 @@ static unsigned int parse_key(struct l_settings *settings, const char *data,
 		return 0;
 	}
 
-	group = l_queue_peek_tail(settings->groups);
+	group = l_deque_peek_tail(settings->groups);
 	pair = l_new(struct setting_data, 1);
 	pair->key = l_strndup(data, end);
-	l_queue_push_head(group->settings, pair);
+	l_deque_push_head(group->settings, pair);
 
 	return end;
 }
@@ -316,8 +316,8 @@ static bool parse_value(struct l_settings *settings, const char *data,
 	struct group_data *group;
 	struct setting_data *pair;
 
-	group = l_queue_peek_tail(settings->groups);
-	pair = l_queue_pop_head(group->settings);
+	group = l_deque_peek_tail(settings->groups);
+	pair = l_deque_pop_head(group->settings);
 
 	if (!l_utf8_validate(data, len, NULL)) {
 		l_util_debug(settings->debug_handler, settings->debug_data,
@@ -330,7 +330,7 @@ static bool parse_value(struct l_settings *settings, const char *data,
 	}
 
 	pair->value = l_strndup(data, end);
-	l_queue_push_tail(group->settings, pair);
+	l_deque_push_tail(group->settings, pair);
 
 	return true;
 }
@@ -416,33 +416,28 @@ LIB_EXPORT char *l_settings_to_data(const struct l_settings *settings,
 {
 	struct l_string *buf;
 	char *ret;
-	const struct l_queue_entry *group_entry;
+	unsigned int i, j;
 
 	if (unlikely(!settings))
 		return NULL;
 
 	buf = l_string_new(255);
 
-	group_entry = l_queue_get_entries(settings->groups);
-	while (group_entry) {
-		struct group_data *group = group_entry->data;
-		const struct l_queue_entry *setting_entry =
-				l_queue_get_entries(group->settings);
+	for (i = 0; i < l_deque_length(settings->groups); i++) {
+		struct group_data *group = l_deque_at(settings->groups, i);
+
+		if (i)
+			l_string_append_c(buf, '\n');
 
 		l_string_append_printf(buf, "[%s]\n", group->name);
 
-		while (setting_entry) {
-			struct setting_data *setting = setting_entry->data;
+		for (j = 0; j < l_deque_length(group->settings); j++) {
+			struct setting_data *setting =
+					l_deque_at(group->settings, j);
 
 			l_string_append_printf(buf, "%s=%s\n",
 						setting->key, setting->value);
-			setting_entry = setting_entry->next;
 		}
-
-		if (group_entry->next)
-			l_string_append_c(buf, '\n');
-
-		group_entry = group_entry->next;
 	}
 
 	ret = l_string_unwrap(buf);
@@ -552,11 +547,11 @@ LIB_EXPORT char **l_settings_get_groups(const struct l_settings *settings)
 	if (unlikely(!settings))
 		return NULL;
 
-	ret = l_new(char *, l_queue_length(settings->groups) + 1);
+	ret = l_new(char *, l_deque_length(settings->groups) + 1);
 	gather.v = ret;
 	gather.cur = 0;
 
-	l_queue_foreach(settings->groups, gather_groups, &gather);
+	l_deque_foreach(settings->groups, gather_groups, &gather);
 
 	return ret;
 }
@@ -569,7 +564,7 @@ LIB_EXPORT bool l_settings_has_group(const struct l_settings *settings,
 	if (unlikely(!settings))
 		return false;
 
-	group = l_queue_find(settings->groups, group_match, group_name);
+	group = l_deque_find(settings->groups, group_match, group_name);
 
 	return !!group;
 }
@@ -600,15 +595,15 @@ LIB_EXPORT char **l_settings_get_keys(const struct l_settings *settings,
 	if (unlikely(!settings))
 		return NULL;
 
-	group_data = l_queue_find(settings->groups, group_match, group_name);
+	group_data = l_deque_find(settings->groups, group_match, group_name);
 	if (!group_data)
 		return NULL;
 
-	ret = l_new(char *, l_queue_length(group_data->settings) + 1);
+	ret = l_new(char *, l_deque_length(group_data->settings) + 1);
 	gather.v = ret;
 	gather.cur = 0;
 
-	l_queue_foreach(group_data->settings, gather_keys, &gather);
+	l_deque_foreach(group_data->settings, gather_keys, &gather);
 
 	return ret;
 }
@@ -622,11 +617,11 @@ LIB_EXPORT bool l_settings_has_key(const struct l_settings *settings,
 	if (unlikely(!settings))
 		return false;
 
-	group = l_queue_find(settings->groups, group_match, group_name);
+	group = l_deque_find(settings->groups, group_match, group_name);
 	if (!group)
 		return false;
 
-	setting = l_queue_find(group->settings, key_match, key);
+	setting = l_deque_find(group->settings, key_match, key);
 
 	return !!setting;
 }
@@ -641,11 +636,11 @@ LIB_EXPORT const char *l_settings_get_value(const struct l_settings *settings,
 	if (unlikely(!settings))
 		return NULL;
 
-	group = l_queue_find(settings->groups, group_match, group_name);
+	group = l_deque_find(settings->groups, group_match, group_name);
 	if (!group)
 		return NULL;
 
-	setting = l_queue_find(group->settings, key_match, key);
+	setting = l_deque_find(group->settings, key_match, key);
 	if (!setting)
 		return NULL;
 
@@ -706,23 +701,23 @@ static bool set_value(struct l_settings *settings, const char *group_name,
 		return false;
 	}
 
-	group = l_queue_find(settings->groups, group_match, group_name);
+	group = l_deque_find(settings->groups, group_match, group_name);
 	if (!group) {
 		group = l_new(struct group_data, 1);
 		group->name = l_strdup(group_name);
-		group->settings = l_queue_new();
+		group->settings = l_deque_new();
 
-		l_queue_push_tail(settings->groups, group);
+		l_deque_push_tail(settings->groups, group);
 		goto add_pair;
 	}
 
-	pair = l_queue_find(group->settings, key_match, key);
+	pair = l_deque_find(group->settings, key_match, key);
 	if (!pair) {
 add_pair:
 		pair = l_new(struct setting_data, 1);
 		pair->key = l_strdup(key);
 		pair->value = value;
-		l_queue_push_tail(group->settings, pair);
+		l_deque_push_tail(group->settings, pair);
 
 		return true;
 	}
@@ -1139,7 +1134,7 @@ LIB_EXPORT bool l_settings_remove_group(struct l_settings *settings,
 	if (unlikely(!settings))
 		return false;
 
-	group = l_queue_remove_if(settings->groups, group_match, group_name);
+	group = l_deque_remove_if(settings->groups, group_match, group_name);
 	if (!group)
 		return false;
 
@@ -1158,11 +1153,11 @@ LIB_EXPORT bool l_settings_remove_key(struct l_settings *settings,
 	if (unlikely(!settings))
 		return false;
 
-	group = l_queue_find(settings->groups, group_match, group_name);
+	group = l_deque_find(settings->groups, group_match, group_name);
 	if (!group)
 		return false;
 
-	setting = l_queue_remove_if(group->settings, key_match, key);
+	setting = l_deque_remove_if(group->settings, key_match, key);
 	if (!setting)
 		return false;
 
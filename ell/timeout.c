@@ -34,6 +34,7 @@
 #include <limits.h>
 
 #include "util.h"
+#include "log.h"
 #include "timeout.h"
 #include "private.h"
 
@@ -44,54 +45,266 @@
  * Timeout support
  */
 
+#define TIMEOUT_DISARMED	UINT64_MAX
+#define TIMEOUT_DETACHED	UINT_MAX
+
+#define DEFAULT_HEAP_ENTRIES	64
+
 /**
  * l_timeout:
  *
  * Opague object representing the timeout.
  */
 struct l_timeout {
-	int fd;
+	uint64_t expiry;
+	unsigned int index;
 	l_timeout_notify_cb_t callback;
 	l_timeout_destroy_cb_t destroy;
 	void *user_data;
 };
 
-static void timeout_destroy(void *user_data)
+/*
+ * All timeouts are multiplexed onto a single timerfd.  Every live timeout
+ * sits in a binary min-heap ordered by its absolute expiry time, disarmed
+ * ones sink to the bottom with an expiry of TIMEOUT_DISARMED.  The timerfd
+ * is always programmed no later than the expiry at the top of the heap.
+ */
+static int timer_fd = -1;
+static uint64_t timer_programmed = TIMEOUT_DISARMED;
+static bool timer_dispatching;
+
+static struct l_timeout **heap;
+static unsigned int heap_entries;
+static unsigned int heap_size;
+
+static uint64_t timeout_now(void)
 {
-	struct l_timeout *timeout = user_data;
+	struct timespec now;
 
-	close(timeout->fd);
-	timeout->fd = -1;
+	clock_gettime(CLOCK_MONOTONIC, &now);
 
-	if (timeout->destroy)
-		timeout->destroy(timeout->user_data);
+	return now.tv_sec * 1000000000ULL + now.tv_nsec;
 }
 
-static void timeout_callback(int fd, uint32_t events, void *user_data)
+static inline void heap_set(unsigned int index, struct l_timeout *timeout)
 {
-	struct l_timeout *timeout = user_data;
-	uint64_t expired;
-	ssize_t result;
+	heap[index] = timeout;
+	timeout->index = index;
+}
+
+static void heap_sift_up(unsigned int index)
+{
+	struct l_timeout *timeout = heap[index];
+
+	while (index > 0) {
+		unsigned int parent = (index - 1) / 2;
+
+		if (heap[parent]->expiry <= timeout->expiry)
+			break;
+
+		heap_set(index, heap[parent]);
+		index = parent;
+	}
+
+	heap_set(index, timeout);
+}
+
+static void heap_sift_down(unsigned int index)
+{
+	struct l_timeout *timeout = heap[index];
+
+	for (;;) {
+		unsigned int child = index * 2 + 1;
+
+		if (child >= heap_size)
+			break;
+
+		if (child + 1 < heap_size &&
+				heap[child + 1]->expiry < heap[child]->expiry)
+			child += 1;
+
+		if (timeout->expiry <= heap[child]->expiry)
+			break;
+
+		heap_set(index, heap[child]);
+		index = child;
+	}
+
+	heap_set(index, timeout);
+}
+
+static void heap_push(struct l_timeout *timeout)
+{
+	if (heap_size == heap_entries) {
+		heap_entries *= 2;
+		heap = l_realloc(heap, heap_entries * sizeof(void *));
+	}
+
+	heap_set(heap_size++, timeout);
+	heap_sift_up(timeout->index);
+}
 
-	result = read(timeout->fd, &expired, sizeof(expired));
-	if (result != sizeof(expired))
+static void heap_remove(struct l_timeout *timeout)
+{
+	unsigned int index = timeout->index;
+	struct l_timeout *last = heap[--heap_size];
+
+	timeout->index = TIMEOUT_DETACHED;
+
+	if (last == timeout)
 		return;
 
-	if (timeout->callback)
-		timeout->callback(timeout, timeout->user_data);
+	heap_set(index, last);
+
+	if (index > 0 && heap[(index - 1) / 2]->expiry > last->expiry)
+		heap_sift_up(index);
+	else
+		heap_sift_down(index);
 }
 
-static inline int timeout_set(int fd, unsigned int seconds, long nanoseconds)
+static void timer_program(void)
 {
 	struct itimerspec itimer;
+	uint64_t expiry;
+
+	if (timer_dispatching)
+		return;
+
+	expiry = heap_size ? heap[0]->expiry : TIMEOUT_DISARMED;
+
+	/*
+	 * Firing early is harmless, the dispatcher simply reprograms the
+	 * timer.  So only touch the timerfd when the earliest expiry moved
+	 * forward or all timeouts got disarmed.
+	 */
+	if (expiry == timer_programmed)
+		return;
+
+	if (expiry > timer_programmed && expiry != TIMEOUT_DISARMED)
+		return;
 
 	memset(&itimer, 0, sizeof(itimer));
-	itimer.it_interval.tv_sec = 0;
-	itimer.it_interval.tv_nsec = 0;
-	itimer.it_value.tv_sec = seconds;
-	itimer.it_value.tv_nsec = nanoseconds;
 
-	return timerfd_settime(fd, 0, &itimer, NULL);
+	if (expiry != TIMEOUT_DISARMED) {
+		itimer.it_value.tv_sec = expiry / 1000000000ULL;
+		itimer.it_value.tv_nsec = expiry % 1000000000ULL;
+	}
+
+	if (timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &itimer, NULL) < 0)
+		return;
+
+	timer_programmed = expiry;
+}
+
+static void timeout_set(struct l_timeout *timeout, uint64_t expiry)
+{
+	uint64_t old = timeout->expiry;
+
+	if (expiry == old)
+		return;
+
+	timeout->expiry = expiry;
+
+	if (expiry < old)
+		heap_sift_up(timeout->index);
+	else
+		heap_sift_down(timeout->index);
+
+	timer_program();
+}
+
+static void timer_callback(int fd, uint32_t events, void *user_data)
+{
+	uint64_t expired;
+	uint64_t now;
+
+	if (read(timer_fd, &expired, sizeof(expired)) < 0 && errno != EAGAIN)
+		return;
+
+	now = timeout_now();
+	timer_programmed = TIMEOUT_DISARMED;
+	timer_dispatching = true;
+
+	while (heap_size && heap[0]->expiry <= now) {
+		struct l_timeout *timeout = heap[0];
+
+		/*
+		 * The timeout is one-shot, disarm it before calling back so
+		 * that the callback is free to rearm or remove it.
+		 */
+		timeout->expiry = TIMEOUT_DISARMED;
+		heap_sift_down(0);
+
+		timeout->callback(timeout, timeout->user_data);
+
+		/* The main loop has been torn down from within the callback */
+		if (timer_fd < 0)
+			return;
+	}
+
+	timer_dispatching = false;
+	timer_program();
+}
+
+static void timer_destroy(void *user_data)
+{
+	/* Don't arm the timerfd for removals from within destroy callbacks */
+	timer_dispatching = true;
+
+	/*
+	 * Detach timeouts from the end of the heap so that the destroy
+	 * callbacks can still remove other timeouts, or create new ones,
+	 * without reordering entries we have yet to visit.
+	 */
+	while (heap_size) {
+		struct l_timeout *timeout = heap[--heap_size];
+
+		timeout->index = TIMEOUT_DETACHED;
+
+		if (timeout->destroy)
+			timeout->destroy(timeout->user_data);
+		else
+			l_error("Dangling timeout %p found", timeout);
+	}
+
+	l_free(heap);
+	heap = NULL;
+	heap_entries = 0;
+	heap_size = 0;
+
+	close(timer_fd);
+	timer_fd = -1;
+	timer_programmed = TIMEOUT_DISARMED;
+	timer_dispatching = false;
+}
+
+static bool timer_setup(void)
+{
+	int err;
+
+	if (timer_fd >= 0)
+		return true;
+
+	timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (timer_fd < 0)
+		return false;
+
+	err = watch_add(timer_fd, EPOLLIN, timer_callback, NULL, timer_destroy);
+	if (err < 0) {
+		close(timer_fd);
+		timer_fd = -1;
+		return false;
+	}
+
+	heap_entries = DEFAULT_HEAP_ENTRIES;
+	heap = l_new(struct l_timeout *, heap_entries);
+
+	return true;
+}
+
+static uint64_t timeout_expiry(unsigned int seconds, long nanoseconds)
+{
+	return timeout_now() + seconds * 1000000000ULL + nanoseconds;
 }
 
 static bool convert_ms(unsigned long milliseconds, unsigned int *seconds,
@@ -129,39 +342,24 @@ static struct l_timeout *timeout_create_with_nanoseconds(unsigned int seconds,
 			void *user_data, l_timeout_destroy_cb_t destroy)
 {
 	struct l_timeout *timeout;
-	int err;
 
 	if (unlikely(!callback))
 		return NULL;
 
+	if (!timer_setup())
+		return NULL;
+
 	timeout = l_new(struct l_timeout, 1);
 
 	timeout->callback = callback;
 	timeout->destroy = destroy;
 	timeout->user_data = user_data;
+	timeout->expiry = TIMEOUT_DISARMED;
 
-	timeout->fd = timerfd_create(CLOCK_MONOTONIC,
-					TFD_NONBLOCK | TFD_CLOEXEC);
-	if (timeout->fd < 0) {
-		l_free(timeout);
-		return NULL;
-	}
+	heap_push(timeout);
 
-	if (seconds > 0 || nanoseconds > 0) {
-		if (timeout_set(timeout->fd, seconds, nanoseconds) < 0) {
-			close(timeout->fd);
-			l_free(timeout);
-			return NULL;
-		}
-	}
-
-	err = watch_add(timeout->fd, EPOLLIN | EPOLLONESHOT, timeout_callback,
-			timeout, timeout_destroy);
-
-	if (err < 0) {
-		l_free(timeout);
-		return NULL;
-	}
+	if (seconds > 0 || nanoseconds > 0)
+		timeout_set(timeout, timeout_expiry(seconds, nanoseconds));
 
 	return timeout;
 }
@@ -231,15 +429,11 @@ LIB_EXPORT void l_timeout_modify(struct l_timeout *timeout,
 	if (unlikely(!timeout))
 		return;
 
-	if (unlikely(timeout->fd < 0))
+	if (unlikely(timeout->index == TIMEOUT_DETACHED))
 		return;
 
-	if (seconds > 0) {
-		if (timeout_set(timeout->fd, seconds, 0) < 0)
-			return;
-	}
-
-	watch_modify(timeout->fd, EPOLLIN | EPOLLONESHOT, true);
+	if (seconds > 0)
+		timeout_set(timeout, timeout_expiry(seconds, 0));
 }
 
 /**
@@ -255,19 +449,18 @@ LIB_EXPORT void l_timeout_modify_ms(struct l_timeout *timeout,
 	if (unlikely(!timeout))
 		return;
 
-	if (unlikely(timeout->fd < 0))
+	if (unlikely(timeout->index == TIMEOUT_DETACHED))
 		return;
 
 	if (milliseconds > 0) {
 		unsigned int sec;
 		long nanosec;
 
-		if (!convert_ms(milliseconds, &sec, &nanosec) ||
-			timeout_set(timeout->fd, sec, nanosec) < 0)
+		if (!convert_ms(milliseconds, &sec, &nanosec))
 			return;
-	}
 
-	watch_modify(timeout->fd, EPOLLIN | EPOLLONESHOT, true);
+		timeout_set(timeout, timeout_expiry(sec, nanosec));
+	}
 }
 
 /**
@@ -281,7 +474,13 @@ LIB_EXPORT void l_timeout_remove(struct l_timeout *timeout)
 	if (unlikely(!timeout))
 		return;
 
-	watch_remove(timeout->fd);
+	if (timeout->index != TIMEOUT_DETACHED) {
+		heap_remove(timeout);
+		timer_program();
+
+		if (timeout->destroy)
+			timeout->destroy(timeout->user_data);
+	}
 
 	l_free(timeout);
 }
@@ -840,6 +840,60 @@ static bool tls_signature_algorithms_client_absent(struct l_tls *tls)
 	return true;
 }
 
+/* RFC 5077, Section 3.2 */
+static ssize_t tls_session_ticket_client_write(struct l_tls *tls,
+						uint8_t *buf, size_t len)
+{
+	const struct l_tls_session *session = tls->session;
+
+	/* An empty ticket tells the server we'd like one */
+	if (!session || !session->ticket)
+		return 0;
+
+	if (len < session->ticket_len)
+		return -ENOSPC;
+
+	memcpy(buf, session->ticket, session->ticket_len);
+	return session->ticket_len;
+}
+
+static bool tls_session_ticket_client_handle(struct l_tls *tls,
+						const uint8_t *buf, size_t len)
+{
+	if (!tls->session_cache ||
+			!tls_session_cache_has_tickets(tls->session_cache))
+		return true;
+
+	tls->session_ticket_ext = true;
+
+	if (len) {
+		tls->session_ticket = l_memdup(buf, len);
+		tls->session_ticket_len = len;
+	}
+
+	return true;
+}
+
+static ssize_t tls_session_ticket_server_write(struct l_tls *tls,
+						uint8_t *buf, size_t len)
+{
+	/* We'll send a NewSessionTicket */
+	if (!tls->session_ticket_ext)
+		return -ENOMSG;
+
+	return 0;
+}
+
+static bool tls_session_ticket_server_handle(struct l_tls *tls,
+						const uint8_t *buf, size_t len)
+{
+	if (len)
+		return false;
+
+	tls->session_ticket_ext = true;
+	return true;
+}
+
 const struct tls_hello_extension tls_extensions[] = {
 	{
 		"Supported Groups", "elliptic_curves", 10,
@@ -863,6 +917,15 @@ const struct tls_hello_extension tls_extensions[] = {
 		tls_signature_algorithms_client_absent,
 		NULL, NULL, NULL,
 	},
+	{
+		"Session Ticket", "session_ticket", 35,
+		tls_session_ticket_client_write,
+		tls_session_ticket_client_handle,
+		NULL,
+		tls_session_ticket_server_write,
+		tls_session_ticket_server_handle,
+		NULL,
+	},
 	{}
 };
 
@@ -23,6 +23,9 @@
 #define TLS_MAX_VERSION	L_TLS_V12
 #define TLS_MIN_VERSION	L_TLS_V10
 
+struct aes_ctx;
+struct hmac_ctx;
+
 enum tls_cipher_type {
 	TLS_CIPHER_STREAM,
 	TLS_CIPHER_BLOCK,
@@ -186,6 +189,7 @@ enum tls_handshake_type {
 	TLS_HELLO_REQUEST	= 0,
 	TLS_CLIENT_HELLO	= 1,
 	TLS_SERVER_HELLO	= 2,
+	TLS_NEW_SESSION_TICKET	= 4,
 	TLS_CERTIFICATE		= 11,
 	TLS_SERVER_KEY_EXCHANGE	= 12,
 	TLS_CERTIFICATE_REQUEST	= 13,
@@ -195,10 +199,32 @@ enum tls_handshake_type {
 	TLS_FINISHED		= 20,
 };
 
+#define TLS_SESSION_ID_SIZE	32
+
+/*
+ * What a client needs to offer and a server needs to accept an
+ * abbreviated handshake.  Either session_id or ticket identify the
+ * session to the server.
+ */
+struct l_tls_session {
+	enum l_tls_version version;
+	uint8_t cipher_suite_id[2];
+	uint8_t compression_method_id;
+	uint8_t master_secret[48];
+	uint8_t session_id[TLS_SESSION_ID_SIZE];
+	size_t session_id_size;
+	uint8_t *ticket;
+	size_t ticket_len;
+	bool peer_authenticated;
+	char *peer_identity;
+	uint64_t expiry;
+};
+
 struct l_tls {
 	bool server;
 
 	l_tls_write_cb_t tx, rx;
+	l_tls_writev_cb_t tx_iov;
 	l_tls_ready_cb_t ready_handle;
 	l_tls_disconnect_cb_t disconnected;
 	void *user_data;
@@ -221,6 +247,7 @@ struct l_tls {
 	int record_buf_len;
 	int record_buf_max_len;
 	bool record_flush;
+	bool kernel_crypto;
 
 	uint8_t *message_buf;
 	int message_buf_len;
@@ -245,6 +272,21 @@ struct l_tls {
 	const struct tls_named_group *negotiated_curve;
 	const struct tls_named_group *negotiated_ff_group;
 
+	/*
+	 * Session resumption.  On the client session is what we offer
+	 * and later the session we end up with, on the server the session
+	 * being resumed or the one the full handshake establishes.
+	 */
+	struct l_tls_session_cache *session_cache;
+	struct l_tls_session *session;
+	uint8_t session_id[TLS_SESSION_ID_SIZE];
+	size_t session_id_size;
+	uint8_t *session_ticket;
+	size_t session_ticket_len;
+	uint32_t session_ticket_lifetime;
+	bool session_ticket_ext;
+	bool resuming;
+
 	/* SecurityParameters current and pending */
 
 	struct {
@@ -269,6 +311,12 @@ struct l_tls {
 		struct l_aead_cipher *aead_cipher[2];
 	};
 	struct l_checksum *mac[2];
+	/*
+	 * In-process AES and HMAC state, used instead of the kernel
+	 * cipher and mac above when the suite's algorithms allow it.
+	 */
+	struct aes_ctx *aes[2];
+	struct hmac_ctx *hmac[2];
 	size_t mac_length[2];
 	size_t block_length[2];
 	size_t record_iv_length[2];
@@ -301,6 +349,9 @@ void tls_disconnect(struct l_tls *tls, enum l_tls_alert_desc desc,
 
 void tls_tx_record(struct l_tls *tls, enum tls_content_type type,
 			const uint8_t *data, size_t len);
+void tls_tx_recordv(struct l_tls *tls, enum tls_content_type type,
+			const struct iovec *iov, size_t iov_cnt,
+			size_t headroom, size_t tailroom);
 bool tls_handle_message(struct l_tls *tls, const uint8_t *message,
 			int len, enum tls_content_type type, uint16_t version);
 
@@ -308,6 +359,8 @@ bool tls_handle_message(struct l_tls *tls, const uint8_t *message,
 
 void tls_tx_handshake(struct l_tls *tls, int type, uint8_t *buf, size_t length);
 
+bool tls_change_cipher_spec(struct l_tls *tls, bool txrx, const char **error);
+
 bool tls_cipher_suite_is_compatible(struct l_tls *tls,
 					const struct tls_cipher_suite *suite,
 					const char **error);
@@ -333,6 +386,25 @@ ssize_t tls_parse_signature_algorithms(struct l_tls *tls,
 int tls_parse_certificate_list(const void *data, size_t len,
 				struct l_certchain **out_certchain);
 
+void tls_generate_key_block(struct l_tls *tls);
+
+struct l_tls_session *tls_session_dup(const struct l_tls_session *session);
+const struct l_tls_session *tls_session_cache_lookup(
+					struct l_tls_session_cache *cache,
+					const uint8_t *session_id, size_t size);
+void tls_session_cache_add(struct l_tls_session_cache *cache,
+				const struct l_tls_session *session);
+void tls_session_cache_remove(struct l_tls_session_cache *cache,
+				const uint8_t *session_id, size_t size);
+bool tls_session_cache_has_tickets(struct l_tls_session_cache *cache);
+uint64_t tls_session_cache_lifetime(struct l_tls_session_cache *cache);
+uint8_t *tls_session_ticket_encrypt(struct l_tls_session_cache *cache,
+					const struct l_tls_session *session,
+					size_t *out_len);
+struct l_tls_session *tls_session_ticket_decrypt(
+					struct l_tls_session_cache *cache,
+					const uint8_t *ticket, size_t len);
+
 #define TLS_DEBUG(fmt, args...)	\
 	l_util_debug(tls->debug_handler, tls->debug_data, "%s:%i " fmt,	\
 			__func__, __LINE__, ## args)
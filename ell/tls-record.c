@@ -23,7 +23,7 @@
 #endif
 
 #define _GNU_SOURCE
-#include <alloca.h>
+#include <sys/uio.h>
 
 #include "private.h"
 #include "tls.h"
@@ -32,139 +32,248 @@
 #include "cert.h"
 #include "tls-private.h"
 #include "random.h"
+#include "digest-private.h"
+#include "aes-private.h"
 
 /* Implementation-specific max Record Layer fragment size (must be < 16kB) */
 #define TX_RECORD_MAX_LEN	4096
 
-/* TLSPlaintext + TLSCompressed + TLSCiphertext headers + seq_num sizes */
-#define TX_RECORD_MAX_HEADERS	(5 + 5 + 8 + 5)
+/* Largest fragment l_tls_writev can encrypt in place */
+#define TX_RECORD_MAX_INPLACE_LEN	L_TLS_WRITEV_MAX_LEN
+#define TX_RECORD_MAX_IOV	64
+
 #define TX_RECORD_MAX_MAC	64
 
-/* Head room and tail room for the buffer passed to the cipher */
-#define TX_RECORD_HEADROOM	TX_RECORD_MAX_HEADERS
-#define TX_RECORD_TAILROOM	TX_RECORD_MAX_MAC
+/* TLSCiphertext header + explicit IV, and MAC + padding or AEAD tag */
+#define TX_RECORD_HEADROOM	L_TLS_WRITEV_HEADROOM
+#define TX_RECORD_TAILROOM	L_TLS_WRITEV_TAILROOM
+
+static bool tls_cipher_encrypt(struct l_tls *tls, const void *in, void *out,
+				size_t len)
+{
+	if (tls->aes[1]) {
+		_aes_cbc_encrypt(tls->aes[1], in, out, len);
+		return true;
+	}
+
+	return l_cipher_encrypt(tls->cipher[1], in, out, len);
+}
+
+static bool tls_cipher_decrypt(struct l_tls *tls, const void *in, void *out,
+				size_t len)
+{
+	if (tls->aes[0]) {
+		_aes_cbc_decrypt(tls->aes[0], in, out, len);
+		return true;
+	}
+
+	return l_cipher_decrypt(tls->cipher[0], in, out, len);
+}
+
+static bool tls_cipher_set_iv(struct l_tls *tls, bool txrx,
+				const uint8_t *iv, size_t iv_len)
+{
+	if (tls->aes[txrx]) {
+		_aes_set_iv(tls->aes[txrx], iv);
+		return true;
+	}
+
+	return l_cipher_set_iv(tls->cipher[txrx], iv, iv_len);
+}
+
+static void tls_tx_iov(struct l_tls *tls, const struct iovec *iov,
+				size_t iov_cnt)
+{
+	uint8_t buf[TX_RECORD_HEADROOM + TX_RECORD_MAX_INPLACE_LEN +
+			TX_RECORD_TAILROOM];
+	size_t len = 0;
+	size_t i;
+
+	if (tls->tx_iov) {
+		tls->tx_iov(iov, iov_cnt, tls->user_data);
+		return;
+	}
+
+	if (iov_cnt == 1) {
+		tls->tx(iov->iov_base, iov->iov_len, tls->user_data);
+		return;
+	}
+
+	for (i = 0; i < iov_cnt; i++) {
+		memcpy(buf + len, iov[i].iov_base, iov[i].iov_len);
+		len += iov[i].iov_len;
+	}
+
+	tls->tx(buf, len, tls->user_data);
+}
 
-static void tls_write_mac(struct l_tls *tls, uint8_t *compressed,
-				uint16_t compressed_len, uint8_t *out_buf,
-				bool txrx)
+/* MAC over seq_num + the TLSCompressed header + fragment */
+static void tls_write_mac(struct l_tls *tls, const uint8_t *header,
+				const struct iovec *iov, size_t iov_cnt,
+				uint8_t *out_buf, bool txrx)
 {
-	uint8_t *in_buf;
+	uint8_t prefix[13];
+	size_t i;
+
+	l_put_be64(tls->seq_num[txrx]++, prefix);
+	memcpy(prefix + 8, header, 5);
+
+	if (tls->hmac[txrx]) {
+		_hmac_update(tls->hmac[txrx], prefix, sizeof(prefix));
 
-	/* Prepend the sequence number to the TLSCompressed buffer */
-	in_buf = compressed - 8;
-	l_put_be64(tls->seq_num[txrx]++, in_buf);
+		for (i = 0; i < iov_cnt; i++)
+			_hmac_update(tls->hmac[txrx], iov[i].iov_base,
+					iov[i].iov_len);
 
-	if (tls->mac[txrx]) {
+		_hmac_final(tls->hmac[txrx], out_buf);
+	} else if (tls->mac[txrx]) {
 		l_checksum_reset(tls->mac[txrx]);
-		l_checksum_update(tls->mac[txrx], in_buf, compressed_len + 8);
+		l_checksum_update(tls->mac[txrx], prefix, sizeof(prefix));
+		l_checksum_updatev(tls->mac[txrx], iov, iov_cnt);
 		l_checksum_get_digest(tls->mac[txrx], out_buf,
 					tls->mac_length[txrx]);
 	}
 }
 
-static void tls_tx_record_plaintext(struct l_tls *tls,
-					uint8_t *plaintext,
-					uint16_t plaintext_len)
+/*
+ * CBC-encrypt the buffers in place as one stream.  A block that straddles
+ * buffers goes through a bounce buffer and is scattered back.
+ */
+static void tls_cbc_encrypt_iov(struct aes_ctx *aes, const struct iovec *iov,
+				size_t iov_cnt)
 {
-	uint8_t *compressed;
-	uint16_t compressed_len;
-	uint8_t *cipher_input;
-	uint16_t cipher_input_len;
-	uint8_t *ciphertext;
-	uint16_t ciphertext_len;
+	uint8_t block[AES_BLOCK_SIZE];
+	uint8_t *piece[AES_BLOCK_SIZE];
+	size_t piece_len[AES_BLOCK_SIZE];
+	unsigned int pieces = 0;
+	size_t fill = 0;
+	size_t i, n;
+
+	for (; iov_cnt; iov++, iov_cnt--) {
+		uint8_t *data = iov->iov_base;
+		size_t len = iov->iov_len;
+
+		if (fill) {
+			n = len < AES_BLOCK_SIZE - fill ?
+				len : AES_BLOCK_SIZE - fill;
+			memcpy(block + fill, data, n);
+			piece[pieces] = data;
+			piece_len[pieces++] = n;
+			fill += n;
+			data += n;
+			len -= n;
+
+			if (fill < AES_BLOCK_SIZE)
+				continue;
+
+			_aes_cbc_encrypt(aes, block, block, AES_BLOCK_SIZE);
+
+			for (i = 0, n = 0; i < pieces; n += piece_len[i++])
+				memcpy(piece[i], block + n, piece_len[i]);
+
+			fill = 0;
+			pieces = 0;
+		}
+
+		n = len & ~(AES_BLOCK_SIZE - 1);
+		_aes_cbc_encrypt(aes, data, data, n);
+		data += n;
+		len -= n;
+
+		if (len) {
+			memcpy(block, data, len);
+			piece[0] = data;
+			piece_len[0] = len;
+			pieces = 1;
+			fill = len;
+		}
+	}
+}
+
+/*
+ * Build a record from the fragment in @iov and encrypt it in place.  There
+ * must be TX_RECORD_HEADROOM writable bytes in front of the first buffer
+ * and TX_RECORD_TAILROOM bytes after the last one.  A kernel AEAD cipher
+ * can only handle a single buffer.
+ */
+static void tls_tx_record_iov(struct l_tls *tls, enum tls_content_type type,
+				const struct iovec *iov, size_t iov_cnt,
+				size_t fragment_len)
+{
+	struct iovec segs[TX_RECORD_MAX_IOV];
+	struct iovec *last = &segs[iov_cnt - 1];
+	uint8_t *trailer = (uint8_t *) iov[iov_cnt - 1].iov_base +
+		iov[iov_cnt - 1].iov_len;
+	uint16_t version = tls->negotiated_version ?: tls->min_version;
+	size_t explicit_iv_len = 0;
+	size_t trailer_len = 0;
+	size_t ciphertext_len;
 	uint8_t padding_length;
-	uint8_t buf[TX_RECORD_HEADROOM + TX_RECORD_MAX_LEN +
-				TX_RECORD_TAILROOM];
+	uint8_t header[5];
+	uint8_t assocdata[13];
+	struct aes_gcm_state gcm;
+	uint8_t *record;
 	uint8_t iv[32];
-	uint8_t *assocdata;
-	int offset;
+	size_t i;
 
-	/*
-	 * TODO: if DEFLATE is selected in current state, use a new buffer
-	 * on stack to write a TLSCompressed structure there, otherwise use
-	 * the provided buffer.  Since only null compression is supported
-	 * today we always use the provided buffer.
-	 */
-	compressed_len = plaintext_len - 5;
-	compressed = plaintext;
+	memcpy(segs, iov, iov_cnt * sizeof(struct iovec));
 
-	/* Build a TLSCompressed struct */
-	compressed[0] = plaintext[0]; /* Copy type and version fields */
-	compressed[1] = plaintext[1];
-	compressed[2] = plaintext[2];
-	compressed[3] = compressed_len >> 8;
-	compressed[4] = compressed_len >> 0;
+	/* TLSCompressed header, null compression keeps TLSPlaintext as is */
+	header[0] = type;
+	header[1] = (uint8_t) (version >> 8);
+	header[2] = (uint8_t) (version >> 0);
+	l_put_be16(fragment_len, header + 3);
 
 	switch (tls->cipher_type[1]) {
 	case TLS_CIPHER_STREAM:
 		/* Append the MAC after TLSCompressed.fragment, if needed */
-		tls_write_mac(tls, compressed, compressed_len + 5,
-				compressed + compressed_len + 5, true);
-
-		cipher_input = compressed + 5;
-		cipher_input_len = compressed_len + tls->mac_length[1];
-
-		if (!tls->cipher[1]) {
-			ciphertext = cipher_input;
-			ciphertext_len = cipher_input_len;
-		} else {
-			ciphertext = buf + TX_RECORD_HEADROOM;
-			ciphertext_len = cipher_input_len;
-			l_cipher_encrypt(tls->cipher[1], cipher_input,
-						ciphertext, cipher_input_len);
-		}
+		tls_write_mac(tls, header, segs, iov_cnt, trailer, true);
+		trailer_len = tls->mac_length[1];
+		last->iov_len += trailer_len;
 
+		if (!tls->cipher[1])
+			break;
+
+		l_cipher_encryptv(tls->cipher[1], segs, iov_cnt,
+					segs, iov_cnt);
 		break;
 
 	case TLS_CIPHER_BLOCK:
 		/* Append the MAC after TLSCompressed.fragment, if needed */
-		cipher_input = compressed + 5;
-		tls_write_mac(tls, compressed, compressed_len + 5,
-				cipher_input + compressed_len, true);
-		cipher_input_len = compressed_len + tls->mac_length[1];
+		tls_write_mac(tls, header, segs, iov_cnt, trailer, true);
+		trailer_len = tls->mac_length[1];
 
 		/* Add minimum padding */
-		padding_length = (~cipher_input_len) &
+		padding_length = (~(fragment_len + trailer_len)) &
 			(tls->block_length[1] - 1);
-		memset(cipher_input + cipher_input_len, padding_length,
+		memset(trailer + trailer_len, padding_length,
 				padding_length + 1);
-		cipher_input_len += padding_length + 1;
+		trailer_len += padding_length + 1;
+		last->iov_len += trailer_len;
 
 		/* Generate an IV */
-		ciphertext = buf + TX_RECORD_HEADROOM;
+		if (tls->negotiated_version >= L_TLS_V11)
+			explicit_iv_len = tls->record_iv_length[1];
 
-		offset = 0;
+		record = (uint8_t *) segs[0].iov_base - explicit_iv_len;
 
 		if (tls->negotiated_version >= L_TLS_V12) {
-			l_getrandom(ciphertext, tls->record_iv_length[1]);
-
-			l_cipher_set_iv(tls->cipher[1], ciphertext,
-					tls->record_iv_length[1]);
-
-			offset = tls->record_iv_length[1];
+			l_getrandom(record, explicit_iv_len);
+			tls_cipher_set_iv(tls, 1, record, explicit_iv_len);
 		} else if (tls->negotiated_version >= L_TLS_V11) {
-			l_getrandom(iv, tls->record_iv_length[1]);
-
-			l_cipher_encrypt(tls->cipher[1], iv, ciphertext,
-						tls->record_iv_length[1]);
-
-			offset = tls->record_iv_length[1];
+			l_getrandom(iv, explicit_iv_len);
+			tls_cipher_encrypt(tls, iv, record, explicit_iv_len);
 		}
 
-		l_cipher_encrypt(tls->cipher[1], cipher_input,
-					ciphertext + offset, cipher_input_len);
-		ciphertext_len = offset + cipher_input_len;
+		if (tls->aes[1])
+			tls_cbc_encrypt_iov(tls->aes[1], segs, iov_cnt);
+		else
+			l_cipher_encryptv(tls->cipher[1], segs, iov_cnt,
+						segs, iov_cnt);
 
 		break;
 
 	case TLS_CIPHER_AEAD:
-		/* Prepend seq_num to TLSCompressed.type + .version + .length */
-		assocdata = compressed - 8;
-		l_put_be64(tls->seq_num[1]++, assocdata);
-
-		cipher_input = compressed + 5;
-		cipher_input_len = compressed_len;
-
 		/*
 		 * Build the IV.  The explicit part generation method is
 		 * actually cipher suite-specific but our only AEAD cipher
@@ -183,70 +292,130 @@ static void tls_tx_record_plaintext(struct l_tls *tls,
 			memset(iv + tls->fixed_iv_length[1] + 8, 42,
 				tls->record_iv_length[1] - 8);
 
+		/* Prepend seq_num to TLSCompressed.type + .version + .length */
+		l_put_be64(tls->seq_num[1]++, assocdata);
+		memcpy(assocdata + 8, header, 5);
+
+		explicit_iv_len = tls->record_iv_length[1];
+		trailer_len = tls->auth_tag_length[1];
+
 		/* Build the GenericAEADCipher struct */
-		ciphertext = buf + TX_RECORD_HEADROOM;
-		memcpy(ciphertext, iv + tls->fixed_iv_length[1],
-			tls->record_iv_length[1]);
-		l_aead_cipher_encrypt(tls->aead_cipher[1],
-					cipher_input, cipher_input_len,
-					assocdata, 13,
-					iv, tls->fixed_iv_length[1] +
-					tls->record_iv_length[1],
-					ciphertext + tls->record_iv_length[1],
-					cipher_input_len +
-					tls->auth_tag_length[1]);
-
-		ciphertext_len = tls->record_iv_length[1] +
-			cipher_input_len + tls->auth_tag_length[1];
+		record = (uint8_t *) segs[0].iov_base - explicit_iv_len;
+		memcpy(record, iv + tls->fixed_iv_length[1], explicit_iv_len);
+
+		if (!tls->aes[1]) {
+			l_aead_cipher_encrypt(tls->aead_cipher[1],
+						segs[0].iov_base, fragment_len,
+						assocdata, 13,
+						iv, tls->fixed_iv_length[1] +
+						explicit_iv_len,
+						segs[0].iov_base,
+						fragment_len + trailer_len);
+			last->iov_len += trailer_len;
+			break;
+		}
 
+		_aes_gcm_start(&gcm, tls->aes[1], iv, assocdata, 13);
+
+		for (i = 0; i < iov_cnt; i++)
+			_aes_gcm_encrypt_update(&gcm, segs[i].iov_base,
+						segs[i].iov_base,
+						segs[i].iov_len);
+
+		_aes_gcm_finish(&gcm, trailer, trailer_len);
+		last->iov_len += trailer_len;
 		break;
 
 	default:
 		return;
 	}
 
-	/* Build a TLSCiphertext struct */
-	ciphertext -= 5;
-	ciphertext[0] = plaintext[0]; /* Copy type and version fields */
-	ciphertext[1] = plaintext[1];
-	ciphertext[2] = plaintext[2];
-	ciphertext[3] = ciphertext_len >> 8;
-	ciphertext[4] = ciphertext_len >> 0;
+	ciphertext_len = explicit_iv_len + fragment_len + trailer_len;
+
+	/* Build a TLSCiphertext struct in front of the first buffer */
+	record = (uint8_t *) segs[0].iov_base - explicit_iv_len - 5;
+	memcpy(record, header, 3);
+	l_put_be16(ciphertext_len, record + 3);
 
-	tls->tx(ciphertext, ciphertext_len + 5, tls->user_data);
+	segs[0].iov_base = record;
+	segs[0].iov_len += explicit_iv_len + 5;
+
+	tls_tx_iov(tls, segs, iov_cnt);
 }
 
-void tls_tx_record(struct l_tls *tls, enum tls_content_type type,
-			const uint8_t *data, size_t len)
+/* Copy the data into records of up to TX_RECORD_MAX_LEN and send them */
+static void tls_tx_record_copy(struct l_tls *tls, enum tls_content_type type,
+				const struct iovec *iov, size_t iov_cnt)
 {
 	uint8_t buf[TX_RECORD_HEADROOM + TX_RECORD_MAX_LEN +
 				TX_RECORD_TAILROOM];
-	uint8_t *fragment, *plaintext;
-	uint16_t fragment_len;
-	uint16_t version = tls->negotiated_version ?: tls->min_version;
+	struct iovec fragment;
+	size_t offset = 0;
+
+	fragment.iov_base = buf + TX_RECORD_HEADROOM;
+
+	while (iov_cnt) {
+		fragment.iov_len = 0;
+
+		while (iov_cnt && fragment.iov_len < TX_RECORD_MAX_LEN) {
+			size_t n = iov->iov_len - offset;
+
+			if (n > TX_RECORD_MAX_LEN - fragment.iov_len)
+				n = TX_RECORD_MAX_LEN - fragment.iov_len;
+
+			memcpy(buf + TX_RECORD_HEADROOM + fragment.iov_len,
+				(const uint8_t *) iov->iov_base + offset, n);
+			fragment.iov_len += n;
+			offset += n;
+
+			if (offset == iov->iov_len) {
+				iov++;
+				iov_cnt--;
+				offset = 0;
+			}
+		}
+
+		if (!fragment.iov_len)
+			break;
+
+		tls_tx_record_iov(tls, type, &fragment, 1, fragment.iov_len);
+	}
+}
+
+void tls_tx_record(struct l_tls *tls, enum tls_content_type type,
+			const uint8_t *data, size_t len)
+{
+	struct iovec iov = { .iov_base = (void *) data, .iov_len = len };
 
 	if (type == TLS_CT_ALERT)
 		tls->record_flush = true;
 
-	while (len) {
-		fragment = buf + TX_RECORD_HEADROOM;
-		fragment_len = len < TX_RECORD_MAX_LEN ?
-			len : TX_RECORD_MAX_LEN;
-
-		/* Build a TLSPlaintext struct */
-		plaintext = fragment - 5;
-		plaintext[0] = type;
-		plaintext[1] = (uint8_t) (version >> 8);
-		plaintext[2] = (uint8_t) (version >> 0);
-		plaintext[3] = fragment_len >> 8;
-		plaintext[4] = fragment_len >> 0;
-		memcpy(plaintext + 5, data, fragment_len);
-
-		tls_tx_record_plaintext(tls, plaintext, fragment_len + 5);
-
-		data += fragment_len;
-		len -= fragment_len;
+	tls_tx_record_copy(tls, type, &iov, 1);
+}
+
+void tls_tx_recordv(struct l_tls *tls, enum tls_content_type type,
+			const struct iovec *iov, size_t iov_cnt,
+			size_t headroom, size_t tailroom)
+{
+	size_t len = 0;
+	size_t i;
+
+	for (i = 0; i < iov_cnt; i++)
+		len += iov[i].iov_len;
+
+	if (!len)
+		return;
+
+	if (headroom < TX_RECORD_HEADROOM || tailroom < TX_RECORD_TAILROOM ||
+			len > TX_RECORD_MAX_INPLACE_LEN ||
+			iov_cnt > TX_RECORD_MAX_IOV ||
+			(tls->cipher_type[1] == TLS_CIPHER_AEAD &&
+			 !tls->aes[1] && iov_cnt > 1)) {
+		tls_tx_record_copy(tls, type, iov, iov_cnt);
+		return;
 	}
+
+	tls_tx_record_iov(tls, type, iov, iov_cnt, len);
 }
 
 static bool tls_handle_plaintext(struct l_tls *tls, const uint8_t *plaintext,
@@ -369,21 +538,28 @@ static bool tls_handle_plaintext(struct l_tls *tls, const uint8_t *plaintext,
 	return true;
 }
 
-static bool tls_handle_ciphertext(struct l_tls *tls)
+/*
+ * Decrypt and authenticate the TLSCiphertext at @record in place and pass
+ * the plaintext on.  The plaintext is left inside the record's fragment.
+ */
+static bool tls_handle_ciphertext(struct l_tls *tls, uint8_t *record)
 {
 	uint8_t type;
 	uint16_t version;
 	uint16_t fragment_len;
+	uint8_t *fragment = record + 5;
 	uint8_t mac_buf[TX_RECORD_MAX_MAC], i, padding_len;
 	int cipher_output_len, error;
 	uint8_t *compressed;
 	int compressed_len;
+	uint8_t header[5];
+	struct iovec iov;
 	uint8_t iv[32];
-	uint8_t *assocdata;
+	uint8_t assocdata[13];
 
-	type = tls->record_buf[0];
-	version = l_get_be16(tls->record_buf + 1);
-	fragment_len = l_get_be16(tls->record_buf + 3);
+	type = record[0];
+	version = l_get_be16(record + 1);
+	fragment_len = l_get_be16(record + 3);
 
 	if (fragment_len > (1 << 14) + 2048) {
 		TLS_DISCONNECT(TLS_ALERT_RECORD_OVERFLOW, 0,
@@ -393,7 +569,7 @@ static bool tls_handle_ciphertext(struct l_tls *tls)
 
 	if ((tls->negotiated_version && tls->negotiated_version != version) ||
 			(!tls->negotiated_version &&
-			 tls->record_buf[1] != 0x03 /* Appending E.1 */)) {
+			 record[1] != 0x03 /* Appending E.1 */)) {
 		TLS_DISCONNECT(TLS_ALERT_PROTOCOL_VERSION, 0,
 				"Record version mismatch: %02x", version);
 		return false;
@@ -405,41 +581,37 @@ static bool tls_handle_ciphertext(struct l_tls *tls)
 		return false;
 	}
 
-	compressed = alloca(8 + 5 + fragment_len);
 	/* Copy the type and version fields */
-	compressed[8] = type;
-	l_put_be16(version, compressed + 9);
+	header[0] = type;
+	l_put_be16(version, header + 1);
 
 	switch (tls->cipher_type[0]) {
 	case TLS_CIPHER_STREAM:
 		cipher_output_len = fragment_len;
 		compressed_len = cipher_output_len - tls->mac_length[0];
-		l_put_be16(compressed_len, compressed + 11);
-
-		if (!tls->cipher[0])
-			memcpy(compressed + 13, tls->record_buf + 5,
-					cipher_output_len);
-		else if (!l_cipher_decrypt(tls->cipher[0], tls->record_buf + 5,
-						compressed + 13,
-						cipher_output_len)) {
+		l_put_be16(compressed_len, header + 3);
+		compressed = fragment;
+
+		if (tls->cipher[0] && !l_cipher_decrypt(tls->cipher[0],
+							fragment, fragment,
+							cipher_output_len)) {
 			TLS_DISCONNECT(TLS_ALERT_INTERNAL_ERROR, 0,
 					"Decrypting record fragment failed");
 			return false;
 		}
 
 		/* Calculate the MAC if needed */
-		tls_write_mac(tls, compressed + 8, 5 + compressed_len,
-				mac_buf, false);
+		iov.iov_base = compressed;
+		iov.iov_len = compressed_len;
+		tls_write_mac(tls, header, &iov, 1, mac_buf, false);
 
-		if (memcmp(mac_buf, compressed + 13 + compressed_len,
+		if (memcmp(mac_buf, compressed + compressed_len,
 							tls->mac_length[0])) {
 			TLS_DISCONNECT(TLS_ALERT_BAD_RECORD_MAC, 0,
 					"Record fragment MAC mismatch");
 			return false;
 		}
 
-		compressed += 13;
-
 		break;
 
 	case TLS_CIPHER_BLOCK:
@@ -471,24 +643,24 @@ static bool tls_handle_ciphertext(struct l_tls *tls)
 		}
 
 		if (tls->negotiated_version >= L_TLS_V12) {
-			if (!l_cipher_set_iv(tls->cipher[0],
-						tls->record_buf + 5,
+			if (!tls_cipher_set_iv(tls, 0, fragment,
 						tls->record_iv_length[0])) {
 				TLS_DISCONNECT(TLS_ALERT_INTERNAL_ERROR, 0,
 						"Setting fragment IV failed");
 				return false;
 			}
 		} else if (tls->negotiated_version >= L_TLS_V11)
-			if (!l_cipher_decrypt(tls->cipher[0],
-						tls->record_buf + 5, iv,
+			if (!tls_cipher_decrypt(tls, fragment, iv,
 						tls->record_iv_length[0])) {
 				TLS_DISCONNECT(TLS_ALERT_INTERNAL_ERROR, 0,
 						"Setting fragment IV failed");
 				return false;
 			}
 
-		if (!l_cipher_decrypt(tls->cipher[0], tls->record_buf + 5 + i,
-					compressed + 13, cipher_output_len)) {
+		compressed = fragment + i;
+
+		if (!tls_cipher_decrypt(tls, compressed, compressed,
+					cipher_output_len)) {
 			TLS_DISCONNECT(TLS_ALERT_INTERNAL_ERROR, 0,
 					"Fragment decryption failed");
 			return false;
@@ -505,7 +677,7 @@ static bool tls_handle_ciphertext(struct l_tls *tls)
 		 * implementation might assume a zero-length pad and then
 		 * compute the MAC.
 		 */
-		padding_len = compressed[13 + cipher_output_len - 1];
+		padding_len = compressed[cipher_output_len - 1];
 		error = 0;
 		if (padding_len + tls->mac_length[0] + 1 >
 				(size_t) cipher_output_len) {
@@ -520,18 +692,19 @@ static bool tls_handle_ciphertext(struct l_tls *tls)
 
 		compressed_len = cipher_output_len - 1 - padding_len -
 			tls->mac_length[0];
-		l_put_be16(compressed_len, compressed + 11);
+		l_put_be16(compressed_len, header + 3);
 
 		for (i = 0; i < padding_len; i++)
-			if (compressed[13 + cipher_output_len - 1 -
+			if (compressed[cipher_output_len - 1 -
 					padding_len + i] != padding_len)
 				error = 1;
 
 		/* Calculate the MAC if needed */
-		tls_write_mac(tls, compressed + 8, 5 + compressed_len,
-				mac_buf, false);
+		iov.iov_base = compressed;
+		iov.iov_len = compressed_len;
+		tls_write_mac(tls, header, &iov, 1, mac_buf, false);
 
-		if ((tls->mac_length[0] && memcmp(mac_buf, compressed + 13 +
+		if ((tls->mac_length[0] && memcmp(mac_buf, compressed +
 					compressed_len, tls->mac_length[0])) ||
 				error) {
 			TLS_DISCONNECT(TLS_ALERT_BAD_RECORD_MAC, 0,
@@ -539,8 +712,6 @@ static bool tls_handle_ciphertext(struct l_tls *tls)
 			return false;
 		}
 
-		compressed += 13;
-
 		break;
 
 	case TLS_CIPHER_AEAD:
@@ -554,20 +725,30 @@ static bool tls_handle_ciphertext(struct l_tls *tls)
 
 		compressed_len = fragment_len - tls->record_iv_length[0] -
 			tls->auth_tag_length[0];
-		l_put_be16(compressed_len, compressed + 11);
+		l_put_be16(compressed_len, header + 3);
+		compressed = fragment + tls->record_iv_length[0];
 
 		/* Prepend seq_num to TLSCompressed.type + .version + .length */
-		assocdata = compressed;
 		l_put_be64(tls->seq_num[0]++, assocdata);
-		compressed += 13;
+		memcpy(assocdata + 8, header, 5);
 
 		/* Build the IV */
 		memcpy(iv, tls->fixed_iv[0], tls->fixed_iv_length[0]);
-		memcpy(iv + tls->fixed_iv_length[0], tls->record_buf + 5,
+		memcpy(iv + tls->fixed_iv_length[0], fragment,
 			tls->record_iv_length[0]);
 
-		if (!l_aead_cipher_decrypt(tls->aead_cipher[0],
-				tls->record_buf + 5 + tls->record_iv_length[0],
+		if (tls->aes[0]) {
+			if (!_aes_gcm_decrypt(tls->aes[0], iv, assocdata, 13,
+						compressed, compressed,
+						compressed_len,
+						compressed + compressed_len,
+						tls->auth_tag_length[0])) {
+				TLS_DISCONNECT(TLS_ALERT_BAD_RECORD_MAC, 0,
+						"Record fragment MAC mismatch");
+				return false;
+			}
+		} else if (!l_aead_cipher_decrypt(tls->aead_cipher[0],
+				compressed,
 				fragment_len - tls->record_iv_length[0],
 				assocdata, 13, iv, tls->fixed_iv_length[0] +
 				tls->record_iv_length[0],
@@ -589,46 +770,49 @@ static bool tls_handle_ciphertext(struct l_tls *tls)
 					type, version);
 }
 
-LIB_EXPORT void l_tls_handle_rx(struct l_tls *tls, const uint8_t *data,
-				size_t len)
+/*
+ * Records that are entirely inside @data are decrypted right there when
+ * @in_place is set, the rest are reassembled in tls->record_buf first.
+ * @data is only written to if @in_place is set.
+ */
+static void tls_handle_rx(struct l_tls *tls, uint8_t *data, size_t len,
+				bool in_place)
 {
 	int need_len;
 	int chunk_len;
 
 	tls->record_flush = false;
 
-	/* Reassemble TLSCiphertext structures from the received chunks */
-
-	while (1) {
-		/* Do we have a full header in tls->record_buf? */
-		if (tls->record_buf_len >= 5) {
-			need_len = 5 + l_get_be16(tls->record_buf + 3);
+	while (len) {
+		if (in_place && !tls->record_buf_len && len >= 5) {
+			need_len = 5 + l_get_be16(data + 3);
 
-			/* Do we have a full structure? */
-			if (tls->record_buf_len == need_len) {
-				if (!tls_handle_ciphertext(tls))
+			if (len >= (size_t) need_len) {
+				if (!tls_handle_ciphertext(tls, data))
 					return;
 
-				tls->record_buf_len = 0;
-				need_len = 5;
+				data += need_len;
+				len -= need_len;
 
 				if (tls->record_flush)
 					break;
+
+				continue;
 			}
+		}
 
-			if (!len)
-				break;
-		} else
-			need_len = 5;
+		/* Reassemble TLSCiphertext structures in tls->record_buf */
+		need_len = 5;
+
+		if (tls->record_buf_len >= 5)
+			need_len += l_get_be16(tls->record_buf + 3);
 
-		/* Try to fill up tls->record_buf up to need_len */
 		if (tls->record_buf_max_len < need_len) {
 			tls->record_buf_max_len = need_len;
 			tls->record_buf = l_realloc(tls->record_buf, need_len);
 		}
 
-		need_len -= tls->record_buf_len;
-		chunk_len = need_len;
+		chunk_len = need_len - tls->record_buf_len;
 		if (len < (size_t) chunk_len)
 			chunk_len = len;
 
@@ -637,7 +821,29 @@ LIB_EXPORT void l_tls_handle_rx(struct l_tls *tls, const uint8_t *data,
 		data += chunk_len;
 		len -= chunk_len;
 
-		if (chunk_len < need_len)
+		/* Do we have a full structure? */
+		if (tls->record_buf_len < 5 || tls->record_buf_len !=
+				5 + l_get_be16(tls->record_buf + 3))
+			continue;
+
+		if (!tls_handle_ciphertext(tls, tls->record_buf))
+			return;
+
+		tls->record_buf_len = 0;
+
+		if (tls->record_flush)
 			break;
 	}
 }
+
+LIB_EXPORT void l_tls_handle_rx(struct l_tls *tls, const uint8_t *data,
+				size_t len)
+{
+	tls_handle_rx(tls, (uint8_t *) data, len, false);
+}
+
+LIB_EXPORT void l_tls_handle_rx_inplace(struct l_tls *tls, uint8_t *data,
+					size_t len)
+{
+	tls_handle_rx(tls, data, len, true);
+}
@@ -0,0 +1,465 @@
+/*
+ *  Embedded Linux library
+ *
+ *  Copyright (C) 2019  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+#include <string.h>
+
+#include "util.h"
+#include "private.h"
+#include "tls.h"
+#include "checksum.h"
+#include "cipher.h"
+#include "cert.h"
+#include "random.h"
+#include "hashmap.h"
+#include "time.h"
+#include "tls-private.h"
+#include "digest-private.h"
+#include "aes-private.h"
+
+#define TICKET_KEY_NAME_SIZE	16
+#define TICKET_HMAC_KEY_SIZE	32
+#define TICKET_MAC_SIZE		32
+
+/* key_name + IV + encrypted_state length + MAC, RFC 5077 Section 4 */
+#define TICKET_OVERHEAD		(TICKET_KEY_NAME_SIZE + AES_BLOCK_SIZE + 2 + \
+					TICKET_MAC_SIZE)
+
+struct tls_ticket_key {
+	uint8_t name[TICKET_KEY_NAME_SIZE];
+	uint8_t aes_key[16];
+	uint8_t hmac_key[TICKET_HMAC_KEY_SIZE];
+	uint64_t expiry;
+};
+
+struct tls_session_entry {
+	struct l_tls_session *session;
+	struct tls_session_entry *prev;
+	struct tls_session_entry *next;
+};
+
+struct l_tls_session_cache {
+	struct l_hashmap *sessions;
+	/* Most recently used first */
+	struct tls_session_entry *head;
+	struct tls_session_entry *tail;
+	unsigned int max_sessions;
+	uint64_t lifetime;
+	uint64_t ticket_key_lifetime;
+	/* The current ticket key and the one it replaced */
+	struct tls_ticket_key ticket_keys[2];
+};
+
+static unsigned int session_id_hash(const void *p)
+{
+	/* Session IDs we hand out are random */
+	return l_get_u32(p);
+}
+
+static int session_id_compare(const void *a, const void *b)
+{
+	return memcmp(a, b, TLS_SESSION_ID_SIZE);
+}
+
+LIB_EXPORT struct l_tls_session_cache *l_tls_session_cache_new(
+						unsigned int max_sessions,
+						unsigned int lifetime)
+{
+	struct l_tls_session_cache *cache;
+
+	if (unlikely(!lifetime))
+		return NULL;
+
+	cache = l_new(struct l_tls_session_cache, 1);
+	cache->sessions = l_hashmap_new();
+	l_hashmap_set_hash_function(cache->sessions, session_id_hash);
+	l_hashmap_set_compare_function(cache->sessions, session_id_compare);
+	cache->max_sessions = max_sessions;
+	cache->lifetime = (uint64_t) lifetime * 1000000;
+
+	return cache;
+}
+
+static void session_free(struct l_tls_session *session)
+{
+	explicit_bzero(session->master_secret, sizeof(session->master_secret));
+	l_free(session->ticket);
+	l_free(session->peer_identity);
+	l_free(session);
+}
+
+static void session_entry_free(void *data)
+{
+	struct tls_session_entry *entry = data;
+
+	session_free(entry->session);
+	l_free(entry);
+}
+
+LIB_EXPORT void l_tls_session_cache_free(struct l_tls_session_cache *cache)
+{
+	if (unlikely(!cache))
+		return;
+
+	l_hashmap_destroy(cache->sessions, session_entry_free);
+	explicit_bzero(cache->ticket_keys, sizeof(cache->ticket_keys));
+	l_free(cache);
+}
+
+LIB_EXPORT bool l_tls_session_cache_enable_tickets(
+					struct l_tls_session_cache *cache,
+					unsigned int key_lifetime)
+{
+	if (unlikely(!cache || !key_lifetime))
+		return false;
+
+	cache->ticket_key_lifetime = (uint64_t) key_lifetime * 1000000;
+
+	return true;
+}
+
+static void session_entry_unlink(struct l_tls_session_cache *cache,
+					struct tls_session_entry *entry)
+{
+	if (entry->prev)
+		entry->prev->next = entry->next;
+	else
+		cache->head = entry->next;
+
+	if (entry->next)
+		entry->next->prev = entry->prev;
+	else
+		cache->tail = entry->prev;
+
+	entry->prev = NULL;
+	entry->next = NULL;
+}
+
+static void session_entry_link(struct l_tls_session_cache *cache,
+					struct tls_session_entry *entry)
+{
+	entry->next = cache->head;
+
+	if (cache->head)
+		cache->head->prev = entry;
+	else
+		cache->tail = entry;
+
+	cache->head = entry;
+}
+
+static void session_entry_remove(struct l_tls_session_cache *cache,
+					struct tls_session_entry *entry)
+{
+	l_hashmap_remove(cache->sessions, entry->session->session_id);
+	session_entry_unlink(cache, entry);
+	session_entry_free(entry);
+}
+
+struct l_tls_session *tls_session_dup(const struct l_tls_session *session)
+{
+	struct l_tls_session *copy = l_memdup(session, sizeof(*session));
+
+	if (session->ticket)
+		copy->ticket = l_memdup(session->ticket, session->ticket_len);
+
+	copy->peer_identity = l_strdup(session->peer_identity);
+
+	return copy;
+}
+
+const struct l_tls_session *tls_session_cache_lookup(
+					struct l_tls_session_cache *cache,
+					const uint8_t *session_id, size_t size)
+{
+	struct tls_session_entry *entry;
+
+	if (size != TLS_SESSION_ID_SIZE)
+		return NULL;
+
+	entry = l_hashmap_lookup(cache->sessions, session_id);
+	if (!entry)
+		return NULL;
+
+	if (l_time_after(l_time_now(), entry->session->expiry)) {
+		session_entry_remove(cache, entry);
+		return NULL;
+	}
+
+	session_entry_unlink(cache, entry);
+	session_entry_link(cache, entry);
+
+	return entry->session;
+}
+
+void tls_session_cache_add(struct l_tls_session_cache *cache,
+				const struct l_tls_session *session)
+{
+	struct tls_session_entry *entry;
+
+	if (!cache->max_sessions ||
+			session->session_id_size != TLS_SESSION_ID_SIZE)
+		return;
+
+	entry = l_hashmap_lookup(cache->sessions, session->session_id);
+	if (entry)
+		session_entry_remove(cache, entry);
+
+	while (l_hashmap_size(cache->sessions) >= cache->max_sessions)
+		session_entry_remove(cache, cache->tail);
+
+	entry = l_new(struct tls_session_entry, 1);
+	entry->session = tls_session_dup(session);
+	entry->session->expiry = l_time_offset(l_time_now(), cache->lifetime);
+	l_free(entry->session->ticket);
+	entry->session->ticket = NULL;
+	entry->session->ticket_len = 0;
+
+	l_hashmap_insert(cache->sessions, entry->session->session_id, entry);
+	session_entry_link(cache, entry);
+}
+
+void tls_session_cache_remove(struct l_tls_session_cache *cache,
+				const uint8_t *session_id, size_t size)
+{
+	struct tls_session_entry *entry;
+
+	if (size != TLS_SESSION_ID_SIZE)
+		return;
+
+	entry = l_hashmap_lookup(cache->sessions, session_id);
+	if (entry)
+		session_entry_remove(cache, entry);
+}
+
+bool tls_session_cache_has_tickets(struct l_tls_session_cache *cache)
+{
+	return cache->ticket_key_lifetime != 0;
+}
+
+uint64_t tls_session_cache_lifetime(struct l_tls_session_cache *cache)
+{
+	return cache->lifetime;
+}
+
+static const struct tls_ticket_key *ticket_key_current(
+					struct l_tls_session_cache *cache)
+{
+	struct tls_ticket_key *key = &cache->ticket_keys[0];
+	uint64_t now = l_time_now();
+
+	if (key->expiry && l_time_before(now, key->expiry))
+		return key;
+
+	cache->ticket_keys[1] = *key;
+	l_getrandom(key->name, sizeof(key->name));
+	l_getrandom(key->aes_key, sizeof(key->aes_key));
+	l_getrandom(key->hmac_key, sizeof(key->hmac_key));
+	key->expiry = l_time_offset(now, cache->ticket_key_lifetime);
+
+	return key;
+}
+
+static const struct tls_ticket_key *ticket_key_find(
+					struct l_tls_session_cache *cache,
+					const uint8_t *name)
+{
+	uint64_t now = l_time_now();
+	unsigned int i;
+
+	/*
+	 * A key stops issuing tickets when it expires but is good for
+	 * one more key lifetime, whether or not it has been replaced yet.
+	 */
+	for (i = 0; i < 2; i++) {
+		const struct tls_ticket_key *key = &cache->ticket_keys[i];
+		uint64_t expiry = key->expiry;
+
+		if (!expiry)
+			continue;
+
+		expiry = l_time_offset(expiry, cache->ticket_key_lifetime);
+
+		if (l_time_after(now, expiry))
+			continue;
+
+		if (!memcmp(key->name, name, TICKET_KEY_NAME_SIZE))
+			return key;
+	}
+
+	return NULL;
+}
+
+static void ticket_mac(const struct tls_ticket_key *key,
+				const uint8_t *ticket, size_t len,
+				uint8_t *out)
+{
+	struct hmac_ctx hmac;
+
+	_hmac_init(&hmac, L_CHECKSUM_SHA256, key->hmac_key,
+			sizeof(key->hmac_key));
+	_hmac_update(&hmac, ticket, len);
+	_hmac_final(&hmac, out);
+	explicit_bzero(&hmac, sizeof(hmac));
+}
+
+/*
+ * Serialized state:
+ * version(2) cipher_suite(2) compression_method(1) master_secret(48)
+ * expiry(8) peer_authenticated(1) peer_identity<0..2^16-1>
+ */
+#define TICKET_STATE_FIXED_SIZE	(2 + 2 + 1 + 48 + 8 + 1 + 2)
+
+uint8_t *tls_session_ticket_encrypt(struct l_tls_session_cache *cache,
+					const struct l_tls_session *session,
+					size_t *out_len)
+{
+	const struct tls_ticket_key *key = ticket_key_current(cache);
+	size_t identity_len = session->peer_identity ?
+		strlen(session->peer_identity) : 0;
+	size_t state_len = TICKET_STATE_FIXED_SIZE + identity_len;
+	size_t encrypted_len = align_len(state_len + 1, AES_BLOCK_SIZE);
+	size_t len = TICKET_OVERHEAD + encrypted_len;
+	uint8_t *ticket;
+	uint8_t *ptr;
+	struct aes_ctx aes;
+
+	if (identity_len > 0xffff - TICKET_STATE_FIXED_SIZE - AES_BLOCK_SIZE)
+		return NULL;
+
+	ticket = l_malloc(len);
+
+	memcpy(ticket, key->name, TICKET_KEY_NAME_SIZE);
+	ptr = ticket + TICKET_KEY_NAME_SIZE;
+	l_getrandom(ptr, AES_BLOCK_SIZE);
+	_aes_init(&aes, key->aes_key, sizeof(key->aes_key));
+	_aes_set_iv(&aes, ptr);
+	ptr += AES_BLOCK_SIZE;
+	l_put_be16(encrypted_len, ptr);
+	ptr += 2;
+
+	l_put_be16(session->version, ptr);
+	memcpy(ptr + 2, session->cipher_suite_id, 2);
+	ptr[4] = session->compression_method_id;
+	memcpy(ptr + 5, session->master_secret, 48);
+	l_put_be64(session->expiry, ptr + 53);
+	ptr[61] = session->peer_authenticated;
+	l_put_be16(identity_len, ptr + 62);
+	memcpy(ptr + 64, session->peer_identity, identity_len);
+
+	/* PKCS#7 padding */
+	memset(ptr + state_len, encrypted_len - state_len,
+		encrypted_len - state_len);
+
+	_aes_cbc_encrypt(&aes, ptr, ptr, encrypted_len);
+	explicit_bzero(&aes, sizeof(aes));
+	ptr += encrypted_len;
+
+	ticket_mac(key, ticket, ptr - ticket, ptr);
+
+	*out_len = len;
+	return ticket;
+}
+
+struct l_tls_session *tls_session_ticket_decrypt(
+					struct l_tls_session_cache *cache,
+					const uint8_t *ticket, size_t len)
+{
+	const struct tls_ticket_key *key;
+	uint8_t mac[TICKET_MAC_SIZE];
+	uint8_t diff = 0;
+	size_t encrypted_len;
+	uint8_t *state;
+	uint8_t padding;
+	size_t identity_len;
+	struct aes_ctx aes;
+	struct l_tls_session *session = NULL;
+	size_t i;
+
+	if (len < TICKET_OVERHEAD + AES_BLOCK_SIZE)
+		return NULL;
+
+	encrypted_len = l_get_be16(ticket + TICKET_KEY_NAME_SIZE +
+					AES_BLOCK_SIZE);
+	if (encrypted_len != len - TICKET_OVERHEAD ||
+			encrypted_len % AES_BLOCK_SIZE ||
+			encrypted_len < TICKET_STATE_FIXED_SIZE + 1)
+		return NULL;
+
+	key = ticket_key_find(cache, ticket);
+	if (!key)
+		return NULL;
+
+	ticket_mac(key, ticket, len - TICKET_MAC_SIZE, mac);
+
+	for (i = 0; i < TICKET_MAC_SIZE; i++)
+		diff |= mac[i] ^ ticket[len - TICKET_MAC_SIZE + i];
+
+	if (diff)
+		return NULL;
+
+	state = l_memdup(ticket + TICKET_OVERHEAD - TICKET_MAC_SIZE,
+				encrypted_len);
+	_aes_init(&aes, key->aes_key, sizeof(key->aes_key));
+	_aes_set_iv(&aes, ticket + TICKET_KEY_NAME_SIZE);
+	_aes_cbc_decrypt(&aes, state, state, encrypted_len);
+	explicit_bzero(&aes, sizeof(aes));
+
+	/* The MAC has been verified so the padding can't be an oracle */
+	padding = state[encrypted_len - 1];
+	if (!padding || padding > AES_BLOCK_SIZE)
+		goto done;
+
+	identity_len = l_get_be16(state + 62);
+	if (TICKET_STATE_FIXED_SIZE + identity_len + padding != encrypted_len)
+		goto done;
+
+	if (l_time_after(l_time_now(), l_get_be64(state + 53)))
+		goto done;
+
+	session = l_new(struct l_tls_session, 1);
+	session->version = l_get_be16(state);
+	memcpy(session->cipher_suite_id, state + 2, 2);
+	session->compression_method_id = state[4];
+	memcpy(session->master_secret, state + 5, 48);
+	session->expiry = l_get_be64(state + 53);
+	session->peer_authenticated = state[61];
+
+	if (identity_len)
+		session->peer_identity = l_strndup((char *) state + 64,
+							identity_len);
+
+done:
+	explicit_bzero(state, encrypted_len);
+	l_free(state);
+	return session;
+}
+
+LIB_EXPORT void l_tls_session_free(struct l_tls_session *session)
+{
+	if (unlikely(!session))
+		return;
+
+	session_free(session);
+}
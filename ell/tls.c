@@ -33,13 +33,17 @@
 #include "private.h"
 #include "tls.h"
 #include "checksum.h"
+#include "checksum-private.h"
 #include "cipher.h"
 #include "random.h"
 #include "queue.h"
+#include "time.h"
 #include "pem.h"
 #include "cert.h"
 #include "cert-private.h"
 #include "tls-private.h"
+#include "digest-private.h"
+#include "aes-private.h"
 #include "key.h"
 #include "asn1-private.h"
 #include "strv.h"
@@ -199,6 +203,12 @@ static void tls_reset_handshake(struct l_tls *tls)
 	for (hash = 0; hash < __HANDSHAKE_HASH_COUNT; hash++)
 		tls_drop_handshake_hash(tls, hash);
 
+	l_free(tls->session_ticket);
+	tls->session_ticket = NULL;
+	tls->session_ticket_len = 0;
+	tls->session_ticket_ext = false;
+	tls->resuming = false;
+
 	TLS_SET_STATE(TLS_HANDSHAKE_WAIT_START);
 	tls->cert_requested = 0;
 	tls->cert_sent = 0;
@@ -211,8 +221,20 @@ static void tls_cleanup_handshake(struct l_tls *tls)
 	explicit_bzero(tls->pending.master_secret, 48);
 }
 
-static bool tls_change_cipher_spec(struct l_tls *tls, bool txrx,
-					const char **error)
+/* AES-CBC and AES-GCM can be done without the AF_ALG round trips */
+static bool tls_cipher_in_process(struct l_tls *tls,
+			const struct tls_bulk_encryption_algorithm *enc)
+{
+	if (tls->kernel_crypto)
+		return false;
+
+	if (enc->cipher_type == TLS_CIPHER_AEAD)
+		return enc->l_aead_id == L_AEAD_CIPHER_AES_GCM;
+
+	return enc->l_id == L_CIPHER_AES_CBC;
+}
+
+bool tls_change_cipher_spec(struct l_tls *tls, bool txrx, const char **error)
 {
 	struct tls_bulk_encryption_algorithm *enc;
 	struct tls_mac_algorithm *mac;
@@ -231,6 +253,12 @@ static bool tls_change_cipher_spec(struct l_tls *tls, bool txrx,
 		}
 	}
 
+	if (tls->aes[txrx]) {
+		explicit_bzero(tls->aes[txrx], sizeof(struct aes_ctx));
+		l_free(tls->aes[txrx]);
+		tls->aes[txrx] = NULL;
+	}
+
 	tls->cipher_type[txrx] = TLS_CIPHER_STREAM;
 
 	if (tls->mac[txrx]) {
@@ -238,6 +266,12 @@ static bool tls_change_cipher_spec(struct l_tls *tls, bool txrx,
 		tls->mac[txrx] = NULL;
 	}
 
+	if (tls->hmac[txrx]) {
+		explicit_bzero(tls->hmac[txrx], sizeof(struct hmac_ctx));
+		l_free(tls->hmac[txrx]);
+		tls->hmac[txrx] = NULL;
+	}
+
 	tls->mac_length[txrx] = 0;
 	tls->block_length[txrx] = 0;
 	tls->record_iv_length[txrx] = 0;
@@ -263,7 +297,18 @@ static bool tls_change_cipher_spec(struct l_tls *tls, bool txrx,
 		if ((tls->server && txrx) || (!tls->server && !txrx))
 			key_offset += mac->mac_length;
 
-		tls->mac[txrx] = l_checksum_new_hmac(mac->hmac_type,
+		if (tls->kernel_crypto)
+			tls->mac[txrx] = _checksum_new_hmac_kernel(
+						mac->hmac_type,
+						tls->pending.key_block +
+						key_offset, mac->mac_length);
+		else if (_digest_supported(mac->hmac_type)) {
+			tls->hmac[txrx] = l_new(struct hmac_ctx, 1);
+			_hmac_init(tls->hmac[txrx], mac->hmac_type,
+					tls->pending.key_block + key_offset,
+					mac->mac_length);
+		} else
+			tls->mac[txrx] = l_checksum_new_hmac(mac->hmac_type,
 						tls->pending.key_block +
 						key_offset, mac->mac_length);
 
@@ -271,7 +316,7 @@ static bool tls_change_cipher_spec(struct l_tls *tls, bool txrx,
 		explicit_bzero(tls->pending.key_block + key_offset,
 				mac->mac_length);
 
-		if (!tls->mac[txrx]) {
+		if (!tls->mac[txrx] && !tls->hmac[txrx]) {
 			if (error) {
 				*error = error_buf;
 				snprintf(error_buf, sizeof(error_buf),
@@ -297,7 +342,17 @@ static bool tls_change_cipher_spec(struct l_tls *tls, bool txrx,
 		if ((tls->server && txrx) || (!tls->server && !txrx))
 			key_offset += enc->key_length;
 
-		if (enc->cipher_type == TLS_CIPHER_AEAD) {
+		if (tls_cipher_in_process(tls, enc)) {
+			tls->aes[txrx] = l_new(struct aes_ctx, 1);
+			cipher = tls->aes[txrx];
+
+			if (!_aes_init(cipher, tls->pending.key_block +
+						key_offset, enc->key_length)) {
+				l_free(cipher);
+				tls->aes[txrx] = NULL;
+				cipher = NULL;
+			}
+		} else if (enc->cipher_type == TLS_CIPHER_AEAD) {
 			cipher = l_aead_cipher_new(enc->l_aead_id,
 						tls->pending.key_block +
 						key_offset, enc->key_length,
@@ -348,8 +403,13 @@ static bool tls_change_cipher_spec(struct l_tls *tls, bool txrx,
 		if ((tls->server && txrx) || (!tls->server && !txrx))
 			key_offset += enc->iv_length;
 
-		l_cipher_set_iv(tls->cipher[txrx], tls->pending.key_block +
-				key_offset, enc->iv_length);
+		if (tls->aes[txrx])
+			_aes_set_iv(tls->aes[txrx], tls->pending.key_block +
+					key_offset);
+		else
+			l_cipher_set_iv(tls->cipher[txrx],
+					tls->pending.key_block + key_offset,
+					enc->iv_length);
 
 		/* Wipe out the now unneeded part of the key block */
 		explicit_bzero(tls->pending.key_block + key_offset,
@@ -411,7 +471,9 @@ bool tls_cipher_suite_is_compatible(struct l_tls *tls,
 			return false;
 		}
 
-		if (!l_aead_cipher_is_supported(suite->encryption->l_aead_id)) {
+		if (!tls_cipher_in_process(tls, suite->encryption) &&
+				!l_aead_cipher_is_supported(
+					suite->encryption->l_aead_id)) {
 			if (error) {
 				*error = error_buf;
 				snprintf(error_buf, sizeof(error_buf),
@@ -423,7 +485,8 @@ bool tls_cipher_suite_is_compatible(struct l_tls *tls,
 			return false;
 		}
 	} else if (suite->encryption) { /* Block or stream cipher */
-		if (!l_cipher_is_supported(suite->encryption->l_id)) {
+		if (!tls_cipher_in_process(tls, suite->encryption) &&
+				!l_cipher_is_supported(suite->encryption->l_id)) {
 			if (error) {
 				*error = error_buf;
 				snprintf(error_buf, sizeof(error_buf),
@@ -437,8 +500,11 @@ bool tls_cipher_suite_is_compatible(struct l_tls *tls,
 		}
 	}
 
-	if (suite->mac &&
-			!l_checksum_is_supported(suite->mac->hmac_type, true)) {
+	if (suite->mac && (tls->kernel_crypto ?
+			!_checksum_kernel_supported(suite->mac->hmac_type,
+							true) :
+			!l_checksum_is_supported(suite->mac->hmac_type,
+							true))) {
 		if (error) {
 			*error = error_buf;
 			snprintf(error_buf, sizeof(error_buf),
@@ -639,6 +705,7 @@ static const char *tls_handshake_type_to_str(enum tls_handshake_type type)
 	SWITCH_ENUM_TO_STR(TLS_HELLO_REQUEST)
 	SWITCH_ENUM_TO_STR(TLS_CLIENT_HELLO)
 	SWITCH_ENUM_TO_STR(TLS_SERVER_HELLO)
+	SWITCH_ENUM_TO_STR(TLS_NEW_SESSION_TICKET)
 	SWITCH_ENUM_TO_STR(TLS_CERTIFICATE)
 	SWITCH_ENUM_TO_STR(TLS_SERVER_KEY_EXCHANGE)
 	SWITCH_ENUM_TO_STR(TLS_CERTIFICATE_REQUEST)
@@ -666,6 +733,17 @@ static void tls_send_alert(struct l_tls *tls, bool fatal,
 	tls_tx_record(tls, TLS_CT_ALERT, buf, 2);
 }
 
+static void tls_forget_session(struct l_tls *tls)
+{
+	if (tls->server && tls->session_cache)
+		tls_session_cache_remove(tls->session_cache, tls->session_id,
+						tls->session_id_size);
+
+	l_tls_session_free(tls->session);
+	tls->session = NULL;
+	tls->session_id_size = 0;
+}
+
 /*
  * Callers make sure this is about the last function before returning
  * from the stack frames up to the exported library call so that the
@@ -677,6 +755,13 @@ void tls_disconnect(struct l_tls *tls, enum l_tls_alert_desc desc,
 {
 	tls_send_alert(tls, true, desc);
 
+	/*
+	 * RFC 5246, Section 7.2.2: "Thus, any connection terminated with
+	 * a fatal alert MUST NOT be resumed."
+	 */
+	if (desc || local_desc)
+		tls_forget_session(tls);
+
 	tls_reset_handshake(tls);
 	tls_cleanup_handshake(tls);
 
@@ -799,9 +884,92 @@ static ssize_t tls_append_hello_extensions(struct l_tls *tls,
 	return ptr - buf;
 }
 
+/* Tickets larger than this are not offered, they wouldn't fit a Client Hello */
+#define TLS_MAX_OFFERED_TICKET_SIZE	1024
+
+static struct tls_cipher_suite *tls_session_cipher_suite(struct l_tls *tls,
+					const struct l_tls_session *session)
+{
+	struct tls_cipher_suite *suite =
+		tls_find_cipher_suite(session->cipher_suite_id);
+	struct tls_cipher_suite **iter;
+	const char *error;
+
+	if (!suite)
+		return NULL;
+
+	for (iter = tls->cipher_suite_pref_list; *iter; iter++)
+		if (*iter == suite)
+			break;
+
+	if (!*iter) {
+		TLS_DEBUG("Session's cipher suite %s disallowed by config",
+				suite->name);
+		return NULL;
+	}
+
+	if (!tls_cipher_suite_is_compatible(tls, suite, &error)) {
+		TLS_DEBUG("Session not resumable: %s", error);
+		return NULL;
+	}
+
+	return suite;
+}
+
+/*
+ * A full handshake with the current settings would authenticate the
+ * peer if we have CAs configured, don't let a session that didn't
+ * skip that.
+ */
+static bool tls_session_peer_ok(struct l_tls *tls,
+				const struct tls_cipher_suite *suite,
+				const struct l_tls_session *session)
+{
+	if (!tls->ca_certs || !suite->signature)
+		return true;
+
+	if (!session->peer_authenticated) {
+		TLS_DEBUG("Session's peer wasn't authenticated");
+		return false;
+	}
+
+	if (!session->peer_identity) {
+		TLS_DEBUG("Session has no peer identity");
+		return false;
+	}
+
+	return true;
+}
+
+static bool tls_session_is_resumable(struct l_tls *tls,
+					const struct l_tls_session *session)
+{
+	struct tls_cipher_suite *suite;
+
+	if (session->expiry && l_time_after(l_time_now(), session->expiry))
+		return false;
+
+	if (session->version < tls->min_version ||
+			session->version > tls->max_version)
+		return false;
+
+	if (session->ticket_len > TLS_MAX_OFFERED_TICKET_SIZE)
+		return false;
+
+	if (!session->session_id_size && !session->ticket)
+		return false;
+
+	suite = tls_session_cipher_suite(tls, session);
+	if (!suite)
+		return false;
+
+	return tls_session_peer_ok(tls, suite, session);
+}
+
 static bool tls_send_client_hello(struct l_tls *tls)
 {
-	uint8_t buf[1024 + L_ARRAY_SIZE(tls_compression_pref)];
+	uint8_t buf[1024 + L_ARRAY_SIZE(tls_compression_pref) +
+			TLS_SESSION_ID_SIZE + TLS_MAX_OFFERED_TICKET_SIZE];
 	uint8_t *ptr = buf + TLS_HANDSHAKE_HEADER_SIZE;
 	uint8_t *len_ptr;
 	unsigned int i;
@@ -817,7 +985,30 @@ static bool tls_send_client_hello(struct l_tls *tls)
 	memcpy(ptr, tls->pending.client_random, 32);
 	ptr += 32;
 
-	*ptr++ = 0; /* No SessionID */
+	tls->session_id_size = 0;
+
+	if (tls->session && !tls_session_is_resumable(tls, tls->session)) {
+		TLS_DEBUG("Not offering session for resumption");
+		l_tls_session_free(tls->session);
+		tls->session = NULL;
+	}
+
+	/*
+	 * RFC 5077, Section 3.4: a client offering only a ticket sends a
+	 * random Session ID so it can tell whether the server accepted it.
+	 */
+	if (tls->session && tls->session->session_id_size) {
+		tls->session_id_size = tls->session->session_id_size;
+		memcpy(tls->session_id, tls->session->session_id,
+			tls->session_id_size);
+	} else if (tls->session) {
+		tls->session_id_size = TLS_SESSION_ID_SIZE;
+		l_getrandom(tls->session_id, TLS_SESSION_ID_SIZE);
+	}
+
+	*ptr++ = tls->session_id_size;
+	memcpy(ptr, tls->session_id, tls->session_id_size);
+	ptr += tls->session_id_size;
 
 	len_ptr = ptr;
 	ptr += 2;
@@ -872,7 +1063,10 @@ static bool tls_send_server_hello(struct l_tls *tls, struct l_queue *extensions)
 	memcpy(ptr, tls->pending.server_random, 32);
 	ptr += 32;
 
-	*ptr++ = 0; /* Sessions are not cached */
+	/* Either the ID of the session being resumed or a new one */
+	*ptr++ = tls->session_id_size;
+	memcpy(ptr, tls->session_id, tls->session_id_size);
+	ptr += tls->session_id_size;
 
 	*ptr++ = tls->pending.cipher_suite->id[0];
 	*ptr++ = tls->pending.cipher_suite->id[1];
@@ -1076,7 +1270,6 @@ void tls_generate_master_secret(struct l_tls *tls,
 				int pre_master_secret_len)
 {
 	uint8_t seed[64];
-	int key_block_size;
 
 	memcpy(seed +  0, tls->pending.client_random, 32);
 	memcpy(seed + 32, tls->pending.server_random, 32);
@@ -1084,9 +1277,16 @@ void tls_generate_master_secret(struct l_tls *tls,
 	tls_prf_get_bytes(tls, pre_master_secret, pre_master_secret_len,
 				"master secret", seed, 64,
 				tls->pending.master_secret, 48);
+	explicit_bzero(seed, 64);
 
 	/* Directly generate the key block while we're at it */
-	key_block_size = 0;
+	tls_generate_key_block(tls);
+}
+
+void tls_generate_key_block(struct l_tls *tls)
+{
+	uint8_t seed[64];
+	int key_block_size = 0;
 
 	if (tls->pending.cipher_suite->encryption)
 		key_block_size += 2 *
@@ -1217,6 +1417,38 @@ static void tls_send_finished(struct l_tls *tls)
 	tls_tx_handshake(tls, TLS_FINISHED, buf, ptr - buf);
 }
 
+/* RFC 5077, Section 3.3 */
+static void tls_send_new_session_ticket(struct l_tls *tls,
+					const struct l_tls_session *session)
+{
+	uint8_t *buf;
+	uint8_t *ticket;
+	size_t ticket_len;
+	uint64_t now = l_time_now();
+	uint32_t lifetime_hint = 0;
+
+	/* An empty ticket tells the client we won't issue one after all */
+	ticket = tls_session_ticket_encrypt(tls->session_cache, session,
+						&ticket_len);
+	if (!ticket)
+		ticket_len = 0;
+
+	if (l_time_before(now, session->expiry))
+		lifetime_hint = l_time_diff(now, session->expiry) / 1000000;
+
+	buf = l_malloc(TLS_HANDSHAKE_HEADER_SIZE + 6 + ticket_len);
+	l_put_be32(lifetime_hint, buf + TLS_HANDSHAKE_HEADER_SIZE);
+	l_put_be16(ticket_len, buf + TLS_HANDSHAKE_HEADER_SIZE + 4);
+
+	if (ticket_len)
+		memcpy(buf + TLS_HANDSHAKE_HEADER_SIZE + 6, ticket, ticket_len);
+
+	tls_tx_handshake(tls, TLS_NEW_SESSION_TICKET, buf,
+				TLS_HANDSHAKE_HEADER_SIZE + 6 + ticket_len);
+	l_free(buf);
+	l_free(ticket);
+}
+
 static bool tls_verify_finished(struct l_tls *tls, const uint8_t *received,
 				size_t len)
 {
@@ -1397,6 +1629,125 @@ decode_error:
 	return false;
 }
 
+static bool tls_server_find_session(struct l_tls *tls,
+					const uint8_t *session_id,
+					size_t session_id_size,
+					const uint8_t *cipher_suites,
+					size_t cipher_suites_size,
+					const uint8_t *compression_methods,
+					size_t compression_methods_size)
+{
+	struct l_tls_session *session = NULL;
+	struct tls_cipher_suite *suite;
+	size_t i;
+
+	/*
+	 * RFC 5077, Section 3.4: without a Session ID the client couldn't
+	 * tell that we accepted the ticket so do a full handshake then.
+	 */
+	if (!session_id_size)
+		return false;
+
+	if (tls->session_ticket) {
+		session = tls_session_ticket_decrypt(tls->session_cache,
+							tls->session_ticket,
+							tls->session_ticket_len);
+		if (!session)
+			TLS_DEBUG("Session ticket not accepted");
+	}
+
+	if (!session) {
+		const struct l_tls_session *cached = tls_session_cache_lookup(
+							tls->session_cache,
+							session_id,
+							session_id_size);
+
+		if (!cached)
+			return false;
+
+		session = tls_session_dup(cached);
+	}
+
+	if (session->version != tls->negotiated_version)
+		goto not_resumable;
+
+	suite = tls_session_cipher_suite(tls, session);
+	if (!suite || !tls_session_peer_ok(tls, suite, session))
+		goto not_resumable;
+
+	/* The client must still be offering the session's parameters */
+	for (i = 0; i < cipher_suites_size; i += 2)
+		if (!memcmp(cipher_suites + i, suite->id, 2))
+			break;
+
+	if (i == cipher_suites_size)
+		goto not_resumable;
+
+	if (!memchr(compression_methods, session->compression_method_id,
+			compression_methods_size))
+		goto not_resumable;
+
+	tls->pending.compression_method =
+		tls_find_compression_method(session->compression_method_id);
+	if (!tls->pending.compression_method)
+		goto not_resumable;
+
+	tls->pending.cipher_suite = suite;
+	tls->peer_authenticated = session->peer_authenticated;
+	tls->session = session;
+	tls->resuming = true;
+
+	memcpy(tls->session_id, session_id, session_id_size);
+	tls->session_id_size = session_id_size;
+
+	return true;
+
+not_resumable:
+	TLS_DEBUG("Session found but not resumable with the client's "
+			"parameters");
+	l_tls_session_free(session);
+	return false;
+}
+
+/*
+ * RFC 5246, Section 7.3: in an abbreviated handshake the ServerHello
+ * is directly followed by our ChangeCipherSpec and Finished.
+ */
+static void tls_server_resume(struct l_tls *tls, struct l_queue *extensions)
+{
+	const char *error;
+
+	if (!tls_set_prf_hmac(tls)) {
+		TLS_DISCONNECT(TLS_ALERT_INTERNAL_ERROR, 0,
+				"Error selecting the PRF HMAC");
+		return;
+	}
+
+	TLS_DEBUG("Resuming session with %s",
+			tls->pending.cipher_suite->name);
+
+	if (!tls_send_server_hello(tls, extensions))
+		return;
+
+	memcpy(tls->pending.master_secret, tls->session->master_secret, 48);
+	tls_generate_key_block(tls);
+
+	if (tls->session_ticket_ext)
+		tls_send_new_session_ticket(tls, tls->session);
+
+	tls_send_change_cipher_spec(tls);
+
+	if (!tls_change_cipher_spec(tls, 1, &error)) {
+		TLS_DISCONNECT(TLS_ALERT_INTERNAL_ERROR, 0,
+				"change_cipher_spec: %s", error);
+		return;
+	}
+
+	tls_send_finished(tls);
+
+	TLS_SET_STATE(TLS_HANDSHAKE_WAIT_CHANGE_CIPHER_SPEC);
+}
+
 static void tls_handle_client_hello(struct l_tls *tls,
 					const uint8_t *buf, size_t len)
 {
@@ -1416,6 +1767,9 @@ static void tls_handle_client_hello(struct l_tls *tls,
 	session_id_size = buf[34];
 	len -= 35;
 
+	if (session_id_size > TLS_SESSION_ID_SIZE)
+		goto decode_error;
+
 	/*
 	 * Do we have enough to hold the actual session ID + 2 byte field for
 	 * cipher_suite len + minimum of a single cipher suite identifier
@@ -1455,13 +1809,6 @@ static void tls_handle_client_hello(struct l_tls *tls,
 					len, extensions_offered))
 		goto cleanup;
 
-	/*
-	 * Note: if the client is supplying a SessionID we know it is false
-	 * because our server implementation never generates any SessionIDs
-	 * yet so either the client is attempting something strange or was
-	 * trying to connect somewhere else.  We might want to throw an error.
-	 */
-
 	/* Save client_version for Premaster Secret verification */
 	tls->client_version = l_get_be16(buf);
 
@@ -1487,7 +1834,17 @@ static void tls_handle_client_hello(struct l_tls *tls,
 	if (!tls->cipher_suite_pref_list) {
 		TLS_DISCONNECT(TLS_ALERT_INTERNAL_ERROR, 0,
 				"No usable cipher suites");
-		return;
+		goto cleanup;
+	}
+
+	if (tls->session_cache &&
+			tls_server_find_session(tls, buf + 35, session_id_size,
+						cipher_suites,
+						cipher_suites_size,
+						compression_methods,
+						compression_methods_size)) {
+		tls_server_resume(tls, extensions_offered);
+		goto cleanup;
 	}
 
 	/* Select a cipher suite according to client's preference list */
@@ -1562,6 +1919,13 @@ static void tls_handle_client_hello(struct l_tls *tls,
 
 	TLS_DEBUG("Negotiated %s", tls->pending.compression_method->name);
 
+	/* Give the session an ID if we're going to cache it */
+	if (tls->session_cache) {
+		tls->session_id_size = TLS_SESSION_ID_SIZE;
+		l_getrandom(tls->session_id, TLS_SESSION_ID_SIZE);
+	} else
+		tls->session_id_size = 0;
+
 	if (!tls_send_server_hello(tls, extensions_offered))
 		goto cleanup;
 
@@ -1616,6 +1980,9 @@ static void tls_handle_server_hello(struct l_tls *tls,
 	session_id_size = buf[34];
 	len -= 35;
 
+	if (session_id_size > TLS_SESSION_ID_SIZE)
+		goto decode_error;
+
 	/* Do we have enough for SessionID + CipherSuite ID + Compression ID */
 	if (len < (size_t) session_id_size + 2 + 1)
 		goto decode_error;
@@ -1700,6 +2067,37 @@ static void tls_handle_server_hello(struct l_tls *tls,
 
 	TLS_DEBUG("Negotiated %s", tls->pending.compression_method->name);
 
+	/* The server echoes our Session ID if it accepted the session */
+	if (tls->session && session_id_size &&
+			session_id_size == tls->session_id_size &&
+			!memcmp(buf + 35, tls->session_id, session_id_size)) {
+		const struct l_tls_session *session = tls->session;
+
+		if (tls->negotiated_version != session->version ||
+				memcmp(cipher_suite_id,
+					session->cipher_suite_id, 2) ||
+				compression_method_id !=
+				session->compression_method_id) {
+			TLS_DISCONNECT(TLS_ALERT_ILLEGAL_PARAM, 0,
+					"Resumed session parameters changed");
+			return;
+		}
+
+		TLS_DEBUG("Resuming session");
+		tls->resuming = true;
+		memcpy(tls->pending.master_secret, session->master_secret, 48);
+		tls_generate_key_block(tls);
+
+		TLS_SET_STATE(TLS_HANDSHAKE_WAIT_CHANGE_CIPHER_SPEC);
+		return;
+	}
+
+	l_tls_session_free(tls->session);
+	tls->session = NULL;
+
+	memcpy(tls->session_id, buf + 35, session_id_size);
+	tls->session_id_size = session_id_size;
+
 	if (tls->pending.cipher_suite->signature)
 		TLS_SET_STATE(TLS_HANDSHAKE_WAIT_CERTIFICATE);
 	else
@@ -1933,6 +2331,32 @@ static void tls_handle_server_hello_done(struct l_tls *tls,
 	TLS_SET_STATE(TLS_HANDSHAKE_WAIT_CHANGE_CIPHER_SPEC);
 }
 
+static void tls_handle_new_session_ticket(struct l_tls *tls,
+						const uint8_t *buf, size_t len)
+{
+	size_t ticket_len;
+
+	if (len < 6)
+		goto decode_error;
+
+	ticket_len = l_get_be16(buf + 4);
+	if (ticket_len != len - 6)
+		goto decode_error;
+
+	l_free(tls->session_ticket);
+	tls->session_ticket = ticket_len ? l_memdup(buf + 6, ticket_len) : NULL;
+	tls->session_ticket_len = ticket_len;
+	tls->session_ticket_lifetime = l_get_be32(buf);
+
+	/* Only one NewSessionTicket per handshake */
+	tls->session_ticket_ext = false;
+	return;
+
+decode_error:
+	TLS_DISCONNECT(TLS_ALERT_DECODE_ERROR, 0,
+			"NewSessionTicket decode error");
+}
+
 static bool tls_get_prev_digest_by_type(struct l_tls *tls,
 					enum handshake_hash_type type,
 					const uint8_t *data, size_t data_len,
@@ -2049,16 +2473,80 @@ static char *tls_get_peer_identity_str(struct l_cert *cert)
 		return NULL;
 }
 
+static struct l_tls_session *tls_session_from_pending(struct l_tls *tls)
+{
+	struct l_tls_session *session = l_new(struct l_tls_session, 1);
+
+	session->version = tls->negotiated_version;
+	memcpy(session->cipher_suite_id, tls->pending.cipher_suite->id, 2);
+	session->compression_method_id = tls->pending.compression_method->id;
+	memcpy(session->master_secret, tls->pending.master_secret, 48);
+	memcpy(session->session_id, tls->session_id, tls->session_id_size);
+	session->session_id_size = tls->session_id_size;
+	session->peer_authenticated = tls->peer_authenticated;
+
+	if (tls->peer_authenticated)
+		session->peer_identity =
+			tls_get_peer_identity_str(tls->peer_cert);
+
+	if (tls->server)
+		session->expiry = l_time_offset(l_time_now(),
+				tls_session_cache_lifetime(tls->session_cache));
+
+	return session;
+}
+
+/* Keep what's needed to resume the session before it is wiped */
+static void tls_save_session(struct l_tls *tls)
+{
+	struct l_tls_session *session = tls->session;
+
+	if (tls->server) {
+		/* Only sessions from full handshakes are new to the cache */
+		if (session && !tls->resuming)
+			tls_session_cache_add(tls->session_cache, session);
+
+		l_tls_session_free(session);
+		tls->session = NULL;
+		return;
+	}
+
+	if (tls->session_ticket) {
+		l_free(session->ticket);
+		session->ticket = tls->session_ticket;
+		session->ticket_len = tls->session_ticket_len;
+		session->expiry = tls->session_ticket_lifetime ?
+			l_time_offset(l_time_now(),
+				(uint64_t) tls->session_ticket_lifetime *
+				1000000) : 0;
+
+		tls->session_ticket = NULL;
+		tls->session_ticket_len = 0;
+	}
+
+	if (!session->session_id_size && !session->ticket) {
+		l_tls_session_free(session);
+		tls->session = NULL;
+	}
+}
+
 static void tls_finished(struct l_tls *tls)
 {
 	char *peer_identity = NULL;
 
-	if (tls->peer_authenticated) {
+	if (!tls->server && !tls->resuming)
+		tls->session = tls_session_from_pending(tls);
+
+	if (tls->session)
+		peer_identity = l_strdup(tls->session->peer_identity);
+	else if (tls->peer_authenticated) {
 		peer_identity = tls_get_peer_identity_str(tls->peer_cert);
 		if (!peer_identity)
 			TLS_DEBUG("tls_get_peer_identity_str failed");
 	}
 
+	tls_save_session(tls);
+
 	/* Free up the resources used in the handshake */
 	tls_reset_handshake(tls);
 
@@ -2137,6 +2625,25 @@ static void tls_handle_handshake(struct l_tls *tls, int type,
 
 		break;
 
+	case TLS_NEW_SESSION_TICKET:
+		if (tls->server) {
+			TLS_DISCONNECT(TLS_ALERT_UNEXPECTED_MESSAGE, 0,
+					"Message invalid in server mode");
+			break;
+		}
+
+		if (tls->state != TLS_HANDSHAKE_WAIT_CHANGE_CIPHER_SPEC ||
+				!tls->session_ticket_ext) {
+			TLS_DISCONNECT(TLS_ALERT_UNEXPECTED_MESSAGE, 0,
+					"Message invalid in current state "
+					"or session ticket not expected");
+			break;
+		}
+
+		tls_handle_new_session_ticket(tls, buf, len);
+
+		break;
+
 	case TLS_CERTIFICATE:
 		if (tls->state != TLS_HANDSHAKE_WAIT_CERTIFICATE) {
 			TLS_DISCONNECT(TLS_ALERT_UNEXPECTED_MESSAGE, 0,
@@ -2261,9 +2768,21 @@ static void tls_handle_handshake(struct l_tls *tls, int type,
 		if (!tls_verify_finished(tls, buf, len))
 			break;
 
-		if (tls->server) {
+		/*
+		 * The side that sent its Finished first in a full handshake
+		 * sends it second in an abbreviated one.
+		 */
+		if (tls->server != tls->resuming) {
 			const char *error;
 
+			if (tls->server && tls->session_cache) {
+				tls->session = tls_session_from_pending(tls);
+
+				if (tls->session_ticket_ext)
+					tls_send_new_session_ticket(tls,
+								tls->session);
+			}
+
 			tls_send_change_cipher_spec(tls);
 			if (!tls_change_cipher_spec(tls, 1, &error)) {
 				TLS_DISCONNECT(TLS_ALERT_INTERNAL_ERROR, 0,
@@ -2303,7 +2822,10 @@ static void tls_handle_handshake(struct l_tls *tls, int type,
 		 *      ServerKeyExchange parameters using its certified key
 		 *      pair.
 		 */
-		if (!tls->server && tls->cipher_suite[0]->signature &&
+		if (!tls->server && tls->resuming)
+			tls->peer_authenticated =
+				tls->session->peer_authenticated;
+		else if (!tls->server && tls->cipher_suite[0]->signature &&
 				tls->ca_certs)
 			tls->peer_authenticated = true;
 
@@ -2380,6 +2902,8 @@ LIB_EXPORT void l_tls_free(struct l_tls *tls)
 	if (tls->cipher_suite_pref_list != tls_cipher_suite_pref)
 		l_free(tls->cipher_suite_pref_list);
 
+	l_tls_session_free(tls->session);
+
 	l_free(tls);
 }
 
@@ -2392,6 +2916,28 @@ LIB_EXPORT void l_tls_write(struct l_tls *tls, const uint8_t *data, size_t len)
 	tls_tx_record(tls, TLS_CT_APPLICATION_DATA, data, len);
 }
 
+LIB_EXPORT void l_tls_writev(struct l_tls *tls, const struct iovec *iov,
+				size_t iov_cnt, size_t headroom,
+				size_t tailroom)
+{
+	if (unlikely(!tls->ready))
+		return;
+
+	tls_tx_recordv(tls, TLS_CT_APPLICATION_DATA, iov, iov_cnt,
+			headroom, tailroom);
+}
+
+LIB_EXPORT bool l_tls_set_tx_iov_handler(struct l_tls *tls,
+						l_tls_writev_cb_t handler)
+{
+	if (unlikely(!tls))
+		return false;
+
+	tls->tx_iov = handler;
+
+	return true;
+}
+
 bool tls_handle_message(struct l_tls *tls, const uint8_t *message,
 			int len, enum tls_content_type type, uint16_t version)
 {
@@ -2415,6 +2961,18 @@ bool tls_handle_message(struct l_tls *tls, const uint8_t *message,
 			return false;
 		}
 
+		/*
+		 * RFC 5077, Section 3.3: "This message MUST be sent if the
+		 * server included a SessionTicket extension in the
+		 * ServerHello."
+		 */
+		if (!tls->server && tls->session_ticket_ext) {
+			TLS_DISCONNECT(TLS_ALERT_UNEXPECTED_MESSAGE, 0,
+					"NewSessionTicket missing");
+
+			return false;
+		}
+
 		if (!tls_change_cipher_spec(tls, 0, &error)) {
 			TLS_DISCONNECT(TLS_ALERT_INTERNAL_ERROR, 0,
 					"change_cipher_spec: %s", error);
@@ -2692,6 +3250,79 @@ LIB_EXPORT void l_tls_set_version_range(struct l_tls *tls,
 		max_version : TLS_MAX_VERSION;
 }
 
+/**
+ * l_tls_set_kernel_crypto:
+ * @tls: TLS object
+ * @enabled: whether to protect records through AF_ALG
+ *
+ * By default record encryption and MACs are done in-process whenever
+ * the negotiated suite's algorithms allow it.  Enabling this leaves all
+ * of it to the kernel's AF_ALG implementations as before, e.g. to use
+ * a hardware offload driver, and restricts the suites offered or
+ * accepted to those the kernel supports.  Must be called before
+ * l_tls_start.
+ *
+ * Returns: #true on success or #false if the handshake has started
+ **/
+LIB_EXPORT bool l_tls_set_kernel_crypto(struct l_tls *tls, bool enabled)
+{
+	if (unlikely(!tls))
+		return false;
+
+	/* Servers sit in WAIT_HELLO from l_tls_new until the Client Hello */
+	if (tls->ready || tls->state != (tls->server ?
+						TLS_HANDSHAKE_WAIT_HELLO :
+						TLS_HANDSHAKE_WAIT_START)) {
+		TLS_DEBUG("Call invalid in state %s",
+				tls_handshake_state_to_str(tls->state));
+		return false;
+	}
+
+	tls->kernel_crypto = enabled;
+
+	return true;
+}
+
+LIB_EXPORT bool l_tls_set_session_cache(struct l_tls *tls,
+					struct l_tls_session_cache *cache)
+{
+	if (unlikely(!tls || !tls->server))
+		return false;
+
+	tls->session_cache = cache;
+
+	return true;
+}
+
+LIB_EXPORT struct l_tls_session *l_tls_get_session(struct l_tls *tls)
+{
+	if (unlikely(!tls || tls->server))
+		return NULL;
+
+	if (!tls->ready || !tls->session)
+		return NULL;
+
+	return tls_session_dup(tls->session);
+}
+
+LIB_EXPORT bool l_tls_set_session(struct l_tls *tls,
+					const struct l_tls_session *session)
+{
+	if (unlikely(!tls || tls->server))
+		return false;
+
+	if (tls->state != TLS_HANDSHAKE_WAIT_START) {
+		TLS_DEBUG("Call invalid in state %s",
+				tls_handshake_state_to_str(tls->state));
+		return false;
+	}
+
+	l_tls_session_free(tls->session);
+	tls->session = session ? tls_session_dup(session) : NULL;
+
+	return true;
+}
+
 LIB_EXPORT const char *l_tls_alert_to_str(enum l_tls_alert_desc desc)
 {
 	switch (desc) {
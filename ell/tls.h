@@ -33,6 +33,9 @@ enum l_tls_version {
 };
 
 struct l_tls;
+struct l_tls_session;
+struct l_tls_session_cache;
+struct iovec;
 
 enum l_tls_alert_desc {
 	TLS_ALERT_CLOSE_NOTIFY		= 0,
@@ -64,6 +67,8 @@ enum l_tls_alert_desc {
 
 typedef void (*l_tls_write_cb_t)(const uint8_t *data, size_t len,
 					void *user_data);
+typedef void (*l_tls_writev_cb_t)(const struct iovec *iov, size_t iov_cnt,
+					void *user_data);
 typedef void (*l_tls_ready_cb_t)(const char *peer_identity, void *user_data);
 typedef void (*l_tls_disconnect_cb_t)(enum l_tls_alert_desc reason,
 					bool remote, void *user_data);
@@ -92,9 +97,44 @@ void l_tls_close(struct l_tls *tls);
 /* Submit plaintext data to be encrypted and transmitted */
 void l_tls_write(struct l_tls *tls, const uint8_t *data, size_t len);
 
+/*
+ * Room l_tls_writev needs around the caller's buffers to build a record
+ * in place: the record header and explicit IV in front, the MAC and
+ * padding or the AEAD tag behind.
+ */
+#define L_TLS_WRITEV_HEADROOM	(5 + 16)
+#define L_TLS_WRITEV_TAILROOM	64
+#define L_TLS_WRITEV_MAX_LEN	(1 << 14)
+
+/*
+ * Like l_tls_write but gathers the plaintext from @iov.  If at least
+ * L_TLS_WRITEV_HEADROOM bytes in front of the first buffer and
+ * L_TLS_WRITEV_TAILROOM bytes after the last buffer are writable, and
+ * the total is at most L_TLS_WRITEV_MAX_LEN, the data is encrypted in
+ * place and sent as a single record without being copied.  The buffer
+ * contents are undefined afterwards.
+ */
+void l_tls_writev(struct l_tls *tls, const struct iovec *iov, size_t iov_cnt,
+			size_t headroom, size_t tailroom);
+
+/*
+ * Have records passed to @handler as an iovec array, pointing into the
+ * l_tls_writev buffers where possible, instead of to tx_handler.
+ */
+bool l_tls_set_tx_iov_handler(struct l_tls *tls, l_tls_writev_cb_t handler);
+
 /* Submit TLS payload from underlying transport to be decrypted */
 void l_tls_handle_rx(struct l_tls *tls, const uint8_t *data, size_t len);
 
+/*
+ * Like l_tls_handle_rx but records that are entirely inside @data are
+ * decrypted in place instead of being copied first, and the plaintext
+ * passed to app_data_handler points into @data.  Only records split
+ * across calls are reassembled in an internal buffer.  The contents of
+ * @data are undefined afterwards.
+ */
+void l_tls_handle_rx_inplace(struct l_tls *tls, uint8_t *data, size_t len);
+
 /* If peer is to be authenticated, supply the CA certificates */
 bool l_tls_set_cacert(struct l_tls *tls, const char *ca_cert_path);
 
@@ -117,6 +157,40 @@ void l_tls_set_version_range(struct l_tls *tls,
 				enum l_tls_version min_version,
 				enum l_tls_version max_version);
 
+/*
+ * Record encryption and MACs are done in-process where possible, this
+ * leaves them to the kernel's AF_ALG implementations instead.
+ */
+bool l_tls_set_kernel_crypto(struct l_tls *tls, bool enabled);
+
+/*
+ * Servers remember sessions in a cache that may be shared between
+ * connections so that returning clients can skip the key exchange.
+ * Up to @max_sessions are kept by Session ID, each for @lifetime
+ * seconds, least recently used sessions are dropped first.  With
+ * tickets enabled the session state is also handed to clients that
+ * support RFC 5077, encrypted under a key replaced every @key_lifetime
+ * seconds, so the cache may even be empty.
+ */
+struct l_tls_session_cache *l_tls_session_cache_new(unsigned int max_sessions,
+							unsigned int lifetime);
+void l_tls_session_cache_free(struct l_tls_session_cache *cache);
+bool l_tls_session_cache_enable_tickets(struct l_tls_session_cache *cache,
+					unsigned int key_lifetime);
+bool l_tls_set_session_cache(struct l_tls *tls,
+				struct l_tls_session_cache *cache);
+
+/*
+ * Clients can get a copy of the session established by a connection
+ * once the ready handler has been called, and offer it to the server
+ * before l_tls_start on a later connection to resume it.  A full
+ * handshake is done if the server doesn't accept it.
+ */
+struct l_tls_session *l_tls_get_session(struct l_tls *tls);
+bool l_tls_set_session(struct l_tls *tls,
+			const struct l_tls_session *session);
+void l_tls_session_free(struct l_tls_session *session);
+
 const char *l_tls_alert_to_str(enum l_tls_alert_desc desc);
 
 enum l_checksum_type;
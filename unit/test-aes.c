@@ -0,0 +1,326 @@
+/*
+ *
+ *  Embedded Linux library
+ *
+ *  Copyright (C) 2019  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include <ell/ell.h>
+#include "ell/aes-private.h"
+
+static void check_hex(const uint8_t *buf, size_t len, const char *expected)
+{
+	char *hex;
+
+	if (!len) {
+		assert(!*expected);
+		return;
+	}
+
+	hex = l_util_hexstring(buf, len);
+	assert(!strcmp(hex, expected));
+	l_free(hex);
+}
+
+static void init_hex(struct aes_ctx *ctx, const char *key_hex, bool aesni)
+{
+	size_t key_len;
+	uint8_t *key = l_util_from_hexstring(key_hex, &key_len);
+
+	assert(_aes_init(ctx, key, key_len));
+	l_free(key);
+
+	/* The bitsliced round keys are always there to fall back on */
+	if (!aesni)
+		ctx->aesni = false;
+}
+
+/* FIPS-197 Appendix C */
+static const char *fips197_keys[] = {
+	"000102030405060708090a0b0c0d0e0f",
+	"000102030405060708090a0b0c0d0e0f1011121314151617",
+	"000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f",
+};
+
+static const char *fips197_ciphertexts[] = {
+	"69c4e0d86a7b0430d8cdb78070b4c55a",
+	"dda97ca4864cdfe06eaf70a0ec0d7191",
+	"8ea2b7ca516745bfeafc49904b496089",
+};
+
+/* SP 800-38A F.2.1 */
+static const char cbc_key[] = "2b7e151628aed2a6abf7158809cf4f3c";
+static const char cbc_plaintext[] =
+	"6bc1bee22e409f96e93d7e117393172aae2d8a571e03ac9c9eb76fac45af8e51"
+	"30c81c46a35ce411e5fbc1191a0a52eff69f2445df4f9b17ad2b417be66c3710";
+static const char cbc_ciphertext[] =
+	"7649abac8119b246cee98e9b12e9197d5086cb9b507219ee95db113a917678b2"
+	"73bed6b8e3c1743b7116e69e222295163ff1caa1681fac09120eca307586e1a7";
+
+struct gcm_test {
+	const char *key;
+	const char *nonce;
+	const char *aad;
+	const char *plaintext;
+	const char *ciphertext;
+	const char *tag;
+};
+
+/* Test cases 1, 2, 4 and 16 from the GCM specification */
+static const struct gcm_test gcm_tests[] = {
+	{
+		.key = "00000000000000000000000000000000",
+		.nonce = "000000000000000000000000",
+		.aad = "",
+		.plaintext = "",
+		.ciphertext = "",
+		.tag = "58e2fccefa7e3061367f1d57a4e7455a",
+	},
+	{
+		.key = "00000000000000000000000000000000",
+		.nonce = "000000000000000000000000",
+		.aad = "",
+		.plaintext = "00000000000000000000000000000000",
+		.ciphertext = "0388dace60b6a392f328c2b971b2fe78",
+		.tag = "ab6e47d42cec13bdf53a67b21257bddf",
+	},
+	{
+		.key = "feffe9928665731c6d6a8f9467308308",
+		.nonce = "cafebabefacedbaddecaf888",
+		.aad = "feedfacedeadbeeffeedfacedeadbeefabaddad2",
+		.plaintext = "d9313225f88406e5a55909c5aff5269a"
+			"86a7a9531534f7da2e4c303d8a318a72"
+			"1c3c0c95956809532fcf0e2449a6b525"
+			"b16aedf5aa0de657ba637b39",
+		.ciphertext = "42831ec2217774244b7221b784d0d49c"
+			"e3aa212f2c02a4e035c17e2329aca12e"
+			"21d514b25466931c7d8f6a5aac84aa05"
+			"1ba30b396a0aac973d58e091",
+		.tag = "5bc94fbc3221a5db94fae95ae7121a47",
+	},
+	{
+		.key = "feffe9928665731c6d6a8f9467308308"
+			"feffe9928665731c6d6a8f9467308308",
+		.nonce = "cafebabefacedbaddecaf888",
+		.aad = "feedfacedeadbeeffeedfacedeadbeefabaddad2",
+		.plaintext = "d9313225f88406e5a55909c5aff5269a"
+			"86a7a9531534f7da2e4c303d8a318a72"
+			"1c3c0c95956809532fcf0e2449a6b525"
+			"b16aedf5aa0de657ba637b39",
+		.ciphertext = "522dc1f099567d07f47f37a32a84427d"
+			"643a8cdcbfe5c0c97598a2bd2555d1aa"
+			"8cb08e48590dbb3da7b08b1056828838"
+			"c5f61e6393ba7a0abcc9f662",
+		.tag = "76fc6ece0f4e1768cddf8853bb2d551b",
+	},
+};
+
+static uint8_t *from_hex(const char *hex, size_t *len)
+{
+	if (!*hex) {
+		*len = 0;
+		return l_malloc(1);
+	}
+
+	return l_util_from_hexstring(hex, len);
+}
+
+static void test_known_answers(bool aesni)
+{
+	static const uint8_t fips197_plaintext[16] = {
+		0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+		0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff,
+	};
+	static const uint8_t zero[16];
+	struct aes_ctx ctx;
+	uint8_t buf[64];
+	uint8_t iv[16];
+	uint8_t *plaintext;
+	size_t len;
+	unsigned int i;
+
+	for (i = 0; i < L_ARRAY_SIZE(fips197_keys); i++) {
+		init_hex(&ctx, fips197_keys[i], aesni);
+
+		/* A single CBC block with a zero IV is the raw cipher */
+		_aes_set_iv(&ctx, zero);
+		_aes_cbc_encrypt(&ctx, fips197_plaintext, buf, 16);
+		check_hex(buf, 16, fips197_ciphertexts[i]);
+
+		_aes_set_iv(&ctx, zero);
+		_aes_cbc_decrypt(&ctx, buf, buf, 16);
+		assert(!memcmp(buf, fips197_plaintext, 16));
+	}
+
+	for (i = 0; i < 16; i++)
+		iv[i] = i;
+
+	init_hex(&ctx, cbc_key, aesni);
+	plaintext = l_util_from_hexstring(cbc_plaintext, &len);
+	assert(len == 64);
+
+	/* Chaining carries over between calls */
+	_aes_set_iv(&ctx, iv);
+	_aes_cbc_encrypt(&ctx, plaintext, buf, 16);
+	_aes_cbc_encrypt(&ctx, plaintext + 16, buf + 16, 48);
+	check_hex(buf, 64, cbc_ciphertext);
+
+	_aes_set_iv(&ctx, iv);
+	_aes_cbc_decrypt(&ctx, buf, buf, 48);
+	_aes_cbc_decrypt(&ctx, buf + 48, buf + 48, 16);
+	assert(!memcmp(buf, plaintext, 64));
+	l_free(plaintext);
+
+	for (i = 0; i < L_ARRAY_SIZE(gcm_tests); i++) {
+		const struct gcm_test *test = &gcm_tests[i];
+		uint8_t *nonce, *aad;
+		uint8_t tag[16];
+		size_t aad_len;
+
+		init_hex(&ctx, test->key, aesni);
+		nonce = from_hex(test->nonce, &len);
+		aad = from_hex(test->aad, &aad_len);
+		plaintext = from_hex(test->plaintext, &len);
+
+		_aes_gcm_encrypt(&ctx, nonce, aad, aad_len, plaintext, buf, len,
+								tag, 16);
+		check_hex(buf, len, test->ciphertext);
+		check_hex(tag, 16, test->tag);
+
+		assert(_aes_gcm_decrypt(&ctx, nonce, aad, aad_len, buf, buf,
+							len, tag, 16));
+		assert(!memcmp(buf, plaintext, len));
+
+		/* Piecewise updates produce the same result */
+		if (len) {
+			struct aes_gcm_state gcm;
+			size_t first = len / 3 + 1;
+			size_t second = len / 2;
+
+			memset(buf, 0, sizeof(buf));
+			_aes_gcm_start(&gcm, &ctx, nonce, aad, aad_len);
+			_aes_gcm_encrypt_update(&gcm, plaintext, buf, first);
+			_aes_gcm_encrypt_update(&gcm, plaintext + first,
+						buf + first, second);
+			_aes_gcm_encrypt_update(&gcm, plaintext + first + second,
+						buf + first + second,
+						len - first - second);
+			_aes_gcm_finish(&gcm, tag, 16);
+			check_hex(buf, len, test->ciphertext);
+			check_hex(tag, 16, test->tag);
+		}
+
+		/* A truncated tag still has to match */
+		_aes_gcm_encrypt(&ctx, nonce, aad, aad_len, plaintext, buf, len,
+								tag, 16);
+		tag[11] ^= 1;
+		assert(_aes_gcm_decrypt(&ctx, nonce, aad, aad_len, buf, buf,
+							len, tag, 8));
+		assert(!_aes_gcm_decrypt(&ctx, nonce, aad, aad_len, buf, buf,
+							len, tag, 12));
+
+		l_free(nonce);
+		l_free(aad);
+		l_free(plaintext);
+	}
+}
+
+static void test_portable(const void *data)
+{
+	test_known_answers(false);
+}
+
+static void test_native(const void *data)
+{
+	test_known_answers(true);
+}
+
+/* Both implementations must agree on lengths that hit every tail path */
+static void test_compare(const void *data)
+{
+	static uint8_t key[32], nonce[12], aad[13], iv[16], in[300];
+	struct aes_ctx fast, slow;
+	unsigned int i, len, cbc_len;
+
+	for (i = 0; i < sizeof(key); i++)
+		key[i] = i * 11 + 1;
+
+	for (i = 0; i < sizeof(in); i++)
+		in[i] = i * 7 + 3;
+
+	memset(nonce, 0x5a, sizeof(nonce));
+	memset(aad, 0xa5, sizeof(aad));
+	memset(iv, 0x3c, sizeof(iv));
+
+	assert(_aes_init(&fast, key, 32));
+	slow = fast;
+	slow.aesni = false;
+
+	for (len = 0; len <= sizeof(in); len += 5) {
+		uint8_t out_fast[300], out_slow[300];
+		uint8_t tag_fast[16], tag_slow[16];
+
+		_aes_gcm_encrypt(&fast, nonce, aad, sizeof(aad), in, out_fast,
+						len, tag_fast, 16);
+		_aes_gcm_encrypt(&slow, nonce, aad, sizeof(aad), in, out_slow,
+						len, tag_slow, 16);
+		assert(!memcmp(out_fast, out_slow, len));
+		assert(!memcmp(tag_fast, tag_slow, 16));
+
+		cbc_len = len & ~15;
+
+		_aes_set_iv(&fast, iv);
+		_aes_set_iv(&slow, iv);
+		_aes_cbc_encrypt(&fast, in, out_fast, cbc_len);
+		_aes_cbc_encrypt(&slow, in, out_slow, cbc_len);
+		assert(!memcmp(out_fast, out_slow, cbc_len));
+
+		_aes_cbc_decrypt(&fast, in, out_fast, cbc_len);
+		_aes_cbc_decrypt(&slow, in, out_slow, cbc_len);
+		assert(!memcmp(out_fast, out_slow, cbc_len));
+		assert(!memcmp(fast.iv, slow.iv, 16));
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	struct aes_ctx ctx;
+	static const uint8_t key[16];
+
+	l_test_init(&argc, &argv);
+
+	l_test_add("Bitsliced known answers", test_portable, NULL);
+
+	_aes_init(&ctx, key, sizeof(key));
+
+	if (ctx.aesni) {
+		l_test_add("AES-NI known answers", test_native, NULL);
+		l_test_add("AES-NI matches bitsliced", test_compare, NULL);
+	} else
+		printf("AES-NI not available, testing bitsliced only\n");
+
+	return l_test_run();
+}
@@ -24,9 +24,11 @@
 #include <config.h>
 #endif
 
+#include <stdio.h>
 #include <assert.h>
 
 #include <ell/ell.h>
+#include "ell/alg-private.h"
 
 #define FIXED_STR  "The quick brown fox jumps over the lazy dog. " \
 		   "Jackdaws love my big sphinx of quartz. "       \
@@ -178,6 +180,294 @@ static void test_updatev(const void *data)
 	l_checksum_free(checksum);
 }
 
+static void test_clone(const void *data)
+{
+	struct l_checksum *checksum;
+	struct l_checksum *clone;
+	unsigned char digest1[32];
+	unsigned char digest2[32];
+
+	checksum = l_checksum_new(L_CHECKSUM_SHA256);
+	assert(checksum);
+
+	l_checksum_update(checksum, FIXED_STR, FIXED_LEN / 2);
+
+	/* The clone carries the partial state but is independent */
+	clone = l_checksum_clone(checksum);
+	assert(clone);
+
+	l_checksum_update(clone, "garbage", 7);
+	l_checksum_get_digest(clone, digest1, sizeof(digest1));
+	l_checksum_reset(clone);
+
+	l_checksum_update(checksum, FIXED_STR + FIXED_LEN / 2,
+					FIXED_LEN - FIXED_LEN / 2);
+	l_checksum_get_digest(checksum, digest2, sizeof(digest2));
+	assert(memcmp(digest1, digest2, sizeof(digest1)));
+
+	l_checksum_update(clone, FIXED_STR, FIXED_LEN);
+	l_checksum_get_digest(clone, digest1, sizeof(digest1));
+	assert(!memcmp(digest1, digest2, sizeof(digest1)));
+
+	l_checksum_free(clone);
+	l_checksum_free(checksum);
+}
+
+#define HANDSHAKE_BENCH_COUNT	2000
+
+/*
+ * The TLS handshake keeps one running hash per PRF candidate, feeds it
+ * every handshake message and clones it whenever a Finished or
+ * CertificateVerify value is needed.  Time that pattern end to end.
+ */
+static void test_handshake_benchmark(const void *data)
+{
+	static const enum l_checksum_type types[] = {
+		L_CHECKSUM_MD5, L_CHECKSUM_SHA1,
+		L_CHECKSUM_SHA256, L_CHECKSUM_SHA384,
+	};
+	static const size_t msg_lens[] = { 200, 90, 2500, 300, 4, 130, 16 };
+	uint8_t msg[2500];
+	uint8_t digest[48];
+	uint64_t start;
+	unsigned int i, j, k;
+
+	for (i = 0; i < sizeof(msg); i++)
+		msg[i] = i;
+
+	start = l_time_now();
+
+	for (i = 0; i < HANDSHAKE_BENCH_COUNT; i++) {
+		struct l_checksum *hash[L_ARRAY_SIZE(types)];
+
+		for (j = 0; j < L_ARRAY_SIZE(types); j++)
+			hash[j] = l_checksum_new(types[j]);
+
+		for (k = 0; k < L_ARRAY_SIZE(msg_lens); k++) {
+			for (j = 0; j < L_ARRAY_SIZE(types); j++)
+				l_checksum_update(hash[j], msg, msg_lens[k]);
+
+			/* Verify data for the two Finished messages */
+			if (k < L_ARRAY_SIZE(msg_lens) - 2)
+				continue;
+
+			for (j = 0; j < L_ARRAY_SIZE(types); j++) {
+				struct l_checksum *clone =
+					l_checksum_clone(hash[j]);
+
+				l_checksum_get_digest(clone, digest,
+							sizeof(digest));
+				l_checksum_free(clone);
+			}
+		}
+
+		for (j = 0; j < L_ARRAY_SIZE(types); j++)
+			l_checksum_free(hash[j]);
+	}
+
+	printf("%u handshake transcripts: %llu us\n", HANDSHAKE_BENCH_COUNT,
+		(unsigned long long) l_time_diff(start, l_time_now()));
+}
+
+static const uint8_t pool_key[16] = {
+	0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+	0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c,
+};
+
+static void md4_digest(uint8_t *digest)
+{
+	struct l_checksum *checksum;
+
+	checksum = l_checksum_new(L_CHECKSUM_MD4);
+	assert(checksum);
+
+	assert(l_checksum_update(checksum, FIXED_STR, FIXED_LEN));
+	assert(l_checksum_get_digest(checksum, digest, 16) == 16);
+
+	l_checksum_free(checksum);
+}
+
+static void cmac_digest(const uint8_t *key, uint8_t *digest)
+{
+	struct l_checksum *checksum;
+
+	checksum = l_checksum_new_cmac_aes(key, 16);
+	assert(checksum);
+
+	assert(l_checksum_update(checksum, FIXED_STR, FIXED_LEN));
+	assert(l_checksum_get_digest(checksum, digest, 16) == 16);
+
+	l_checksum_free(checksum);
+}
+
+static void test_pool(const void *data)
+{
+	struct l_checksum *checksum;
+	struct l_alg_pool_stats before, after;
+	uint8_t digest1[16];
+	uint8_t digest2[16];
+
+	/* Without a main loop nothing is pooled */
+	assert(!l_alg_pool_get_stats(&before));
+
+	assert(l_main_init());
+
+	assert(l_alg_pool_get_stats(&before));
+	assert(!before.cached_sockets);
+
+	md4_digest(digest1);
+	assert(l_alg_pool_get_stats(&after));
+	assert(after.created == before.created + 1);
+	assert(after.cached_sockets == 2);
+
+	/* The finished operation socket is handed out again */
+	md4_digest(digest2);
+	assert(l_alg_pool_get_stats(&after));
+	assert(after.created == before.created + 1);
+	assert(after.reused == before.reused + 1);
+	assert(!memcmp(digest1, digest2, sizeof(digest1)));
+
+	/* A socket with a pending hash state isn't, only its transform */
+	checksum = l_checksum_new(L_CHECKSUM_MD4);
+	l_checksum_update(checksum, FIXED_STR, FIXED_LEN);
+	l_checksum_free(checksum);
+
+	md4_digest(digest2);
+	assert(l_alg_pool_get_stats(&after));
+	assert(after.accepted == before.accepted + 1);
+	assert(!memcmp(digest1, digest2, sizeof(digest1)));
+
+	l_alg_pool_set_max(1);
+	assert(l_alg_pool_get_stats(&after));
+	assert(after.cached_sockets <= 1);
+	assert(after.evicted > before.evicted);
+
+	l_alg_pool_set_max(ALG_POOL_DEFAULT_MAX);
+	l_alg_pool_flush();
+	assert(l_alg_pool_get_stats(&after));
+	assert(!after.cached_sockets);
+
+	md4_digest(digest2);
+	assert(l_main_exit());
+	assert(!l_alg_pool_get_stats(&after));
+}
+
+static void test_pool_keyed(const void *data)
+{
+	static const uint8_t other_key[16] = { 0x01 };
+	struct l_alg_pool_stats before, after;
+	uint8_t digest1[16];
+	uint8_t digest2[16];
+
+	assert(l_main_init());
+	assert(l_alg_pool_get_stats(&before));
+
+	/* By default nothing that holds the key stays behind */
+	cmac_digest(pool_key, digest1);
+	cmac_digest(pool_key, digest2);
+	assert(l_alg_pool_get_stats(&after));
+	assert(after.created == before.created + 2);
+	assert(after.cached_sockets == before.cached_sockets);
+	assert(!memcmp(digest1, digest2, sizeof(digest1)));
+
+	/* Once enabled the same key shares a transform, others don't */
+	l_alg_pool_set_keyed(true);
+	assert(l_alg_pool_get_stats(&before));
+
+	cmac_digest(pool_key, digest2);
+	cmac_digest(pool_key, digest2);
+	assert(l_alg_pool_get_stats(&after));
+	assert(after.created == before.created + 1);
+	assert(after.reused == before.reused + 1);
+	assert(!memcmp(digest1, digest2, sizeof(digest1)));
+
+	cmac_digest(other_key, digest2);
+	assert(l_alg_pool_get_stats(&after));
+	assert(after.created == before.created + 2);
+	assert(memcmp(digest1, digest2, sizeof(digest1)));
+
+	/* Turning it off closes the keyed transforms */
+	l_alg_pool_set_keyed(false);
+	assert(l_alg_pool_get_stats(&after));
+	assert(after.cached_sockets == before.cached_sockets);
+
+	assert(l_main_exit());
+}
+
+static void test_pool_unavailable(const void *data)
+{
+	struct l_alg_pool_stats before, after;
+	struct alg_tfm *tfm = NULL;
+
+	assert(l_main_init());
+	assert(l_alg_pool_get_stats(&before));
+
+	/* A failed checkout leaves nothing cached */
+	assert(_alg_pool_get("hash", "no-such-alg", NULL, 0, 0, true,
+								&tfm) < 0);
+	assert(!tfm);
+
+	assert(l_alg_pool_get_stats(&after));
+	assert(after.created == before.created);
+	assert(after.cached_sockets == before.cached_sockets);
+
+	l_alg_pool_flush();
+	l_alg_pool_flush();
+	assert(l_alg_pool_get_stats(&after));
+	assert(!after.cached_sockets);
+
+	assert(l_main_exit());
+}
+
+#define POOL_BENCH_COUNT	5000
+
+static uint64_t pool_benchmark(const uint8_t *key)
+{
+	uint8_t digest[16];
+	uint64_t start, elapsed;
+	unsigned int i;
+
+	start = l_time_now();
+
+	for (i = 0; i < POOL_BENCH_COUNT; i++) {
+		if (key)
+			cmac_digest(key, digest);
+		else
+			md4_digest(digest);
+	}
+
+	elapsed = l_time_diff(start, l_time_now());
+
+	return POOL_BENCH_COUNT * 1000000ULL / (elapsed ? : 1);
+}
+
+static void test_pool_benchmark(const void *data)
+{
+	static const unsigned int max[] = { 0, ALG_POOL_DEFAULT_MAX };
+	unsigned int i;
+
+	assert(l_main_init());
+
+	for (i = 0; i < L_ARRAY_SIZE(max); i++) {
+		l_alg_pool_set_max(max[i]);
+		printf("md4 new/hash/free, pool max %2u: %llu/s\n", max[i],
+			(unsigned long long) pool_benchmark(NULL));
+	}
+
+	if (l_checksum_cmac_aes_supported()) {
+		for (i = 0; i < 2; i++) {
+			l_alg_pool_set_keyed(i);
+			printf("cmac(aes) new/hash/free, keyed pool %s: "
+				"%llu/s\n", i ? "on" : "off",
+				(unsigned long long) pool_benchmark(pool_key));
+		}
+
+		l_alg_pool_set_keyed(false);
+	}
+
+	assert(l_main_exit());
+}
+
 int main(int argc, char *argv[])
 {
 	l_test_init(&argc, &argv);
@@ -197,8 +487,29 @@ int main(int argc, char *argv[])
 		l_test_add("checksum updatev", test_updatev, NULL);
 	}
 
-	if (l_checksum_is_supported(L_CHECKSUM_SHA256, false))
+	if (l_checksum_is_supported(L_CHECKSUM_SHA256, false)) {
 		l_test_add("sha256-1", test_sha256, NULL);
 
+		l_test_add("checksum clone", test_clone, NULL);
+	}
+
+	if (l_checksum_is_supported(L_CHECKSUM_MD5, false) &&
+			l_checksum_is_supported(L_CHECKSUM_SHA1, false) &&
+			l_checksum_is_supported(L_CHECKSUM_SHA256, false) &&
+			l_checksum_is_supported(L_CHECKSUM_SHA384, false))
+		l_test_add("handshake hash benchmark",
+				test_handshake_benchmark, NULL);
+
+	l_test_add("checksum pool unavailable", test_pool_unavailable, NULL);
+
+	if (l_checksum_is_supported(L_CHECKSUM_MD4, false)) {
+		l_test_add("checksum pool", test_pool, NULL);
+		l_test_add("checksum pool benchmark", test_pool_benchmark,
+								NULL);
+	}
+
+	if (l_checksum_cmac_aes_supported())
+		l_test_add("checksum pool keyed", test_pool_keyed, NULL);
+
 	return l_test_run();
 }
@@ -25,6 +25,7 @@
 #endif
 
 #define _GNU_SOURCE
+#include <stdio.h>
 #include <assert.h>
 #include <math.h>
 #include <sys/stat.h>
@@ -2868,6 +2869,309 @@ static void message_fds_build(const void *data)
 	assert(count_fds() == open_fds);
 }
 
+/* Method call to /a with member "m" and a second member field "n" */
+static const unsigned char message_binary_dup_field[] = {
+			0x6c, 0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
+			0x01, 0x00, 0x00, 0x00, 0x2a, 0x00, 0x00, 0x00,
+			0x01, 0x01, 0x6f, 0x00, 0x02, 0x00, 0x00, 0x00,
+			0x2f, 0x61, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+			0x03, 0x01, 0x73, 0x00, 0x01, 0x00, 0x00, 0x00,
+			0x6d, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+			0x03, 0x01, 0x73, 0x00, 0x01, 0x00, 0x00, 0x00,
+			0x6e, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+
+/* As above with the second field being the interface "n" */
+static const unsigned char message_binary_no_dup_field[] = {
+			0x6c, 0x01, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
+			0x01, 0x00, 0x00, 0x00, 0x2a, 0x00, 0x00, 0x00,
+			0x01, 0x01, 0x6f, 0x00, 0x02, 0x00, 0x00, 0x00,
+			0x2f, 0x61, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+			0x03, 0x01, 0x73, 0x00, 0x01, 0x00, 0x00, 0x00,
+			0x6d, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+			0x02, 0x01, 0x73, 0x00, 0x01, 0x00, 0x00, 0x00,
+			0x6e, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+
+/* Method return with a 64-bit reply serial, only valid with GVariant */
+static const unsigned char message_binary_reply_serial_t[] = {
+			0x6c, 0x02, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
+			0x02, 0x00, 0x00, 0x00, 0x10, 0x00, 0x00, 0x00,
+			0x05, 0x01, 0x74, 0x00, 0x00, 0x00, 0x00, 0x00,
+			0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+
+static const unsigned char message_binary_reply_serial_u[] = {
+			0x6c, 0x02, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
+			0x02, 0x00, 0x00, 0x00, 0x08, 0x00, 0x00, 0x00,
+			0x05, 0x01, 0x75, 0x00, 0x01, 0x00, 0x00, 0x00,
+};
+
+static void parse_invalid_header_fields(const void *data)
+{
+	struct l_dbus_message *msg;
+
+	msg = dbus_message_from_blob(message_binary_dup_field,
+					sizeof(message_binary_dup_field),
+					NULL, 0);
+	assert(!msg);
+
+	msg = dbus_message_from_blob(message_binary_no_dup_field,
+					sizeof(message_binary_no_dup_field),
+					NULL, 0);
+	assert(msg);
+	assert(!strcmp(l_dbus_message_get_path(msg), "/a"));
+	assert(!strcmp(l_dbus_message_get_member(msg), "m"));
+	assert(!strcmp(l_dbus_message_get_interface(msg), "n"));
+	l_dbus_message_unref(msg);
+
+	msg = dbus_message_from_blob(message_binary_reply_serial_t,
+					sizeof(message_binary_reply_serial_t),
+					NULL, 0);
+	assert(!msg);
+
+	msg = dbus_message_from_blob(message_binary_reply_serial_u,
+					sizeof(message_binary_reply_serial_u),
+					NULL, 0);
+	assert(msg);
+	assert(_dbus_message_get_reply_serial(msg) == 1);
+	l_dbus_message_unref(msg);
+}
+
+#define DISPATCH_BENCH_COUNT	200000
+
+/*
+ * Received messages are looked at by the reply, filter and object
+ * tree dispatchers, which between them read most header fields once.
+ */
+static void dispatch_benchmark(const void *data)
+{
+	const struct message_data *msg_data = data;
+	uint64_t start, parse, dispatch;
+	unsigned int i;
+
+	start = l_time_now();
+
+	for (i = 0; i < DISPATCH_BENCH_COUNT; i++) {
+		struct l_dbus_message *msg;
+
+		msg = dbus_message_from_blob(msg_data->binary,
+						msg_data->binary_len, NULL, 0);
+		l_dbus_message_unref(msg);
+	}
+
+	parse = l_time_diff(start, l_time_now());
+	start = l_time_now();
+
+	for (i = 0; i < DISPATCH_BENCH_COUNT; i++) {
+		struct l_dbus_message *msg;
+
+		msg = dbus_message_from_blob(msg_data->binary,
+						msg_data->binary_len, NULL, 0);
+
+		_dbus_message_get_reply_serial(msg);
+		assert(!strcmp(l_dbus_message_get_path(msg), msg_data->path));
+		l_dbus_message_get_interface(msg);
+		l_dbus_message_get_member(msg);
+		l_dbus_message_get_destination(msg);
+		l_dbus_message_get_sender(msg);
+
+		l_dbus_message_unref(msg);
+	}
+
+	dispatch = l_time_diff(start, l_time_now());
+
+	printf("%u messages: %llu us parsed, %llu us with header lookups\n",
+			DISPATCH_BENCH_COUNT, (unsigned long long) parse,
+			(unsigned long long) dispatch);
+}
+
+static struct l_dbus_message *build_fixed_array(uint8_t version, bool bulk,
+						const uint8_t *bytes,
+						uint32_t n_bytes,
+						const uint32_t *words,
+						uint32_t n_words)
+{
+	struct l_dbus_message *msg;
+	struct l_dbus_message_builder *builder;
+	uint64_t t = 0x0102030405060708ULL;
+	uint32_t i;
+
+	msg = _dbus_message_new_method_call(version, "org.test", "/test",
+						"org.test", "Fixed");
+	assert(msg);
+
+	builder = l_dbus_message_builder_new(msg);
+	assert(builder);
+
+	if (bulk) {
+		assert(l_dbus_message_builder_append_fixed_array(builder, 'y',
+							bytes, n_bytes));
+		assert(l_dbus_message_builder_append_basic(builder, 't', &t));
+		assert(l_dbus_message_builder_append_fixed_array(builder, 'u',
+							words, n_words));
+	} else {
+		assert(l_dbus_message_builder_enter_array(builder, "y"));
+
+		for (i = 0; i < n_bytes; i++)
+			assert(l_dbus_message_builder_append_basic(builder,
+							'y', bytes + i));
+
+		assert(l_dbus_message_builder_leave_array(builder));
+		assert(l_dbus_message_builder_append_basic(builder, 't', &t));
+		assert(l_dbus_message_builder_enter_array(builder, "u"));
+
+		for (i = 0; i < n_words; i++)
+			assert(l_dbus_message_builder_append_basic(builder,
+							'u', words + i));
+
+		assert(l_dbus_message_builder_leave_array(builder));
+	}
+
+	assert(l_dbus_message_builder_finalize(builder));
+	l_dbus_message_builder_destroy(builder);
+
+	return msg;
+}
+
+static void check_fixed_array(uint8_t version)
+{
+	static const uint8_t bytes[] = { 1, 2, 3, 4, 5 };
+	static const uint32_t words[] = { 0xdeadbeef, 0, 42 };
+	struct l_dbus_message *per_element, *bulk;
+	struct l_dbus_message_builder *builder;
+	struct l_dbus_message_iter array1, array2;
+	const uint8_t *out_bytes;
+	const uint32_t *out_words;
+	uint32_t n_elem;
+	uint64_t t;
+	void *body1, *body2;
+	size_t size1, size2;
+
+	/* An odd length byte array forces padding before the uint64 */
+	per_element = build_fixed_array(version, false, bytes, 5, words, 3);
+	bulk = build_fixed_array(version, true, bytes, 5, words, 3);
+
+	body1 = _dbus_message_get_body(per_element, &size1);
+	body2 = _dbus_message_get_body(bulk, &size2);
+	assert(size1 == size2);
+	assert(!memcmp(body1, body2, size1));
+
+	assert(l_dbus_message_get_arguments(bulk, "aytau", &array1, &t,
+								&array2));
+	assert(t == 0x0102030405060708ULL);
+
+	assert(l_dbus_message_iter_get_fixed_array(&array1, &out_bytes,
+								&n_elem));
+	assert(n_elem == 5);
+	assert(!memcmp(out_bytes, bytes, sizeof(bytes)));
+
+	assert(l_dbus_message_iter_get_fixed_array(&array2, &out_words,
+								&n_elem));
+	assert(n_elem == 3);
+	assert(!memcmp(out_words, words, sizeof(words)));
+
+	l_dbus_message_unref(per_element);
+	l_dbus_message_unref(bulk);
+
+	bulk = build_fixed_array(version, true, NULL, 0, NULL, 0);
+	assert(l_dbus_message_get_arguments(bulk, "aytau", &array1, &t,
+								&array2));
+	assert(l_dbus_message_iter_get_fixed_array(&array1, &out_bytes,
+								&n_elem));
+	assert(n_elem == 0);
+	l_dbus_message_unref(bulk);
+
+	bulk = _dbus_message_new_method_call(version, "org.test", "/test",
+						"org.test", "Fixed");
+	builder = l_dbus_message_builder_new(bulk);
+	assert(builder);
+	assert(!l_dbus_message_builder_append_fixed_array(builder, 's',
+								bytes, 1));
+	assert(!l_dbus_message_builder_append_fixed_array(builder, 'h',
+								words, 1));
+	assert(!l_dbus_message_builder_append_fixed_array(builder, 'y',
+								NULL, 1));
+	l_dbus_message_builder_destroy(builder);
+	l_dbus_message_unref(bulk);
+}
+
+static void fixed_array_dbus1(const void *data)
+{
+	check_fixed_array(1);
+}
+
+static void fixed_array_gvariant(const void *data)
+{
+	check_fixed_array(2);
+}
+
+#define FIXED_ARRAY_BENCH_SIZE (1024 * 1024)
+
+static void fixed_array_benchmark(const void *data)
+{
+	uint8_t *bytes = l_malloc(FIXED_ARRAY_BENCH_SIZE);
+	uint8_t version;
+	uint32_t i;
+
+	for (i = 0; i < FIXED_ARRAY_BENCH_SIZE; i++)
+		bytes[i] = i;
+
+	for (version = 1; version <= 2; version++) {
+		struct l_dbus_message *msg;
+		struct l_dbus_message_iter array1, array2;
+		uint64_t start, append_each, append_bulk;
+		uint64_t get_each, get_bulk;
+		const uint8_t *out;
+		uint32_t n_elem = 0;
+		uint64_t t;
+		uint8_t y;
+
+		start = l_time_now();
+		msg = build_fixed_array(version, false, bytes,
+					FIXED_ARRAY_BENCH_SIZE, NULL, 0);
+		append_each = l_time_diff(start, l_time_now());
+		l_dbus_message_unref(msg);
+
+		start = l_time_now();
+		msg = build_fixed_array(version, true, bytes,
+					FIXED_ARRAY_BENCH_SIZE, NULL, 0);
+		append_bulk = l_time_diff(start, l_time_now());
+
+		assert(l_dbus_message_get_arguments(msg, "aytau", &array1, &t,
+								&array2));
+		start = l_time_now();
+
+		for (i = 0; l_dbus_message_iter_next_entry(&array1, &y); i++)
+			assert(y == bytes[i]);
+
+		get_each = l_time_diff(start, l_time_now());
+		assert(i == FIXED_ARRAY_BENCH_SIZE);
+
+		assert(l_dbus_message_get_arguments(msg, "aytau", &array1, &t,
+								&array2));
+		start = l_time_now();
+		assert(l_dbus_message_iter_get_fixed_array(&array1, &out,
+								&n_elem));
+		get_bulk = l_time_diff(start, l_time_now());
+		assert(n_elem == FIXED_ARRAY_BENCH_SIZE);
+		assert(!memcmp(out, bytes, n_elem));
+
+		l_dbus_message_unref(msg);
+
+		printf("%s %u bytes: append %llu us, bulk %llu us; "
+			"extract %llu us, bulk %llu us\n",
+			version == 1 ? "dbus1" : "gvariant",
+			FIXED_ARRAY_BENCH_SIZE,
+			(unsigned long long) append_each,
+			(unsigned long long) append_bulk,
+			(unsigned long long) get_each,
+			(unsigned long long) get_bulk);
+	}
+
+	l_free(bytes);
+}
+
 int main(int argc, char *argv[])
 {
 	l_test_init(&argc, &argv);
@@ -2970,5 +3274,13 @@ int main(int argc, char *argv[])
 	l_test_add("FDs (parse)", message_fds_parse, NULL);
 	l_test_add("FDs (build)", message_fds_build, NULL);
 
+	l_test_add("Fixed array (dbus1)", fixed_array_dbus1, NULL);
+	l_test_add("Fixed array (gvariant)", fixed_array_gvariant, NULL);
+
+	l_test_add("Invalid header fields", parse_invalid_header_fields, NULL);
+	l_test_add("Dispatch header benchmark", dispatch_benchmark,
+							&message_data_basic_1);
+	l_test_add("Fixed array benchmark", fixed_array_benchmark, NULL);
+
 	return l_test_run();
 }
@@ -0,0 +1,1161 @@
+/*
+ *
+ *  Embedded Linux library
+ *
+ *  Copyright (C) 2019  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <assert.h>
+#include <stddef.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <ell/ell.h>
+#include "ell/private.h"
+#include "ell/dbus-private.h"
+
+/*
+ * A minimal bus peer, forked off into its own process, speaking just
+ * enough of the D-Bus protocol to get a l_dbus connection ready: it
+ * accepts any AUTH, answers Hello and can then push messages at the
+ * client as fast as the socket allows.
+ */
+
+#define PEER_GUID	"0123456789abcdef0123456789abcdef"
+
+#define BURST_MESSAGES	20000
+#define LARGE_MESSAGES	200
+#define LARGE_EVERY	10
+#define LARGE_SIZE	(256 * 1024)
+#define FD_EVERY	100
+#define MEMFD_THRESHOLD	(64 * 1024)
+
+struct peer {
+	int listen_fd;
+	char *address;
+	pid_t pid;
+	struct l_io *io;
+	uint8_t rx[65536];
+	size_t rx_len;
+	int fds[64];
+	unsigned int num_fds;
+	bool begun;
+	bool ready;
+	bool done;
+	uint8_t *tx;
+	size_t tx_len;
+	size_t tx_pos;
+	int tx_fds[4];
+	unsigned int tx_num_fds;
+	bool memfd;
+	uint32_t serial;
+	void (*ready_func)(struct peer *peer);
+	void (*message_func)(struct peer *peer, struct l_dbus_message *msg);
+	void *user_data;
+};
+
+static void peer_queue(struct peer *peer, const void *data, size_t len);
+
+static bool peer_write_handler(struct l_io *io, void *user_data)
+{
+	struct peer *peer = user_data;
+	ssize_t written;
+
+	if (peer->tx_num_fds) {
+		union {
+			uint8_t bytes[CMSG_SPACE(sizeof(peer->tx_fds))];
+			struct cmsghdr align;
+		} fd_buf;
+		size_t fds_len = peer->tx_num_fds * sizeof(int);
+		unsigned int i;
+		struct msghdr msg;
+		struct cmsghdr *cmsg;
+		struct iovec iov;
+
+		iov.iov_base = peer->tx + peer->tx_pos;
+		iov.iov_len = peer->tx_len - peer->tx_pos;
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = &fd_buf;
+		msg.msg_controllen = CMSG_LEN(fds_len);
+
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_len = msg.msg_controllen;
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		memcpy(CMSG_DATA(cmsg), peer->tx_fds, fds_len);
+
+		written = sendmsg(l_io_get_fd(io), &msg, 0);
+		if (written < 0)
+			return true;
+
+		for (i = 0; i < peer->tx_num_fds; i++)
+			close(peer->tx_fds[i]);
+
+		peer->tx_num_fds = 0;
+	} else
+		written = write(l_io_get_fd(io), peer->tx + peer->tx_pos,
+						peer->tx_len - peer->tx_pos);
+
+	if (written < 0)
+		return true;
+
+	peer->tx_pos += written;
+
+	if (peer->tx_pos < peer->tx_len)
+		return true;
+
+	peer->tx_pos = 0;
+	peer->tx_len = 0;
+
+	return false;
+}
+
+static void peer_queue(struct peer *peer, const void *data, size_t len)
+{
+	peer->tx = l_realloc(peer->tx, peer->tx_len + len);
+	memcpy(peer->tx + peer->tx_len, data, len);
+	peer->tx_len += len;
+
+	l_io_set_write_handler(peer->io, peer_write_handler, peer, NULL);
+}
+
+static void peer_send(struct peer *peer, struct l_dbus_message *message)
+{
+	const void *header, *body;
+	size_t header_size, body_size;
+	uint32_t num_fds;
+	int *fds;
+
+	_dbus_message_set_serial(message, ++peer->serial);
+
+	/*
+	 * FDs all go out with the first byte of the queue, which is never
+	 * later than the message they belong to.
+	 */
+	fds = _dbus_message_get_fds(message, &num_fds);
+	if (num_fds) {
+		assert(num_fds == 1 &&
+			peer->tx_num_fds < L_ARRAY_SIZE(peer->tx_fds));
+		peer->tx_fds[peer->tx_num_fds] =
+					fcntl(fds[0], F_DUPFD_CLOEXEC, 0);
+		assert(peer->tx_fds[peer->tx_num_fds++] >= 0);
+	}
+
+	header = _dbus_message_get_header(message, &header_size);
+	body = _dbus_message_get_body(message, &body_size);
+
+	peer_queue(peer, header, header_size);
+	peer_queue(peer, body, body_size);
+
+	l_dbus_message_unref(message);
+}
+
+static void peer_auth_line(struct peer *peer, const char *line)
+{
+	const char *reply = NULL;
+
+	if (!strncmp(line, "AUTH ", 5))
+		reply = "OK " PEER_GUID "\r\n";
+	else if (!strcmp(line, "NEGOTIATE_UNIX_FD"))
+		reply = "AGREE_UNIX_FD\r\n";
+	else if (!strcmp(line, "NEGOTIATE_MEMFD_BODY"))
+		reply = peer->memfd ? "AGREE_MEMFD_BODY\r\n" :
+					"ERROR Unknown command\r\n";
+	else if (!strcmp(line, "BEGIN"))
+		peer->begun = true;
+
+	if (reply)
+		peer_queue(peer, reply, strlen(reply));
+}
+
+static void peer_message(struct peer *peer, struct l_dbus_message *message)
+{
+	struct l_dbus_message *reply;
+
+	if (!peer->ready) {
+		assert(!strcmp(l_dbus_message_get_member(message), "Hello"));
+
+		reply = l_dbus_message_new_method_return(message);
+		l_dbus_message_set_arguments(reply, "s", ":1.1");
+		peer_send(peer, reply);
+
+		peer->ready = true;
+
+		if (peer->ready_func)
+			peer->ready_func(peer);
+
+		return;
+	}
+
+	if (peer->message_func)
+		peer->message_func(peer, message);
+}
+
+static void peer_recv_fds(struct peer *peer, struct msghdr *msg)
+{
+	struct cmsghdr *cmsg;
+	unsigned int num_fds;
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET ||
+				cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+
+		num_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		assert(peer->num_fds + num_fds <= L_ARRAY_SIZE(peer->fds));
+
+		memcpy(peer->fds + peer->num_fds, CMSG_DATA(cmsg),
+						num_fds * sizeof(int));
+		peer->num_fds += num_fds;
+	}
+}
+
+static bool peer_read_handler(struct l_io *io, void *user_data)
+{
+	struct peer *peer = user_data;
+	uint8_t *ptr = peer->rx;
+	union {
+		uint8_t bytes[CMSG_SPACE(16 * sizeof(int))];
+		struct cmsghdr align;
+	} fd_buf;
+	struct msghdr msg;
+	struct iovec iov;
+	size_t len;
+	ssize_t r;
+
+	iov.iov_base = peer->rx + peer->rx_len;
+	iov.iov_len = sizeof(peer->rx) - peer->rx_len;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = &fd_buf;
+	msg.msg_controllen = sizeof(fd_buf);
+
+	r = recvmsg(l_io_get_fd(io), &msg, MSG_CMSG_CLOEXEC);
+	if (r <= 0) {
+		peer->done = true;
+		return false;
+	}
+
+	peer_recv_fds(peer, &msg);
+
+	len = peer->rx_len + r;
+
+	while (!peer->begun && len) {
+		uint8_t *end;
+
+		/* Skip the credentials-passing nul byte */
+		if (*ptr == '\0') {
+			ptr++;
+			len--;
+			continue;
+		}
+
+		end = memmem(ptr, len, "\r\n", 2);
+		if (!end)
+			break;
+
+		*end = '\0';
+		peer_auth_line(peer, (const char *) ptr);
+
+		len -= end + 2 - ptr;
+		ptr = end + 2;
+	}
+
+	while (peer->begun && len >= DBUS_HEADER_SIZE) {
+		const struct dbus_header *hdr = (const void *) ptr;
+		struct l_dbus_message *message;
+		size_t header_size, size;
+		unsigned int num_fds;
+
+		header_size = align_len(DBUS_HEADER_SIZE +
+						hdr->dbus1.field_length, 8);
+		size = header_size + hdr->dbus1.body_length;
+		assert(size <= sizeof(peer->rx));
+
+		if (len < size)
+			break;
+
+		/* Any FDs must have arrived by the time their message has */
+		num_fds = _dbus_message_unix_fds_from_header(ptr, header_size);
+		assert(num_fds <= peer->num_fds);
+
+		message = dbus_message_from_blob(ptr, size, peer->fds, num_fds);
+		assert(message);
+
+		if (peer->memfd && num_fds == 1)
+			_dbus_message_from_memfd(message);
+
+		peer->num_fds -= num_fds;
+		memmove(peer->fds, peer->fds + num_fds,
+					peer->num_fds * sizeof(int));
+
+		peer_message(peer, message);
+		l_dbus_message_unref(message);
+
+		ptr += size;
+		len -= size;
+	}
+
+	memmove(peer->rx, ptr, len);
+	peer->rx_len = len;
+
+	return true;
+}
+
+static struct peer *peer_new(void)
+{
+	struct peer *peer = l_new(struct peer, 1);
+	struct sockaddr_un addr;
+	char name[64];
+	size_t len;
+
+	len = snprintf(name, sizeof(name), "ell-test-dbus-peer-%d", getpid());
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	memcpy(addr.sun_path + 1, name, len);
+
+	peer->listen_fd = socket(PF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	assert(peer->listen_fd >= 0);
+
+	assert(bind(peer->listen_fd, (struct sockaddr *) &addr,
+				sizeof(addr.sun_family) + 1 + len) == 0);
+	assert(listen(peer->listen_fd, 1) == 0);
+
+	peer->address = l_strdup_printf("unix:abstract=%s", name);
+
+	return peer;
+}
+
+static void peer_disconnect(struct l_io *io, void *user_data)
+{
+	struct peer *peer = user_data;
+
+	peer->done = true;
+}
+
+static void peer_start(struct peer *peer)
+{
+	int fd;
+
+	peer->pid = fork();
+	assert(peer->pid >= 0);
+
+	if (peer->pid > 0)
+		return;
+
+	fd = accept4(peer->listen_fd, NULL, NULL,
+					SOCK_CLOEXEC | SOCK_NONBLOCK);
+	assert(fd >= 0);
+
+	assert(l_main_init());
+
+	peer->io = l_io_new(fd);
+	l_io_set_close_on_destroy(peer->io, true);
+	l_io_set_read_handler(peer->io, peer_read_handler, peer, NULL);
+	l_io_set_disconnect_handler(peer->io, peer_disconnect, peer, NULL);
+
+	while (!peer->done)
+		l_main_iterate(-1);
+
+	l_io_destroy(peer->io);
+	l_main_exit();
+
+	_exit(EXIT_SUCCESS);
+}
+
+static void peer_free(struct peer *peer)
+{
+	int status;
+
+	assert(waitpid(peer->pid, &status, 0) == peer->pid);
+	assert(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+
+	close(peer->listen_fd);
+	l_free(peer->address);
+	l_free(peer);
+}
+
+static void ready_callback(void *user_data)
+{
+	bool *ready = user_data;
+
+	*ready = true;
+}
+
+static void client_disconnected(void *user_data)
+{
+	/* The memfd peers only hang up first if one of their checks failed */
+	fprintf(stderr, "Peer disconnected\n");
+	abort();
+}
+
+static struct l_dbus *client_connect(struct peer *peer,
+					size_t memfd_threshold,
+					l_dbus_message_func_t signal_func,
+					void *user_data)
+{
+	struct l_dbus *dbus;
+	bool ready = false;
+
+	dbus = l_dbus_new(peer->address);
+	assert(dbus);
+
+	/* Has to be in place before authentication completes */
+	if (memfd_threshold)
+		assert(l_dbus_set_memfd_threshold(dbus, memfd_threshold));
+
+	/* The peer may start sending right behind the Hello reply */
+	l_dbus_register(dbus, signal_func, user_data, NULL);
+
+	l_dbus_set_ready_handler(dbus, ready_callback, &ready, NULL);
+
+	while (!ready)
+		l_main_iterate(-1);
+
+	l_dbus_set_ready_handler(dbus, NULL, NULL, NULL);
+
+	return dbus;
+}
+
+struct burst {
+	unsigned int expected;
+	unsigned int received;
+	bool large;
+	uint64_t start;
+};
+
+static void burst_signal(struct l_dbus_message *message, void *user_data)
+{
+	struct burst *burst = user_data;
+	const char *str;
+	uint32_t seq;
+
+	if (burst->large) {
+		assert(l_dbus_message_get_arguments(message, "us", &seq, &str));
+		assert(strlen(str) == (seq % LARGE_EVERY ? 1 : LARGE_SIZE));
+	} else
+		assert(l_dbus_message_get_arguments(message, "u", &seq));
+
+	assert(seq == burst->received);
+
+	/* The peer only starts writing once the whole burst is built */
+	if (!burst->received++)
+		burst->start = l_time_now();
+}
+
+static void burst_send(struct peer *peer)
+{
+	struct burst *burst = peer->user_data;
+	char *large = NULL;
+	unsigned int i;
+
+	if (burst->large) {
+		large = l_malloc(LARGE_SIZE + 1);
+		memset(large, 'x', LARGE_SIZE);
+		large[LARGE_SIZE] = '\0';
+	}
+
+	for (i = 0; i < burst->expected; i++) {
+		struct l_dbus_message *signal;
+
+		signal = _dbus_message_new_signal(1, "/test", "org.ell.Test",
+								"Burst");
+
+		if (burst->large)
+			l_dbus_message_set_arguments(signal, "us", i,
+					i % LARGE_EVERY ? "x" : large);
+		else
+			l_dbus_message_set_arguments(signal, "u", i);
+
+		peer_send(peer, signal);
+	}
+
+	l_free(large);
+}
+
+static void run_burst(struct burst *burst)
+{
+	struct l_main_stats before, after;
+	struct peer *peer;
+	struct l_dbus *dbus;
+
+	peer = peer_new();
+	peer->ready_func = burst_send;
+	peer->user_data = burst;
+	peer_start(peer);
+
+	assert(l_main_init());
+
+	l_main_get_stats(&before);
+
+	dbus = client_connect(peer, 0, burst_signal, burst);
+
+	while (burst->received < burst->expected)
+		l_main_iterate(-1);
+
+	l_main_get_stats(&after);
+
+	printf("%u messages in %llu usec, %llu wakeups\n", burst->expected,
+			(unsigned long long) l_time_diff(burst->start,
+								l_time_now()),
+			(unsigned long long) (after.wakeups - before.wakeups));
+
+	l_dbus_destroy(dbus);
+	peer_free(peer);
+
+	assert(l_main_exit());
+}
+
+struct send_burst {
+	unsigned int count;
+	unsigned int received;
+	bool with_fds;
+	bool done;
+};
+
+static void send_burst_peer_message(struct peer *peer,
+					struct l_dbus_message *message)
+{
+	struct send_burst *burst = peer->user_data;
+	struct l_dbus_message *signal;
+	uint32_t seq;
+	int fd;
+
+	if (burst->with_fds && !(burst->received % FD_EVERY)) {
+		assert(l_dbus_message_get_arguments(message, "uh", &seq, &fd));
+		assert(fd >= 0);
+	} else
+		assert(l_dbus_message_get_arguments(message, "u", &seq));
+
+	assert(seq == burst->received);
+
+	if (++burst->received < burst->count)
+		return;
+
+	signal = _dbus_message_new_signal(1, "/test", "org.ell.Test", "Done");
+	l_dbus_message_set_arguments(signal, "");
+	peer_send(peer, signal);
+}
+
+static void send_burst_done(struct l_dbus_message *message, void *user_data)
+{
+	struct send_burst *burst = user_data;
+
+	burst->done = true;
+}
+
+static void run_send_burst(struct send_burst *burst)
+{
+	struct l_main_stats before, after;
+	struct peer *peer;
+	struct l_dbus *dbus;
+	uint64_t start, elapsed;
+	int fd = -1;
+	unsigned int i;
+
+	peer = peer_new();
+	peer->message_func = send_burst_peer_message;
+	peer->user_data = burst;
+	peer_start(peer);
+
+	assert(l_main_init());
+
+	dbus = client_connect(peer, 0, send_burst_done, burst);
+
+	if (burst->with_fds) {
+		fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+		assert(fd >= 0);
+	}
+
+	l_main_get_stats(&before);
+	start = l_time_now();
+
+	for (i = 0; i < burst->count; i++) {
+		struct l_dbus_message *signal;
+
+		signal = l_dbus_message_new_signal(dbus, "/test",
+							"org.ell.Test",
+							"Burst");
+
+		if (burst->with_fds && !(i % FD_EVERY))
+			l_dbus_message_set_arguments(signal, "uh", i, fd);
+		else
+			l_dbus_message_set_arguments(signal, "u", i);
+
+		l_dbus_send(dbus, signal);
+	}
+
+	while (!burst->done)
+		l_main_iterate(-1);
+
+	elapsed = l_time_diff(start, l_time_now());
+	l_main_get_stats(&after);
+
+	printf("%u messages in %llu usec (%llu msgs/sec), %llu wakeups\n",
+			burst->count, (unsigned long long) elapsed,
+			(unsigned long long) burst->count * 1000000 /
+								(elapsed ?: 1),
+			(unsigned long long) (after.wakeups - before.wakeups));
+
+	if (fd >= 0)
+		close(fd);
+
+	l_dbus_destroy(dbus);
+	peer_free(peer);
+
+	assert(l_main_exit());
+}
+
+static void test_receive_burst(const void *test_data)
+{
+	struct burst burst = { .expected = BURST_MESSAGES };
+
+	run_burst(&burst);
+}
+
+static void test_receive_large(const void *test_data)
+{
+	struct burst burst = { .expected = LARGE_MESSAGES, .large = true };
+
+	run_burst(&burst);
+}
+
+static void test_send_burst(const void *test_data)
+{
+	struct send_burst burst = { .count = BURST_MESSAGES };
+
+	run_send_burst(&burst);
+}
+
+static void test_send_fds(const void *test_data)
+{
+	struct send_burst burst = { .count = BURST_MESSAGES,
+					.with_fds = true };
+
+	run_send_burst(&burst);
+}
+
+#define CANCEL_MESSAGES	64
+#define CANCEL_SIZE	(32 * 1024)
+
+static void cancel_peer_message(struct peer *peer,
+					struct l_dbus_message *message)
+{
+	struct l_dbus_message_iter iter;
+	struct l_dbus_message *signal;
+	const uint8_t *data;
+	uint32_t n_elem, i;
+
+	if (!strcmp(l_dbus_message_get_member(message), "Done")) {
+		signal = _dbus_message_new_signal(1, "/test", "org.ell.Test",
+								"Done");
+		l_dbus_message_set_arguments(signal, "");
+		peer_send(peer, signal);
+		return;
+	}
+
+	/* Any message that made it out has to be intact */
+	assert(l_dbus_message_get_arguments(message, "ay", &iter));
+	assert(l_dbus_message_iter_get_fixed_array(&iter, &data, &n_elem));
+	assert(n_elem == CANCEL_SIZE);
+
+	for (i = 0; i < n_elem; i++)
+		assert(data[i] == (uint8_t) (i * 7));
+}
+
+static void cancel_done(struct l_dbus_message *message, void *user_data)
+{
+	bool *done = user_data;
+
+	*done = true;
+}
+
+static void cancel_timeout(struct l_timeout *timeout, void *user_data)
+{
+	/* A peer that lost sync waits for the rest of a bogus message */
+	fprintf(stderr, "Peer never answered\n");
+	abort();
+}
+
+static struct l_dbus_message *new_bytes_signal(struct l_dbus *dbus,
+						uint32_t size);
+
+/*
+ * Cancel everything while the head of the queue is only partly
+ * written.  It still has to go out in full, or the peer loses sync.
+ */
+static void test_cancel_partial(const void *test_data)
+{
+	uint32_t serials[CANCEL_MESSAGES];
+	struct l_dbus_message *done_signal;
+	struct l_timeout *timeout;
+	struct peer *peer;
+	struct l_dbus *dbus;
+	bool done = false;
+	unsigned int i;
+
+	peer = peer_new();
+	peer->message_func = cancel_peer_message;
+	peer_start(peer);
+
+	assert(l_main_init());
+
+	dbus = client_connect(peer, 0, cancel_done, &done);
+	l_dbus_set_disconnect_handler(dbus, client_disconnected, NULL, NULL);
+
+	for (i = 0; i < CANCEL_MESSAGES; i++)
+		serials[i] = l_dbus_send(dbus,
+					new_bytes_signal(dbus, CANCEL_SIZE));
+
+	/* More than the socket takes in one go */
+	l_main_iterate(0);
+
+	for (i = 0; i < CANCEL_MESSAGES; i++)
+		l_dbus_cancel(dbus, serials[i]);
+
+	done_signal = l_dbus_message_new_signal(dbus, "/test", "org.ell.Test",
+								"Done");
+	l_dbus_message_set_arguments(done_signal, "");
+	l_dbus_send(dbus, done_signal);
+
+	timeout = l_timeout_create(10, cancel_timeout, NULL, NULL);
+
+	while (!done)
+		l_main_iterate(-1);
+
+	l_timeout_remove(timeout);
+
+	l_dbus_set_disconnect_handler(dbus, NULL, NULL, NULL);
+	l_dbus_destroy(dbus);
+	peer_free(peer);
+
+	assert(l_main_exit());
+}
+
+struct memfd_send {
+	uint32_t sizes[2];
+	unsigned int received;
+	bool done;
+};
+
+/* The header has to describe the body that is actually there */
+static void check_header(struct l_dbus_message *message,
+						const char *signature)
+{
+	struct l_dbus_message *copy;
+	const void *header, *body;
+	size_t header_size, body_size;
+	uint8_t *blob;
+
+	header = _dbus_message_get_header(message, &header_size);
+	body = _dbus_message_get_body(message, &body_size);
+
+	blob = l_malloc(header_size + body_size);
+	memcpy(blob, header, header_size);
+	memcpy(blob + header_size, body, body_size);
+
+	copy = dbus_message_from_blob(blob, header_size + body_size, NULL, 0);
+	assert(copy);
+	assert(!strcmp(l_dbus_message_get_signature(copy), signature));
+	assert(!strcmp(l_dbus_message_get_member(copy),
+					l_dbus_message_get_member(message)));
+	assert(_dbus_message_get_serial(copy) ==
+					_dbus_message_get_serial(message));
+
+	l_dbus_message_unref(copy);
+	l_free(blob);
+}
+
+static void memfd_send_peer_message(struct peer *peer,
+					struct l_dbus_message *message)
+{
+	struct memfd_send *send = peer->user_data;
+	struct l_dbus_message_iter iter;
+	struct l_dbus_message *signal;
+	const uint8_t *data;
+	uint32_t n_elem, i;
+	uint32_t num_fds;
+
+	/* The memfd has been mapped and closed, leaving no FDs behind */
+	_dbus_message_get_fds(message, &num_fds);
+	assert(!num_fds);
+
+	assert(l_dbus_message_get_arguments(message, "ay", &iter));
+	assert(l_dbus_message_iter_get_fixed_array(&iter, &data, &n_elem));
+	assert(n_elem == send->sizes[send->received]);
+
+	for (i = 0; i < n_elem; i++)
+		assert(data[i] == (uint8_t) (i * 7));
+
+	check_header(message, "ay");
+
+	if (++send->received < 2)
+		return;
+
+	signal = _dbus_message_new_signal(1, "/test", "org.ell.Test", "Done");
+	l_dbus_message_set_arguments(signal, "");
+	peer_send(peer, signal);
+}
+
+static void memfd_send_done(struct l_dbus_message *message, void *user_data)
+{
+	struct memfd_send *send = user_data;
+
+	send->done = true;
+}
+
+static struct l_dbus_message *new_bytes_signal(struct l_dbus *dbus,
+						uint32_t size)
+{
+	struct l_dbus_message *signal;
+	struct l_dbus_message_builder *builder;
+	uint8_t *data = l_malloc(size);
+	uint32_t i;
+
+	for (i = 0; i < size; i++)
+		data[i] = i * 7;
+
+	if (dbus)
+		signal = l_dbus_message_new_signal(dbus, "/test",
+						"org.ell.Test", "Bytes");
+	else
+		signal = _dbus_message_new_signal(1, "/test", "org.ell.Test",
+								"Bytes");
+
+	builder = l_dbus_message_builder_new(signal);
+	l_dbus_message_builder_append_fixed_array(builder, 'y', data, size);
+	l_dbus_message_builder_finalize(builder);
+	l_dbus_message_builder_destroy(builder);
+
+	l_free(data);
+
+	return signal;
+}
+
+static void run_send_memfd(struct memfd_send *send, bool peer_memfd,
+						size_t threshold)
+{
+	struct peer *peer;
+	struct l_dbus *dbus;
+
+	peer = peer_new();
+	peer->message_func = memfd_send_peer_message;
+	peer->user_data = send;
+	peer->memfd = peer_memfd;
+	peer_start(peer);
+
+	assert(l_main_init());
+
+	dbus = client_connect(peer, threshold, memfd_send_done, send);
+	l_dbus_set_disconnect_handler(dbus, client_disconnected, NULL, NULL);
+
+	l_dbus_send(dbus, new_bytes_signal(dbus, send->sizes[0]));
+	l_dbus_send(dbus, new_bytes_signal(dbus, send->sizes[1]));
+
+	while (!send->done)
+		l_main_iterate(-1);
+
+	l_dbus_set_disconnect_handler(dbus, NULL, NULL, NULL);
+	l_dbus_destroy(dbus);
+	peer_free(peer);
+
+	assert(l_main_exit());
+}
+
+static void test_send_memfd(const void *test_data)
+{
+	/* Too large for the peer's receive buffer unless sent as a memfd */
+	struct memfd_send send = { .sizes = { 1024 * 1024, 16 } };
+
+	run_send_memfd(&send, true, MEMFD_THRESHOLD);
+}
+
+static void test_send_memfd_refused(const void *test_data)
+{
+	/* A peer that doesn't agree, like a bus, gets plain bodies */
+	struct memfd_send send = { .sizes = { 4096, 16 } };
+
+	run_send_memfd(&send, false, 1024);
+}
+
+struct memfd_receive {
+	uint32_t size;
+	uint32_t sum;
+	bool received;
+};
+
+static void memfd_receive_peer_message(struct peer *peer,
+					struct l_dbus_message *message)
+{
+	struct l_dbus_message *signal, *wrapper;
+	uint32_t size;
+	bool memfd;
+
+	assert(l_dbus_message_get_arguments(message, "ub", &size, &memfd));
+
+	signal = new_bytes_signal(NULL, size);
+
+	if (memfd) {
+		wrapper = _dbus_message_to_memfd(signal);
+		assert(wrapper);
+
+		l_dbus_message_unref(signal);
+		signal = wrapper;
+	}
+
+	peer_send(peer, signal);
+}
+
+static void memfd_receive_signal(struct l_dbus_message *message,
+							void *user_data)
+{
+	struct memfd_receive *receive = user_data;
+	struct l_dbus_message_iter iter;
+	const uint8_t *data;
+	uint32_t n_elem, i;
+
+	assert(l_dbus_message_get_arguments(message, "ay", &iter));
+	assert(l_dbus_message_iter_get_fixed_array(&iter, &data, &n_elem));
+	assert(n_elem == receive->size);
+
+	if (receive->size == 1024 * 1024)
+		check_header(message, "ay");
+
+	/* Consume the payload so that mapped pages get faulted in */
+	for (i = 0; i < n_elem; i++)
+		receive->sum += data[i];
+
+	receive->received = true;
+}
+
+static uint64_t memfd_receive_one(struct l_dbus *dbus,
+					struct memfd_receive *receive,
+					uint32_t size, bool memfd)
+{
+	struct l_dbus_message *request;
+	uint64_t start;
+
+	receive->size = size;
+	receive->received = false;
+
+	request = l_dbus_message_new_signal(dbus, "/test", "org.ell.Test",
+								"Request");
+	l_dbus_message_set_arguments(request, "ub", size, memfd);
+
+	start = l_time_now();
+	l_dbus_send(dbus, request);
+
+	while (!receive->received)
+		l_main_iterate(-1);
+
+	return l_time_diff(start, l_time_now());
+}
+
+static void test_receive_memfd(const void *test_data)
+{
+	struct memfd_receive receive = {};
+	struct peer *peer;
+	struct l_dbus *dbus;
+	uint32_t size;
+
+	peer = peer_new();
+	peer->message_func = memfd_receive_peer_message;
+	peer->memfd = true;
+	peer_start(peer);
+
+	assert(l_main_init());
+
+	dbus = client_connect(peer, MEMFD_THRESHOLD, memfd_receive_signal,
+								&receive);
+	l_dbus_set_disconnect_handler(dbus, client_disconnected, NULL, NULL);
+
+	for (size = 1024 * 1024; size <= 64 * 1024 * 1024; size *= 4) {
+		uint64_t socket_time, memfd_time;
+
+		socket_time = memfd_receive_one(dbus, &receive, size, false);
+		memfd_time = memfd_receive_one(dbus, &receive, size, true);
+
+		printf("%2u MiB body: %llu usec over the socket, "
+				"%llu usec in a memfd\n", size >> 20,
+				(unsigned long long) socket_time,
+				(unsigned long long) memfd_time);
+	}
+
+	l_dbus_set_disconnect_handler(dbus, NULL, NULL, NULL);
+	l_dbus_destroy(dbus);
+	peer_free(peer);
+
+	assert(l_main_exit());
+}
+
+/*
+ * An invalid message claiming an FD is sent in the same batch as a valid
+ * one carrying another FD.  Dropping the first message must only close
+ * its own FD.
+ */
+static void bad_fds_send_one(struct peer *peer, const char *content,
+				bool invalid)
+{
+	struct l_dbus_message *signal;
+	size_t start = peer->tx_len;
+	int pipe_fds[2];
+
+	assert(pipe2(pipe_fds, O_CLOEXEC) == 0);
+	assert(write(pipe_fds[1], content, strlen(content) + 1) ==
+						(ssize_t) strlen(content) + 1);
+	close(pipe_fds[1]);
+
+	signal = _dbus_message_new_signal(1, "/test", "org.ell.Test", "Fd");
+	l_dbus_message_set_arguments(signal, "h", pipe_fds[0]);
+	close(pipe_fds[0]);
+	peer_send(peer, signal);
+
+	/* Message type 0 is invalid, the header fields still parse */
+	if (invalid)
+		peer->tx[start + 1] = 0;
+}
+
+static void bad_fds_send(struct peer *peer)
+{
+	bad_fds_send_one(peer, "invalid", true);
+	bad_fds_send_one(peer, "valid", false);
+}
+
+static void bad_fds_signal(struct l_dbus_message *message, void *user_data)
+{
+	bool *received = user_data;
+	char buf[16];
+	int fd;
+
+	assert(l_dbus_message_get_arguments(message, "h", &fd));
+	assert(read(fd, buf, sizeof(buf)) == 6);
+	assert(!strcmp(buf, "valid"));
+
+	*received = true;
+}
+
+static void test_receive_bad_fds(const void *test_data)
+{
+	struct l_timeout *timeout;
+	struct peer *peer;
+	struct l_dbus *dbus;
+	bool received = false;
+
+	peer = peer_new();
+	peer->ready_func = bad_fds_send;
+	peer_start(peer);
+
+	assert(l_main_init());
+
+	dbus = client_connect(peer, 0, bad_fds_signal, &received);
+	l_dbus_set_disconnect_handler(dbus, client_disconnected, NULL, NULL);
+	timeout = l_timeout_create(10, cancel_timeout, NULL, NULL);
+
+	while (!received)
+		l_main_iterate(-1);
+
+	l_timeout_remove(timeout);
+	l_dbus_set_disconnect_handler(dbus, NULL, NULL, NULL);
+	l_dbus_destroy(dbus);
+	peer_free(peer);
+
+	assert(l_main_exit());
+}
+
+/* A header whose lengths add up to more than the 128 MiB limit */
+static void oversized_send(struct peer *peer)
+{
+	static const uint8_t header[] = {
+		'l', 0x04, 0x00, 0x01, 0xf0, 0xff, 0xff, 0x7f,
+		0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+	};
+
+	peer_queue(peer, header, sizeof(header));
+}
+
+static void oversized_disconnected(void *user_data)
+{
+	bool *disconnected = user_data;
+
+	*disconnected = true;
+}
+
+static void test_receive_oversized(const void *test_data)
+{
+	struct l_timeout *timeout;
+	struct peer *peer;
+	struct l_dbus *dbus;
+	bool disconnected = false;
+
+	peer = peer_new();
+	peer->ready_func = oversized_send;
+	peer_start(peer);
+
+	assert(l_main_init());
+
+	dbus = client_connect(peer, 0, NULL, NULL);
+	l_dbus_set_disconnect_handler(dbus, oversized_disconnected,
+						&disconnected, NULL);
+	timeout = l_timeout_create(10, cancel_timeout, NULL, NULL);
+
+	/* The client hangs up instead of allocating the message */
+	while (!disconnected)
+		l_main_iterate(-1);
+
+	l_timeout_remove(timeout);
+	l_dbus_destroy(dbus);
+	peer_free(peer);
+
+	assert(l_main_exit());
+}
+
+int main(int argc, char *argv[])
+{
+	l_test_init(&argc, &argv);
+
+	l_test_add("Receive burst", test_receive_burst, NULL);
+	l_test_add("Receive large messages", test_receive_large, NULL);
+	l_test_add("Send burst", test_send_burst, NULL);
+	l_test_add("Send with FDs", test_send_fds, NULL);
+	l_test_add("Cancel partially written", test_cancel_partial, NULL);
+	l_test_add("Send memfd body", test_send_memfd, NULL);
+	l_test_add("Send memfd body refused", test_send_memfd_refused, NULL);
+	l_test_add("Receive memfd body", test_receive_memfd, NULL);
+	l_test_add("Receive FDs after an invalid message",
+					test_receive_bad_fds, NULL);
+	l_test_add("Receive oversized message", test_receive_oversized, NULL);
+
+	return l_test_run();
+}
@@ -25,6 +25,7 @@
 #endif
 
 #define _GNU_SOURCE
+#include <stdio.h>
 #include <assert.h>
 #include <stdbool.h>
 
@@ -178,6 +179,7 @@ static void test_dbus_object_tree_1(const void *test_data)
 	struct _dbus_object_tree *tree;
 	struct object_node *leaf1, *leaf2, *leaf3;
 	struct object_node *tmp;
+	char *long_path;
 
 	tree = _dbus_object_tree_new();
 	assert(tree);
@@ -224,6 +226,22 @@ static void test_dbus_object_tree_1(const void *test_data)
 	tmp = _dbus_object_tree_lookup(tree, "/");
 	assert(tmp);
 
+	/* Long path components, e.g. from a peer's Introspect call */
+	leaf1 = _dbus_object_tree_makepath(tree, "/foo/"
+				"a_component_that_is_longer_than_sixty_four_"
+				"characters_in_total/x");
+	tmp = _dbus_object_tree_lookup(tree, "/foo/"
+				"a_component_that_is_longer_than_sixty_four_"
+				"characters_in_total/x");
+	assert(tmp == leaf1);
+
+	long_path = l_malloc(16 * 1024 * 1024 + 6);
+	strcpy(long_path, "/foo/");
+	memset(long_path + 5, 'a', 16 * 1024 * 1024);
+	long_path[16 * 1024 * 1024 + 5] = '\0';
+	assert(!_dbus_object_tree_lookup(tree, long_path));
+	l_free(long_path);
+
 	_dbus_object_tree_free(tree);
 }
 
@@ -488,6 +506,124 @@ static void test_dbus_object_tree_dispatch(const void *test_data)
 	_dbus_object_tree_free(tree);
 }
 
+#define BENCH_OBJ_COUNT 50000
+#define BENCH_MESSAGES 256
+#define BENCH_ROUNDS 1000
+
+static struct l_dbus_message *bench_ping_callback(struct l_dbus *dbus,
+					struct l_dbus_message *message,
+					void *user_data)
+{
+	unsigned int *calls = user_data;
+
+	(*calls)++;
+
+	return NULL;
+}
+
+static void build_bench_interface(struct l_dbus_interface *iface)
+{
+	l_dbus_interface_method(iface, "Ping", 0, bench_ping_callback,
+				"", "");
+	l_dbus_interface_signal(iface, "Pong", 0, "");
+}
+
+static void test_dbus_object_tree_benchmark(const void *test_data)
+{
+	struct _dbus_object_tree *tree;
+	struct l_dbus_message *messages[BENCH_MESSAGES];
+	struct l_string *buf;
+	char path[50];
+	unsigned int calls = 0;
+	uint64_t start;
+	unsigned int i, j;
+
+	tree = _dbus_object_tree_new();
+	assert(_dbus_object_tree_register_interface(tree, "org.example.Bench",
+						build_bench_interface,
+						NULL, false));
+
+	/* All objects are siblings, the worst case for a child list scan */
+	start = l_time_now();
+
+	for (i = 0; i < BENCH_OBJ_COUNT; i++) {
+		sprintf(path, "/bench/obj%u", i);
+		assert(_dbus_object_tree_add_interface(tree, path,
+							"org.example.Bench",
+							&calls));
+	}
+
+	printf("%u objects registered in %llu usec\n", BENCH_OBJ_COUNT,
+			(unsigned long long) l_time_diff(start, l_time_now()));
+
+	start = l_time_now();
+
+	for (i = 0; i < BENCH_OBJ_COUNT; i++) {
+		sprintf(path, "/bench/obj%u", i);
+		assert(_dbus_object_tree_lookup(tree, path));
+	}
+
+	assert(!_dbus_object_tree_lookup(tree, "/bench/obj"));
+
+	printf("%u objects looked up in %llu usec\n", BENCH_OBJ_COUNT,
+			(unsigned long long) l_time_diff(start, l_time_now()));
+
+	for (i = 0; i < BENCH_MESSAGES; i++) {
+		sprintf(path, "/bench/obj%u", i * 193 % BENCH_OBJ_COUNT);
+		messages[i] = _dbus_message_new_method_call(1, "org.example",
+							path,
+							"org.example.Bench",
+							"Ping");
+		l_dbus_message_set_arguments(messages[i], "");
+	}
+
+	start = l_time_now();
+
+	for (j = 0; j < BENCH_ROUNDS; j++)
+		for (i = 0; i < BENCH_MESSAGES; i++)
+			assert(_dbus_object_tree_dispatch(tree, NULL,
+							messages[i]));
+
+	printf("%u method calls dispatched in %llu usec\n",
+			BENCH_MESSAGES * BENCH_ROUNDS,
+			(unsigned long long) l_time_diff(start, l_time_now()));
+	assert(calls == BENCH_MESSAGES * BENCH_ROUNDS);
+
+	for (i = 0; i < BENCH_MESSAGES; i++)
+		l_dbus_message_unref(messages[i]);
+
+	start = l_time_now();
+
+	buf = l_string_new(1024);
+	_dbus_object_tree_introspect(tree, "/bench", buf);
+	l_string_free(buf);
+
+	for (i = 0; i < BENCH_OBJ_COUNT; i += 50) {
+		sprintf(path, "/bench/obj%u", i);
+		buf = l_string_new(1024);
+		_dbus_object_tree_introspect(tree, path, buf);
+		l_string_free(buf);
+	}
+
+	printf("Introspected parent and %u objects in %llu usec\n",
+			BENCH_OBJ_COUNT / 50,
+			(unsigned long long) l_time_diff(start, l_time_now()));
+
+	start = l_time_now();
+
+	for (i = 0; i < BENCH_OBJ_COUNT; i++) {
+		sprintf(path, "/bench/obj%u", i);
+		assert(_dbus_object_tree_object_destroy(tree, path));
+	}
+
+	printf("%u objects destroyed in %llu usec\n", BENCH_OBJ_COUNT,
+			(unsigned long long) l_time_diff(start, l_time_now()));
+
+	assert(!_dbus_object_tree_lookup(tree, "/bench"));
+
+	_dbus_object_tree_free(tree);
+}
+
 static bool test_property_getter(struct l_dbus *dbus,
 					struct l_dbus_message *message,
 					struct l_dbus_message_builder *builder,
@@ -560,6 +696,10 @@ int main(int argc, char *argv[])
 					test_dbus_object_tree_dispatch,
 					NULL);
 
+	l_test_add("_dbus_object_tree Benchmark",
+					test_dbus_object_tree_benchmark,
+					NULL);
+
 	ret = l_test_run();
 
 	_dbus_interface_free(interface);
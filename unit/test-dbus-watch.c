@@ -24,6 +24,7 @@
 #include <config.h>
 #endif
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
 
@@ -283,6 +284,173 @@ static void test_filter_tree(const void *test_data)
 			test.calls[4] == 1);
 }
 
+static bool bench_add_match(struct l_dbus *dbus, unsigned int id,
+				const struct _dbus_filter_condition *rule,
+				int rule_len)
+{
+	return true;
+}
+
+static bool bench_remove_match(struct l_dbus *dbus, unsigned int id)
+{
+	return true;
+}
+
+static const struct _dbus_filter_ops bench_filter_ops = {
+	.skip_register = true,
+	.add_match = bench_add_match,
+	.remove_match = bench_remove_match,
+};
+
+static void count_cb(struct l_dbus_message *message, void *user_data)
+{
+	int *count = user_data;
+
+	(*count)++;
+}
+
+static void dispatch_signal(struct _dbus_filter *filter, const char *path,
+				const char *member, const char *signature,
+				...)
+{
+	struct l_dbus_message *message;
+	va_list args;
+
+	message = _dbus_message_new_signal(1, path, "org.test", member);
+
+	va_start(args, signature);
+	assert(l_dbus_message_set_arguments_valist(message, signature, args));
+	va_end(args);
+
+	_dbus_filter_dispatch(message, filter);
+	l_dbus_message_unref(message);
+}
+
+static void test_filter_args(const void *test_data)
+{
+	struct l_dbus dbus;
+	struct _dbus_filter *filter;
+	static const struct _dbus_filter_condition rule1[] = {
+		{ L_DBUS_MATCH_TYPE, "signal" },
+		{ L_DBUS_MATCH_MEMBER, "Changed" },
+		{ L_DBUS_MATCH_ARGUMENT(1), "b" },
+	};
+	static const struct _dbus_filter_condition rule2[] = {
+		{ L_DBUS_MATCH_TYPE, "signal" },
+		{ L_DBUS_MATCH_ARGUMENT(0), "a" },
+	};
+	static const struct _dbus_filter_condition rule3[] = {
+		{ L_DBUS_MATCH_ARGUMENT(0), "x" },
+	};
+	int count1 = 0, count2 = 0, count3 = 0;
+	unsigned int id1, id2, id3;
+
+	filter = _dbus_filter_new(&dbus, &bench_filter_ops, NULL);
+
+	id1 = _dbus_filter_add_rule(filter, rule1, L_ARRAY_SIZE(rule1),
+							count_cb, &count1);
+	id2 = _dbus_filter_add_rule(filter, rule2, L_ARRAY_SIZE(rule2),
+							count_cb, &count2);
+	id3 = _dbus_filter_add_rule(filter, rule3, L_ARRAY_SIZE(rule3),
+							count_cb, &count3);
+	assert(id1 && id2 && id3);
+
+	dispatch_signal(filter, "/", "Changed", "ss", "a", "b");
+	assert(count1 == 1 && count2 == 1 && count3 == 0);
+
+	dispatch_signal(filter, "/", "Other", "ss", "x", "b");
+	assert(count1 == 1 && count2 == 1 && count3 == 1);
+
+	/* Arguments that are not strings never match */
+	dispatch_signal(filter, "/", "Changed", "us", 1, "b");
+	assert(count1 == 2 && count2 == 1 && count3 == 1);
+
+	dispatch_signal(filter, "/", "Changed", "s", "a");
+	assert(count1 == 2 && count2 == 2 && count3 == 1);
+
+	assert(_dbus_filter_remove_rule(filter, id2));
+	assert(!_dbus_filter_remove_rule(filter, id2));
+
+	dispatch_signal(filter, "/", "Changed", "ss", "a", "b");
+	assert(count1 == 3 && count2 == 2 && count3 == 1);
+
+	assert(_dbus_filter_remove_rule(filter, id1));
+	assert(_dbus_filter_remove_rule(filter, id3));
+
+	dispatch_signal(filter, "/", "Changed", "ss", "x", "b");
+	assert(count1 == 3 && count2 == 2 && count3 == 1);
+
+	_dbus_filter_free(filter);
+}
+
+#define BENCH_MESSAGES	100000
+
+/* One watch per device object, as a proxy for each would add */
+static void test_filter_benchmark(const void *test_data)
+{
+	static const unsigned int counts[] = { 10, 100, 1000, 10000 };
+	struct l_dbus dbus;
+	struct l_dbus_message *messages[16];
+	unsigned int i, j;
+	int count = 0;
+
+	for (i = 0; i < L_ARRAY_SIZE(messages); i++) {
+		char path[32];
+
+		snprintf(path, sizeof(path), "/device/%u", i * 7);
+		messages[i] = _dbus_message_new_signal(2, path,
+					"org.freedesktop.DBus.Properties",
+					"PropertiesChanged");
+		assert(l_dbus_message_set_arguments(messages[i], "sa{sv}as",
+						"org.test.Device", 0, 0));
+		_dbus_message_set_sender(messages[i], ":1.42");
+	}
+
+	for (i = 0; i < L_ARRAY_SIZE(counts); i++) {
+		struct _dbus_filter *filter;
+		uint64_t start, elapsed;
+
+		filter = _dbus_filter_new(&dbus, &bench_filter_ops, NULL);
+
+		for (j = 0; j < counts[i]; j++) {
+			char path[32];
+			struct _dbus_filter_condition rule[] = {
+				{ L_DBUS_MATCH_TYPE, "signal" },
+				{ L_DBUS_MATCH_SENDER, ":1.42" },
+				{ L_DBUS_MATCH_PATH, path },
+				{ L_DBUS_MATCH_INTERFACE,
+					"org.freedesktop.DBus.Properties" },
+				{ L_DBUS_MATCH_MEMBER, "PropertiesChanged" },
+				{ L_DBUS_MATCH_ARGUMENT(0), "org.test.Device" },
+			};
+
+			snprintf(path, sizeof(path), "/device/%u", j);
+			assert(_dbus_filter_add_rule(filter, rule,
+							L_ARRAY_SIZE(rule),
+							count_cb, &count));
+		}
+
+		count = 0;
+		start = l_time_now();
+
+		for (j = 0; j < BENCH_MESSAGES; j++)
+			_dbus_filter_dispatch(messages[j % 16], filter);
+
+		elapsed = l_time_diff(start, l_time_now());
+
+		printf("%5u watches: %u signals in %llu usec, %d callbacks\n",
+				counts[i], BENCH_MESSAGES,
+				(unsigned long long) elapsed, count);
+
+		_dbus_filter_free(filter);
+	}
+
+	for (i = 0; i < L_ARRAY_SIZE(messages); i++) {
+		_dbus_message_set_sender(messages[i], NULL);
+		l_dbus_message_unref(messages[i]);
+	}
+}
+
 int main(int argc, char *argv[])
 {
 	l_test_init(&argc, &argv);
@@ -290,6 +458,8 @@ int main(int argc, char *argv[])
 	l_test_add("_dbus_filter_rule_to_str", test_rule_to_str, NULL);
 
 	l_test_add("DBus filter tree", test_filter_tree, NULL);
+	l_test_add("DBus filter arguments", test_filter_args, NULL);
+	l_test_add("DBus filter benchmark", test_filter_benchmark, NULL);
 
 	return l_test_run();
 }
@@ -0,0 +1,218 @@
+/*
+ *
+ *  Embedded Linux library
+ *
+ *  Copyright (C) 2019  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include <ell/ell.h>
+
+static void test_push_pop(const void *data)
+{
+	struct l_deque *deque;
+	unsigned int n, i;
+
+	deque = l_deque_new();
+	assert(deque);
+	assert(!l_deque_pop_head(deque));
+	assert(!l_deque_pop_tail(deque));
+
+	for (n = 0; n < 256; n++) {
+		/* Wrap around the ring by pushing at both ends */
+		for (i = 1; i < n + 2; i++) {
+			if (i & 1)
+				l_deque_push_tail(deque, L_UINT_TO_PTR(i));
+			else
+				l_deque_push_head(deque, L_UINT_TO_PTR(i));
+		}
+
+		assert(l_deque_length(deque) == n + 1);
+
+		for (i = 0; i < n + 1; i++) {
+			unsigned int v = L_PTR_TO_UINT(l_deque_at(deque, i));
+
+			if (i < (n + 1) / 2)
+				assert(v == (((n + 1) / 2) - i) * 2);
+			else
+				assert(v == (i - (n + 1) / 2) * 2 + 1);
+		}
+
+		assert(!l_deque_at(deque, n + 1));
+
+		for (i = n + 1; i > 0; i--) {
+			unsigned int v;
+
+			if (i & 1)
+				v = L_PTR_TO_UINT(l_deque_pop_tail(deque));
+			else
+				v = L_PTR_TO_UINT(l_deque_pop_head(deque));
+
+			assert(v == i);
+		}
+
+		assert(l_deque_isempty(deque));
+	}
+
+	l_deque_destroy(deque, NULL);
+}
+
+static bool match_ptr(const void *a, const void *b)
+{
+	return a == b;
+}
+
+static bool remove_odd(void *data, void *user_data)
+{
+	return L_PTR_TO_UINT(data) & 1;
+}
+
+static void test_remove(const void *data)
+{
+	struct l_deque *deque;
+	unsigned int i;
+
+	deque = l_deque_new();
+
+	for (i = 1; i <= 20; i++)
+		l_deque_push_tail(deque, L_UINT_TO_PTR(i));
+
+	assert(l_deque_remove_at(deque, 2) == L_UINT_TO_PTR(3));
+	assert(l_deque_remove_at(deque, 15) == L_UINT_TO_PTR(17));
+	assert(l_deque_remove(deque, L_UINT_TO_PTR(10)));
+	assert(!l_deque_remove(deque, L_UINT_TO_PTR(10)));
+	assert(l_deque_remove_if(deque, match_ptr, L_UINT_TO_PTR(20)) ==
+							L_UINT_TO_PTR(20));
+	assert(l_deque_find(deque, match_ptr, L_UINT_TO_PTR(19)) ==
+							L_UINT_TO_PTR(19));
+	assert(!l_deque_find(deque, match_ptr, L_UINT_TO_PTR(17)));
+	assert(l_deque_length(deque) == 16);
+
+	assert(l_deque_foreach_remove(deque, remove_odd, NULL) == 8);
+
+	for (i = 0; i < l_deque_length(deque); i++)
+		assert(!(L_PTR_TO_UINT(l_deque_at(deque, i)) & 1));
+
+	assert(l_deque_peek_head(deque) == L_UINT_TO_PTR(2));
+	assert(l_deque_peek_tail(deque) == L_UINT_TO_PTR(18));
+
+	l_deque_destroy(deque, NULL);
+}
+
+static int compare_uint(const void *a, const void *b, void *user_data)
+{
+	unsigned int ai = L_PTR_TO_UINT(a);
+	unsigned int bi = L_PTR_TO_UINT(b);
+
+	return ai < bi ? -1 : (ai > bi ? 1 : 0);
+}
+
+static void test_sort(const void *data)
+{
+	struct l_deque *deque;
+	unsigned int i;
+
+	deque = l_deque_new();
+
+	srandom(42);
+
+	/* Push at the head too so the sort needs to unwrap the ring */
+	for (i = 0; i < 1000; i++) {
+		void *v = L_UINT_TO_PTR(random() % 500 * 2);
+
+		if (i & 1)
+			l_deque_push_head(deque, v);
+		else
+			l_deque_push_tail(deque, v);
+	}
+
+	l_deque_sort(deque, compare_uint, NULL);
+
+	for (i = 1; i < l_deque_length(deque); i++)
+		assert(compare_uint(l_deque_at(deque, i - 1),
+					l_deque_at(deque, i), NULL) <= 0);
+
+	for (i = 0; i < l_deque_length(deque); i++) {
+		void *v = l_deque_at(deque, i);
+
+		assert(l_deque_bsearch(deque, v, compare_uint, NULL) == v);
+		assert(!l_deque_bsearch(deque, L_UINT_TO_PTR(
+						L_PTR_TO_UINT(v) + 1),
+						compare_uint, NULL));
+	}
+
+	l_deque_destroy(deque, NULL);
+}
+
+static bool match_uint(const void *a, const void *b)
+{
+	return a == b;
+}
+
+static void test_benchmark(const void *data)
+{
+	const unsigned int n = 10000;
+	struct l_queue *queue = l_queue_new();
+	struct l_deque *deque = l_deque_new();
+	uint64_t start, queue_time, deque_time;
+	unsigned int i;
+
+	for (i = 1; i <= n; i++) {
+		l_queue_push_tail(queue, L_UINT_TO_PTR(i));
+		l_deque_push_tail(deque, L_UINT_TO_PTR(i));
+	}
+
+	start = l_time_now();
+
+	for (i = 1; i <= n; i += 10)
+		assert(l_queue_find(queue, match_uint, L_UINT_TO_PTR(i)));
+
+	queue_time = l_time_diff(start, l_time_now());
+	start = l_time_now();
+
+	for (i = 1; i <= n; i += 10)
+		assert(l_deque_find(deque, match_uint, L_UINT_TO_PTR(i)));
+
+	deque_time = l_time_diff(start, l_time_now());
+
+	printf("%u finds in %u entries: queue %llu usec, deque %llu usec\n",
+				n / 10, n, (unsigned long long) queue_time,
+				(unsigned long long) deque_time);
+
+	l_queue_destroy(queue, NULL);
+	l_deque_destroy(deque, NULL);
+}
+
+int main(int argc, char *argv[])
+{
+	l_test_init(&argc, &argv);
+
+	l_test_add("deque push & pop", test_push_pop, NULL);
+	l_test_add("deque remove", test_remove, NULL);
+	l_test_add("deque sort & bsearch", test_sort, NULL);
+	l_test_add("deque vs queue find", test_benchmark, NULL);
+
+	return l_test_run();
+}
@@ -0,0 +1,358 @@
+/*
+ *
+ *  Embedded Linux library
+ *
+ *  Copyright (C) 2019  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include <ell/ell.h>
+#include "ell/digest-private.h"
+
+struct digest_test {
+	enum l_checksum_type type;
+	const char *abc;
+	const char *two_blocks;
+	const char *hmac;
+};
+
+static const struct digest_test digest_tests[] = {
+	{
+		.type = L_CHECKSUM_MD5,
+		.abc = "900150983cd24fb0d6963f7d28e17f72",
+		.two_blocks = "8215ef0796a20bcaaae116d3876c664a",
+		.hmac = "750c783e6ab0b503eaa86e310a5db738",
+	},
+	{
+		.type = L_CHECKSUM_SHA1,
+		.abc = "a9993e364706816aba3e25717850c26c9cd0d89d",
+		.two_blocks = "84983e441c3bd26ebaae4aa1f95129e5e54670f1",
+		.hmac = "effcdf6ae5eb2fa2d27416d5f184df9c259a7c79",
+	},
+	{
+		.type = L_CHECKSUM_SHA224,
+		.abc = "23097d223405d8228642a477bda255b32aadbce4bda0b3f7"
+			"e36c9da7",
+		.two_blocks = "75388b16512776cc5dba5da1fd890150b0c6455cb4f58b"
+			"1952522525",
+		.hmac = "a30e01098bc6dbbf45690f3a7e9e6d0f8bbea2a39e614800"
+			"8fd05e44",
+	},
+	{
+		.type = L_CHECKSUM_SHA256,
+		.abc = "ba7816bf8f01cfea414140de5dae2223b00361a396177a9c"
+			"b410ff61f20015ad",
+		.two_blocks = "248d6a61d20638b8e5c026930c3e6039a33ce45964ff21"
+			"67f6ecedd419db06c1",
+		.hmac = "5bdcc146bf60754e6a042426089575c75a003f089d273983"
+			"9dec58b964ec3843",
+	},
+	{
+		.type = L_CHECKSUM_SHA384,
+		.abc = "cb00753f45a35e8bb5a03d699ac65007272c32ab0eded163"
+			"1a8b605a43ff5bed8086072ba1e7cc2358baeca134c825a7",
+		.two_blocks = "3391fdddfc8dc7393707a65b1b4709397cf8b1d162af05"
+			"abfe8f450de5f36bc6b0455a8520bc4e6f5fe95b1fe3c845"
+			"2b",
+		.hmac = "af45d2e376484031617f78d2b58a6b1b9c7ef464f5a01b47"
+			"e42ec3736322445e8e2240ca5e69e2c78b3239ecfab21649",
+	},
+	{
+		.type = L_CHECKSUM_SHA512,
+		.abc = "ddaf35a193617abacc417349ae20413112e6fa4e89a97ea2"
+			"0a9eeee64b55d39a2192992a274fc1a836ba3c23a3feebbd"
+			"454d4423643ce80e2a9ac94fa54ca49f",
+		.two_blocks = "204a8fc6dda82f0a0ced7beb8e08a41657c16ef468b228"
+			"a8279be331a703c33596fd15c13b1b07f9aa1d3bea57789c"
+			"a031ad85c7a71dd70354ec631238ca3445",
+		.hmac = "164b7a7bfcf819e2e395fbe73b56e0a387bd64222e831fd6"
+			"10270cd7ea2505549758bf75c05a994a6d034f65f8f0e6fd"
+			"caeab1a34d4a6b4b636e070a38bce737",
+	},
+};
+
+static void check_digest(enum l_checksum_type type, const void *data,
+					size_t len, const char *expected)
+{
+	struct digest_ctx ctx;
+	uint8_t digest[DIGEST_MAX_LEN];
+	char *hex;
+
+	assert(_digest_init(&ctx, type));
+	_digest_update(&ctx, data, len);
+	_digest_final(&ctx, digest);
+
+	hex = l_util_hexstring(digest, _digest_length(type));
+	assert(!strcmp(hex, expected));
+	l_free(hex);
+}
+
+static void test_known_answers(const void *data)
+{
+	static const char two_blocks[] =
+		"abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+	static const char hmac_data[] = "what do ya want for nothing?";
+	unsigned int i;
+
+	for (i = 0; i < L_ARRAY_SIZE(digest_tests); i++) {
+		const struct digest_test *test = &digest_tests[i];
+		struct hmac_ctx hmac;
+		uint8_t digest[DIGEST_MAX_LEN];
+		char *hex;
+
+		check_digest(test->type, "abc", 3, test->abc);
+		check_digest(test->type, two_blocks, strlen(two_blocks),
+							test->two_blocks);
+
+		assert(_hmac_init(&hmac, test->type, "Jefe", 4));
+		_hmac_update(&hmac, hmac_data, strlen(hmac_data));
+		_hmac_final(&hmac, digest);
+
+		hex = l_util_hexstring(digest, _digest_length(test->type));
+		assert(!strcmp(hex, test->hmac));
+		l_free(hex);
+
+		/* The context is ready for reuse after _hmac_final */
+		_hmac_update(&hmac, hmac_data, strlen(hmac_data));
+		_hmac_final(&hmac, digest);
+
+		hex = l_util_hexstring(digest, _digest_length(test->type));
+		assert(!strcmp(hex, test->hmac));
+		l_free(hex);
+	}
+
+	assert(!_digest_supported(L_CHECKSUM_NONE));
+	assert(!_digest_supported(L_CHECKSUM_MD4));
+}
+
+static void test_split_updates(const void *data)
+{
+	uint8_t buf[600];
+	unsigned int i, len, split;
+
+	for (i = 0; i < sizeof(buf); i++)
+		buf[i] = i * 7 + 3;
+
+	for (i = 0; i < L_ARRAY_SIZE(digest_tests); i++) {
+		enum l_checksum_type type = digest_tests[i].type;
+
+		for (len = 0; len < sizeof(buf); len += 13) {
+			struct digest_ctx ctx;
+			uint8_t expected[DIGEST_MAX_LEN];
+			uint8_t digest[DIGEST_MAX_LEN];
+
+			_digest_init(&ctx, type);
+			_digest_update(&ctx, buf, len);
+			_digest_final(&ctx, expected);
+
+			for (split = 0; split <= len; split += 11) {
+				_digest_init(&ctx, type);
+				_digest_update(&ctx, buf, split);
+				_digest_update(&ctx, buf + split, len - split);
+				_digest_final(&ctx, digest);
+
+				assert(!memcmp(digest, expected,
+						_digest_length(type)));
+			}
+		}
+	}
+}
+
+static void test_kernel(const void *data)
+{
+	uint8_t buf[300];
+	uint8_t key[200];
+	unsigned int i, len;
+
+	for (i = 0; i < sizeof(buf); i++)
+		buf[i] = i ^ 0x5a;
+
+	for (i = 0; i < sizeof(key); i++)
+		key[i] = i * 3;
+
+	for (i = 0; i < L_ARRAY_SIZE(digest_tests); i++) {
+		enum l_checksum_type type = digest_tests[i].type;
+		size_t digest_len = _digest_length(type);
+
+		if (!l_checksum_is_supported(type, true))
+			continue;
+
+		for (len = 0; len < sizeof(buf); len += 17) {
+			struct l_checksum *checksum;
+			struct digest_ctx ctx;
+			struct hmac_ctx hmac;
+			uint8_t expected[DIGEST_MAX_LEN];
+			uint8_t digest[DIGEST_MAX_LEN];
+
+			checksum = l_checksum_new(type);
+			l_checksum_update(checksum, buf, len);
+			l_checksum_get_digest(checksum, expected, digest_len);
+			l_checksum_free(checksum);
+
+			_digest_init(&ctx, type);
+			_digest_update(&ctx, buf, len);
+			_digest_final(&ctx, digest);
+			assert(!memcmp(digest, expected, digest_len));
+
+			/* Key lengths on both sides of the block size */
+			checksum = l_checksum_new_hmac(type, key, len % 200);
+			l_checksum_update(checksum, buf, len);
+			l_checksum_get_digest(checksum, expected, digest_len);
+			l_checksum_free(checksum);
+
+			_hmac_init(&hmac, type, key, len % 200);
+			_hmac_update(&hmac, buf, len);
+			_hmac_final(&hmac, digest);
+			assert(!memcmp(digest, expected, digest_len));
+		}
+	}
+}
+
+static void test_many(const void *data)
+{
+	bool avx2 = L_PTR_TO_UINT(data);
+	uint8_t buf[300];
+	struct iovec msgs[29];
+	uint8_t digests[29 * DIGEST_MAX_LEN];
+	unsigned int i, count, n;
+
+	assert(_digest_many_set_avx2(avx2) == avx2);
+
+	for (i = 0; i < sizeof(buf); i++)
+		buf[i] = i * 5 + 1;
+
+	/* Lengths around both padding boundaries, lanes finish unevenly */
+	for (n = 0; n < L_ARRAY_SIZE(msgs); n++) {
+		msgs[n].iov_base = buf + n;
+		msgs[n].iov_len = (n * 37 + n / 3) % (sizeof(buf) - n);
+	}
+
+	for (i = 0; i < L_ARRAY_SIZE(digest_tests); i++) {
+		enum l_checksum_type type = digest_tests[i].type;
+		size_t digest_len = _digest_length(type);
+
+		for (count = 0; count <= L_ARRAY_SIZE(msgs); count++) {
+			memset(digests, 0, sizeof(digests));
+			assert(l_checksum_digest_many(type, msgs, count,
+								digests));
+
+			for (n = 0; n < count; n++) {
+				struct digest_ctx ctx;
+				uint8_t expected[DIGEST_MAX_LEN];
+
+				_digest_init(&ctx, type);
+				_digest_update(&ctx, msgs[n].iov_base,
+							msgs[n].iov_len);
+				_digest_final(&ctx, expected);
+
+				assert(!memcmp(digests + n * digest_len,
+						expected, digest_len));
+			}
+		}
+	}
+
+	_digest_many_set_avx2(true);
+}
+
+#define MANY_BENCH_BYTES	(1024 * 1024)
+
+static void test_many_benchmark(const void *data)
+{
+	static const enum l_checksum_type types[] = {
+		L_CHECKSUM_SHA1, L_CHECKSUM_SHA256,
+	};
+	static const size_t lens[] = { 64, 1024 };
+	uint8_t *buf = l_malloc(MANY_BENCH_BYTES);
+	uint8_t *digests = l_malloc(MANY_BENCH_BYTES / 64 * DIGEST_MAX_LEN);
+	struct iovec *msgs = l_new(struct iovec, MANY_BENCH_BYTES / 64);
+	unsigned int i, j;
+	size_t n, count;
+
+	for (n = 0; n < MANY_BENCH_BYTES; n++)
+		buf[n] = n;
+
+	for (i = 0; i < L_ARRAY_SIZE(types); i++) {
+		size_t digest_len = _digest_length(types[i]);
+
+		for (j = 0; j < L_ARRAY_SIZE(lens); j++) {
+			uint64_t start, single, many;
+
+			count = MANY_BENCH_BYTES / lens[j];
+
+			for (n = 0; n < count; n++) {
+				msgs[n].iov_base = buf + n * lens[j];
+				msgs[n].iov_len = lens[j];
+			}
+
+			start = l_time_now();
+
+			for (n = 0; n < count; n++) {
+				struct l_checksum *checksum;
+
+				checksum = l_checksum_new(types[i]);
+				l_checksum_update(checksum, msgs[n].iov_base,
+							msgs[n].iov_len);
+				l_checksum_get_digest(checksum,
+						digests + n * digest_len,
+						digest_len);
+				l_checksum_free(checksum);
+			}
+
+			single = l_time_diff(start, l_time_now());
+
+			start = l_time_now();
+			l_checksum_digest_many(types[i], msgs, count, digests);
+			many = l_time_diff(start, l_time_now());
+
+			printf("%s %4zu byte messages: %llu us one by one, "
+				"%llu us with digest_many\n",
+				types[i] == L_CHECKSUM_SHA1 ? "SHA-1  " :
+				"SHA-256", lens[j],
+				(unsigned long long) single,
+				(unsigned long long) many);
+		}
+	}
+
+	l_free(msgs);
+	l_free(digests);
+	l_free(buf);
+}
+
+int main(int argc, char *argv[])
+{
+	l_test_init(&argc, &argv);
+
+	l_test_add("Known answers", test_known_answers, NULL);
+	l_test_add("Split updates", test_split_updates, NULL);
+	l_test_add("Compare with kernel", test_kernel, NULL);
+	l_test_add("Multi-buffer portable", test_many, L_UINT_TO_PTR(false));
+
+	if (_digest_many_set_avx2(true))
+		l_test_add("Multi-buffer AVX2", test_many, L_UINT_TO_PTR(true));
+
+	l_test_add("Multi-buffer benchmark", test_many_benchmark, NULL);
+
+	return l_test_run();
+}
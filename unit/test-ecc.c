@@ -24,6 +24,7 @@
 #include <config.h>
 #endif
 
+#include <stdio.h>
 #include <string.h>
 #include <assert.h>
 
@@ -126,9 +127,10 @@ struct ecc_test_data exp_test = {
 	.type = TEST_EXP,
 	.a = "cae1d5624344984073fd955a72d4ebacedc084679333e4beebff94869e9f6ca8",
 	.b = "93a02ae89d15e38a33bf3fea4c99937825b279fa8fa81dded1ccb687cec88461",
-	.mod = CURVE_P_32_STR,
-	.result = "e7488e3a4d56938bbddc2a615c768d48"
-			"9e5634aced9ceee37249fae1caa36fec"
+	.mod = "ffffffff000000010000000000000000"
+			"00000000ffffffffffffffffffffffff",
+	.result = "415b2e00b2dfd0bf4889a64398c0fe6f"
+			"b4960df8e18c95799e08bfffb5814d5a"
 
 };
 
@@ -317,6 +319,397 @@ static void run_test_p256(const void *arg)
 	}
 }
 
+static void fill_scalar(uint64_t *scalar, unsigned int ndigits,
+							uint64_t *seed)
+{
+	unsigned int i;
+
+	for (i = 0; i < ndigits; i++) {
+		*seed = *seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		scalar[i] = *seed;
+	}
+
+	/* Stay below n on both curves */
+	scalar[ndigits - 1] >>= 1;
+}
+
+static void check_mult_g(const struct l_ecc_curve *curve,
+				const uint64_t *scalar)
+{
+	struct l_ecc_point ladder = { .curve = curve };
+	struct l_ecc_point fixed = { .curve = curve };
+	size_t len = curve->ndigits * 8;
+
+	_ecc_point_mult(&ladder, &curve->g, scalar, NULL, curve->p);
+	_ecc_point_mult_g(&fixed, curve, scalar);
+
+	assert(!memcmp(ladder.x, fixed.x, len));
+	assert(!memcmp(ladder.y, fixed.y, len));
+}
+
+static void test_mult_g(const void *data)
+{
+	static const unsigned int groups[] = { 19, 20 };
+	uint64_t seed = 1;
+	unsigned int i, j;
+
+	for (i = 0; i < L_ARRAY_SIZE(groups); i++) {
+		const struct l_ecc_curve *curve =
+					l_ecc_curve_get_ike_group(groups[i]);
+		uint64_t scalar[L_ECC_MAX_DIGITS];
+		uint64_t one[L_ECC_MAX_DIGITS] = { 1 };
+		uint64_t zero[L_ECC_MAX_DIGITS] = { 0 };
+
+		struct l_ecc_point result = { .curve = curve };
+		uint64_t neg_y[L_ECC_MAX_DIGITS];
+		size_t len = curve->ndigits * 8;
+
+		/*
+		 * The ladder hits exceptional cases for 1, n - 1 and n - 2,
+		 * so compare with G and -G directly there.
+		 */
+		_ecc_point_mult_g(&result, curve, one);
+		assert(!memcmp(result.x, curve->g.x, len));
+		assert(!memcmp(result.y, curve->g.y, len));
+
+		_vli_sub(scalar, curve->n, one, curve->ndigits);
+		_ecc_point_mult_g(&result, curve, scalar);
+		_vli_sub(neg_y, curve->p, curve->g.y, curve->ndigits);
+		assert(!memcmp(result.x, curve->g.x, len));
+		assert(!memcmp(result.y, neg_y, len));
+
+		/* Even and odd scalars take different paths */
+		memset(scalar, 0, sizeof(scalar));
+		scalar[0] = 2;
+		check_mult_g(curve, scalar);
+		scalar[0] = 3;
+		check_mult_g(curve, scalar);
+
+		_vli_sub(scalar, curve->n, one, curve->ndigits);
+		scalar[0] -= 2;
+		check_mult_g(curve, scalar);
+		scalar[0] -= 1;
+		check_mult_g(curve, scalar);
+
+		/*
+		 * 2^bits - n is made odd as n - k, whose recoding makes a
+		 * partial sum reach +-G.  Neighbours take the other parity.
+		 */
+		_vli_sub(scalar, zero, curve->n, curve->ndigits);
+		check_mult_g(curve, scalar);
+		scalar[0] += 1;
+		check_mult_g(curve, scalar);
+
+		for (j = 0; j < 64; j++) {
+			fill_scalar(scalar, curve->ndigits, &seed);
+			check_mult_g(curve, scalar);
+		}
+	}
+}
+
+static void test_field_inv(const void *data)
+{
+	static const unsigned int groups[] = { 19, 20 };
+	uint64_t seed = 3;
+	unsigned int i, j;
+
+	for (i = 0; i < L_ARRAY_SIZE(groups); i++) {
+		const struct l_ecc_curve *curve =
+					l_ecc_curve_get_ike_group(groups[i]);
+		uint64_t one[L_ECC_MAX_DIGITS] = { 1 };
+		uint64_t x[L_ECC_MAX_DIGITS];
+		uint64_t binary[L_ECC_MAX_DIGITS];
+		uint64_t fermat[L_ECC_MAX_DIGITS];
+		uint64_t check[L_ECC_MAX_DIGITS];
+		size_t len = curve->ndigits * 8;
+
+		for (j = 0; j < 64; j++) {
+			fill_scalar(x, curve->ndigits, &seed);
+
+			_vli_mod_inv(binary, x, curve->p, curve->ndigits);
+			_vli_mod_inv_fast(fermat, x, curve->p, curve->ndigits);
+			assert(!memcmp(binary, fermat, len));
+
+			_vli_mod_mult_fast(check, x, fermat, curve->p,
+							curve->ndigits);
+			assert(!memcmp(check, one, len));
+
+			_vli_mod_square_fast(check, x, curve->p,
+							curve->ndigits);
+			_vli_mod_mult_fast(x, x, x, curve->p, curve->ndigits);
+			assert(!memcmp(check, x, len));
+		}
+	}
+}
+
+#define FIELD_BENCH_COUNT 100000
+
+static void test_field_benchmark(const void *data)
+{
+	static const unsigned int groups[] = { 19, 20 };
+	uint64_t seed = 4;
+	unsigned int i, j;
+
+	for (i = 0; i < L_ARRAY_SIZE(groups); i++) {
+		const struct l_ecc_curve *curve =
+					l_ecc_curve_get_ike_group(groups[i]);
+		unsigned int ndigits = curve->ndigits;
+		uint64_t x[L_ECC_MAX_DIGITS];
+		uint64_t y[L_ECC_MAX_DIGITS];
+		uint64_t start, mult_time, square_time;
+		uint64_t binary_time, fermat_time;
+
+		fill_scalar(x, ndigits, &seed);
+		fill_scalar(y, ndigits, &seed);
+
+		start = l_time_now();
+
+		for (j = 0; j < FIELD_BENCH_COUNT; j++)
+			_vli_mod_mult_fast(x, x, y, curve->p, ndigits);
+
+		mult_time = l_time_diff(start, l_time_now()) ?: 1;
+		start = l_time_now();
+
+		for (j = 0; j < FIELD_BENCH_COUNT; j++)
+			_vli_mod_square_fast(x, x, curve->p, ndigits);
+
+		square_time = l_time_diff(start, l_time_now()) ?: 1;
+		start = l_time_now();
+
+		for (j = 0; j < FIELD_BENCH_COUNT / 100; j++)
+			_vli_mod_inv(x, x, curve->p, ndigits);
+
+		binary_time = l_time_diff(start, l_time_now()) ?: 1;
+		start = l_time_now();
+
+		for (j = 0; j < FIELD_BENCH_COUNT / 100; j++)
+			_vli_mod_inv_fast(x, x, curve->p, ndigits);
+
+		fermat_time = l_time_diff(start, l_time_now()) ?: 1;
+
+		printf("%s: mult %llu/s, square %llu/s, "
+			"inverse %llu/s binary, %llu/s constant-time\n",
+			curve->name,
+			FIELD_BENCH_COUNT * 1000000ULL / mult_time,
+			FIELD_BENCH_COUNT * 1000000ULL / square_time,
+			FIELD_BENCH_COUNT * 10000ULL / binary_time,
+			FIELD_BENCH_COUNT * 10000ULL / fermat_time);
+	}
+}
+
+#define MULT_BENCH_COUNT 200
+
+static void test_mult_g_benchmark(const void *data)
+{
+	static const unsigned int groups[] = { 19, 20 };
+	uint64_t seed = 2;
+	unsigned int i, j;
+
+	for (i = 0; i < L_ARRAY_SIZE(groups); i++) {
+		const struct l_ecc_curve *curve =
+					l_ecc_curve_get_ike_group(groups[i]);
+		struct l_ecc_point result = { .curve = curve };
+		uint64_t scalar[L_ECC_MAX_DIGITS];
+		uint64_t start, ladder_time, fixed_time;
+
+		fill_scalar(scalar, curve->ndigits, &seed);
+
+		/* Build the table outside of the timed loop */
+		_ecc_point_mult_g(&result, curve, scalar);
+
+		start = l_time_now();
+
+		for (j = 0; j < MULT_BENCH_COUNT; j++)
+			_ecc_point_mult(&result, &curve->g, scalar, NULL,
+								curve->p);
+
+		ladder_time = l_time_diff(start, l_time_now()) ?: 1;
+		start = l_time_now();
+
+		for (j = 0; j < MULT_BENCH_COUNT; j++)
+			_ecc_point_mult_g(&result, curve, scalar);
+
+		fixed_time = l_time_diff(start, l_time_now()) ?: 1;
+
+		printf("%s k * G: ladder %llu/s, fixed-base %llu/s\n",
+			curve->name,
+			MULT_BENCH_COUNT * 1000000ULL / ladder_time,
+			MULT_BENCH_COUNT * 1000000ULL / fixed_time);
+	}
+}
+
+static void test_points_to_affine(const void *data)
+{
+	static const unsigned int groups[] = { 19, 20 };
+	uint64_t seed = 6;
+	unsigned int i, j;
+
+	for (i = 0; i < L_ARRAY_SIZE(groups); i++) {
+		const struct l_ecc_curve *curve =
+					l_ecc_curve_get_ike_group(groups[i]);
+		unsigned int ndigits = curve->ndigits;
+		struct ecc_jacobian_point points[9];
+		struct l_ecc_point affine[L_ARRAY_SIZE(points)];
+		uint64_t zero[L_ECC_MAX_DIGITS] = { 0 };
+		size_t len = ndigits * 8;
+
+		for (j = 0; j < L_ARRAY_SIZE(points); j++) {
+			uint64_t k[L_ECC_MAX_DIGITS];
+			uint64_t z2[L_ECC_MAX_DIGITS];
+
+			affine[j].curve = curve;
+			fill_scalar(k, ndigits, &seed);
+			_ecc_point_mult_g(&affine[j], curve, k);
+
+			/* (x * z^2, y * z^3, z) */
+			fill_scalar(points[j].z, ndigits, &seed);
+			_vli_mod_square_fast(z2, points[j].z, curve->p,
+								ndigits);
+			_vli_mod_mult_fast(points[j].x, affine[j].x, z2,
+						curve->p, ndigits);
+			_vli_mod_mult_fast(z2, z2, points[j].z, curve->p,
+								ndigits);
+			_vli_mod_mult_fast(points[j].y, affine[j].y, z2,
+						curve->p, ndigits);
+		}
+
+		/* The point at infinity does not spoil the others */
+		memset(points[4].z, 0, sizeof(points[4].z));
+
+		_ecc_points_to_affine(points, L_ARRAY_SIZE(points), curve->p,
+								ndigits);
+
+		for (j = 0; j < L_ARRAY_SIZE(points); j++) {
+			if (j == 4) {
+				assert(!memcmp(points[j].x, zero, len));
+				assert(!memcmp(points[j].y, zero, len));
+				assert(!memcmp(points[j].z, zero, len));
+				continue;
+			}
+
+			assert(!memcmp(points[j].x, affine[j].x, len));
+			assert(!memcmp(points[j].y, affine[j].y, len));
+			assert(points[j].z[0] == 1);
+		}
+	}
+}
+
+static void three_call_mult_add(struct l_ecc_point *ret,
+				const struct l_ecc_scalar *a,
+				const struct l_ecc_point *p,
+				const struct l_ecc_scalar *b,
+				const struct l_ecc_point *q)
+{
+	struct l_ecc_point ap = { .curve = p->curve };
+	struct l_ecc_point bq = { .curve = p->curve };
+
+	assert(l_ecc_point_multiply(&ap, a, p));
+	assert(l_ecc_point_multiply(&bq, b, q));
+	assert(l_ecc_point_add(ret, &ap, &bq));
+}
+
+static void test_mult_add(const void *data)
+{
+	static const unsigned int groups[] = { 19, 20 };
+	uint64_t seed = 7;
+	unsigned int i, j;
+
+	for (i = 0; i < L_ARRAY_SIZE(groups); i++) {
+		const struct l_ecc_curve *curve =
+					l_ecc_curve_get_ike_group(groups[i]);
+		struct l_ecc_scalar *order = l_ecc_curve_get_order(curve);
+		struct l_ecc_scalar a = { .curve = curve };
+		struct l_ecc_scalar b = { .curve = curve };
+		struct l_ecc_scalar sum = { .curve = curve };
+		struct l_ecc_point p = { .curve = curve };
+		struct l_ecc_point q = { .curve = curve };
+		struct l_ecc_point expect = { .curve = curve };
+		struct l_ecc_point result = { .curve = curve };
+		uint64_t k[L_ECC_MAX_DIGITS];
+		size_t len = curve->ndigits * 8;
+
+		for (j = 0; j < 32; j++) {
+			fill_scalar(k, curve->ndigits, &seed);
+			_ecc_point_mult_g(&p, curve, k);
+			fill_scalar(k, curve->ndigits, &seed);
+			_ecc_point_mult_g(&q, curve, k);
+
+			fill_scalar(a.c, curve->ndigits, &seed);
+			fill_scalar(b.c, curve->ndigits, &seed);
+
+			/* Cover all parity combinations */
+			a.c[0] = (a.c[0] & ~1ull) | (j & 1);
+			b.c[0] = (b.c[0] & ~1ull) | (j >> 1 & 1);
+
+			three_call_mult_add(&expect, &a, &p, &b, &q);
+			assert(l_ecc_point_multiply_add(&result, &a, &p,
+								&b, &q));
+			assert(!memcmp(result.x, expect.x, len));
+			assert(!memcmp(result.y, expect.y, len));
+
+			/* The same point twice hits the doubling case */
+			assert(l_ecc_scalar_add(&sum, &a, &b, order));
+			assert(l_ecc_point_multiply(&expect, &sum, &p));
+			assert(l_ecc_point_multiply_add(&result, &a, &p,
+								&b, &p));
+			assert(!memcmp(result.x, expect.x, len));
+			assert(!memcmp(result.y, expect.y, len));
+		}
+
+		/* a * P + (n - a) * P is the point at infinity */
+		_vli_sub(b.c, curve->n, a.c, curve->ndigits);
+		assert(!l_ecc_point_multiply_add(&result, &a, &p, &b, &p));
+
+		l_ecc_scalar_free(order);
+	}
+}
+
+#define MULT_ADD_BENCH_COUNT 100
+
+static void test_mult_add_benchmark(const void *data)
+{
+	static const unsigned int groups[] = { 19, 20 };
+	uint64_t seed = 8;
+	unsigned int i, j;
+
+	for (i = 0; i < L_ARRAY_SIZE(groups); i++) {
+		const struct l_ecc_curve *curve =
+					l_ecc_curve_get_ike_group(groups[i]);
+		struct l_ecc_scalar a = { .curve = curve };
+		struct l_ecc_scalar b = { .curve = curve };
+		struct l_ecc_point p = { .curve = curve };
+		struct l_ecc_point q = { .curve = curve };
+		struct l_ecc_point result = { .curve = curve };
+		uint64_t k[L_ECC_MAX_DIGITS];
+		uint64_t start, three_call_time, straus_time;
+
+		fill_scalar(k, curve->ndigits, &seed);
+		_ecc_point_mult_g(&p, curve, k);
+		fill_scalar(k, curve->ndigits, &seed);
+		_ecc_point_mult_g(&q, curve, k);
+		fill_scalar(a.c, curve->ndigits, &seed);
+		fill_scalar(b.c, curve->ndigits, &seed);
+
+		start = l_time_now();
+
+		for (j = 0; j < MULT_ADD_BENCH_COUNT; j++)
+			three_call_mult_add(&result, &a, &p, &b, &q);
+
+		three_call_time = l_time_diff(start, l_time_now()) ?: 1;
+		start = l_time_now();
+
+		for (j = 0; j < MULT_ADD_BENCH_COUNT; j++)
+			l_ecc_point_multiply_add(&result, &a, &p, &b, &q);
+
+		straus_time = l_time_diff(start, l_time_now()) ?: 1;
+
+		printf("%s a * P + b * Q: multiply, multiply, add %llu/s, "
+			"multiply_add %llu/s\n", curve->name,
+			MULT_ADD_BENCH_COUNT * 1000000ULL / three_call_time,
+			MULT_ADD_BENCH_COUNT * 1000000ULL / straus_time);
+	}
+}
+
 int main(int argc, char *argv[])
 {
 	l_test_init(&argc, &argv);
@@ -335,6 +728,15 @@ int main(int argc, char *argv[])
 	l_test_add("ECC legendre", run_test_p256, &legendre_test4);
 	l_test_add("ECC legendre", run_test_p256, &legendre_test5);
 	l_test_add("ECC legendre", run_test_p256, &legendre_test6);
+	l_test_add("ECC field inverse", test_field_inv, NULL);
+	l_test_add("ECC field benchmark", test_field_benchmark, NULL);
+	l_test_add("ECC fixed-base mult", test_mult_g, NULL);
+	l_test_add("ECC fixed-base benchmark", test_mult_g_benchmark, NULL);
+	l_test_add("ECC batch affine conversion", test_points_to_affine,
+									NULL);
+	l_test_add("ECC multiply-add", test_mult_add, NULL);
+	l_test_add("ECC multiply-add benchmark", test_mult_add_benchmark,
+									NULL);
 
 	return l_test_run();
 }
@@ -25,6 +25,7 @@
 #endif
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <assert.h>
 
 #include <ell/ell.h>
@@ -271,6 +272,180 @@ static void test_foreach_remove(const void *test_data)
 	l_hashmap_destroy(hashmap, NULL);
 };
 
+static unsigned int mod_7(const void *p)
+{
+	return L_PTR_TO_UINT(p) % 7;
+}
+
+static bool remove_odd(const void *key, void *value, void *user_data)
+{
+	return L_PTR_TO_UINT(key) & 1;
+}
+
+/*
+ * Mix inserts (including duplicate keys), lookups and removes across
+ * several grow and shrink cycles and compare against a set of queues.
+ * Duplicates must always be found and removed in insertion order.
+ */
+static void test_resize(const void *test_data)
+{
+	l_hashmap_hash_func_t hash_func = test_data;
+	static const unsigned int nkeys = 4096;
+	struct l_queue **expected;
+	struct l_hashmap *hashmap;
+	unsigned int seq = 0;
+	unsigned int total = 0;
+	unsigned int i, round;
+
+	hashmap = l_hashmap_new();
+	assert(hashmap);
+
+	if (hash_func)
+		assert(l_hashmap_set_hash_function(hashmap, hash_func));
+
+	expected = l_new(struct l_queue *, nkeys);
+
+	for (i = 0; i < nkeys; i++)
+		expected[i] = l_queue_new();
+
+	for (round = 0; round < 6; round++) {
+		unsigned int count = round < 3 ? 20000 : 2000;
+
+		srandom(round);
+
+		for (i = 0; i < count; i++) {
+			unsigned int key = random() % nkeys;
+			void *value;
+
+			if (random() % 3 || round >= 3) {
+				value = L_UINT_TO_PTR(++seq);
+				assert(l_hashmap_insert(hashmap,
+						L_UINT_TO_PTR(key), value));
+				l_queue_push_tail(expected[key], value);
+				total++;
+			}
+
+			key = random() % nkeys;
+			assert(l_hashmap_lookup(hashmap, L_UINT_TO_PTR(key)) ==
+					l_queue_peek_head(expected[key]));
+
+			if (round < 3 && random() % 2)
+				continue;
+
+			value = l_hashmap_remove(hashmap, L_UINT_TO_PTR(key));
+			assert(value == l_queue_pop_head(expected[key]));
+
+			if (value)
+				total--;
+		}
+
+		assert(l_hashmap_size(hashmap) == total);
+	}
+
+	for (i = 0; i < nkeys; i++) {
+		if (!(i & 1))
+			continue;
+
+		total -= l_queue_length(expected[i]);
+		l_queue_clear(expected[i], NULL);
+	}
+
+	l_hashmap_foreach_remove(hashmap, remove_odd, NULL);
+	assert(l_hashmap_size(hashmap) == total);
+
+	for (i = 0; i < nkeys; i++) {
+		void *value;
+
+		while ((value = l_queue_pop_head(expected[i])))
+			assert(l_hashmap_remove(hashmap,
+						L_UINT_TO_PTR(i)) == value);
+
+		assert(!l_hashmap_lookup(hashmap, L_UINT_TO_PTR(i)));
+		l_queue_destroy(expected[i], NULL);
+	}
+
+	assert(l_hashmap_isempty(hashmap));
+
+	l_free(expected);
+	l_hashmap_destroy(hashmap, NULL);
+}
+
+static void test_benchmark(const void *test_data)
+{
+	static const unsigned int sizes[] = { 1000, 100000, 1000000 };
+	unsigned int n, i;
+
+	for (n = 0; n < L_ARRAY_SIZE(sizes); n++) {
+		struct l_hashmap *hashmap = l_hashmap_new();
+		uint64_t start, inserted, looked_up, removed;
+
+		start = l_time_now();
+
+		for (i = 1; i <= sizes[n]; i++)
+			l_hashmap_insert(hashmap, L_UINT_TO_PTR(i),
+							L_UINT_TO_PTR(i));
+
+		inserted = l_time_now();
+
+		for (i = 1; i <= sizes[n]; i++)
+			assert(l_hashmap_lookup(hashmap, L_UINT_TO_PTR(i)) ==
+							L_UINT_TO_PTR(i));
+
+		looked_up = l_time_now();
+
+		for (i = 1; i <= sizes[n]; i++)
+			assert(l_hashmap_remove(hashmap, L_UINT_TO_PTR(i)) ==
+							L_UINT_TO_PTR(i));
+
+		removed = l_time_now();
+
+		assert(l_hashmap_isempty(hashmap));
+		l_hashmap_destroy(hashmap, NULL);
+
+		printf("%u entries: insert %llu usec, lookup %llu usec, "
+			"remove %llu usec\n", sizes[n],
+			(unsigned long long) l_time_diff(start, inserted),
+			(unsigned long long) l_time_diff(inserted, looked_up),
+			(unsigned long long) l_time_diff(looked_up, removed));
+	}
+}
+
+static void test_str_hash(const void *test_data)
+{
+	static const char *keys[] = {
+		"a", "org.freedesktop.DBus", "/net/connman/iwd/0/1",
+		":1.42", "PropertiesChanged", "Settings",
+	};
+	const unsigned int rounds = 1000000;
+	unsigned int sum = 0;
+	uint64_t start, superfast, keyed;
+	unsigned int i;
+
+	for (i = 0; i < L_ARRAY_SIZE(keys); i++) {
+		char *copy = l_strdup(keys[i]);
+
+		assert(l_str_hash_keyed(keys[i]) == l_str_hash_keyed(copy));
+		l_free(copy);
+	}
+
+	start = l_time_now();
+
+	for (i = 0; i < rounds; i++)
+		sum += l_str_hash(keys[i % L_ARRAY_SIZE(keys)]);
+
+	superfast = l_time_now();
+
+	for (i = 0; i < rounds; i++)
+		sum += l_str_hash_keyed(keys[i % L_ARRAY_SIZE(keys)]);
+
+	keyed = l_time_now();
+
+	printf("%u short keys: superfast %llu usec, siphash %llu usec (%x)\n",
+			rounds,
+			(unsigned long long) l_time_diff(start, superfast),
+			(unsigned long long) l_time_diff(superfast, keyed), sum);
+}
+
 int main(int argc, char *argv[])
 {
 	l_test_init(&argc, &argv);
@@ -279,6 +454,10 @@ int main(int argc, char *argv[])
 	l_test_add("String Test", test_str, NULL);
 	l_test_add("Duplicate Test", test_duplicate, NULL);
 	l_test_add("Foreach Remove Test", test_foreach_remove, NULL);
+	l_test_add("Resize Test", test_resize, NULL);
+	l_test_add("Resize Collision Test", test_resize, mod_7);
+	l_test_add("Benchmark", test_benchmark, NULL);
+	l_test_add("String Hash Benchmark", test_str_hash, NULL);
 
 	return l_test_run();
 }
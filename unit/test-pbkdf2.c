@@ -29,7 +29,10 @@
 #include <assert.h>
 #include <ell/ell.h>
 
+#include "ell/checksum-private.h"
+
 struct pbkdf2_data {
+	enum l_checksum_type type;
 	const char *password;
 	const char *salt;
 	unsigned int salt_len;
@@ -43,7 +46,7 @@ static void pbkdf2_test(const void *data)
 	const struct pbkdf2_data *test = data;
 	unsigned int salt_len;
 	unsigned int key_len;
-	unsigned char output[25];
+	unsigned char output[64];
 	char *key;
 	bool result;
 
@@ -51,7 +54,24 @@ static void pbkdf2_test(const void *data)
 
 	key_len = test->key_len ? : (strlen(test->key) / 2);
 
-	result = l_pkcs5_pbkdf2(L_CHECKSUM_SHA1, test->password,
+	result = l_pkcs5_pbkdf2(test->type ?: L_CHECKSUM_SHA1, test->password,
+				(const uint8_t *) test->salt, salt_len,
+				test->count, output, key_len);
+
+	assert(result == true);
+
+	key = l_util_hexstring(output, key_len);
+
+	assert(strcmp(test->key, key) == 0);
+
+	l_free(key);
+
+	if (!_checksum_kernel_supported(test->type ?: L_CHECKSUM_SHA1, true) ||
+			test->count > 4096)
+		return;
+
+	result = l_pkcs5_pbkdf2_kernel(test->type ?: L_CHECKSUM_SHA1,
+				test->password,
 				(const uint8_t *) test->salt, salt_len,
 				test->count, output, key_len);
 
@@ -155,15 +175,82 @@ static const struct pbkdf2_data athena_test_vector_7 = {
 	.key		= "6b9cf26d45455a43a5b8bb276a403b39",
 };
 
-int main(int argc, char *argv[])
+static const struct pbkdf2_data pbkdf2_sha256_test_vector_1 = {
+	.type		= L_CHECKSUM_SHA256,
+	.password	= "password",
+	.salt		= "salt",
+	.count		= 4096,
+	.key		= "c5e478d59288c841aa530db6845c4c8d"
+			  "962893a001ce4e11a4963873aa98134a",
+};
+
+static const struct pbkdf2_data pbkdf2_sha256_test_vector_2 = {
+	.type		= L_CHECKSUM_SHA256,
+	.password	= "passwordPASSWORDpassword",
+	.salt		= "saltSALTsaltSALTsaltSALTsaltSALTsalt",
+	.count		= 4096,
+	.key		= "348c89dbcbd32b2f32d814b8116e84cf"
+			  "2b17347ebc1800181c4e2a1fb8dd53e1"
+			  "c635518c7dac47e9",
+};
+
+static const struct pbkdf2_data pbkdf2_sha512_test_vector_1 = {
+	.type		= L_CHECKSUM_SHA512,
+	.password	= "password",
+	.salt		= "salt",
+	.count		= 4096,
+	.key		= "d197b1b33db0143e018b12f3d1d1479e"
+			  "6cdebdcc97c5c0f87f6902e072f457b5"
+			  "143f30602641b3d55cd335988cb36b84"
+			  "376060ecd532e039b742a239434af2d5",
+};
+
+#define BENCHMARK_ROUNDS 20
+
+static uint64_t benchmark_psk(bool kernel)
 {
-	l_test_init(&argc, &argv);
+	static const char *ssid = "ell-benchmark";
+	uint8_t psk[32];
+	uint64_t start = l_time_now();
+	unsigned int i;
+	bool result;
 
-	if (!l_checksum_is_supported(L_CHECKSUM_SHA1, true)) {
-		printf("SHA1 support missing, skipping...\n");
-		goto done;
+	for (i = 0; i < BENCHMARK_ROUNDS; i++) {
+		if (kernel)
+			result = l_pkcs5_pbkdf2_kernel(L_CHECKSUM_SHA1,
+						"passphrase",
+						(const uint8_t *) ssid,
+						strlen(ssid), 4096,
+						psk, sizeof(psk));
+		else
+			result = l_pkcs5_pbkdf2(L_CHECKSUM_SHA1, "passphrase",
+						(const uint8_t *) ssid,
+						strlen(ssid), 4096,
+						psk, sizeof(psk));
+
+		assert(result);
 	}
 
+	return l_time_diff(start, l_time_now()) / BENCHMARK_ROUNDS;
+}
+
+/* WPA-PSK derivation: 4096 iterations, 32 bytes of output */
+static void pbkdf2_benchmark(const void *data)
+{
+	printf("WPA-PSK: %llu usec in-process",
+			(unsigned long long) benchmark_psk(false));
+
+	if (_checksum_kernel_supported(L_CHECKSUM_SHA1, true))
+		printf(", %llu usec AF_ALG",
+			(unsigned long long) benchmark_psk(true));
+
+	printf("\n");
+}
+
+int main(int argc, char *argv[])
+{
+	l_test_init(&argc, &argv);
+
 	l_test_add("/pbkdf2-sha1/PBKDF2 Test vector 1",
 					pbkdf2_test, &pbkdf2_test_vector_1);
 	l_test_add("/pbkdf2-sha1/PBKDF2 Test vector 2",
@@ -190,6 +277,14 @@ int main(int argc, char *argv[])
 	l_test_add("/pbkdf2-sha1/ATHENA Test vector 7",
 					pbkdf2_test, &athena_test_vector_7);
 
-done:
+	l_test_add("/pbkdf2-sha256/PBKDF2 Test vector 1",
+				pbkdf2_test, &pbkdf2_sha256_test_vector_1);
+	l_test_add("/pbkdf2-sha256/PBKDF2 Test vector 2",
+				pbkdf2_test, &pbkdf2_sha256_test_vector_2);
+	l_test_add("/pbkdf2-sha512/PBKDF2 Test vector 1",
+				pbkdf2_test, &pbkdf2_sha512_test_vector_1);
+
+	l_test_add("/pbkdf2/Benchmark", pbkdf2_benchmark, NULL);
+
 	return l_test_run();
 }
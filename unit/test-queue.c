@@ -28,6 +28,7 @@
 #include <assert.h>
 
 #include <ell/ell.h>
+#include "ell/pool-private.h"
 
 static void test_push_pop(const void *data)
 {
@@ -103,12 +104,130 @@ static void test_insert(const void *data)
 	l_queue_destroy(queue, NULL);
 }
 
+#define CHURN_ROUNDS	100000
+#define CHURN_DEPTH	64
+
+static uint64_t churn(struct l_queue *queue, unsigned long *mallocs)
+{
+	struct pool_stats before, after;
+	uint64_t start, elapsed;
+	unsigned int n, i;
+
+	_pool_set_stats_enabled(true);
+	_pool_get_stats(&before);
+	start = l_time_now();
+
+	for (n = 0; n < CHURN_ROUNDS; n++) {
+		for (i = 0; i < CHURN_DEPTH; i++)
+			l_queue_push_tail(queue, L_UINT_TO_PTR(i + 1));
+
+		for (i = 0; i < CHURN_DEPTH; i++)
+			assert(l_queue_pop_head(queue) == L_UINT_TO_PTR(i + 1));
+	}
+
+	elapsed = l_time_diff(start, l_time_now());
+	_pool_get_stats(&after);
+	_pool_set_stats_enabled(false);
+
+	assert(after.allocs - before.allocs == CHURN_ROUNDS * CHURN_DEPTH);
+	assert(after.frees - before.frees == CHURN_ROUNDS * CHURN_DEPTH);
+
+	*mallocs = after.mallocs - before.mallocs;
+
+	return elapsed;
+}
+
+/*
+ * Entries are only cached while the thread runs a main loop, so the
+ * same churn without one measures plain malloc.
+ */
+static void test_churn(const void *data)
+{
+	struct l_queue *queue;
+	unsigned long malloc_mallocs, pool_mallocs;
+	uint64_t malloc_time, pool_time;
+
+	queue = l_queue_new();
+	assert(queue);
+
+	assert(!_pool_caching_enabled());
+	malloc_time = churn(queue, &malloc_mallocs);
+	assert(malloc_mallocs == CHURN_ROUNDS * CHURN_DEPTH);
+
+	assert(l_main_init());
+	pool_time = churn(queue, &pool_mallocs);
+
+	/* Sanitizer builds hand every entry back to malloc */
+	if (_pool_caching_enabled())
+		assert(pool_mallocs <= CHURN_DEPTH);
+
+	assert(l_main_exit());
+
+	printf("%u push/pop: malloc %llu usec, pool %llu usec "
+			"(%lu mallocs)\n", CHURN_ROUNDS * CHURN_DEPTH,
+			(unsigned long long) malloc_time,
+			(unsigned long long) pool_time, pool_mallocs);
+
+	l_queue_destroy(queue, NULL);
+}
+
+static unsigned long push_mallocs(struct l_queue *queue)
+{
+	struct pool_stats before, after;
+
+	_pool_set_stats_enabled(true);
+	_pool_get_stats(&before);
+	l_queue_push_tail(queue, L_UINT_TO_PTR(1));
+	_pool_get_stats(&after);
+	_pool_set_stats_enabled(false);
+
+	return after.mallocs - before.mallocs;
+}
+
+static void test_pool_flush(const void *data)
+{
+	struct l_queue *queue;
+
+	queue = l_queue_new();
+
+	/* Nothing is cached by a thread without a main loop */
+	l_queue_push_tail(queue, L_UINT_TO_PTR(1));
+	l_queue_pop_head(queue);
+	assert(push_mallocs(queue) == 1);
+	l_queue_pop_head(queue);
+
+	assert(l_main_init());
+
+	l_queue_push_tail(queue, L_UINT_TO_PTR(1));
+	l_queue_pop_head(queue);
+
+	if (_pool_caching_enabled())
+		assert(push_mallocs(queue) == 0);
+	else
+		assert(push_mallocs(queue) == 1);
+
+	l_queue_pop_head(queue);
+	_queue_pool_flush();
+	assert(push_mallocs(queue) == 1);
+	l_queue_pop_head(queue);
+
+	/* l_main_exit hands the cached entry back to malloc */
+	assert(l_main_exit());
+	assert(l_main_init());
+	assert(push_mallocs(queue) == 1);
+	assert(l_main_exit());
+
+	l_queue_destroy(queue, NULL);
+}
+
 int main(int argc, char *argv[])
 {
 	l_test_init(&argc, &argv);
 
 	l_test_add("queue push & pop", test_push_pop, NULL);
 	l_test_add("queue insert", test_insert, NULL);
+	l_test_add("queue churn", test_churn, NULL);
+	l_test_add("queue pool flush", test_pool_flush, NULL);
 
 	return l_test_run();
 }
@@ -0,0 +1,245 @@
+/*
+ *
+ *  Embedded Linux library
+ *
+ *  Copyright (C) 2019  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include <ell/ell.h>
+
+#define MANY_TIMEOUTS 100000
+
+static const unsigned long order_ms[] = { 40, 10, 30, 20, 50 };
+static unsigned int order_fired[L_ARRAY_SIZE(order_ms)];
+static unsigned int order_count;
+
+static void order_callback(struct l_timeout *timeout, void *user_data)
+{
+	order_fired[order_count++] = L_PTR_TO_UINT(user_data);
+}
+
+static void test_order(const void *test_data)
+{
+	static const unsigned int expected[] = { 3, 2, 0, 4, 1 };
+	struct l_timeout *timeouts[L_ARRAY_SIZE(order_ms)];
+	uint64_t start = l_time_now();
+	unsigned int i;
+
+	assert(l_main_init());
+
+	for (i = 0; i < L_ARRAY_SIZE(order_ms); i++) {
+		timeouts[i] = l_timeout_create_ms(order_ms[i], order_callback,
+							L_UINT_TO_PTR(i), NULL);
+		assert(timeouts[i]);
+	}
+
+	/* Moving the earliest timeout to the back must not fire it early */
+	l_timeout_modify_ms(timeouts[1], 60);
+
+	while (order_count < L_ARRAY_SIZE(order_ms))
+		l_main_iterate(-1);
+
+	assert(l_time_diff(start, l_time_now()) >= 60 * 1000);
+	assert(!memcmp(order_fired, expected, sizeof(expected)));
+
+	for (i = 0; i < L_ARRAY_SIZE(order_ms); i++)
+		l_timeout_remove(timeouts[i]);
+
+	assert(l_main_exit());
+}
+
+static void remove_other_callback(struct l_timeout *timeout, void *user_data)
+{
+	struct l_timeout **other = user_data;
+
+	l_timeout_remove(*other);
+	*other = NULL;
+}
+
+static void remove_self_callback(struct l_timeout *timeout, void *user_data)
+{
+	struct l_timeout **self = user_data;
+
+	l_timeout_remove(timeout);
+	*self = NULL;
+}
+
+static void destroy_callback(void *user_data)
+{
+	unsigned int *destroyed = user_data;
+
+	*destroyed += 1;
+}
+
+static void test_remove(const void *test_data)
+{
+	struct l_timeout *racer1, *racer2, *self, *idle;
+	unsigned int destroyed = 0;
+
+	assert(l_main_init());
+
+	racer1 = l_timeout_create_ms(10, remove_other_callback, &racer2, NULL);
+	racer2 = l_timeout_create_ms(10, remove_other_callback, &racer1, NULL);
+	self = l_timeout_create_ms(5, remove_self_callback, &self, NULL);
+	idle = l_timeout_create(0, remove_self_callback, &destroyed,
+							destroy_callback);
+
+	while (self || (racer1 && racer2))
+		l_main_iterate(-1);
+
+	assert(!racer1 != !racer2);
+	l_timeout_remove(racer1);
+	l_timeout_remove(racer2);
+
+	/* A timeout created with zero time is never armed */
+	assert(destroyed == 0);
+	l_timeout_remove(idle);
+	assert(destroyed == 1);
+
+	assert(l_main_exit());
+}
+
+static void count_callback(struct l_timeout *timeout, void *user_data)
+{
+	unsigned int *fired = user_data;
+
+	*fired += 1;
+}
+
+/*
+ * Laid out so that removing the fourth entry from the third one's destroy
+ * callback moves the last entry up past the ones already visited.
+ */
+static const unsigned int exit_seconds[] = { 1, 5, 2, 6, 7, 3 };
+static const int exit_victims[] = { -1, -1, 3, 0, 0, -1 };
+static struct l_timeout *exit_timeouts[L_ARRAY_SIZE(exit_seconds)];
+static unsigned int exit_destroyed[L_ARRAY_SIZE(exit_seconds)];
+
+static void exit_callback(struct l_timeout *timeout, void *user_data)
+{
+	assert(false);
+}
+
+static void exit_destroy(void *user_data)
+{
+	unsigned int i = L_PTR_TO_UINT(user_data);
+	int victim = exit_victims[i];
+	struct l_timeout *timeout;
+
+	exit_destroyed[i] += 1;
+
+	if (victim < 0 || !exit_timeouts[victim] || exit_destroyed[victim])
+		return;
+
+	timeout = exit_timeouts[victim];
+	exit_timeouts[victim] = NULL;
+	l_timeout_remove(timeout);
+}
+
+static void test_remove_on_exit(const void *test_data)
+{
+	unsigned int i;
+
+	assert(l_main_init());
+
+	for (i = 0; i < L_ARRAY_SIZE(exit_seconds); i++) {
+		exit_timeouts[i] = l_timeout_create(exit_seconds[i],
+							exit_callback,
+							L_UINT_TO_PTR(i),
+							exit_destroy);
+		assert(exit_timeouts[i]);
+	}
+
+	assert(l_main_exit());
+
+	for (i = 0; i < L_ARRAY_SIZE(exit_seconds); i++)
+		assert(exit_destroyed[i] == 1);
+
+	/* The timeouts not removed from destroy callbacks are still ours */
+	for (i = 0; i < L_ARRAY_SIZE(exit_seconds); i++)
+		l_timeout_remove(exit_timeouts[i]);
+}
+
+static void test_many_timeouts(const void *test_data)
+{
+	struct l_timeout **timeouts;
+	unsigned int fired = 0;
+	uint64_t start, created, modified, dispatched, removed;
+	unsigned int i;
+
+	assert(l_main_init());
+
+	timeouts = l_new(struct l_timeout *, MANY_TIMEOUTS);
+
+	start = l_time_now();
+
+	for (i = 0; i < MANY_TIMEOUTS; i++) {
+		timeouts[i] = l_timeout_create_ms(1000 + i % 100,
+						count_callback, &fired, NULL);
+		assert(timeouts[i]);
+	}
+
+	created = l_time_now();
+
+	for (i = 0; i < MANY_TIMEOUTS; i++)
+		l_timeout_modify_ms(timeouts[i], 1 + i % 50);
+
+	modified = l_time_now();
+
+	while (fired < MANY_TIMEOUTS)
+		l_main_iterate(-1);
+
+	dispatched = l_time_now();
+
+	for (i = 0; i < MANY_TIMEOUTS; i++)
+		l_timeout_remove(timeouts[i]);
+
+	removed = l_time_now();
+
+	printf("%u timeouts: create %llu usec, modify %llu usec, "
+			"dispatch %llu usec, remove %llu usec\n",
+			MANY_TIMEOUTS,
+			(unsigned long long) l_time_diff(start, created),
+			(unsigned long long) l_time_diff(created, modified),
+			(unsigned long long) l_time_diff(modified, dispatched),
+			(unsigned long long) l_time_diff(dispatched, removed));
+
+	l_free(timeouts);
+
+	assert(l_main_exit());
+}
+
+int main(int argc, char *argv[])
+{
+	l_test_init(&argc, &argv);
+
+	l_test_add("Timeout order", test_order, NULL);
+	l_test_add("Timeout remove", test_remove, NULL);
+	l_test_add("Timeout remove on exit", test_remove_on_exit, NULL);
+	l_test_add("Many timeouts", test_many_timeouts, NULL);
+
+	return l_test_run();
+}
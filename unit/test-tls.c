@@ -27,11 +27,15 @@
 #include <assert.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
 
 #include <ell/ell.h>
 
 #include "ell/tls-private.h"
 #include "ell/cert-private.h"
+#include "ell/aes-private.h"
+#include "ell/checksum-private.h"
 
 static void test_tls10_prf(const void *data)
 {
@@ -615,6 +619,860 @@ static void test_tls_suite_test(const void *data)
 	test_tls_with_ver(&test, 0, 0);
 }
 
+struct record_test {
+	const char *suite;
+	enum l_tls_version version;
+};
+
+static const struct record_test record_tests[] = {
+	{ "TLS_RSA_WITH_AES_128_CBC_SHA", L_TLS_V10 },
+	{ "TLS_RSA_WITH_AES_128_CBC_SHA", L_TLS_V11 },
+	{ "TLS_RSA_WITH_AES_256_CBC_SHA256", L_TLS_V12 },
+	{ "TLS_RSA_WITH_AES_128_GCM_SHA256", L_TLS_V12 },
+	{ "TLS_RSA_WITH_AES_256_GCM_SHA384", L_TLS_V12 },
+};
+
+#define RECORD_WRITE_LEN	16384
+#define RECORD_TOTAL_LEN	(16 * 1024 * 1024)
+
+struct record_state {
+	struct l_tls *rx;
+	uint8_t data[RECORD_WRITE_LEN];
+	size_t received;
+	uint8_t *capture;
+	size_t capture_len;
+	/* Record bytes handed to tx from outside the caller's buffer */
+	const uint8_t *tx_buf;
+	size_t tx_buf_len;
+	uint64_t tx_copied;
+	/* Plaintext delivered from outside the buffer fed to rx */
+	size_t capture_size;
+	uint64_t rx_copied;
+};
+
+static void record_test_tx(const uint8_t *data, size_t len, void *user_data)
+{
+	struct record_state *s = user_data;
+
+	s->tx_copied += len;
+
+	if (s->capture) {
+		memcpy(s->capture + s->capture_len, data, len);
+		s->capture_len += len;
+		return;
+	}
+
+	l_tls_handle_rx(s->rx, data, len);
+}
+
+static void record_test_tx_iov(const struct iovec *iov, size_t iov_cnt,
+				void *user_data)
+{
+	struct record_state *s = user_data;
+	size_t i;
+
+	for (i = 0; i < iov_cnt; i++) {
+		const uint8_t *base = iov[i].iov_base;
+
+		if (base < s->tx_buf || base >= s->tx_buf + s->tx_buf_len)
+			s->tx_copied += iov[i].iov_len;
+
+		l_tls_handle_rx(s->rx, iov[i].iov_base, iov[i].iov_len);
+	}
+}
+
+static void record_test_new_data(const uint8_t *data, size_t len,
+					void *user_data)
+{
+	struct record_state *s = user_data;
+
+	assert(!memcmp(data, s->data + s->received % RECORD_WRITE_LEN, len));
+	s->received += len;
+
+	if (!s->capture || data < s->capture ||
+			data >= s->capture + s->capture_size)
+		s->rx_copied += len;
+}
+
+static void record_test_disconnected(enum l_tls_alert_desc reason,
+					bool remote, void *user_data)
+{
+	assert(false);
+}
+
+static struct l_tls *record_test_tls_new(bool server,
+					const struct tls_cipher_suite *suite,
+					enum l_tls_version version,
+					bool kernel_crypto,
+					struct record_state *s)
+{
+	struct l_tls *tls = l_tls_new(server, record_test_new_data,
+					record_test_tx, NULL,
+					record_test_disconnected, s);
+	unsigned int i;
+
+	assert(tls);
+	assert(l_tls_set_kernel_crypto(tls, kernel_crypto));
+
+	/* Both ends derive the same keys from the same key block */
+	for (i = 0; i < sizeof(tls->pending.key_block); i++)
+		tls->pending.key_block[i] = i;
+
+	tls->negotiated_version = version;
+	tls->pending.cipher_suite = (struct tls_cipher_suite *) suite;
+	assert(tls_change_cipher_spec(tls, !server, NULL));
+	tls->ready = true;
+
+	return tls;
+}
+
+static const struct tls_cipher_suite *find_suite(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; tls_cipher_suite_pref[i]; i++)
+		if (!strcmp(tls_cipher_suite_pref[i]->name, name))
+			return tls_cipher_suite_pref[i];
+
+	return NULL;
+}
+
+static void test_record_layer(const void *data)
+{
+	unsigned int i;
+
+	for (i = 0; i < L_ARRAY_SIZE(record_tests); i++) {
+		const struct record_test *test = &record_tests[i];
+		const struct tls_cipher_suite *suite = find_suite(test->suite);
+		struct record_state s;
+		struct l_tls *client;
+		uint64_t start, elapsed;
+		unsigned int j;
+
+		assert(suite);
+
+		for (j = 0; j < sizeof(s.data); j++)
+			s.data[j] = j * 13;
+
+		s.received = 0;
+		s.capture = NULL;
+		s.rx = record_test_tls_new(true, suite, test->version, false,
+						&s);
+		client = record_test_tls_new(false, suite, test->version, false,
+						&s);
+
+		start = l_time_now();
+
+		for (j = 0; j < RECORD_TOTAL_LEN / RECORD_WRITE_LEN; j++)
+			l_tls_write(client, s.data, sizeof(s.data));
+
+		elapsed = l_time_diff(start, l_time_now());
+		assert(s.received == RECORD_TOTAL_LEN);
+
+		printf("%s TLS 1.%i: %llu MB/s (%s)\n", test->suite,
+			test->version - L_TLS_V10,
+			(unsigned long long) RECORD_TOTAL_LEN / (elapsed ?: 1),
+			_aes_implementation(client->aes[1]));
+
+		l_tls_free(client);
+		l_tls_free(s.rx);
+	}
+}
+
+/*
+ * Compare l_tls_write against l_tls_writev on a buffer with headroom and
+ * tailroom, split into iovecs at offsets that don't fall on a block
+ * boundary.  The writev buffer is refilled before every call because it
+ * is encrypted in place.
+ */
+static void test_record_writev(const void *data)
+{
+	static uint8_t buf[L_TLS_WRITEV_HEADROOM + RECORD_WRITE_LEN +
+				L_TLS_WRITEV_TAILROOM];
+	uint8_t *plaintext = buf + L_TLS_WRITEV_HEADROOM;
+	struct iovec iov[3] = {
+		{ .iov_base = plaintext, .iov_len = 1000 },
+		{ .iov_base = plaintext + 1000, .iov_len = 7001 },
+		{ .iov_base = plaintext + 8001,
+			.iov_len = RECORD_WRITE_LEN - 8001 },
+	};
+	unsigned int i;
+
+	for (i = 0; i < L_ARRAY_SIZE(record_tests); i++) {
+		const struct record_test *test = &record_tests[i];
+		const struct tls_cipher_suite *suite = find_suite(test->suite);
+		struct record_state s;
+		struct l_tls *client;
+		uint64_t start, write_time, writev_time;
+		uint64_t write_copied;
+		unsigned int j;
+
+		assert(suite);
+
+		for (j = 0; j < sizeof(s.data); j++)
+			s.data[j] = j * 13;
+
+		s.received = 0;
+		s.capture = NULL;
+		s.tx_buf = buf;
+		s.tx_buf_len = sizeof(buf);
+		s.tx_copied = 0;
+		s.rx = record_test_tls_new(true, suite, test->version, false,
+						&s);
+		client = record_test_tls_new(false, suite, test->version, false,
+						&s);
+
+		start = l_time_now();
+
+		for (j = 0; j < RECORD_TOTAL_LEN / RECORD_WRITE_LEN; j++)
+			l_tls_write(client, s.data, sizeof(s.data));
+
+		write_time = l_time_diff(start, l_time_now());
+		write_copied = s.tx_copied;
+		s.tx_copied = 0;
+
+		l_tls_set_tx_iov_handler(client, record_test_tx_iov);
+		start = l_time_now();
+
+		for (j = 0; j < RECORD_TOTAL_LEN / RECORD_WRITE_LEN; j++) {
+			memcpy(plaintext, s.data, sizeof(s.data));
+			l_tls_writev(client, iov, L_ARRAY_SIZE(iov),
+					L_TLS_WRITEV_HEADROOM,
+					L_TLS_WRITEV_TAILROOM);
+		}
+
+		writev_time = l_time_diff(start, l_time_now());
+		assert(s.received == 2 * RECORD_TOTAL_LEN);
+		assert(!s.tx_copied);
+
+		printf("%s TLS 1.%i: write %llu MB/s %llu bytes copied, "
+			"writev %llu MB/s %llu bytes copied\n", test->suite,
+			test->version - L_TLS_V10,
+			(unsigned long long) RECORD_TOTAL_LEN /
+			(write_time ?: 1),
+			(unsigned long long) write_copied,
+			(unsigned long long) RECORD_TOTAL_LEN /
+			(writev_time ?: 1),
+			(unsigned long long) s.tx_copied);
+
+		l_tls_free(client);
+		l_tls_free(s.rx);
+	}
+}
+
+#define RECORD_RX_CHUNK_LEN	65536
+
+static uint64_t record_rx_feed(struct l_tls *tls, uint8_t *data, size_t len,
+				bool in_place)
+{
+	uint64_t start = l_time_now();
+
+	while (len) {
+		size_t n = len < RECORD_RX_CHUNK_LEN ? len : RECORD_RX_CHUNK_LEN;
+
+		if (in_place)
+			l_tls_handle_rx_inplace(tls, data, n);
+		else
+			l_tls_handle_rx(tls, data, n);
+
+		data += n;
+		len -= n;
+	}
+
+	return l_time_diff(start, l_time_now());
+}
+
+/*
+ * Receive the same traffic, fed in 64 KiB reads, through l_tls_handle_rx
+ * and l_tls_handle_rx_inplace.  Records that straddle two reads are
+ * still reassembled by the latter.
+ */
+static void record_rx_run(const struct record_test *test, size_t record_len)
+{
+	static uint8_t buf[L_TLS_WRITEV_HEADROOM + RECORD_WRITE_LEN +
+				L_TLS_WRITEV_TAILROOM];
+	const struct tls_cipher_suite *suite = find_suite(test->suite);
+	size_t count = 2 * RECORD_TOTAL_LEN / record_len;
+	struct iovec iov = {
+		.iov_base = buf + L_TLS_WRITEV_HEADROOM,
+		.iov_len = record_len,
+	};
+	struct record_state s;
+	struct l_tls *client;
+	uint64_t copy_time, in_place_time, copied;
+	size_t half;
+	unsigned int j;
+
+	assert(suite);
+
+	for (j = 0; j < sizeof(s.data); j++)
+		s.data[j] = j * 13;
+
+	s.received = 0;
+	s.capture_size = count * (record_len + 128);
+	s.capture = l_malloc(s.capture_size);
+	s.capture_len = 0;
+	s.rx = record_test_tls_new(true, suite, test->version, false, &s);
+	client = record_test_tls_new(false, suite, test->version, false,
+						&s);
+
+	for (j = 0; j < count; j++) {
+		memcpy(iov.iov_base, s.data +
+			(j * record_len) % RECORD_WRITE_LEN, record_len);
+		l_tls_writev(client, &iov, 1, L_TLS_WRITEV_HEADROOM,
+				L_TLS_WRITEV_TAILROOM);
+	}
+
+	/* All records have the same length */
+	half = s.capture_len / 2;
+
+	s.rx_copied = 0;
+	copy_time = record_rx_feed(s.rx, s.capture, half, false);
+	copied = s.rx_copied;
+	s.rx_copied = 0;
+	in_place_time = record_rx_feed(s.rx, s.capture + half, half, true);
+	assert(s.received == 2 * RECORD_TOTAL_LEN);
+
+	printf("%s TLS 1.%i %zu byte records: copy %llu MB/s "
+		"%llu bytes copied, in place %llu MB/s "
+		"%llu bytes copied\n", test->suite,
+		test->version - L_TLS_V10, record_len,
+		(unsigned long long) RECORD_TOTAL_LEN / (copy_time ?: 1),
+		(unsigned long long) copied,
+		(unsigned long long) RECORD_TOTAL_LEN / (in_place_time ?: 1),
+		(unsigned long long) s.rx_copied);
+
+	l_free(s.capture);
+	l_tls_free(client);
+	l_tls_free(s.rx);
+}
+
+static void test_record_rx(const void *data)
+{
+	unsigned int i;
+
+	for (i = 0; i < L_ARRAY_SIZE(record_tests); i++) {
+		record_rx_run(&record_tests[i], 1024);
+		record_rx_run(&record_tests[i], RECORD_WRITE_LEN);
+	}
+}
+
+/*
+ * With kernel crypto selected a suite may only be used when AF_ALG has
+ * both its cipher and its HMAC, and the records must then go through
+ * the kernel objects rather than the in-process contexts.
+ */
+static void test_record_kernel_crypto(const void *data)
+{
+	unsigned int i;
+
+	for (i = 0; i < L_ARRAY_SIZE(record_tests); i++) {
+		const struct record_test *test = &record_tests[i];
+		const struct tls_cipher_suite *suite = find_suite(test->suite);
+		const struct tls_bulk_encryption_algorithm *enc;
+		struct record_state s;
+		struct l_tls *tls;
+		struct l_tls *client;
+		bool supported;
+		unsigned int j;
+
+		assert(suite);
+		enc = suite->encryption;
+
+		if (enc->cipher_type == TLS_CIPHER_AEAD)
+			supported = l_aead_cipher_is_supported(enc->l_aead_id);
+		else
+			supported = l_cipher_is_supported(enc->l_id) &&
+				_checksum_kernel_supported(
+						suite->mac->hmac_type, true);
+
+		tls = l_tls_new(false, record_test_new_data, record_test_tx,
+				NULL, record_test_disconnected, &s);
+		assert(tls);
+		tls->negotiated_version = test->version;
+		assert(tls_cipher_suite_is_compatible(tls, suite, NULL));
+		assert(l_tls_set_kernel_crypto(tls, true));
+		assert(tls_cipher_suite_is_compatible(tls, suite, NULL) ==
+								supported);
+		l_tls_free(tls);
+
+		if (!supported) {
+			printf("%s TLS 1.%i: not supported by the kernel\n",
+				test->suite, test->version - L_TLS_V10);
+			continue;
+		}
+
+		for (j = 0; j < sizeof(s.data); j++)
+			s.data[j] = j * 13;
+
+		s.received = 0;
+		s.capture = NULL;
+		s.rx = record_test_tls_new(true, suite, test->version, true,
+						&s);
+		client = record_test_tls_new(false, suite, test->version, true,
+						&s);
+		assert(!client->aes[1] && !client->hmac[1]);
+		assert(!s.rx->aes[0] && !s.rx->hmac[0]);
+
+		for (j = 0; j < 16; j++)
+			l_tls_write(client, s.data, sizeof(s.data));
+
+		assert(s.received == 16 * RECORD_WRITE_LEN);
+
+		l_tls_free(client);
+		l_tls_free(s.rx);
+	}
+}
+
+static struct l_tls_session *session_test_new(uint8_t fill)
+{
+	struct l_tls_session *session = l_new(struct l_tls_session, 1);
+
+	session->version = L_TLS_V12;
+	session->cipher_suite_id[0] = 0x00;
+	session->cipher_suite_id[1] = 0x9c;
+	memset(session->master_secret, fill, sizeof(session->master_secret));
+	memset(session->session_id, fill, TLS_SESSION_ID_SIZE);
+	session->session_id_size = TLS_SESSION_ID_SIZE;
+	session->peer_authenticated = true;
+	session->peer_identity = l_strdup("Foo Example Organization");
+	session->expiry = l_time_offset(l_time_now(), 60 * 1000000ULL);
+
+	return session;
+}
+
+static void test_session_cache(const void *data)
+{
+	struct l_tls_session_cache *cache = l_tls_session_cache_new(2, 60);
+	struct l_tls_session *sessions[3];
+	const struct l_tls_session *found;
+	unsigned int i;
+
+	assert(cache);
+	assert(!l_tls_session_cache_new(2, 0));
+
+	for (i = 0; i < L_ARRAY_SIZE(sessions); i++)
+		sessions[i] = session_test_new(i + 1);
+
+	tls_session_cache_add(cache, sessions[0]);
+	tls_session_cache_add(cache, sessions[1]);
+
+	/* Makes sessions[1] the least recently used */
+	found = tls_session_cache_lookup(cache, sessions[0]->session_id,
+						TLS_SESSION_ID_SIZE);
+	assert(found);
+	assert(!memcmp(found->master_secret, sessions[0]->master_secret, 48));
+	assert(!strcmp(found->peer_identity, sessions[0]->peer_identity));
+
+	tls_session_cache_add(cache, sessions[2]);
+	assert(tls_session_cache_lookup(cache, sessions[0]->session_id,
+						TLS_SESSION_ID_SIZE));
+	assert(!tls_session_cache_lookup(cache, sessions[1]->session_id,
+						TLS_SESSION_ID_SIZE));
+	assert(tls_session_cache_lookup(cache, sessions[2]->session_id,
+						TLS_SESSION_ID_SIZE));
+
+	tls_session_cache_remove(cache, sessions[2]->session_id,
+					TLS_SESSION_ID_SIZE);
+	assert(!tls_session_cache_lookup(cache, sessions[2]->session_id,
+						TLS_SESSION_ID_SIZE));
+
+	for (i = 0; i < L_ARRAY_SIZE(sessions); i++)
+		l_tls_session_free(sessions[i]);
+
+	l_tls_session_cache_free(cache);
+}
+
+static void test_session_ticket(const void *data)
+{
+	struct l_tls_session_cache *cache = l_tls_session_cache_new(0, 60);
+	struct l_tls_session_cache *other = l_tls_session_cache_new(0, 60);
+	struct l_tls_session *session = session_test_new(0x5a);
+	struct l_tls_session *decrypted;
+	uint8_t *ticket;
+	size_t ticket_len;
+
+	assert(!tls_session_cache_has_tickets(cache));
+	assert(l_tls_session_cache_enable_tickets(cache, 60));
+	assert(l_tls_session_cache_enable_tickets(other, 60));
+	assert(tls_session_cache_has_tickets(cache));
+
+	ticket = tls_session_ticket_encrypt(cache, session, &ticket_len);
+	assert(ticket);
+
+	decrypted = tls_session_ticket_decrypt(cache, ticket, ticket_len);
+	assert(decrypted);
+	assert(decrypted->version == session->version);
+	assert(!memcmp(decrypted->cipher_suite_id,
+			session->cipher_suite_id, 2));
+	assert(!memcmp(decrypted->master_secret, session->master_secret, 48));
+	assert(decrypted->expiry == session->expiry);
+	assert(decrypted->peer_authenticated);
+	assert(!strcmp(decrypted->peer_identity, session->peer_identity));
+	l_tls_session_free(decrypted);
+
+	/* Someone else's key */
+	tls_session_ticket_encrypt(other, session, &ticket_len);
+	assert(!tls_session_ticket_decrypt(other, ticket, ticket_len));
+
+	/* Any modification is caught by the MAC */
+	ticket[ticket_len / 2] ^= 1;
+	assert(!tls_session_ticket_decrypt(cache, ticket, ticket_len));
+	ticket[ticket_len / 2] ^= 1;
+	assert(!tls_session_ticket_decrypt(cache, ticket, ticket_len - 1));
+	l_free(ticket);
+
+	/* Expired sessions can't be resumed even with a valid ticket */
+	session->expiry = l_time_now() - 1;
+	ticket = tls_session_ticket_encrypt(cache, session, &ticket_len);
+	assert(!tls_session_ticket_decrypt(cache, ticket, ticket_len));
+	l_free(ticket);
+
+	l_tls_session_free(session);
+	l_tls_session_cache_free(cache);
+	l_tls_session_cache_free(other);
+}
+
+static void test_session_ticket_rotation(const void *data)
+{
+	struct l_tls_session_cache *cache = l_tls_session_cache_new(0, 60);
+	struct l_tls_session *session = session_test_new(0x5a);
+	struct l_tls_session *decrypted;
+	uint8_t *old_ticket;
+	uint8_t *ticket;
+	size_t old_len;
+	size_t len;
+
+	assert(l_tls_session_cache_enable_tickets(cache, 1));
+	old_ticket = tls_session_ticket_encrypt(cache, session, &old_len);
+	assert(old_ticket);
+
+	/* Expired for new tickets but still accepted */
+	usleep(1100000);
+	decrypted = tls_session_ticket_decrypt(cache, old_ticket, old_len);
+	assert(decrypted);
+	l_tls_session_free(decrypted);
+
+	/* Issuing a ticket now rotates the key, the old one still works */
+	ticket = tls_session_ticket_encrypt(cache, session, &len);
+	assert(ticket);
+	assert(memcmp(ticket, old_ticket, 16));
+
+	decrypted = tls_session_ticket_decrypt(cache, ticket, len);
+	assert(decrypted);
+	l_tls_session_free(decrypted);
+
+	decrypted = tls_session_ticket_decrypt(cache, old_ticket, old_len);
+	assert(decrypted);
+	l_tls_session_free(decrypted);
+
+	/* Until it has been expired for a whole key lifetime */
+	usleep(1000000);
+	assert(!tls_session_ticket_decrypt(cache, old_ticket, old_len));
+
+	decrypted = tls_session_ticket_decrypt(cache, ticket, len);
+	assert(decrypted);
+	l_tls_session_free(decrypted);
+
+	l_free(old_ticket);
+	l_free(ticket);
+	l_tls_session_free(session);
+	l_tls_session_cache_free(cache);
+}
+
+struct resume_test_state {
+	struct l_tls *tls;
+	int fd;
+	const char *expect_identity;
+	bool ready;
+};
+
+static void resume_test_tx(const uint8_t *data, size_t len, void *user_data)
+{
+	struct resume_test_state *s = user_data;
+
+	assert(write(s->fd, data, len) == (ssize_t) len);
+}
+
+static void resume_test_new_data(const uint8_t *data, size_t len,
+					void *user_data)
+{
+}
+
+static void resume_test_ready(const char *peer_identity, void *user_data)
+{
+	struct resume_test_state *s = user_data;
+
+	if (s->expect_identity)
+		assert(peer_identity &&
+			!strcmp(peer_identity, s->expect_identity));
+	else
+		assert(!peer_identity);
+
+	s->ready = true;
+}
+
+static void resume_test_disconnected(enum l_tls_alert_desc reason,
+					bool remote, void *user_data)
+{
+	assert(false);
+}
+
+#define RESUME_SERVER_AUTH	0x1	/* Client has the CA */
+#define RESUME_CLIENT_AUTH	0x2	/* Server has the CA, client a cert */
+
+/*
+ * Run one handshake over a socketpair, offering *session if set, and
+ * replace *session with the one the client ends up with.
+ */
+static void resume_test_run(struct l_tls_session_cache *cache,
+				struct l_tls_session **session,
+				unsigned int auth, const char **client_suites)
+{
+	struct resume_test_state s[2] = {};
+	uint8_t buf[16384];
+	int fds[2];
+	unsigned int i;
+
+	assert(!socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds));
+
+	for (i = 0; i < 2; i++) {
+		s[i].fd = fds[i];
+		s[i].tls = l_tls_new(i == 0, resume_test_new_data,
+					resume_test_tx, resume_test_ready,
+					resume_test_disconnected, &s[i]);
+		assert(s[i].tls);
+	}
+
+	assert(l_tls_set_auth_data(s[0].tls, CERTDIR "cert-server.pem",
+					CERTDIR "cert-server-key-pkcs8.pem",
+					NULL));
+	assert(l_tls_set_session_cache(s[0].tls, cache));
+	assert(l_tls_set_session(s[1].tls, *session));
+
+	if (auth & RESUME_SERVER_AUTH) {
+		assert(l_tls_set_cacert(s[1].tls, CERTDIR "cert-ca.pem"));
+		s[1].expect_identity = "Foo Example Organization";
+	}
+
+	if (auth & RESUME_CLIENT_AUTH) {
+		assert(l_tls_set_cacert(s[0].tls, CERTDIR "cert-ca.pem"));
+		assert(l_tls_set_auth_data(s[1].tls, CERTDIR "cert-client.pem",
+					CERTDIR "cert-client-key-pkcs8.pem",
+					NULL));
+		s[0].expect_identity = "Bar Example Organization";
+	}
+
+	if (client_suites)
+		assert(tls_set_cipher_suites(s[1].tls, client_suites));
+
+	assert(l_tls_start(s[0].tls));
+	assert(l_tls_start(s[1].tls));
+
+	while (!s[0].ready || !s[1].ready) {
+		bool progress = false;
+
+		for (i = 0; i < 2; i++) {
+			ssize_t len = recv(s[i].fd, buf, sizeof(buf),
+						MSG_DONTWAIT);
+
+			if (len <= 0)
+				continue;
+
+			l_tls_handle_rx(s[i].tls, buf, len);
+			progress = true;
+		}
+
+		assert(progress);
+	}
+
+	l_tls_session_free(*session);
+	*session = l_tls_get_session(s[1].tls);
+	assert(*session);
+
+	for (i = 0; i < 2; i++) {
+		l_tls_free(s[i].tls);
+		close(s[i].fd);
+	}
+}
+
+static void resume_test_handshake(struct l_tls_session_cache *cache,
+					struct l_tls_session **session)
+{
+	resume_test_run(cache, session, RESUME_SERVER_AUTH, NULL);
+}
+
+static bool resume_test_resumed_with(struct l_tls_session_cache *cache,
+					struct l_tls_session **session,
+					unsigned int auth,
+					const char **client_suites)
+{
+	uint8_t master_secret[48];
+
+	memcpy(master_secret, (*session)->master_secret, 48);
+	resume_test_run(cache, session, auth, client_suites);
+
+	return !memcmp(master_secret, (*session)->master_secret, 48);
+}
+
+static bool resume_test_resumed(struct l_tls_session_cache *cache,
+				struct l_tls_session **session)
+{
+	return resume_test_resumed_with(cache, session, RESUME_SERVER_AUTH,
+					NULL);
+}
+
+static void test_tls_resumption(const void *data)
+{
+	struct l_tls_session_cache *cache = l_tls_session_cache_new(16, 60);
+	struct l_tls_session_cache *ticket_cache =
+		l_tls_session_cache_new(0, 60);
+	struct l_tls_session_cache *other = l_tls_session_cache_new(16, 60);
+	struct l_tls_session *session = NULL;
+
+	l_tls_session_cache_enable_tickets(ticket_cache, 60);
+
+	/* Resumed by Session ID */
+	resume_test_handshake(cache, &session);
+	assert(session->session_id_size && !session->ticket);
+	assert(resume_test_resumed(cache, &session));
+
+	/* Unknown to the server, falls back to a full handshake */
+	assert(!resume_test_resumed(other, &session));
+
+	/* Resumed by ticket with nothing in the cache */
+	l_tls_session_free(session);
+	session = NULL;
+	resume_test_handshake(ticket_cache, &session);
+	assert(session->ticket);
+	assert(resume_test_resumed(ticket_cache, &session));
+	assert(resume_test_resumed(ticket_cache, &session));
+
+	/* A tampered ticket is ignored, not fatal */
+	session->ticket[session->ticket_len / 2] ^= 1;
+	assert(!resume_test_resumed(ticket_cache, &session));
+	assert(session->ticket);
+	assert(resume_test_resumed(ticket_cache, &session));
+
+	l_tls_session_free(session);
+	l_tls_session_cache_free(cache);
+	l_tls_session_cache_free(ticket_cache);
+	l_tls_session_cache_free(other);
+}
+
+static void test_tls_resumption_policy(const void *data)
+{
+	struct l_tls_session_cache *cache = l_tls_session_cache_new(16, 60);
+	struct l_tls_session_cache *ticket_cache =
+		l_tls_session_cache_new(0, 60);
+	struct l_tls_session *session = NULL;
+	const char *gcm[] = { "TLS_RSA_WITH_AES_128_GCM_SHA256", NULL };
+	const char *cbc[] = { "TLS_RSA_WITH_AES_128_CBC_SHA", NULL };
+
+	l_tls_session_cache_enable_tickets(ticket_cache, 60);
+
+	/* The server wasn't authenticated, can't skip that once we'd do it */
+	resume_test_run(cache, &session, 0, NULL);
+	assert(!session->peer_authenticated);
+	assert(resume_test_resumed_with(cache, &session, 0, NULL));
+	assert(!resume_test_resumed_with(cache, &session, RESUME_SERVER_AUTH,
+						NULL));
+	assert(session->peer_authenticated);
+	assert(resume_test_resumed_with(cache, &session, RESUME_SERVER_AUTH,
+						NULL));
+
+	/* Same on the server, for both the cache and tickets */
+	assert(!resume_test_resumed_with(cache, &session,
+				RESUME_SERVER_AUTH | RESUME_CLIENT_AUTH, NULL));
+	assert(resume_test_resumed_with(cache, &session,
+				RESUME_SERVER_AUTH | RESUME_CLIENT_AUTH, NULL));
+
+	l_tls_session_free(session);
+	session = NULL;
+	resume_test_handshake(ticket_cache, &session);
+	assert(session->ticket);
+	assert(!resume_test_resumed_with(ticket_cache, &session,
+				RESUME_SERVER_AUTH | RESUME_CLIENT_AUTH, NULL));
+	assert(resume_test_resumed_with(ticket_cache, &session,
+				RESUME_SERVER_AUTH | RESUME_CLIENT_AUTH, NULL));
+
+	/* A suite we no longer allow */
+	l_tls_session_free(session);
+	session = NULL;
+	resume_test_run(cache, &session, RESUME_SERVER_AUTH, gcm);
+	assert(resume_test_resumed_with(cache, &session, RESUME_SERVER_AUTH,
+						gcm));
+	assert(!resume_test_resumed_with(cache, &session, RESUME_SERVER_AUTH,
+						cbc));
+
+	l_tls_session_free(session);
+	l_tls_session_cache_free(cache);
+	l_tls_session_cache_free(ticket_cache);
+}
+
+#define RESUME_BENCH_COUNT	50
+
+static void test_tls_resumption_benchmark(const void *data)
+{
+	struct l_tls_session_cache *caches[2] = {
+		l_tls_session_cache_new(RESUME_BENCH_COUNT, 60),
+		l_tls_session_cache_new(0, 60),
+	};
+	static const char *names[] = { "session ID", "session ticket" };
+	struct l_tls_session *session = NULL;
+	uint64_t start, full_time, resumed_time;
+	unsigned int i, j;
+
+	l_tls_session_cache_enable_tickets(caches[1], 60);
+
+	start = l_time_now();
+
+	for (i = 0; i < RESUME_BENCH_COUNT; i++) {
+		l_tls_session_free(session);
+		session = NULL;
+		resume_test_handshake(caches[0], &session);
+	}
+
+	full_time = l_time_diff(start, l_time_now());
+	printf("Full handshakes: %llu/s\n", (unsigned long long)
+		RESUME_BENCH_COUNT * 1000000 / (full_time ?: 1));
+
+	for (j = 0; j < L_ARRAY_SIZE(caches); j++) {
+		l_tls_session_free(session);
+		session = NULL;
+		resume_test_handshake(caches[j], &session);
+
+		start = l_time_now();
+
+		for (i = 0; i < RESUME_BENCH_COUNT; i++)
+			assert(resume_test_resumed(caches[j], &session));
+
+		resumed_time = l_time_diff(start, l_time_now());
+		printf("Resumed handshakes (%s): %llu/s\n", names[j],
+			(unsigned long long) RESUME_BENCH_COUNT * 1000000 /
+			(resumed_time ?: 1));
+	}
+
+	l_tls_session_free(session);
+
+	for (j = 0; j < L_ARRAY_SIZE(caches); j++)
+		l_tls_session_cache_free(caches[j]);
+}
+
+/* Needs the kernel's PKCS#8 parser, not always built in */
+static bool private_key_loadable(void)
+{
+	struct l_key *key;
+
+	key = l_pem_load_private_key(CERTDIR "cert-server-key-pkcs8.pem",
+					NULL, NULL);
+	if (!key)
+		return false;
+
+	l_key_free(key);
+	return true;
+}
+
 static int read_int_from_file(const char *path)
 {
 	int ret;
@@ -638,6 +1496,21 @@ int main(int argc, char *argv[])
 
 	l_test_init(&argc, &argv);
 
+	if (l_getrandom_is_supported()) {
+		l_test_add("TLS record layer benchmark", test_record_layer,
+				NULL);
+		l_test_add("TLS zero-copy writev benchmark",
+				test_record_writev, NULL);
+		l_test_add("TLS in-place receive benchmark", test_record_rx,
+				NULL);
+		l_test_add("TLS record layer on kernel crypto",
+				test_record_kernel_crypto, NULL);
+		l_test_add("TLS session cache", test_session_cache, NULL);
+		l_test_add("TLS session ticket", test_session_ticket, NULL);
+		l_test_add("TLS session ticket key rotation",
+				test_session_ticket_rotation, NULL);
+	}
+
 	if (!l_checksum_is_supported(L_CHECKSUM_MD5, false) ||
 			!l_checksum_is_supported(L_CHECKSUM_SHA1, false) ||
 			!l_checksum_is_supported(L_CHECKSUM_SHA256, false) ||
@@ -666,6 +1539,21 @@ int main(int argc, char *argv[])
 		goto done;
 	}
 
+	if (!l_key_is_supported(L_KEY_FEATURE_RESTRICT |
+				L_KEY_FEATURE_CRYPTO) ||
+			!private_key_loadable()) {
+		printf("Kernel lacks key restrictions or crypto, "
+			"skipping TLS connection tests...\n");
+		goto done;
+	}
+
+	/* The in-process AES suites are all these need */
+	l_test_add("TLS session resumption", test_tls_resumption, NULL);
+	l_test_add("TLS session resumption policy",
+			test_tls_resumption_policy, NULL);
+	l_test_add("TLS full vs resumed handshake benchmark",
+			test_tls_resumption_benchmark, NULL);
+
 	if (!l_cipher_is_supported(L_CIPHER_DES3_EDE_CBC) ||
 			!l_cipher_is_supported(L_CIPHER_AES_CBC) ||
 			!l_cipher_is_supported(L_CIPHER_ARC4)) {
@@ -674,13 +1562,6 @@ int main(int argc, char *argv[])
 		goto done;
 	}
 
-	if (!l_key_is_supported(L_KEY_FEATURE_RESTRICT |
-				L_KEY_FEATURE_CRYPTO)) {
-		printf("Kernel lacks key restrictions or crypto, "
-			"skipping TLS connection tests...\n");
-		goto done;
-	}
-
 	maxkeys = read_int_from_file(getuid() > 0 ?
 					"/proc/sys/kernel/keys/maxkeys" :
 					"/proc/sys/kernel/keys/root_maxkeys");
@@ -0,0 +1,252 @@
+/*
+ *
+ *  Embedded Linux library
+ *
+ *  Copyright (C) 2019  Intel Corporation. All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public
+ *  License as published by the Free Software Foundation; either
+ *  version 2.1 of the License, or (at your option) any later version.
+ *
+ *  This library is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  Lesser General Public License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public
+ *  License along with this library; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+
+#include <ell/ell.h>
+#include "ell/private.h"
+
+#define MANY_WATCHES 50000
+
+static void watch_callback(int fd, uint32_t events, void *user_data)
+{
+}
+
+static void watch_destroy(void *user_data)
+{
+	unsigned int *destroyed = user_data;
+
+	*destroyed += 1;
+}
+
+static unsigned int max_watches(void)
+{
+	struct rlimit rlim;
+
+	if (getrlimit(RLIMIT_NOFILE, &rlim) < 0)
+		return 0;
+
+	if (rlim.rlim_cur < rlim.rlim_max) {
+		rlim.rlim_cur = rlim.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rlim);
+	}
+
+	/* Leave some room for stdio and the epoll descriptor itself */
+	if (rlim.rlim_cur < MANY_WATCHES + 64)
+		return rlim.rlim_cur > 64 ? rlim.rlim_cur - 64 : 0;
+
+	return MANY_WATCHES;
+}
+
+static void test_high_fd(const void *test_data)
+{
+	unsigned int destroyed = 0;
+	int fd, high_fd;
+
+	assert(l_main_init());
+
+	fd = eventfd(0, EFD_CLOEXEC);
+	assert(fd >= 0);
+
+	/* Well beyond the initial size of the watch table */
+	high_fd = fcntl(fd, F_DUPFD_CLOEXEC, 1000);
+	if (high_fd < 0) {
+		close(fd);
+		assert(l_main_exit());
+		return;
+	}
+
+	assert(watch_modify(high_fd, EPOLLIN, false) == -ENXIO);
+	assert(watch_add(high_fd, EPOLLIN, watch_callback,
+					&destroyed, watch_destroy) == 0);
+	assert(watch_add(fd, EPOLLIN, watch_callback,
+					&destroyed, watch_destroy) == 0);
+	assert(watch_modify(high_fd, EPOLLOUT, false) == 0);
+	assert(watch_remove(high_fd) == 0);
+	assert(watch_remove(high_fd) == -ENXIO);
+	assert(watch_remove(fd) == 0);
+	assert(destroyed == 2);
+
+	close(high_fd);
+	close(fd);
+
+	assert(l_main_exit());
+}
+
+static void test_many_watches(const void *test_data)
+{
+	unsigned int count = max_watches();
+	unsigned int destroyed = 0;
+	uint64_t start, added, removed;
+	unsigned int i;
+	int *fds;
+
+	assert(l_main_init());
+
+	fds = l_new(int, count);
+
+	for (i = 0; i < count; i++) {
+		fds[i] = eventfd(0, EFD_CLOEXEC);
+		if (fds[i] < 0)
+			break;
+	}
+
+	count = i;
+
+	start = l_time_now();
+
+	for (i = 0; i < count; i++)
+		assert(watch_add(fds[i], EPOLLIN, watch_callback,
+					&destroyed, watch_destroy) == 0);
+
+	added = l_time_now();
+
+	for (i = 0; i < count; i++)
+		assert(watch_remove(fds[i]) == 0);
+
+	removed = l_time_now();
+
+	assert(destroyed == count);
+
+	printf("%u watches: add %llu usec, remove %llu usec\n", count,
+			(unsigned long long) l_time_diff(start, added),
+			(unsigned long long) l_time_diff(added, removed));
+
+	for (i = 0; i < count; i++)
+		close(fds[i]);
+
+	l_free(fds);
+
+	assert(l_main_exit());
+}
+
+static void test_event_batch(const void *test_data)
+{
+	struct l_main_stats stats;
+	unsigned int destroyed = 0;
+	uint64_t value = 1;
+	int fds[512];
+	unsigned int i;
+
+	assert(!l_main_get_stats(&stats));
+	assert(l_main_init());
+
+	assert(l_main_get_stats(&stats));
+	assert(stats.wakeups == 0);
+	assert(stats.event_batch > 0);
+
+	for (i = 0; i < L_ARRAY_SIZE(fds); i++) {
+		fds[i] = eventfd(0, EFD_CLOEXEC);
+		assert(fds[i] >= 0);
+		assert(write(fds[i], &value, sizeof(value)) == sizeof(value));
+		assert(watch_add(fds[i], EPOLLIN, watch_callback,
+					&destroyed, watch_destroy) == 0);
+	}
+
+	/* All descriptors stay readable, so every batch comes back full */
+	for (i = 0; i < 8; i++)
+		l_main_iterate(0);
+
+	assert(l_main_get_stats(&stats));
+	assert(stats.wakeups == 8);
+	assert(stats.max_events == stats.event_batch);
+	assert(stats.events > 8 * 10);
+
+	printf("%llu events in %llu wakeups, batch %u, dispatch %llu usec\n",
+			(unsigned long long) stats.events,
+			(unsigned long long) stats.wakeups, stats.event_batch,
+			(unsigned long long) stats.dispatch_time);
+
+	for (i = 0; i < L_ARRAY_SIZE(fds); i++) {
+		assert(watch_remove(fds[i]) == 0);
+		close(fds[i]);
+	}
+
+	assert(destroyed == L_ARRAY_SIZE(fds));
+
+	assert(l_main_exit());
+}
+
+static void test_fixed_event_batch(const void *test_data)
+{
+	struct l_main_stats stats;
+	unsigned int destroyed = 0;
+	uint64_t value = 1;
+	int fds[64];
+	unsigned int i;
+
+	assert(!l_main_set_event_batch(0, 16));
+	assert(!l_main_set_event_batch(32, 16));
+	assert(!l_main_set_event_batch(16, 257));
+	assert(l_main_set_event_batch(16, 16));
+	assert(l_main_init());
+
+	for (i = 0; i < L_ARRAY_SIZE(fds); i++) {
+		fds[i] = eventfd(0, EFD_CLOEXEC);
+		assert(fds[i] >= 0);
+		assert(write(fds[i], &value, sizeof(value)) == sizeof(value));
+		assert(watch_add(fds[i], EPOLLIN, watch_callback,
+					&destroyed, watch_destroy) == 0);
+	}
+
+	for (i = 0; i < 8; i++)
+		l_main_iterate(0);
+
+	/* Full batches every time but it doesn't grow */
+	assert(l_main_get_stats(&stats));
+	assert(stats.events == 8 * 16);
+	assert(stats.max_events == 16);
+	assert(stats.event_batch == 16);
+
+	for (i = 0; i < L_ARRAY_SIZE(fds); i++) {
+		assert(watch_remove(fds[i]) == 0);
+		close(fds[i]);
+	}
+
+	assert(destroyed == L_ARRAY_SIZE(fds));
+
+	assert(l_main_exit());
+	assert(l_main_set_event_batch(10, 256));
+}
+
+int main(int argc, char *argv[])
+{
+	l_test_init(&argc, &argv);
+
+	l_test_add("Watch on high fd", test_high_fd, NULL);
+	l_test_add("Many watches", test_many_watches, NULL);
+	l_test_add("Event batch", test_event_batch, NULL);
+	l_test_add("Fixed event batch", test_fixed_event_batch, NULL);
+
+	return l_test_run();
+}